@@ -1,463 +1,641 @@
 #include "AES.h"
+#include "AESKeyCache.h"
 #include "pch.h"
 #include <stdexcept> // For exception handling
 
-AES::AES(const AESKeyLength keyLength) {
+namespace {
+
+static constexpr size_t GCMTagBytes = 16;
+
+const unsigned char* Data(std::span<const std::byte> bytes) {
+    return reinterpret_cast<const unsigned char*>(bytes.data());
+}
+
+unsigned char* Data(std::span<std::byte> bytes) {
+    return reinterpret_cast<unsigned char*>(bytes.data());
+}
+
+std::span<const std::byte> AsBytes(const std::vector<unsigned char>& v) {
+    return std::as_bytes(std::span<const unsigned char>(v));
+}
+
+std::span<std::byte> AsWritableBytes(std::vector<unsigned char>& v) {
+    return std::as_writable_bytes(std::span<unsigned char>(v));
+}
+
+// Expands `key` after checking it has the size `keyLength` calls for
+std::shared_ptr<const AESKey> ScheduleFor(std::span<const std::byte> key,
+    AESKeyLength keyLength) {
+    if (AESKey::KeyLengthForBytes(key.size()) != keyLength) {
+        throw std::invalid_argument("Key does not match the AES key length");
+    }
+    return CachedKey(Data(key), keyLength);
+}
+
+void CheckIV(std::span<const std::byte> iv) {
+    if (iv.size() != 16) {
+        throw std::invalid_argument("IV must be 16 bytes");
+    }
+}
+
+void CheckOutput(std::span<std::byte> out, size_t len) {
+    if (out.size() < len) {
+        throw std::length_error("Output buffer is too small");
+    }
+}
+
+}  // namespace
+
+// Nk and Nr follow from the key length at compile time (AESCore.h); each
+// call takes its expanded schedule from the key cache (AESKeyCache.h), so a
+// key is only expanded again once it has been evicted.
+AES::AES(const AESKeyLength keyLength) : keyLength(keyLength) {
     switch (keyLength) {
     case AESKeyLength::AES_128:
-        Nk = 4;
-        Nr = 10;
-        break;
     case AESKeyLength::AES_192:
-        Nk = 6;
-        Nr = 12;
-        break;
     case AESKeyLength::AES_256:
-        Nk = 8;
-        Nr = 14;
         break;
     default:
         throw std::invalid_argument("Invalid AES key length");
     }
 }
 
-unsigned char* AES::EncryptECB(const unsigned char in[], unsigned int inLen,
+unsigned char* AES::EncryptECB(const unsigned char in[], size_t inLen,
     const unsigned char key[]) {
     CheckLength(inLen);
+    std::shared_ptr<const AESKey> context = CachedKey(key, keyLength);
     unsigned char* out = new unsigned char[inLen];
-    unsigned char* roundKeys = new unsigned char[4 * Nb * (Nr + 1)];
-    KeyExpansion(key, roundKeys);
-    for (unsigned int i = 0; i < inLen; i += blockBytesLen) {
-        EncryptBlock(in + i, out + i, roundKeys);
-    }
-
-    delete[] roundKeys;
+    context->EncryptECB(in, out, inLen);
 
     return out;
 }
 
-unsigned char* AES::DecryptECB(const unsigned char in[], unsigned int inLen,
+unsigned char* AES::DecryptECB(const unsigned char in[], size_t inLen,
     const unsigned char key[]) {
     CheckLength(inLen);
+    std::shared_ptr<const AESKey> context = CachedKey(key, keyLength);
     unsigned char* out = new unsigned char[inLen];
-    unsigned char* roundKeys = new unsigned char[4 * Nb * (Nr + 1)];
-    KeyExpansion(key, roundKeys);
-    for (unsigned int i = 0; i < inLen; i += blockBytesLen) {
-        DecryptBlock(in + i, out + i, roundKeys);
-    }
-
-    delete[] roundKeys;
+    context->DecryptECB(in, out, inLen);
 
     return out;
 }
 
-unsigned char* AES::EncryptCBC(const unsigned char in[], unsigned int inLen,
+unsigned char* AES::EncryptCBC(const unsigned char in[], size_t inLen,
     const unsigned char key[],
     const unsigned char* iv) {
     CheckLength(inLen);
+    std::shared_ptr<const AESKey> context = CachedKey(key, keyLength);
     unsigned char* out = new unsigned char[inLen];
-    unsigned char block[blockBytesLen];
-    unsigned char* roundKeys = new unsigned char[4 * Nb * (Nr + 1)];
-    KeyExpansion(key, roundKeys);
-    memcpy(block, iv, blockBytesLen);
-    for (unsigned int i = 0; i < inLen; i += blockBytesLen) {
-        XorBlocks(block, in + i, block, blockBytesLen);
-        EncryptBlock(block, out + i, roundKeys);
-        memcpy(block, out + i, blockBytesLen);
-    }
-
-    delete[] roundKeys;
+    context->EncryptCBC(in, out, inLen, iv);
 
     return out;
 }
 
-unsigned char* AES::DecryptCBC(const unsigned char in[], unsigned int inLen,
+unsigned char* AES::DecryptCBC(const unsigned char in[], size_t inLen,
     const unsigned char key[],
     const unsigned char* iv) {
     CheckLength(inLen);
+    std::shared_ptr<const AESKey> context = CachedKey(key, keyLength);
     unsigned char* out = new unsigned char[inLen];
-    unsigned char block[blockBytesLen];
-    unsigned char* roundKeys = new unsigned char[4 * Nb * (Nr + 1)];
-    KeyExpansion(key, roundKeys);
-    memcpy(block, iv, blockBytesLen);
-    for (unsigned int i = 0; i < inLen; i += blockBytesLen) {
-        DecryptBlock(in + i, out + i, roundKeys);
-        XorBlocks(block, out + i, out + i, blockBytesLen);
-        memcpy(block, in + i, blockBytesLen);
-    }
-
-    delete[] roundKeys;
+    context->DecryptCBC(in, out, inLen, iv);
 
     return out;
 }
 
-unsigned char* AES::EncryptCFB(const unsigned char in[], unsigned int inLen,
+unsigned char* AES::EncryptCFB(const unsigned char in[], size_t inLen,
     const unsigned char key[],
     const unsigned char* iv) {
     CheckLength(inLen);
+    std::shared_ptr<const AESKey> context = CachedKey(key, keyLength);
     unsigned char* out = new unsigned char[inLen];
-    unsigned char block[blockBytesLen];
-    unsigned char encryptedBlock[blockBytesLen];
-    unsigned char* roundKeys = new unsigned char[4 * Nb * (Nr + 1)];
-    KeyExpansion(key, roundKeys);
-    memcpy(block, iv, blockBytesLen);
-    for (unsigned int i = 0; i < inLen; i += blockBytesLen) {
-        EncryptBlock(block, encryptedBlock, roundKeys);
-        XorBlocks(in + i, encryptedBlock, out + i, blockBytesLen);
-        memcpy(block, out + i, blockBytesLen);
-    }
-
-    delete[] roundKeys;
+    context->EncryptCFB(in, out, inLen, iv);
 
     return out;
 }
 
-unsigned char* AES::DecryptCFB(const unsigned char in[], unsigned int inLen,
+unsigned char* AES::DecryptCFB(const unsigned char in[], size_t inLen,
     const unsigned char key[],
     const unsigned char* iv) {
     CheckLength(inLen);
+    std::shared_ptr<const AESKey> context = CachedKey(key, keyLength);
     unsigned char* out = new unsigned char[inLen];
-    unsigned char block[blockBytesLen];
-    unsigned char encryptedBlock[blockBytesLen];
-    unsigned char* roundKeys = new unsigned char[4 * Nb * (Nr + 1)];
-    KeyExpansion(key, roundKeys);
-    memcpy(block, iv, blockBytesLen);
-    for (unsigned int i = 0; i < inLen; i += blockBytesLen) {
-        EncryptBlock(block, encryptedBlock, roundKeys);
-        XorBlocks(in + i, encryptedBlock, out + i, blockBytesLen);
-        memcpy(block, in + i, blockBytesLen);
-    }
-
-    delete[] roundKeys;
+    context->DecryptCFB(in, out, inLen, iv);
 
     return out;
 }
 
-void AES::CheckLength(unsigned int len) {
-    if (len % blockBytesLen != 0) {
-        throw std::length_error("Plaintext length must be divisible by " +
-            std::to_string(blockBytesLen));
+unsigned char* AES::EncryptCTR(const unsigned char in[], size_t inLen,
+    const unsigned char key[],
+    const unsigned char* iv,
+    const AESCounterLayout& layout) {
+    std::shared_ptr<const AESKey> context = CachedKey(key, keyLength);
+    unsigned char* out = new unsigned char[inLen];
+    try {
+        context->EncryptCTR(in, out, inLen, iv, layout);
     }
+    catch (...) {
+        delete[] out;
+        throw;
+    }
+
+    return out;
 }
 
-void AES::EncryptBlock(const unsigned char in[], unsigned char out[],
-    unsigned char* roundKeys) {
-    unsigned char state[4][Nb];
-    unsigned int i, j, round;
+unsigned char* AES::DecryptCTR(const unsigned char in[], size_t inLen,
+    const unsigned char key[],
+    const unsigned char* iv,
+    const AESCounterLayout& layout) {
+    return EncryptCTR(in, inLen, key, iv, layout);
+}
 
-    for (i = 0; i < 4; i++) {
-        for (j = 0; j < Nb; j++) {
-            state[i][j] = in[i + 4 * j];
-        }
+unsigned char* AES::DecryptCTRRange(const unsigned char in[], size_t inLen,
+    const unsigned char key[], const unsigned char* iv,
+    unsigned long long offset, const AESCounterLayout& layout) {
+    std::shared_ptr<const AESKey> context = CachedKey(key, keyLength);
+    unsigned char* out = new unsigned char[inLen];
+    try {
+        context->DecryptCTRRange(in, out, inLen, iv, offset, layout);
+    }
+    catch (...) {
+        delete[] out;
+        throw;
     }
 
-    AddRoundKey(state, roundKeys);
+    return out;
+}
 
-    for (round = 1; round <= Nr - 1; round++) {
-        SubBytes(state);
-        ShiftRows(state);
-        MixColumns(state);
-        AddRoundKey(state, roundKeys + round * 4 * Nb);
+unsigned char* AES::EncryptGCM(const unsigned char in[], size_t inLen,
+    const unsigned char key[], const unsigned char* iv, size_t ivLen,
+    const unsigned char* aad, size_t aadLen, unsigned char tag[16]) {
+    std::shared_ptr<const AESKey> context = CachedKey(key, keyLength);
+    unsigned char* out = new unsigned char[inLen];
+    try {
+        context->EncryptGCM(in, out, inLen, iv, ivLen, aad, aadLen, tag);
+    }
+    catch (...) {
+        delete[] out;
+        throw;
     }
 
-    SubBytes(state);
-    ShiftRows(state);
-    AddRoundKey(state, roundKeys + Nr * 4 * Nb);
+    return out;
+}
 
-    for (i = 0; i < 4; i++) {
-        for (j = 0; j < Nb; j++) {
-            out[i + 4 * j] = state[i][j];
-        }
+unsigned char* AES::DecryptGCM(const unsigned char in[], size_t inLen,
+    const unsigned char key[], const unsigned char* iv, size_t ivLen,
+    const unsigned char* aad, size_t aadLen,
+    const unsigned char tag[16]) {
+    std::shared_ptr<const AESKey> context = CachedKey(key, keyLength);
+    unsigned char* out = new unsigned char[inLen];
+    bool authentic = false;
+    try {
+        authentic = context->DecryptGCM(in, out, inLen, iv, ivLen, aad, aadLen,
+            tag);
+    }
+    catch (...) {
+        delete[] out;
+        throw;
+    }
+    if (!authentic) {
+        delete[] out;
+        throw std::runtime_error("GCM authentication failed");
     }
+
+    return out;
 }
 
-void AES::DecryptBlock(const unsigned char in[], unsigned char out[],
-    unsigned char* roundKeys) {
-    unsigned char state[4][Nb];
-    unsigned int i, j, round;
+void AES::EncryptECBInPlace(unsigned char data[], size_t len,
+    const unsigned char key[]) {
+    CheckLength(len);
+    CachedKey(key, keyLength)->EncryptECB(data, data, len);
+}
 
-    for (i = 0; i < 4; i++) {
-        for (j = 0; j < Nb; j++) {
-            state[i][j] = in[i + 4 * j];
-        }
-    }
+void AES::DecryptECBInPlace(unsigned char data[], size_t len,
+    const unsigned char key[]) {
+    CheckLength(len);
+    CachedKey(key, keyLength)->DecryptECB(data, data, len);
+}
 
-    AddRoundKey(state, roundKeys + Nr * 4 * Nb);
+void AES::EncryptCBCInPlace(unsigned char data[], size_t len,
+    const unsigned char key[], const unsigned char* iv) {
+    CheckLength(len);
+    CachedKey(key, keyLength)->EncryptCBC(data, data, len, iv);
+}
 
-    for (round = Nr - 1; round >= 1; round--) {
-        InvSubBytes(state);
-        InvShiftRows(state);
-        AddRoundKey(state, roundKeys + round * 4 * Nb);
-        InvMixColumns(state);
-    }
+void AES::DecryptCBCInPlace(unsigned char data[], size_t len,
+    const unsigned char key[], const unsigned char* iv) {
+    CheckLength(len);
+    CachedKey(key, keyLength)->DecryptCBC(data, data, len, iv);
+}
 
-    InvSubBytes(state);
-    InvShiftRows(state);
-    AddRoundKey(state, roundKeys);
+void AES::EncryptCFBInPlace(unsigned char data[], size_t len,
+    const unsigned char key[], const unsigned char* iv) {
+    CheckLength(len);
+    CachedKey(key, keyLength)->EncryptCFB(data, data, len, iv);
+}
 
-    for (i = 0; i < 4; i++) {
-        for (j = 0; j < Nb; j++) {
-            out[i + 4 * j] = state[i][j];
-        }
+void AES::DecryptCFBInPlace(unsigned char data[], size_t len,
+    const unsigned char key[], const unsigned char* iv) {
+    CheckLength(len);
+    CachedKey(key, keyLength)->DecryptCFB(data, data, len, iv);
+}
+
+void AES::EncryptCTRInPlace(unsigned char data[], size_t len,
+    const unsigned char key[], const unsigned char* iv,
+    const AESCounterLayout& layout) {
+    CachedKey(key, keyLength)->EncryptCTR(data, data, len, iv, layout);
+}
+
+void AES::DecryptCTRInPlace(unsigned char data[], size_t len,
+    const unsigned char key[], const unsigned char* iv,
+    const AESCounterLayout& layout) {
+    EncryptCTRInPlace(data, len, key, iv, layout);
+}
+
+void AES::EncryptGCMInPlace(unsigned char data[], size_t len,
+    const unsigned char key[], const unsigned char* iv, size_t ivLen,
+    const unsigned char* aad, size_t aadLen, unsigned char tag[16]) {
+    CachedKey(key, keyLength)->EncryptGCM(data, data, len, iv, ivLen, aad,
+        aadLen, tag);
+}
+
+void AES::DecryptGCMInPlace(unsigned char data[], size_t len,
+    const unsigned char key[], const unsigned char* iv, size_t ivLen,
+    const unsigned char* aad, size_t aadLen, const unsigned char tag[16]) {
+    std::shared_ptr<const AESKey> context = CachedKey(key, keyLength);
+    if (!context->DecryptGCM(data, data, len, iv, ivLen, aad, aadLen, tag)) {
+        throw std::runtime_error("GCM authentication failed");
     }
 }
 
-void AES::SubBytes(unsigned char state[4][Nb]) {
-    unsigned int i, j;
-    unsigned char t;
-    for (i = 0; i < 4; i++) {
-        for (j = 0; j < Nb; j++) {
-            t = state[i][j];
-            state[i][j] = sbox[t / 16][t % 16];
-        }
+void AES::CheckLength(size_t len) {
+    if (len % blockBytesLen != 0) {
+        throw std::length_error("Plaintext length must be divisible by " +
+            std::to_string(blockBytesLen));
     }
 }
 
-void AES::ShiftRow(unsigned char state[4][Nb], unsigned int i,
-    unsigned int n)  // shift row i on n positions
-{
-    unsigned char tmp[Nb];
-    for (unsigned int j = 0; j < Nb; j++) {
-        tmp[j] = state[i][(j + n) % Nb];
+void AES::printHexArray(unsigned char a[], unsigned int n) {
+    for (unsigned int i = 0; i < n; i++) {
+        printf("%02x ", a[i]);
     }
-    memcpy(state[i], tmp, Nb * sizeof(unsigned char));
 }
 
-void AES::ShiftRows(unsigned char state[4][Nb]) {
-    ShiftRow(state, 1, 1);
-    ShiftRow(state, 2, 2);
-    ShiftRow(state, 3, 3);
+void AES::printHexVector(std::vector<unsigned char> a) {
+    for (size_t i = 0; i < a.size(); i++) {
+        printf("%02x ", a[i]);
+    }
 }
 
-unsigned char AES::xtime(unsigned char b)  // multiply on x
-{
-    return (b << 1) ^ (((b >> 7) & 1) * 0x1b);
+void AES::EncryptECB(std::span<const std::byte> in, std::span<std::byte> out, std::span<const std::byte> key) {
+    CheckOutput(out, in.size());
+    ScheduleFor(key, keyLength)->EncryptECB(Data(in), Data(out), in.size());
 }
 
-void AES::MixColumns(unsigned char state[4][Nb]) {
-    unsigned char temp_state[4][Nb];
+void AES::DecryptECB(std::span<const std::byte> in, std::span<std::byte> out, std::span<const std::byte> key) {
+    CheckOutput(out, in.size());
+    ScheduleFor(key, keyLength)->DecryptECB(Data(in), Data(out), in.size());
+}
 
-    for (size_t i = 0; i < 4; ++i) {
-        memset(temp_state[i], 0, 4);
-    }
+void AES::EncryptCBC(std::span<const std::byte> in, std::span<std::byte> out, std::span<const std::byte> key,
+    std::span<const std::byte> iv) {
+    CheckOutput(out, in.size());
+    CheckIV(iv);
+    ScheduleFor(key, keyLength)->EncryptCBC(Data(in), Data(out), in.size(),
+        Data(iv));
+}
 
-    for (size_t i = 0; i < 4; ++i) {
-        for (size_t k = 0; k < 4; ++k) {
-            for (size_t j = 0; j < 4; ++j) {
-                if (CMDS[i][k] == 1)
-                    temp_state[i][j] ^= state[k][j];
-                else
-                    temp_state[i][j] ^= GF_MUL_TABLE[CMDS[i][k]][state[k][j]];
-            }
-        }
-    }
+void AES::DecryptCBC(std::span<const std::byte> in, std::span<std::byte> out, std::span<const std::byte> key,
+    std::span<const std::byte> iv) {
+    CheckOutput(out, in.size());
+    CheckIV(iv);
+    ScheduleFor(key, keyLength)->DecryptCBC(Data(in), Data(out), in.size(),
+        Data(iv));
+}
 
-    for (size_t i = 0; i < 4; ++i) {
-        memcpy(state[i], temp_state[i], 4);
-    }
+void AES::EncryptCFB(std::span<const std::byte> in, std::span<std::byte> out, std::span<const std::byte> key,
+    std::span<const std::byte> iv) {
+    CheckOutput(out, in.size());
+    CheckIV(iv);
+    ScheduleFor(key, keyLength)->EncryptCFB(Data(in), Data(out), in.size(),
+        Data(iv));
 }
 
-void AES::AddRoundKey(unsigned char state[4][Nb], unsigned char* key) {
-    unsigned int i, j;
-    for (i = 0; i < 4; i++) {
-        for (j = 0; j < Nb; j++) {
-            state[i][j] = state[i][j] ^ key[i + 4 * j];
-        }
-    }
+void AES::DecryptCFB(std::span<const std::byte> in, std::span<std::byte> out, std::span<const std::byte> key,
+    std::span<const std::byte> iv) {
+    CheckOutput(out, in.size());
+    CheckIV(iv);
+    ScheduleFor(key, keyLength)->DecryptCFB(Data(in), Data(out), in.size(),
+        Data(iv));
 }
 
-void AES::SubWord(unsigned char* a) {
-    int i;
-    for (i = 0; i < 4; i++) {
-        a[i] = sbox[a[i] / 16][a[i] % 16];
-    }
+void AES::EncryptCTR(std::span<const std::byte> in, std::span<std::byte> out, std::span<const std::byte> key,
+    std::span<const std::byte> iv, const AESCounterLayout& layout) {
+    CheckOutput(out, in.size());
+    CheckIV(iv);
+    ScheduleFor(key, keyLength)->EncryptCTR(Data(in), Data(out), in.size(),
+        Data(iv), layout);
 }
 
-void AES::RotWord(unsigned char* a) {
-    unsigned char c = a[0];
-    a[0] = a[1];
-    a[1] = a[2];
-    a[2] = a[3];
-    a[3] = c;
+void AES::DecryptCTR(std::span<const std::byte> in, std::span<std::byte> out, std::span<const std::byte> key,
+    std::span<const std::byte> iv, const AESCounterLayout& layout) {
+    EncryptCTR(in, out, key, iv, layout);
 }
 
-void AES::XorWords(unsigned char* a, unsigned char* b, unsigned char* c) {
-    int i;
-    for (i = 0; i < 4; i++) {
-        c[i] = a[i] ^ b[i];
-    }
+void AES::EncryptGCM(std::span<const std::byte> in, std::span<std::byte> out, std::span<const std::byte> key,
+    std::span<const std::byte> iv, std::span<const std::byte> aad) {
+    CheckOutput(out, in.size() + GCMTagBytes);
+    // The tag goes behind the ciphertext, so with out == in it is written
+    // only after the last input byte has been read
+    ScheduleFor(key, keyLength)->EncryptGCM(Data(in), Data(out), in.size(),
+        Data(iv), iv.size(), Data(aad), aad.size(), Data(out) + in.size());
 }
 
-void AES::Rcon(unsigned char* a, unsigned int n) {
-    unsigned int i;
-    unsigned char c = 1;
-    for (i = 0; i < n - 1; i++) {
-        c = xtime(c);
+void AES::DecryptGCM(std::span<const std::byte> in, std::span<std::byte> out, std::span<const std::byte> key,
+    std::span<const std::byte> iv, std::span<const std::byte> aad) {
+    if (in.size() < GCMTagBytes) {
+        throw std::length_error("GCM input is shorter than its tag");
+    }
+    const size_t len = in.size() - GCMTagBytes;
+    CheckOutput(out, len);
+    if (!ScheduleFor(key, keyLength)->DecryptGCM(Data(in), Data(out), len,
+        Data(iv), iv.size(), Data(aad), aad.size(), Data(in) + len)) {
+        throw std::runtime_error("GCM authentication failed");
     }
+}
 
-    a[0] = c;
-    a[1] = a[2] = a[3] = 0;
+std::vector<std::byte> AES::EncryptECB(std::span<const std::byte> in, std::span<const std::byte> key) {
+    std::vector<std::byte> out(in.size());
+    EncryptECB(in, out, key);
+    return out;
 }
 
-void AES::KeyExpansion(const unsigned char key[], unsigned char w[]) {
-    unsigned char temp[4];
-    unsigned char rcon[4];
+std::vector<std::byte> AES::DecryptECB(std::span<const std::byte> in, std::span<const std::byte> key) {
+    std::vector<std::byte> out(in.size());
+    DecryptECB(in, out, key);
+    return out;
+}
 
-    unsigned int i = 0;
-    while (i < 4 * Nk) {
-        w[i] = key[i];
-        i++;
-    }
+std::vector<std::byte> AES::EncryptCBC(std::span<const std::byte> in, std::span<const std::byte> key,
+    std::span<const std::byte> iv) {
+    std::vector<std::byte> out(in.size());
+    EncryptCBC(in, out, key, iv);
+    return out;
+}
 
-    i = 4 * Nk;
-    while (i < 4 * Nb * (Nr + 1)) {
-        temp[0] = w[i - 4 + 0];
-        temp[1] = w[i - 4 + 1];
-        temp[2] = w[i - 4 + 2];
-        temp[3] = w[i - 4 + 3];
-
-        if (i / 4 % Nk == 0) {
-            RotWord(temp);
-            SubWord(temp);
-            Rcon(rcon, i / (Nk * 4));
-            XorWords(temp, rcon, temp);
-        }
-        else if (Nk > 6 && i / 4 % Nk == 4) {
-            SubWord(temp);
-        }
+std::vector<std::byte> AES::DecryptCBC(std::span<const std::byte> in, std::span<const std::byte> key,
+    std::span<const std::byte> iv) {
+    std::vector<std::byte> out(in.size());
+    DecryptCBC(in, out, key, iv);
+    return out;
+}
 
-        w[i + 0] = w[i - 4 * Nk] ^ temp[0];
-        w[i + 1] = w[i + 1 - 4 * Nk] ^ temp[1];
-        w[i + 2] = w[i + 2 - 4 * Nk] ^ temp[2];
-        w[i + 3] = w[i + 3 - 4 * Nk] ^ temp[3];
-        i += 4;
-    }
+std::vector<std::byte> AES::EncryptCFB(std::span<const std::byte> in, std::span<const std::byte> key,
+    std::span<const std::byte> iv) {
+    std::vector<std::byte> out(in.size());
+    EncryptCFB(in, out, key, iv);
+    return out;
 }
 
-void AES::InvSubBytes(unsigned char state[4][Nb]) {
-    unsigned int i, j;
-    unsigned char t;
-    for (i = 0; i < 4; i++) {
-        for (j = 0; j < Nb; j++) {
-            t = state[i][j];
-            state[i][j] = inv_sbox[t / 16][t % 16];
-        }
-    }
+std::vector<std::byte> AES::DecryptCFB(std::span<const std::byte> in, std::span<const std::byte> key,
+    std::span<const std::byte> iv) {
+    std::vector<std::byte> out(in.size());
+    DecryptCFB(in, out, key, iv);
+    return out;
 }
 
-void AES::InvMixColumns(unsigned char state[4][Nb]) {
-    unsigned char temp_state[4][Nb];
+std::vector<std::byte> AES::EncryptCTR(std::span<const std::byte> in, std::span<const std::byte> key,
+    std::span<const std::byte> iv, const AESCounterLayout& layout) {
+    std::vector<std::byte> out(in.size());
+    EncryptCTR(in, out, key, iv, layout);
+    return out;
+}
 
-    for (size_t i = 0; i < 4; ++i) {
-        memset(temp_state[i], 0, 4);
-    }
+std::vector<std::byte> AES::DecryptCTR(std::span<const std::byte> in, std::span<const std::byte> key,
+    std::span<const std::byte> iv, const AESCounterLayout& layout) {
+    std::vector<std::byte> out(in.size());
+    DecryptCTR(in, out, key, iv, layout);
+    return out;
+}
 
-    for (size_t i = 0; i < 4; ++i) {
-        for (size_t k = 0; k < 4; ++k) {
-            for (size_t j = 0; j < 4; ++j) {
-                temp_state[i][j] ^= GF_MUL_TABLE[INV_CMDS[i][k]][state[k][j]];
-            }
-        }
-    }
+std::vector<std::byte> AES::EncryptGCM(std::span<const std::byte> in, std::span<const std::byte> key,
+    std::span<const std::byte> iv, std::span<const std::byte> aad) {
+    std::vector<std::byte> out(in.size() + GCMTagBytes);
+    EncryptGCM(in, out, key, iv, aad);
+    return out;
+}
 
-    for (size_t i = 0; i < 4; ++i) {
-        memcpy(state[i], temp_state[i], 4);
-    }
+std::vector<std::byte> AES::DecryptGCM(std::span<const std::byte> in, std::span<const std::byte> key,
+    std::span<const std::byte> iv, std::span<const std::byte> aad) {
+    std::vector<std::byte> out(in.size() < GCMTagBytes ? 0 : in.size() - GCMTagBytes);
+    DecryptGCM(in, out, key, iv, aad);
+    return out;
 }
 
-void AES::InvShiftRows(unsigned char state[4][Nb]) {
-    ShiftRow(state, 1, Nb - 1);
-    ShiftRow(state, 2, Nb - 2);
-    ShiftRow(state, 3, Nb - 3);
+std::vector<unsigned char> AES::EncryptECB(const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& key) {
+    std::vector<unsigned char> out(in.size());
+    EncryptECB(AsBytes(in), AsWritableBytes(out), AsBytes(key));
+    return out;
 }
 
-void AES::XorBlocks(const unsigned char* a, const unsigned char* b,
-    unsigned char* c, unsigned int len) {
-    for (unsigned int i = 0; i < len; i++) {
-        c[i] = a[i] ^ b[i];
-    }
+std::vector<unsigned char> AES::EncryptECB(std::vector<unsigned char>&& in,
+    const std::vector<unsigned char>& key) {
+    EncryptECB(AsBytes(in), AsWritableBytes(in), AsBytes(key));
+    return std::move(in);
 }
 
-void AES::printHexArray(unsigned char a[], unsigned int n) {
-    for (unsigned int i = 0; i < n; i++) {
-        printf("%02x ", a[i]);
-    }
+std::vector<unsigned char> AES::DecryptECB(const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& key) {
+    std::vector<unsigned char> out(in.size());
+    DecryptECB(AsBytes(in), AsWritableBytes(out), AsBytes(key));
+    return out;
 }
 
-void AES::printHexVector(std::vector<unsigned char> a) {
-    for (unsigned int i = 0; i < a.size(); i++) {
-        printf("%02x ", a[i]);
+std::vector<unsigned char> AES::DecryptECB(std::vector<unsigned char>&& in,
+    const std::vector<unsigned char>& key) {
+    DecryptECB(AsBytes(in), AsWritableBytes(in), AsBytes(key));
+    return std::move(in);
+}
+
+std::vector<unsigned char> AES::EncryptCBC(const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv) {
+    std::vector<unsigned char> out(in.size());
+    EncryptCBC(AsBytes(in), AsWritableBytes(out), AsBytes(key), AsBytes(iv));
+    return out;
+}
+
+std::vector<unsigned char> AES::EncryptCBC(std::vector<unsigned char>&& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv) {
+    EncryptCBC(AsBytes(in), AsWritableBytes(in), AsBytes(key), AsBytes(iv));
+    return std::move(in);
+}
+
+std::vector<unsigned char> AES::DecryptCBC(const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv) {
+    std::vector<unsigned char> out(in.size());
+    DecryptCBC(AsBytes(in), AsWritableBytes(out), AsBytes(key), AsBytes(iv));
+    return out;
+}
+
+std::vector<unsigned char> AES::DecryptCBC(std::vector<unsigned char>&& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv) {
+    DecryptCBC(AsBytes(in), AsWritableBytes(in), AsBytes(key), AsBytes(iv));
+    return std::move(in);
+}
+
+std::vector<std::vector<unsigned char>> AES::EncryptCBCMulti(
+    const std::vector<std::vector<unsigned char>>& ins,
+    const std::vector<std::vector<unsigned char>>& keys,
+    const std::vector<std::vector<unsigned char>>& ivs) {
+    if (keys.size() != ins.size() || ivs.size() != ins.size()) {
+        throw std::invalid_argument("Need one key and one IV per message");
+    }
+
+    std::vector<std::shared_ptr<const AESKey>> contexts;
+    contexts.reserve(ins.size());
+    std::vector<std::vector<unsigned char>> outs(ins.size());
+    std::vector<AESCBCMessage> messages(ins.size());
+    for (size_t i = 0; i < ins.size(); i++) {
+        if (AESKey::KeyLengthForBytes(keys[i].size()) != keyLength) {
+            throw std::invalid_argument("Key does not match the AES key length");
+        }
+        if (ivs[i].size() != blockBytesLen) {
+            throw std::invalid_argument("IV must be " +
+                std::to_string(blockBytesLen) + " bytes");
+        }
+        contexts.push_back(CachedKey(keys[i].data(), keyLength));
+        outs[i].resize(ins[i].size());
+        messages[i] = { contexts[i].get(), ivs[i].data(), ins[i].data(),
+            outs[i].data(), ins[i].size() };
     }
+    AESKey::EncryptCBCMulti(messages.data(), messages.size());
+    return outs;
+}
+
+std::vector<unsigned char> AES::EncryptCFB(const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv) {
+    std::vector<unsigned char> out(in.size());
+    EncryptCFB(AsBytes(in), AsWritableBytes(out), AsBytes(key), AsBytes(iv));
+    return out;
 }
 
-std::vector<unsigned char> AES::ArrayToVector(unsigned char* a,
-    unsigned int len) {
-    std::vector<unsigned char> v(a, a + len * sizeof(unsigned char));
-    return v;
+std::vector<unsigned char> AES::EncryptCFB(std::vector<unsigned char>&& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv) {
+    EncryptCFB(AsBytes(in), AsWritableBytes(in), AsBytes(key), AsBytes(iv));
+    return std::move(in);
 }
 
-unsigned char* AES::VectorToArray(std::vector<unsigned char>& a) {
-    return a.data();
+std::vector<unsigned char> AES::DecryptCFB(const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv) {
+    std::vector<unsigned char> out(in.size());
+    DecryptCFB(AsBytes(in), AsWritableBytes(out), AsBytes(key), AsBytes(iv));
+    return out;
 }
 
-std::vector<unsigned char> AES::EncryptECB(std::vector<unsigned char> in,
-    std::vector<unsigned char> key) {
-    unsigned char* out = EncryptECB(VectorToArray(in), (unsigned int)in.size(),
-        VectorToArray(key));
-    std::vector<unsigned char> v = ArrayToVector(out, in.size());
-    delete[] out;
-    return v;
+std::vector<unsigned char> AES::DecryptCFB(std::vector<unsigned char>&& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv) {
+    DecryptCFB(AsBytes(in), AsWritableBytes(in), AsBytes(key), AsBytes(iv));
+    return std::move(in);
+}
+
+std::vector<unsigned char> AES::EncryptCTR(const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv,
+    const AESCounterLayout& layout) {
+    std::vector<unsigned char> out(in.size());
+    EncryptCTR(AsBytes(in), AsWritableBytes(out), AsBytes(key), AsBytes(iv),
+        layout);
+    return out;
 }
 
-std::vector<unsigned char> AES::DecryptECB(std::vector<unsigned char> in,
-    std::vector<unsigned char> key) {
-    unsigned char* out = DecryptECB(VectorToArray(in), (unsigned int)in.size(),
-        VectorToArray(key));
-    std::vector<unsigned char> v = ArrayToVector(out, (unsigned int)in.size());
-    delete[] out;
-    return v;
+std::vector<unsigned char> AES::EncryptCTR(std::vector<unsigned char>&& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv,
+    const AESCounterLayout& layout) {
+    EncryptCTR(AsBytes(in), AsWritableBytes(in), AsBytes(key), AsBytes(iv),
+        layout);
+    return std::move(in);
 }
 
-std::vector<unsigned char> AES::EncryptCBC(std::vector<unsigned char> in,
-    std::vector<unsigned char> key,
-    std::vector<unsigned char> iv) {
-    unsigned char* out = EncryptCBC(VectorToArray(in), (unsigned int)in.size(),
-        VectorToArray(key), VectorToArray(iv));
-    std::vector<unsigned char> v = ArrayToVector(out, in.size());
-    delete[] out;
-    return v;
+std::vector<unsigned char> AES::DecryptCTR(const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv,
+    const AESCounterLayout& layout) {
+    std::vector<unsigned char> out(in.size());
+    DecryptCTR(AsBytes(in), AsWritableBytes(out), AsBytes(key), AsBytes(iv),
+        layout);
+    return out;
 }
 
-std::vector<unsigned char> AES::DecryptCBC(std::vector<unsigned char> in,
-    std::vector<unsigned char> key,
-    std::vector<unsigned char> iv) {
-    unsigned char* out = DecryptCBC(VectorToArray(in), (unsigned int)in.size(),
-        VectorToArray(key), VectorToArray(iv));
-    std::vector<unsigned char> v = ArrayToVector(out, (unsigned int)in.size());
-    delete[] out;
-    return v;
+std::vector<unsigned char> AES::DecryptCTR(std::vector<unsigned char>&& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv,
+    const AESCounterLayout& layout) {
+    DecryptCTR(AsBytes(in), AsWritableBytes(in), AsBytes(key), AsBytes(iv),
+        layout);
+    return std::move(in);
+}
+
+std::vector<unsigned char> AES::DecryptCTRRange(
+    const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv, unsigned long long offset,
+    const AESCounterLayout& layout) {
+    CheckIV(AsBytes(iv));
+    std::vector<unsigned char> out(in.size());
+    ScheduleFor(AsBytes(key), keyLength)->DecryptCTRRange(in.data(),
+        out.data(), in.size(), iv.data(), offset, layout);
+    return out;
 }
 
-std::vector<unsigned char> AES::EncryptCFB(std::vector<unsigned char> in,
-    std::vector<unsigned char> key,
-    std::vector<unsigned char> iv) {
-    unsigned char* out = EncryptCFB(VectorToArray(in), (unsigned int)in.size(),
-        VectorToArray(key), VectorToArray(iv));
-    std::vector<unsigned char> v = ArrayToVector(out, in.size());
-    delete[] out;
-    return v;
+std::vector<unsigned char> AES::EncryptGCM(const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv,
+    const std::vector<unsigned char>& aad) {
+    std::vector<unsigned char> out(in.size() + GCMTagBytes);
+    EncryptGCM(AsBytes(in), AsWritableBytes(out), AsBytes(key), AsBytes(iv),
+        AsBytes(aad));
+    return out;
 }
 
-std::vector<unsigned char> AES::DecryptCFB(std::vector<unsigned char> in,
-    std::vector<unsigned char> key,
-    std::vector<unsigned char> iv) {
-    unsigned char* out = DecryptCFB(VectorToArray(in), (unsigned int)in.size(),
-        VectorToArray(key), VectorToArray(iv));
-    std::vector<unsigned char> v = ArrayToVector(out, (unsigned int)in.size());
-    delete[] out;
-    return v;
+std::vector<unsigned char> AES::EncryptGCM(std::vector<unsigned char>&& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv,
+    const std::vector<unsigned char>& aad) {
+    const size_t len = in.size();
+    in.resize(len + GCMTagBytes);
+    EncryptGCM(AsBytes(in).first(len), AsWritableBytes(in), AsBytes(key),
+        AsBytes(iv), AsBytes(aad));
+    return std::move(in);
+}
+
+std::vector<unsigned char> AES::DecryptGCM(const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv,
+    const std::vector<unsigned char>& aad) {
+    std::vector<unsigned char> out(in.size() < GCMTagBytes ? 0 : in.size() - GCMTagBytes);
+    DecryptGCM(AsBytes(in), AsWritableBytes(out), AsBytes(key), AsBytes(iv),
+        AsBytes(aad));
+    return out;
 }
 
+std::vector<unsigned char> AES::DecryptGCM(std::vector<unsigned char>&& in,
+    const std::vector<unsigned char>& key,
+    const std::vector<unsigned char>& iv,
+    const std::vector<unsigned char>& aad) {
+    DecryptGCM(AsBytes(in), AsWritableBytes(in), AsBytes(key), AsBytes(iv),
+        AsBytes(aad));
+    in.resize(in.size() - GCMTagBytes);
+    return std::move(in);
+}
 
 // My Definitions
 
@@ -0,0 +1,608 @@
+#include "pch.h"
+#include "AESEngine.h"
+
+#ifdef AES_X86
+
+#include <cstring>
+#include <emmintrin.h>
+
+namespace AESEngine {
+
+namespace {
+
+/// Bitsliced state of eight blocks. Plane q[i] holds bit i of every state
+/// byte: byte k of a plane is state position k (column k / 4, row k % 4) and
+/// bit j of that byte belongs to block j. ShiftRows and MixColumns then act
+/// on whole planes with shuffles and shifts, and SubBytes is a Boolean
+/// circuit, so nothing indexes memory with secret data.
+static constexpr size_t Lanes = 8;
+
+typedef __m128i Plane;
+
+AES_TARGET("sse2")
+inline Plane Splat(unsigned char b) {
+    return _mm_set1_epi8((char)b);
+}
+
+// Swaps the bits selected by m in b with the bits selected by m << n in a
+AES_TARGET("sse2")
+inline void SwapMove(Plane& a, Plane& b, int n, unsigned char m) {
+    const Plane t = _mm_and_si128(
+        _mm_xor_si128(_mm_srli_epi64(a, n), b), Splat(m));
+    b = _mm_xor_si128(b, t);
+    a = _mm_xor_si128(a, _mm_slli_epi64(t, n));
+}
+
+// 8x8 bit transpose inside every byte position; its own inverse
+AES_TARGET("sse2")
+void Transpose(Plane q[8]) {
+    SwapMove(q[0], q[1], 1, 0x55);
+    SwapMove(q[2], q[3], 1, 0x55);
+    SwapMove(q[4], q[5], 1, 0x55);
+    SwapMove(q[6], q[7], 1, 0x55);
+    SwapMove(q[0], q[2], 2, 0x33);
+    SwapMove(q[1], q[3], 2, 0x33);
+    SwapMove(q[4], q[6], 2, 0x33);
+    SwapMove(q[5], q[7], 2, 0x33);
+    SwapMove(q[0], q[4], 4, 0x0f);
+    SwapMove(q[1], q[5], 4, 0x0f);
+    SwapMove(q[2], q[6], 4, 0x0f);
+    SwapMove(q[3], q[7], 4, 0x0f);
+}
+
+// Spreads one 16-byte value over all eight block lanes of each plane
+AES_TARGET("sse2")
+void SpreadBytes(const unsigned char* bytes, Plane q[8]) {
+    const Plane v = _mm_loadu_si128((const Plane*)bytes);
+    for (int i = 0; i < 8; i++) {
+        const Plane bit = Splat((unsigned char)(1 << i));
+        q[i] = _mm_cmpeq_epi8(_mm_and_si128(v, bit), bit);
+    }
+}
+
+// Inverse of SpreadBytes, reading block lane 0
+AES_TARGET("sse2")
+void GatherBytes(const Plane q[8], unsigned char* bytes) {
+    Plane v = _mm_setzero_si128();
+    for (int i = 0; i < 8; i++) {
+        v = _mm_or_si128(v, _mm_and_si128(q[i], Splat((unsigned char)(1 << i))));
+    }
+    _mm_storeu_si128((Plane*)bytes, v);
+}
+
+AES_TARGET("sse2")
+inline void AddRoundKey(Plane q[8], const Plane k[8]) {
+    for (int i = 0; i < 8; i++) {
+        q[i] = _mm_xor_si128(q[i], k[i]);
+    }
+}
+
+/// Boyar-Peralta S-box circuit (113 gates). x0 is the most significant bit.
+AES_TARGET("sse2")
+void SubBytes(Plane q[8]) {
+    const Plane ones = _mm_set1_epi32(-1);
+    const Plane x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4];
+    const Plane x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+    // Top linear transformation
+    const Plane y14 = _mm_xor_si128(x3, x5);
+    const Plane y13 = _mm_xor_si128(x0, x6);
+    const Plane y9 = _mm_xor_si128(x0, x3);
+    const Plane y8 = _mm_xor_si128(x0, x5);
+    const Plane t0 = _mm_xor_si128(x1, x2);
+    const Plane y1 = _mm_xor_si128(t0, x7);
+    const Plane y4 = _mm_xor_si128(y1, x3);
+    const Plane y12 = _mm_xor_si128(y13, y14);
+    const Plane y2 = _mm_xor_si128(y1, x0);
+    const Plane y5 = _mm_xor_si128(y1, x6);
+    const Plane y3 = _mm_xor_si128(y5, y8);
+    const Plane t1 = _mm_xor_si128(x4, y12);
+    const Plane y15 = _mm_xor_si128(t1, x5);
+    const Plane y20 = _mm_xor_si128(t1, x1);
+    const Plane y6 = _mm_xor_si128(y15, x7);
+    const Plane y10 = _mm_xor_si128(y15, t0);
+    const Plane y11 = _mm_xor_si128(y20, y9);
+    const Plane y7 = _mm_xor_si128(x7, y11);
+    const Plane y17 = _mm_xor_si128(y10, y11);
+    const Plane y19 = _mm_xor_si128(y10, y8);
+    const Plane y16 = _mm_xor_si128(t0, y11);
+    const Plane y21 = _mm_xor_si128(y13, y16);
+    const Plane y18 = _mm_xor_si128(x0, y16);
+
+    // Non-linear section: inversion in GF(2^8)
+    const Plane t2 = _mm_and_si128(y12, y15);
+    const Plane t3 = _mm_and_si128(y3, y6);
+    const Plane t4 = _mm_xor_si128(t3, t2);
+    const Plane t5 = _mm_and_si128(y4, x7);
+    const Plane t6 = _mm_xor_si128(t5, t2);
+    const Plane t7 = _mm_and_si128(y13, y16);
+    const Plane t8 = _mm_and_si128(y5, y1);
+    const Plane t9 = _mm_xor_si128(t8, t7);
+    const Plane t10 = _mm_and_si128(y2, y7);
+    const Plane t11 = _mm_xor_si128(t10, t7);
+    const Plane t12 = _mm_and_si128(y9, y11);
+    const Plane t13 = _mm_and_si128(y14, y17);
+    const Plane t14 = _mm_xor_si128(t13, t12);
+    const Plane t15 = _mm_and_si128(y8, y10);
+    const Plane t16 = _mm_xor_si128(t15, t12);
+    const Plane t17 = _mm_xor_si128(t4, t14);
+    const Plane t18 = _mm_xor_si128(t6, t16);
+    const Plane t19 = _mm_xor_si128(t9, t14);
+    const Plane t20 = _mm_xor_si128(t11, t16);
+    const Plane t21 = _mm_xor_si128(t17, y20);
+    const Plane t22 = _mm_xor_si128(t18, y19);
+    const Plane t23 = _mm_xor_si128(t19, y21);
+    const Plane t24 = _mm_xor_si128(t20, y18);
+
+    const Plane t25 = _mm_xor_si128(t21, t22);
+    const Plane t26 = _mm_and_si128(t21, t23);
+    const Plane t27 = _mm_xor_si128(t24, t26);
+    const Plane t28 = _mm_and_si128(t25, t27);
+    const Plane t29 = _mm_xor_si128(t28, t22);
+    const Plane t30 = _mm_xor_si128(t23, t24);
+    const Plane t31 = _mm_xor_si128(t22, t26);
+    const Plane t32 = _mm_and_si128(t31, t30);
+    const Plane t33 = _mm_xor_si128(t32, t24);
+    const Plane t34 = _mm_xor_si128(t23, t33);
+    const Plane t35 = _mm_xor_si128(t27, t33);
+    const Plane t36 = _mm_and_si128(t24, t35);
+    const Plane t37 = _mm_xor_si128(t36, t34);
+    const Plane t38 = _mm_xor_si128(t27, t36);
+    const Plane t39 = _mm_and_si128(t29, t38);
+    const Plane t40 = _mm_xor_si128(t25, t39);
+
+    const Plane t41 = _mm_xor_si128(t40, t37);
+    const Plane t42 = _mm_xor_si128(t29, t33);
+    const Plane t43 = _mm_xor_si128(t29, t40);
+    const Plane t44 = _mm_xor_si128(t33, t37);
+    const Plane t45 = _mm_xor_si128(t42, t41);
+    const Plane z0 = _mm_and_si128(t44, y15);
+    const Plane z1 = _mm_and_si128(t37, y6);
+    const Plane z2 = _mm_and_si128(t33, x7);
+    const Plane z3 = _mm_and_si128(t43, y16);
+    const Plane z4 = _mm_and_si128(t40, y1);
+    const Plane z5 = _mm_and_si128(t29, y7);
+    const Plane z6 = _mm_and_si128(t42, y11);
+    const Plane z7 = _mm_and_si128(t45, y17);
+    const Plane z8 = _mm_and_si128(t41, y10);
+    const Plane z9 = _mm_and_si128(t44, y12);
+    const Plane z10 = _mm_and_si128(t37, y3);
+    const Plane z11 = _mm_and_si128(t33, y4);
+    const Plane z12 = _mm_and_si128(t43, y13);
+    const Plane z13 = _mm_and_si128(t40, y5);
+    const Plane z14 = _mm_and_si128(t29, y2);
+    const Plane z15 = _mm_and_si128(t42, y9);
+    const Plane z16 = _mm_and_si128(t45, y14);
+    const Plane z17 = _mm_and_si128(t41, y8);
+
+    // Bottom linear transformation, including the affine constant 0x63
+    const Plane t46 = _mm_xor_si128(z15, z16);
+    const Plane t47 = _mm_xor_si128(z10, z11);
+    const Plane t48 = _mm_xor_si128(z5, z13);
+    const Plane t49 = _mm_xor_si128(z9, z10);
+    const Plane t50 = _mm_xor_si128(z2, z12);
+    const Plane t51 = _mm_xor_si128(z2, z5);
+    const Plane t52 = _mm_xor_si128(z7, z8);
+    const Plane t53 = _mm_xor_si128(z0, z3);
+    const Plane t54 = _mm_xor_si128(z6, z7);
+    const Plane t55 = _mm_xor_si128(z16, z17);
+    const Plane t56 = _mm_xor_si128(z12, t48);
+    const Plane t57 = _mm_xor_si128(t50, t53);
+    const Plane t58 = _mm_xor_si128(z4, t46);
+    const Plane t59 = _mm_xor_si128(z3, t54);
+    const Plane t60 = _mm_xor_si128(t46, t57);
+    const Plane t61 = _mm_xor_si128(z14, t57);
+    const Plane t62 = _mm_xor_si128(t52, t58);
+    const Plane t63 = _mm_xor_si128(t49, t58);
+    const Plane t64 = _mm_xor_si128(z4, t59);
+    const Plane t65 = _mm_xor_si128(t61, t62);
+    const Plane t66 = _mm_xor_si128(z1, t63);
+    const Plane s0 = _mm_xor_si128(t59, t63);
+    const Plane s6 = _mm_xor_si128(t56, _mm_xor_si128(t62, ones));
+    const Plane s7 = _mm_xor_si128(t48, _mm_xor_si128(t60, ones));
+    const Plane t67 = _mm_xor_si128(t64, t65);
+    const Plane s3 = _mm_xor_si128(t53, t66);
+    const Plane s4 = _mm_xor_si128(t51, t66);
+    const Plane s5 = _mm_xor_si128(t47, t65);
+    const Plane s1 = _mm_xor_si128(t64, _mm_xor_si128(s3, ones));
+    const Plane s2 = _mm_xor_si128(t55, _mm_xor_si128(t67, ones));
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+// Inverse affine map y -> rotl(y,1) ^ rotl(y,3) ^ rotl(y,6) ^ 0x05
+AES_TARGET("sse2")
+void InvAffine(Plane q[8]) {
+    const Plane ones = _mm_set1_epi32(-1);
+    Plane r[8];
+    for (int i = 0; i < 8; i++) {
+        r[i] = _mm_xor_si128(_mm_xor_si128(q[(i + 7) & 7], q[(i + 5) & 7]),
+            q[(i + 2) & 7]);
+    }
+    r[0] = _mm_xor_si128(r[0], ones);
+    r[2] = _mm_xor_si128(r[2], ones);
+    memcpy(q, r, sizeof(r));
+}
+
+// InvSubBytes = InvAffine o SubBytes o InvAffine, since SubBytes is the
+// affine map applied after inversion
+AES_TARGET("sse2")
+void InvSubBytes(Plane q[8]) {
+    InvAffine(q);
+    SubBytes(q);
+    InvAffine(q);
+}
+
+// Row r of the state is byte r of each 32-bit column; ShiftRows rotates the
+// columns of row r left by r
+AES_TARGET("sse2")
+inline Plane ShiftPlane(Plane x) {
+    const Plane row0 = _mm_set1_epi32(0x000000ff);
+    const Plane row1 = _mm_set1_epi32(0x0000ff00);
+    const Plane row2 = _mm_set1_epi32(0x00ff0000);
+    const Plane row3 = _mm_set1_epi32((int)0xff000000);
+    return _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(x, row0),
+            _mm_shuffle_epi32(_mm_and_si128(x, row1), _MM_SHUFFLE(0, 3, 2, 1))),
+        _mm_or_si128(
+            _mm_shuffle_epi32(_mm_and_si128(x, row2), _MM_SHUFFLE(1, 0, 3, 2)),
+            _mm_shuffle_epi32(_mm_and_si128(x, row3), _MM_SHUFFLE(2, 1, 0, 3))));
+}
+
+AES_TARGET("sse2")
+inline Plane InvShiftPlane(Plane x) {
+    const Plane row0 = _mm_set1_epi32(0x000000ff);
+    const Plane row1 = _mm_set1_epi32(0x0000ff00);
+    const Plane row2 = _mm_set1_epi32(0x00ff0000);
+    const Plane row3 = _mm_set1_epi32((int)0xff000000);
+    return _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(x, row0),
+            _mm_shuffle_epi32(_mm_and_si128(x, row1), _MM_SHUFFLE(2, 1, 0, 3))),
+        _mm_or_si128(
+            _mm_shuffle_epi32(_mm_and_si128(x, row2), _MM_SHUFFLE(1, 0, 3, 2)),
+            _mm_shuffle_epi32(_mm_and_si128(x, row3), _MM_SHUFFLE(0, 3, 2, 1))));
+}
+
+AES_TARGET("sse2")
+void ShiftRows(Plane q[8]) {
+    for (int i = 0; i < 8; i++) {
+        q[i] = ShiftPlane(q[i]);
+    }
+}
+
+AES_TARGET("sse2")
+void InvShiftRows(Plane q[8]) {
+    for (int i = 0; i < 8; i++) {
+        q[i] = InvShiftPlane(q[i]);
+    }
+}
+
+// Row r of every column receives row r + 1 (r + 2) of the same column
+AES_TARGET("sse2")
+inline Plane RotRows1(Plane x) {
+    return _mm_or_si128(_mm_srli_epi32(x, 8), _mm_slli_epi32(x, 24));
+}
+
+AES_TARGET("sse2")
+inline Plane RotRows2(Plane x) {
+    return _mm_or_si128(_mm_srli_epi32(x, 16), _mm_slli_epi32(x, 16));
+}
+
+// Multiplication by x: planes move up one bit, and bit 7 folds back in
+// through the reduction polynomial 0x1b
+AES_TARGET("sse2")
+void Xtime(const Plane t[8], Plane r[8]) {
+    r[0] = t[7];
+    r[1] = _mm_xor_si128(t[0], t[7]);
+    r[2] = t[1];
+    r[3] = _mm_xor_si128(t[2], t[7]);
+    r[4] = _mm_xor_si128(t[3], t[7]);
+    r[5] = t[4];
+    r[6] = t[5];
+    r[7] = t[6];
+}
+
+// out = 2a0 ^ 3a1 ^ a2 ^ a3 = xtime(a0 ^ a1) ^ a1 ^ (a2 ^ a3)
+AES_TARGET("sse2")
+void MixColumns(Plane q[8]) {
+    Plane r1[8], t[8], xt[8];
+    for (int i = 0; i < 8; i++) {
+        r1[i] = RotRows1(q[i]);
+        t[i] = _mm_xor_si128(q[i], r1[i]);
+    }
+    Xtime(t, xt);
+    for (int i = 0; i < 8; i++) {
+        q[i] = _mm_xor_si128(_mm_xor_si128(xt[i], r1[i]), RotRows2(t[i]));
+    }
+}
+
+// InvMixColumns = MixColumns after adding 4 * (a_r ^ a_{r+2}) to each row
+AES_TARGET("sse2")
+void InvMixColumns(Plane q[8]) {
+    Plane t[8], x2[8], x4[8];
+    for (int i = 0; i < 8; i++) {
+        t[i] = _mm_xor_si128(q[i], RotRows2(q[i]));
+    }
+    Xtime(t, x2);
+    Xtime(x2, x4);
+    for (int i = 0; i < 8; i++) {
+        q[i] = _mm_xor_si128(q[i], x4[i]);
+    }
+    MixColumns(q);
+}
+
+struct SlicedKeys {
+    Plane k[MaxRounds + 1][8];
+};
+
+AES_TARGET("sse2")
+void SliceKeys(const AESRoundKeys& rk, SlicedKeys& sk) {
+    for (unsigned int round = 0; round <= rk.Nr; round++) {
+        SpreadBytes(rk.enc + round * BlockBytes, sk.k[round]);
+    }
+}
+
+AES_TARGET("sse2")
+void Load(const unsigned char* in, Plane q[8]) {
+    for (size_t j = 0; j < Lanes; j++) {
+        q[j] = _mm_loadu_si128((const Plane*)(in + j * BlockBytes));
+    }
+    Transpose(q);
+}
+
+AES_TARGET("sse2")
+void Store(Plane q[8], unsigned char* out) {
+    Transpose(q);
+    for (size_t j = 0; j < Lanes; j++) {
+        _mm_storeu_si128((Plane*)(out + j * BlockBytes), q[j]);
+    }
+}
+
+AES_TARGET("sse2")
+void Encrypt8(const SlicedKeys& sk, unsigned int Nr, const unsigned char* in,
+    unsigned char* out) {
+    Plane q[8];
+    Load(in, q);
+    AddRoundKey(q, sk.k[0]);
+    for (unsigned int round = 1; round < Nr; round++) {
+        SubBytes(q);
+        ShiftRows(q);
+        MixColumns(q);
+        AddRoundKey(q, sk.k[round]);
+    }
+    SubBytes(q);
+    ShiftRows(q);
+    AddRoundKey(q, sk.k[Nr]);
+    Store(q, out);
+}
+
+// Straight inverse cipher over the encryption schedule
+AES_TARGET("sse2")
+void Decrypt8(const SlicedKeys& sk, unsigned int Nr, const unsigned char* in,
+    unsigned char* out) {
+    Plane q[8];
+    Load(in, q);
+    AddRoundKey(q, sk.k[Nr]);
+    for (unsigned int round = Nr - 1; round >= 1; round--) {
+        InvShiftRows(q);
+        InvSubBytes(q);
+        AddRoundKey(q, sk.k[round]);
+        InvMixColumns(q);
+    }
+    InvShiftRows(q);
+    InvSubBytes(q);
+    AddRoundKey(q, sk.k[0]);
+    Store(q, out);
+}
+
+// Runs a partial batch through the eight-lane kernel via scratch space
+template <typename Kernel>
+void Tail(Kernel kernel, const unsigned char* in, unsigned char* out,
+    size_t blocks) {
+    unsigned char buffer[Lanes * BlockBytes] = {};
+    memcpy(buffer, in, blocks * BlockBytes);
+    kernel(buffer, buffer);
+    memcpy(out, buffer, blocks * BlockBytes);
+}
+
+AES_TARGET("sse2")
+void EncryptBlocksBitslice(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    SlicedKeys sk;
+    SliceKeys(rk, sk);
+    for (; blocks >= Lanes; blocks -= Lanes) {
+        Encrypt8(sk, rk.Nr, in, out);
+        in += Lanes * BlockBytes;
+        out += Lanes * BlockBytes;
+    }
+    if (blocks > 0) {
+        Tail([&](const unsigned char* i, unsigned char* o) {
+            Encrypt8(sk, rk.Nr, i, o); }, in, out, blocks);
+    }
+}
+
+AES_TARGET("sse2")
+void DecryptBlocksBitslice(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    SlicedKeys sk;
+    SliceKeys(rk, sk);
+    for (; blocks >= Lanes; blocks -= Lanes) {
+        Decrypt8(sk, rk.Nr, in, out);
+        in += Lanes * BlockBytes;
+        out += Lanes * BlockBytes;
+    }
+    if (blocks > 0) {
+        Tail([&](const unsigned char* i, unsigned char* o) {
+            Decrypt8(sk, rk.Nr, i, o); }, in, out, blocks);
+    }
+}
+
+// Slices the round keys of eight schedules, one per lane: plane bit j of
+// round r is keys[j]'s round key r, so AddRoundKey applies each block's own
+// key. That is the same transpose Load runs on the state.
+AES_TARGET("sse2")
+void SliceLaneKeys(const AESRoundKeys* const keys[], unsigned int Nr,
+    SlicedKeys& sk) {
+    for (unsigned int round = 0; round <= Nr; round++) {
+        for (size_t j = 0; j < Lanes; j++) {
+            sk.k[round][j] = _mm_loadu_si128(
+                (const Plane*)(keys[j]->enc + round * BlockBytes));
+        }
+        Transpose(sk.k[round]);
+    }
+}
+
+// Eight blocks under up to eight keys per pass. Slicing the keys costs one
+// transpose per round on top of the cipher's own work; a short last pass
+// repeats its first key in the unused lanes.
+AES_TARGET("sse2")
+void CryptBlocksMultiKeyBitslice(const AESRoundKeys* const keys[],
+    const unsigned char* const in[], unsigned char* const out[],
+    size_t blocks, bool decrypt) {
+    const unsigned int Nr = keys[0]->Nr;
+    const AESRoundKeys* lane[Lanes];
+    unsigned char buffer[Lanes * BlockBytes] = {};
+    SlicedKeys sk;
+    while (blocks > 0) {
+        const size_t n = blocks < Lanes ? blocks : Lanes;
+        for (size_t j = 0; j < Lanes; j++) {
+            lane[j] = keys[j < n ? j : 0];
+            if (j < n) {
+                memcpy(buffer + j * BlockBytes, in[j], BlockBytes);
+            }
+        }
+        SliceLaneKeys(lane, Nr, sk);
+        if (decrypt) {
+            Decrypt8(sk, Nr, buffer, buffer);
+        }
+        else {
+            Encrypt8(sk, Nr, buffer, buffer);
+        }
+        for (size_t j = 0; j < n; j++) {
+            memcpy(out[j], buffer + j * BlockBytes, BlockBytes);
+        }
+        keys += n;
+        in += n;
+        out += n;
+        blocks -= n;
+    }
+}
+
+void EncryptBlocksMultiKeyBitslice(const AESRoundKeys* const keys[],
+    const unsigned char* const in[], unsigned char* const out[],
+    size_t blocks) {
+    CryptBlocksMultiKeyBitslice(keys, in, out, blocks, false);
+}
+
+void DecryptBlocksMultiKeyBitslice(const AESRoundKeys* const keys[],
+    const unsigned char* const in[], unsigned char* const out[],
+    size_t blocks) {
+    CryptBlocksMultiKeyBitslice(keys, in, out, blocks, true);
+}
+
+// Serial chains only fill one lane; they exist so the backend can be forced
+// end to end, the dispatcher never picks them over a single-block backend.
+AES_TARGET("sse2")
+void EncryptCBCBitslice(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    for (size_t i = 0; i < blocks; i++) {
+        for (unsigned int j = 0; j < BlockBytes; j++) {
+            iv[j] ^= in[j];
+        }
+        EncryptBlocksBitslice(rk, iv, iv, 1);
+        memcpy(out, iv, BlockBytes);
+        in += BlockBytes;
+        out += BlockBytes;
+    }
+}
+
+AES_TARGET("sse2")
+void EncryptCFBBitslice(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    for (size_t i = 0; i < blocks; i++) {
+        EncryptBlocksBitslice(rk, iv, iv, 1);
+        for (unsigned int j = 0; j < BlockBytes; j++) {
+            iv[j] ^= in[j];
+        }
+        memcpy(out, iv, BlockBytes);
+        in += BlockBytes;
+        out += BlockBytes;
+    }
+}
+
+// Key schedule with the S-box and InvMixColumns evaluated on planes, so the
+// key never indexes a table either
+AES_TARGET("sse2")
+uint32_t SubWordSliced(uint32_t w) {
+    unsigned char bytes[BlockBytes] = {};
+    Plane q[8];
+    memcpy(bytes, &w, 4);
+    SpreadBytes(bytes, q);
+    SubBytes(q);
+    GatherBytes(q, bytes);
+    memcpy(&w, bytes, 4);
+    return w;
+}
+
+AES_TARGET("sse2")
+void ExpandKeyBitslice(const unsigned char key[], unsigned int Nk,
+    AESRoundKeys& rk) {
+    const unsigned int Nr = Nk + 6;
+    const unsigned int words = 4 * (Nr + 1);
+    uint32_t w[4 * (MaxRounds + 1)];
+    uint32_t rcon = 1;
+
+    rk.Nr = Nr;
+    memcpy(w, key, 4 * Nk);
+    for (unsigned int i = Nk; i < words; i++) {
+        uint32_t temp = w[i - 1];
+        if (i % Nk == 0) {
+            temp = SubWordSliced((temp >> 8) | (temp << 24)) ^ rcon;
+            rcon = (rcon << 1) ^ ((rcon >> 7) * 0x11b);
+        }
+        else if (Nk > 6 && i % Nk == 4) {
+            temp = SubWordSliced(temp);
+        }
+        w[i] = w[i - Nk] ^ temp;
+    }
+    memcpy(rk.enc, w, 4 * words);
+
+    memcpy(rk.dec, rk.enc + Nr * BlockBytes, BlockBytes);
+    for (unsigned int round = 1; round < Nr; round++) {
+        Plane q[8];
+        SpreadBytes(rk.enc + (Nr - round) * BlockBytes, q);
+        InvMixColumns(q);
+        GatherBytes(q, rk.dec + round * BlockBytes);
+    }
+    memcpy(rk.dec + Nr * BlockBytes, rk.enc, BlockBytes);
+}
+
+}  // namespace
+
+const Backend& BitsliceBackend() {
+    static const Backend backend = {
+        "bitslice",
+        ExpandKeyBitslice,
+        EncryptBlocksBitslice,
+        DecryptBlocksBitslice,
+        EncryptCBCBitslice,
+        EncryptCFBBitslice,
+        nullptr,
+        0,
+        nullptr,
+        EncryptBlocksMultiKeyBitslice,
+        DecryptBlocksMultiKeyBitslice,
+    };
+    return backend;
+}
+
+}  // namespace AESEngine
+
+#endif  // AES_X86
@@ -0,0 +1,607 @@
+#include "pch.h"
+#include "AESEngine.h"
+#include "AESCore.h"
+
+#ifdef AES_X86
+
+#include <cstring>
+#include <immintrin.h>
+
+namespace AESEngine {
+
+namespace {
+
+// Blocks kept in flight by the bulk loops; AESENC has a latency of several
+// cycles but issues every cycle, so independent blocks fill the pipeline.
+static constexpr size_t Lanes = 8;
+
+// SubWord(w), or SubWord(RotWord(w)), computed by AESKEYGENASSIST on lane 1
+AES_TARGET("aes,sse2")
+inline uint32_t KeyAssist(uint32_t w, bool rotate) {
+    __m128i x = _mm_shuffle_epi32(_mm_cvtsi32_si128((int)w),
+        _MM_SHUFFLE(1, 1, 0, 0));
+    x = _mm_aeskeygenassist_si128(x, 0);
+    return (uint32_t)_mm_cvtsi128_si32(
+        rotate ? _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 1, 1, 1)) : x);
+}
+
+template <class Core>
+AES_TARGET("aes,sse2")
+void ExpandKeyNI(const unsigned char key[], AESRoundKeys& rk) {
+    constexpr unsigned int Nk = Core::Nk;
+    constexpr unsigned int Nr = Core::Nr;
+    constexpr unsigned int words = Core::ScheduleWords;
+    uint32_t w[words];
+    uint32_t rcon = 1;
+
+    rk.Nr = Nr;
+    memcpy(w, key, 4 * Nk);
+    for (unsigned int i = Nk; i < words; i++) {
+        uint32_t temp = w[i - 1];
+        if (i % Nk == 0) {
+            temp = KeyAssist(temp, true) ^ rcon;
+            rcon = (rcon << 1) ^ ((rcon >> 7) * 0x11b);
+        }
+        else if (Nk > 6 && i % Nk == 4) {
+            temp = KeyAssist(temp, false);
+        }
+        w[i] = w[i - Nk] ^ temp;
+    }
+    memcpy(rk.enc, w, 4 * words);
+
+    const __m128i* enc = (const __m128i*)rk.enc;
+    __m128i* dec = (__m128i*)rk.dec;
+    dec[0] = enc[Nr];
+    AES_UNROLL
+    for (unsigned int round = 1; round < Nr; round++) {
+        dec[round] = _mm_aesimc_si128(enc[Nr - round]);
+    }
+    dec[Nr] = enc[0];
+}
+
+template <class Core>
+AES_TARGET("aes,sse2")
+inline __m128i Encrypt1(const __m128i* k, __m128i b) {
+    b = _mm_xor_si128(b, k[0]);
+    AES_UNROLL
+    for (unsigned int round = 1; round < Core::Nr; round++) {
+        b = _mm_aesenc_si128(b, k[round]);
+    }
+    return _mm_aesenclast_si128(b, k[Core::Nr]);
+}
+
+template <class Core>
+AES_TARGET("aes,sse2")
+inline __m128i Decrypt1(const __m128i* k, __m128i b) {
+    b = _mm_xor_si128(b, k[0]);
+    AES_UNROLL
+    for (unsigned int round = 1; round < Core::Nr; round++) {
+        b = _mm_aesdec_si128(b, k[round]);
+    }
+    return _mm_aesdeclast_si128(b, k[Core::Nr]);
+}
+
+// The eight lanes are spelled out so every block stays in a register
+template <class Core>
+AES_TARGET("aes,sse2")
+void EncryptBlocksNI(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    const __m128i* k = (const __m128i*)rk.enc;
+    constexpr unsigned int Nr = Core::Nr;
+    const __m128i* src = (const __m128i*)in;
+    __m128i* dst = (__m128i*)out;
+
+    for (; blocks >= Lanes; blocks -= Lanes) {
+        __m128i b0 = _mm_xor_si128(_mm_loadu_si128(src + 0), k[0]);
+        __m128i b1 = _mm_xor_si128(_mm_loadu_si128(src + 1), k[0]);
+        __m128i b2 = _mm_xor_si128(_mm_loadu_si128(src + 2), k[0]);
+        __m128i b3 = _mm_xor_si128(_mm_loadu_si128(src + 3), k[0]);
+        __m128i b4 = _mm_xor_si128(_mm_loadu_si128(src + 4), k[0]);
+        __m128i b5 = _mm_xor_si128(_mm_loadu_si128(src + 5), k[0]);
+        __m128i b6 = _mm_xor_si128(_mm_loadu_si128(src + 6), k[0]);
+        __m128i b7 = _mm_xor_si128(_mm_loadu_si128(src + 7), k[0]);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            const __m128i key = k[round];
+            b0 = _mm_aesenc_si128(b0, key);
+            b1 = _mm_aesenc_si128(b1, key);
+            b2 = _mm_aesenc_si128(b2, key);
+            b3 = _mm_aesenc_si128(b3, key);
+            b4 = _mm_aesenc_si128(b4, key);
+            b5 = _mm_aesenc_si128(b5, key);
+            b6 = _mm_aesenc_si128(b6, key);
+            b7 = _mm_aesenc_si128(b7, key);
+        }
+        const __m128i key = k[Nr];
+        _mm_storeu_si128(dst + 0, _mm_aesenclast_si128(b0, key));
+        _mm_storeu_si128(dst + 1, _mm_aesenclast_si128(b1, key));
+        _mm_storeu_si128(dst + 2, _mm_aesenclast_si128(b2, key));
+        _mm_storeu_si128(dst + 3, _mm_aesenclast_si128(b3, key));
+        _mm_storeu_si128(dst + 4, _mm_aesenclast_si128(b4, key));
+        _mm_storeu_si128(dst + 5, _mm_aesenclast_si128(b5, key));
+        _mm_storeu_si128(dst + 6, _mm_aesenclast_si128(b6, key));
+        _mm_storeu_si128(dst + 7, _mm_aesenclast_si128(b7, key));
+        src += Lanes;
+        dst += Lanes;
+    }
+
+    for (; blocks > 0; blocks--) {
+        _mm_storeu_si128(dst++, Encrypt1<Core>(k, _mm_loadu_si128(src++)));
+    }
+}
+
+template <class Core>
+AES_TARGET("aes,sse2")
+void DecryptBlocksNI(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    const __m128i* k = (const __m128i*)rk.dec;
+    constexpr unsigned int Nr = Core::Nr;
+    const __m128i* src = (const __m128i*)in;
+    __m128i* dst = (__m128i*)out;
+
+    for (; blocks >= Lanes; blocks -= Lanes) {
+        __m128i b0 = _mm_xor_si128(_mm_loadu_si128(src + 0), k[0]);
+        __m128i b1 = _mm_xor_si128(_mm_loadu_si128(src + 1), k[0]);
+        __m128i b2 = _mm_xor_si128(_mm_loadu_si128(src + 2), k[0]);
+        __m128i b3 = _mm_xor_si128(_mm_loadu_si128(src + 3), k[0]);
+        __m128i b4 = _mm_xor_si128(_mm_loadu_si128(src + 4), k[0]);
+        __m128i b5 = _mm_xor_si128(_mm_loadu_si128(src + 5), k[0]);
+        __m128i b6 = _mm_xor_si128(_mm_loadu_si128(src + 6), k[0]);
+        __m128i b7 = _mm_xor_si128(_mm_loadu_si128(src + 7), k[0]);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            const __m128i key = k[round];
+            b0 = _mm_aesdec_si128(b0, key);
+            b1 = _mm_aesdec_si128(b1, key);
+            b2 = _mm_aesdec_si128(b2, key);
+            b3 = _mm_aesdec_si128(b3, key);
+            b4 = _mm_aesdec_si128(b4, key);
+            b5 = _mm_aesdec_si128(b5, key);
+            b6 = _mm_aesdec_si128(b6, key);
+            b7 = _mm_aesdec_si128(b7, key);
+        }
+        const __m128i key = k[Nr];
+        _mm_storeu_si128(dst + 0, _mm_aesdeclast_si128(b0, key));
+        _mm_storeu_si128(dst + 1, _mm_aesdeclast_si128(b1, key));
+        _mm_storeu_si128(dst + 2, _mm_aesdeclast_si128(b2, key));
+        _mm_storeu_si128(dst + 3, _mm_aesdeclast_si128(b3, key));
+        _mm_storeu_si128(dst + 4, _mm_aesdeclast_si128(b4, key));
+        _mm_storeu_si128(dst + 5, _mm_aesdeclast_si128(b5, key));
+        _mm_storeu_si128(dst + 6, _mm_aesdeclast_si128(b6, key));
+        _mm_storeu_si128(dst + 7, _mm_aesdeclast_si128(b7, key));
+        src += Lanes;
+        dst += Lanes;
+    }
+
+    for (; blocks > 0; blocks--) {
+        _mm_storeu_si128(dst++, Decrypt1<Core>(k, _mm_loadu_si128(src++)));
+    }
+}
+
+// The chain runs one block at a time, so the schedule is copied to a local
+// array the compiler can keep in registers across blocks.
+template <class Core>
+AES_TARGET("aes,sse2")
+void EncryptCBCNI(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    const __m128i* k = (const __m128i*)rk.enc;
+    __m128i key[Core::Nr + 1];
+    for (unsigned int round = 0; round <= Core::Nr; round++) {
+        key[round] = k[round];
+    }
+    __m128i chain = _mm_loadu_si128((const __m128i*)iv);
+    for (size_t i = 0; i < blocks; i++) {
+        chain = _mm_xor_si128(chain, _mm_loadu_si128((const __m128i*)in));
+        chain = Encrypt1<Core>(key, chain);
+        _mm_storeu_si128((__m128i*)out, chain);
+        in += BlockBytes;
+        out += BlockBytes;
+    }
+    _mm_storeu_si128((__m128i*)iv, chain);
+}
+
+template <class Core>
+AES_TARGET("aes,sse2")
+void EncryptCFBNI(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    const __m128i* k = (const __m128i*)rk.enc;
+    __m128i key[Core::Nr + 1];
+    for (unsigned int round = 0; round <= Core::Nr; round++) {
+        key[round] = k[round];
+    }
+    __m128i chain = _mm_loadu_si128((const __m128i*)iv);
+    for (size_t i = 0; i < blocks; i++) {
+        chain = Encrypt1<Core>(key, chain);
+        chain = _mm_xor_si128(chain, _mm_loadu_si128((const __m128i*)in));
+        _mm_storeu_si128((__m128i*)out, chain);
+        in += BlockBytes;
+        out += BlockBytes;
+    }
+    _mm_storeu_si128((__m128i*)iv, chain);
+}
+
+// Eight independent CBC chains, one block each per step. Every lane has its
+// own key, so each round loads eight keys from the lane-interleaved table
+// instead of one hoisted register. Lane pointers are copied to locals: the
+// output stores could otherwise alias them and force reloads.
+template <class Core>
+AES_TARGET("aes,sse2")
+void EncryptCBCLanesNI(CBCLanes& lanes, size_t steps) {
+    constexpr unsigned int Nr = Core::Nr;
+    const unsigned char* in[Lanes];
+    unsigned char* out[Lanes];
+    size_t stride[Lanes];
+    for (size_t l = 0; l < Lanes; l++) {
+        in[l] = lanes.in[l];
+        out[l] = lanes.out[l];
+        stride[l] = lanes.stride[l];
+    }
+    const __m128i* chain = (const __m128i*)lanes.chain;
+    __m128i c0 = _mm_load_si128(chain + 0);
+    __m128i c1 = _mm_load_si128(chain + 1);
+    __m128i c2 = _mm_load_si128(chain + 2);
+    __m128i c3 = _mm_load_si128(chain + 3);
+    __m128i c4 = _mm_load_si128(chain + 4);
+    __m128i c5 = _mm_load_si128(chain + 5);
+    __m128i c6 = _mm_load_si128(chain + 6);
+    __m128i c7 = _mm_load_si128(chain + 7);
+
+    for (size_t step = 0; step < steps; step++) {
+        const __m128i* key = (const __m128i*)lanes.keys[0];
+        c0 = _mm_xor_si128(_mm_xor_si128(c0, key[0]),
+            _mm_loadu_si128((const __m128i*)in[0]));
+        c1 = _mm_xor_si128(_mm_xor_si128(c1, key[1]),
+            _mm_loadu_si128((const __m128i*)in[1]));
+        c2 = _mm_xor_si128(_mm_xor_si128(c2, key[2]),
+            _mm_loadu_si128((const __m128i*)in[2]));
+        c3 = _mm_xor_si128(_mm_xor_si128(c3, key[3]),
+            _mm_loadu_si128((const __m128i*)in[3]));
+        c4 = _mm_xor_si128(_mm_xor_si128(c4, key[4]),
+            _mm_loadu_si128((const __m128i*)in[4]));
+        c5 = _mm_xor_si128(_mm_xor_si128(c5, key[5]),
+            _mm_loadu_si128((const __m128i*)in[5]));
+        c6 = _mm_xor_si128(_mm_xor_si128(c6, key[6]),
+            _mm_loadu_si128((const __m128i*)in[6]));
+        c7 = _mm_xor_si128(_mm_xor_si128(c7, key[7]),
+            _mm_loadu_si128((const __m128i*)in[7]));
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            key = (const __m128i*)lanes.keys[round];
+            c0 = _mm_aesenc_si128(c0, key[0]);
+            c1 = _mm_aesenc_si128(c1, key[1]);
+            c2 = _mm_aesenc_si128(c2, key[2]);
+            c3 = _mm_aesenc_si128(c3, key[3]);
+            c4 = _mm_aesenc_si128(c4, key[4]);
+            c5 = _mm_aesenc_si128(c5, key[5]);
+            c6 = _mm_aesenc_si128(c6, key[6]);
+            c7 = _mm_aesenc_si128(c7, key[7]);
+        }
+        key = (const __m128i*)lanes.keys[Nr];
+        c0 = _mm_aesenclast_si128(c0, key[0]);
+        c1 = _mm_aesenclast_si128(c1, key[1]);
+        c2 = _mm_aesenclast_si128(c2, key[2]);
+        c3 = _mm_aesenclast_si128(c3, key[3]);
+        c4 = _mm_aesenclast_si128(c4, key[4]);
+        c5 = _mm_aesenclast_si128(c5, key[5]);
+        c6 = _mm_aesenclast_si128(c6, key[6]);
+        c7 = _mm_aesenclast_si128(c7, key[7]);
+        _mm_storeu_si128((__m128i*)out[0], c0);
+        _mm_storeu_si128((__m128i*)out[1], c1);
+        _mm_storeu_si128((__m128i*)out[2], c2);
+        _mm_storeu_si128((__m128i*)out[3], c3);
+        _mm_storeu_si128((__m128i*)out[4], c4);
+        _mm_storeu_si128((__m128i*)out[5], c5);
+        _mm_storeu_si128((__m128i*)out[6], c6);
+        _mm_storeu_si128((__m128i*)out[7], c7);
+        for (size_t l = 0; l < Lanes; l++) {
+            in[l] += stride[l];
+            out[l] += stride[l];
+        }
+    }
+
+    __m128i* chainOut = (__m128i*)lanes.chain;
+    _mm_store_si128(chainOut + 0, c0);
+    _mm_store_si128(chainOut + 1, c1);
+    _mm_store_si128(chainOut + 2, c2);
+    _mm_store_si128(chainOut + 3, c3);
+    _mm_store_si128(chainOut + 4, c4);
+    _mm_store_si128(chainOut + 5, c5);
+    _mm_store_si128(chainOut + 6, c6);
+    _mm_store_si128(chainOut + 7, c7);
+    for (size_t l = 0; l < Lanes; l++) {
+        lanes.in[l] = in[l];
+        lanes.out[l] = out[l];
+    }
+}
+
+// Eight blocks under eight schedules. Each lane reads its round key straight
+// from its own AESRoundKeys: the loads hit L1 and issue alongside AESENC, so
+// blocks of different keys pipeline like blocks of one key, with no per-key
+// setup beyond fetching eight pointers.
+template <class Core>
+AES_TARGET("aes,sse2")
+void EncryptBlocksMultiKeyNI(const AESRoundKeys* const keys[],
+    const unsigned char* const in[], unsigned char* const out[],
+    size_t blocks) {
+    constexpr unsigned int Nr = Core::Nr;
+
+    for (; blocks >= Lanes; blocks -= Lanes) {
+        const __m128i* k0 = (const __m128i*)keys[0]->enc;
+        const __m128i* k1 = (const __m128i*)keys[1]->enc;
+        const __m128i* k2 = (const __m128i*)keys[2]->enc;
+        const __m128i* k3 = (const __m128i*)keys[3]->enc;
+        const __m128i* k4 = (const __m128i*)keys[4]->enc;
+        const __m128i* k5 = (const __m128i*)keys[5]->enc;
+        const __m128i* k6 = (const __m128i*)keys[6]->enc;
+        const __m128i* k7 = (const __m128i*)keys[7]->enc;
+        __m128i b0 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[0]), k0[0]);
+        __m128i b1 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[1]), k1[0]);
+        __m128i b2 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[2]), k2[0]);
+        __m128i b3 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[3]), k3[0]);
+        __m128i b4 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[4]), k4[0]);
+        __m128i b5 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[5]), k5[0]);
+        __m128i b6 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[6]), k6[0]);
+        __m128i b7 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[7]), k7[0]);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            b0 = _mm_aesenc_si128(b0, k0[round]);
+            b1 = _mm_aesenc_si128(b1, k1[round]);
+            b2 = _mm_aesenc_si128(b2, k2[round]);
+            b3 = _mm_aesenc_si128(b3, k3[round]);
+            b4 = _mm_aesenc_si128(b4, k4[round]);
+            b5 = _mm_aesenc_si128(b5, k5[round]);
+            b6 = _mm_aesenc_si128(b6, k6[round]);
+            b7 = _mm_aesenc_si128(b7, k7[round]);
+        }
+        _mm_storeu_si128((__m128i*)out[0], _mm_aesenclast_si128(b0, k0[Nr]));
+        _mm_storeu_si128((__m128i*)out[1], _mm_aesenclast_si128(b1, k1[Nr]));
+        _mm_storeu_si128((__m128i*)out[2], _mm_aesenclast_si128(b2, k2[Nr]));
+        _mm_storeu_si128((__m128i*)out[3], _mm_aesenclast_si128(b3, k3[Nr]));
+        _mm_storeu_si128((__m128i*)out[4], _mm_aesenclast_si128(b4, k4[Nr]));
+        _mm_storeu_si128((__m128i*)out[5], _mm_aesenclast_si128(b5, k5[Nr]));
+        _mm_storeu_si128((__m128i*)out[6], _mm_aesenclast_si128(b6, k6[Nr]));
+        _mm_storeu_si128((__m128i*)out[7], _mm_aesenclast_si128(b7, k7[Nr]));
+        keys += Lanes;
+        in += Lanes;
+        out += Lanes;
+    }
+
+    for (size_t i = 0; i < blocks; i++) {
+        const __m128i b = _mm_loadu_si128((const __m128i*)in[i]);
+        _mm_storeu_si128((__m128i*)out[i],
+            Encrypt1<Core>((const __m128i*)keys[i]->enc, b));
+    }
+}
+
+template <class Core>
+AES_TARGET("aes,sse2")
+void DecryptBlocksMultiKeyNI(const AESRoundKeys* const keys[],
+    const unsigned char* const in[], unsigned char* const out[],
+    size_t blocks) {
+    constexpr unsigned int Nr = Core::Nr;
+
+    for (; blocks >= Lanes; blocks -= Lanes) {
+        const __m128i* k0 = (const __m128i*)keys[0]->dec;
+        const __m128i* k1 = (const __m128i*)keys[1]->dec;
+        const __m128i* k2 = (const __m128i*)keys[2]->dec;
+        const __m128i* k3 = (const __m128i*)keys[3]->dec;
+        const __m128i* k4 = (const __m128i*)keys[4]->dec;
+        const __m128i* k5 = (const __m128i*)keys[5]->dec;
+        const __m128i* k6 = (const __m128i*)keys[6]->dec;
+        const __m128i* k7 = (const __m128i*)keys[7]->dec;
+        __m128i b0 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[0]), k0[0]);
+        __m128i b1 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[1]), k1[0]);
+        __m128i b2 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[2]), k2[0]);
+        __m128i b3 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[3]), k3[0]);
+        __m128i b4 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[4]), k4[0]);
+        __m128i b5 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[5]), k5[0]);
+        __m128i b6 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[6]), k6[0]);
+        __m128i b7 = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)in[7]), k7[0]);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            b0 = _mm_aesdec_si128(b0, k0[round]);
+            b1 = _mm_aesdec_si128(b1, k1[round]);
+            b2 = _mm_aesdec_si128(b2, k2[round]);
+            b3 = _mm_aesdec_si128(b3, k3[round]);
+            b4 = _mm_aesdec_si128(b4, k4[round]);
+            b5 = _mm_aesdec_si128(b5, k5[round]);
+            b6 = _mm_aesdec_si128(b6, k6[round]);
+            b7 = _mm_aesdec_si128(b7, k7[round]);
+        }
+        _mm_storeu_si128((__m128i*)out[0], _mm_aesdeclast_si128(b0, k0[Nr]));
+        _mm_storeu_si128((__m128i*)out[1], _mm_aesdeclast_si128(b1, k1[Nr]));
+        _mm_storeu_si128((__m128i*)out[2], _mm_aesdeclast_si128(b2, k2[Nr]));
+        _mm_storeu_si128((__m128i*)out[3], _mm_aesdeclast_si128(b3, k3[Nr]));
+        _mm_storeu_si128((__m128i*)out[4], _mm_aesdeclast_si128(b4, k4[Nr]));
+        _mm_storeu_si128((__m128i*)out[5], _mm_aesdeclast_si128(b5, k5[Nr]));
+        _mm_storeu_si128((__m128i*)out[6], _mm_aesdeclast_si128(b6, k6[Nr]));
+        _mm_storeu_si128((__m128i*)out[7], _mm_aesdeclast_si128(b7, k7[Nr]));
+        keys += Lanes;
+        in += Lanes;
+        out += Lanes;
+    }
+
+    for (size_t i = 0; i < blocks; i++) {
+        const __m128i b = _mm_loadu_si128((const __m128i*)in[i]);
+        _mm_storeu_si128((__m128i*)out[i],
+            Decrypt1<Core>((const __m128i*)keys[i]->dec, b));
+    }
+}
+
+// Counters are kept byte-reversed so the big-endian low word is lane 0 and
+// steps with a plain 32-bit add; PSHUFB reverses each one back on use.
+template <class Core>
+AES_TARGET("aes,ssse3")
+void CryptCTR32NI(const AESRoundKeys& rk, unsigned char counter[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    const __m128i* k = (const __m128i*)rk.enc;
+    constexpr unsigned int Nr = Core::Nr;
+    const __m128i* src = (const __m128i*)in;
+    __m128i* dst = (__m128i*)out;
+    const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+        12, 13, 14, 15);
+    const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+    __m128i ctr = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)counter),
+        swap);
+
+    for (; blocks >= Lanes; blocks -= Lanes) {
+        __m128i b0 = _mm_xor_si128(_mm_shuffle_epi8(ctr, swap), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        __m128i b1 = _mm_xor_si128(_mm_shuffle_epi8(ctr, swap), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        __m128i b2 = _mm_xor_si128(_mm_shuffle_epi8(ctr, swap), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        __m128i b3 = _mm_xor_si128(_mm_shuffle_epi8(ctr, swap), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        __m128i b4 = _mm_xor_si128(_mm_shuffle_epi8(ctr, swap), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        __m128i b5 = _mm_xor_si128(_mm_shuffle_epi8(ctr, swap), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        __m128i b6 = _mm_xor_si128(_mm_shuffle_epi8(ctr, swap), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        __m128i b7 = _mm_xor_si128(_mm_shuffle_epi8(ctr, swap), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            const __m128i key = k[round];
+            b0 = _mm_aesenc_si128(b0, key);
+            b1 = _mm_aesenc_si128(b1, key);
+            b2 = _mm_aesenc_si128(b2, key);
+            b3 = _mm_aesenc_si128(b3, key);
+            b4 = _mm_aesenc_si128(b4, key);
+            b5 = _mm_aesenc_si128(b5, key);
+            b6 = _mm_aesenc_si128(b6, key);
+            b7 = _mm_aesenc_si128(b7, key);
+        }
+        const __m128i key = k[Nr];
+        _mm_storeu_si128(dst + 0, _mm_xor_si128(_mm_loadu_si128(src + 0),
+            _mm_aesenclast_si128(b0, key)));
+        _mm_storeu_si128(dst + 1, _mm_xor_si128(_mm_loadu_si128(src + 1),
+            _mm_aesenclast_si128(b1, key)));
+        _mm_storeu_si128(dst + 2, _mm_xor_si128(_mm_loadu_si128(src + 2),
+            _mm_aesenclast_si128(b2, key)));
+        _mm_storeu_si128(dst + 3, _mm_xor_si128(_mm_loadu_si128(src + 3),
+            _mm_aesenclast_si128(b3, key)));
+        _mm_storeu_si128(dst + 4, _mm_xor_si128(_mm_loadu_si128(src + 4),
+            _mm_aesenclast_si128(b4, key)));
+        _mm_storeu_si128(dst + 5, _mm_xor_si128(_mm_loadu_si128(src + 5),
+            _mm_aesenclast_si128(b5, key)));
+        _mm_storeu_si128(dst + 6, _mm_xor_si128(_mm_loadu_si128(src + 6),
+            _mm_aesenclast_si128(b6, key)));
+        _mm_storeu_si128(dst + 7, _mm_xor_si128(_mm_loadu_si128(src + 7),
+            _mm_aesenclast_si128(b7, key)));
+        src += Lanes;
+        dst += Lanes;
+    }
+
+    for (; blocks > 0; blocks--) {
+        const __m128i keystream = Encrypt1<Core>(k, _mm_shuffle_epi8(ctr, swap));
+        _mm_storeu_si128(dst++, _mm_xor_si128(_mm_loadu_si128(src++), keystream));
+        ctr = _mm_add_epi32(ctr, one);
+    }
+    _mm_storeu_si128((__m128i*)counter, _mm_shuffle_epi8(ctr, swap));
+}
+
+// Backend entry points: pick the specialization for the key once per call
+
+void ExpandKeyNI(const unsigned char key[], unsigned int Nk, AESRoundKeys& rk) {
+    WithCore(Nk + 6, [&](auto core) {
+        ExpandKeyNI<decltype(core)>(key, rk);
+    });
+}
+
+void EncryptBlocksNI(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    WithCore(rk.Nr, [&](auto core) {
+        EncryptBlocksNI<decltype(core)>(rk, in, out, blocks);
+    });
+}
+
+void DecryptBlocksNI(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    WithCore(rk.Nr, [&](auto core) {
+        DecryptBlocksNI<decltype(core)>(rk, in, out, blocks);
+    });
+}
+
+void EncryptCBCNI(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    WithCore(rk.Nr, [&](auto core) {
+        EncryptCBCNI<decltype(core)>(rk, iv, in, out, blocks);
+    });
+}
+
+void EncryptCFBNI(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    WithCore(rk.Nr, [&](auto core) {
+        EncryptCFBNI<decltype(core)>(rk, iv, in, out, blocks);
+    });
+}
+
+void EncryptCBCLanesNI(CBCLanes& lanes, size_t steps) {
+    WithCore(lanes.Nr, [&](auto core) {
+        EncryptCBCLanesNI<decltype(core)>(lanes, steps);
+    });
+}
+
+void EncryptBlocksMultiKeyNI(const AESRoundKeys* const keys[],
+    const unsigned char* const in[], unsigned char* const out[],
+    size_t blocks) {
+    WithCore(keys[0]->Nr, [&](auto core) {
+        EncryptBlocksMultiKeyNI<decltype(core)>(keys, in, out, blocks);
+    });
+}
+
+void DecryptBlocksMultiKeyNI(const AESRoundKeys* const keys[],
+    const unsigned char* const in[], unsigned char* const out[],
+    size_t blocks) {
+    WithCore(keys[0]->Nr, [&](auto core) {
+        DecryptBlocksMultiKeyNI<decltype(core)>(keys, in, out, blocks);
+    });
+}
+
+void CryptCTR32NI(const AESRoundKeys& rk, unsigned char counter[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    WithCore(rk.Nr, [&](auto core) {
+        CryptCTR32NI<decltype(core)>(rk, counter, in, out, blocks);
+    });
+}
+
+}  // namespace
+
+const Backend& AESNIBackend() {
+    static const Backend backend = {
+        "aesni",
+        ExpandKeyNI,
+        EncryptBlocksNI,
+        DecryptBlocksNI,
+        EncryptCBCNI,
+        EncryptCFBNI,
+        CryptCTR32NI,
+        (unsigned int)Lanes,
+        EncryptCBCLanesNI,
+        EncryptBlocksMultiKeyNI,
+        DecryptBlocksMultiKeyNI,
+    };
+    return backend;
+}
+
+}  // namespace AESEngine
+
+#endif  // AES_X86
@@ -0,0 +1,668 @@
+#include "pch.h"
+#include "AESEngine.h"
+#include "AESCore.h"
+
+#ifdef AES_X86
+
+#include <immintrin.h>
+
+namespace AESEngine {
+
+namespace {
+
+/// VAES runs one AES round on every 128-bit lane of a YMM or ZMM register,
+/// so a ZMM instruction advances four blocks and a YMM instruction two.
+/// Eight registers are kept in flight: 32 blocks per iteration on ZMM, 16 on
+/// YMM. Remainders shorter than one register go through AES-NI, and key
+/// expansion and the serial chains are AES-NI's as well.
+static constexpr size_t Registers = 8;
+
+AES_TARGET("vaes,avx512f,avx512bw")
+inline void EncRound512(__m512i& a, __m512i& b, __m512i& c, __m512i& d,
+    __m512i key) {
+    a = _mm512_aesenc_epi128(a, key);
+    b = _mm512_aesenc_epi128(b, key);
+    c = _mm512_aesenc_epi128(c, key);
+    d = _mm512_aesenc_epi128(d, key);
+}
+
+AES_TARGET("vaes,avx512f,avx512bw")
+inline void DecRound512(__m512i& a, __m512i& b, __m512i& c, __m512i& d,
+    __m512i key) {
+    a = _mm512_aesdec_epi128(a, key);
+    b = _mm512_aesdec_epi128(b, key);
+    c = _mm512_aesdec_epi128(c, key);
+    d = _mm512_aesdec_epi128(d, key);
+}
+
+template <class Core>
+AES_TARGET("vaes,avx512f,avx512bw")
+void EncryptBlocksVAES512(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    static constexpr size_t Width = 4;
+    const __m128i* k = (const __m128i*)rk.enc;
+    constexpr unsigned int Nr = Core::Nr;
+    __m512i key[Nr + 1];
+    for (unsigned int round = 0; round <= Nr; round++) {
+        key[round] = _mm512_broadcast_i32x4(_mm_load_si128(k + round));
+    }
+
+    const __m512i* src = (const __m512i*)in;
+    __m512i* dst = (__m512i*)out;
+    for (; blocks >= Registers * Width; blocks -= Registers * Width) {
+        __m512i b0 = _mm512_xor_si512(_mm512_loadu_si512(src + 0), key[0]);
+        __m512i b1 = _mm512_xor_si512(_mm512_loadu_si512(src + 1), key[0]);
+        __m512i b2 = _mm512_xor_si512(_mm512_loadu_si512(src + 2), key[0]);
+        __m512i b3 = _mm512_xor_si512(_mm512_loadu_si512(src + 3), key[0]);
+        __m512i b4 = _mm512_xor_si512(_mm512_loadu_si512(src + 4), key[0]);
+        __m512i b5 = _mm512_xor_si512(_mm512_loadu_si512(src + 5), key[0]);
+        __m512i b6 = _mm512_xor_si512(_mm512_loadu_si512(src + 6), key[0]);
+        __m512i b7 = _mm512_xor_si512(_mm512_loadu_si512(src + 7), key[0]);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            EncRound512(b0, b1, b2, b3, key[round]);
+            EncRound512(b4, b5, b6, b7, key[round]);
+        }
+        _mm512_storeu_si512(dst + 0, _mm512_aesenclast_epi128(b0, key[Nr]));
+        _mm512_storeu_si512(dst + 1, _mm512_aesenclast_epi128(b1, key[Nr]));
+        _mm512_storeu_si512(dst + 2, _mm512_aesenclast_epi128(b2, key[Nr]));
+        _mm512_storeu_si512(dst + 3, _mm512_aesenclast_epi128(b3, key[Nr]));
+        _mm512_storeu_si512(dst + 4, _mm512_aesenclast_epi128(b4, key[Nr]));
+        _mm512_storeu_si512(dst + 5, _mm512_aesenclast_epi128(b5, key[Nr]));
+        _mm512_storeu_si512(dst + 6, _mm512_aesenclast_epi128(b6, key[Nr]));
+        _mm512_storeu_si512(dst + 7, _mm512_aesenclast_epi128(b7, key[Nr]));
+        src += Registers;
+        dst += Registers;
+    }
+
+    for (; blocks >= Width; blocks -= Width) {
+        __m512i b = _mm512_xor_si512(_mm512_loadu_si512(src++), key[0]);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            b = _mm512_aesenc_epi128(b, key[round]);
+        }
+        _mm512_storeu_si512(dst++, _mm512_aesenclast_epi128(b, key[Nr]));
+    }
+
+    if (blocks > 0) {
+        AESNIBackend().encryptBlocks(rk, (const unsigned char*)src,
+            (unsigned char*)dst, blocks);
+    }
+}
+
+template <class Core>
+AES_TARGET("vaes,avx512f,avx512bw")
+void DecryptBlocksVAES512(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    static constexpr size_t Width = 4;
+    const __m128i* k = (const __m128i*)rk.dec;
+    constexpr unsigned int Nr = Core::Nr;
+    __m512i key[Nr + 1];
+    for (unsigned int round = 0; round <= Nr; round++) {
+        key[round] = _mm512_broadcast_i32x4(_mm_load_si128(k + round));
+    }
+
+    const __m512i* src = (const __m512i*)in;
+    __m512i* dst = (__m512i*)out;
+    for (; blocks >= Registers * Width; blocks -= Registers * Width) {
+        __m512i b0 = _mm512_xor_si512(_mm512_loadu_si512(src + 0), key[0]);
+        __m512i b1 = _mm512_xor_si512(_mm512_loadu_si512(src + 1), key[0]);
+        __m512i b2 = _mm512_xor_si512(_mm512_loadu_si512(src + 2), key[0]);
+        __m512i b3 = _mm512_xor_si512(_mm512_loadu_si512(src + 3), key[0]);
+        __m512i b4 = _mm512_xor_si512(_mm512_loadu_si512(src + 4), key[0]);
+        __m512i b5 = _mm512_xor_si512(_mm512_loadu_si512(src + 5), key[0]);
+        __m512i b6 = _mm512_xor_si512(_mm512_loadu_si512(src + 6), key[0]);
+        __m512i b7 = _mm512_xor_si512(_mm512_loadu_si512(src + 7), key[0]);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            DecRound512(b0, b1, b2, b3, key[round]);
+            DecRound512(b4, b5, b6, b7, key[round]);
+        }
+        _mm512_storeu_si512(dst + 0, _mm512_aesdeclast_epi128(b0, key[Nr]));
+        _mm512_storeu_si512(dst + 1, _mm512_aesdeclast_epi128(b1, key[Nr]));
+        _mm512_storeu_si512(dst + 2, _mm512_aesdeclast_epi128(b2, key[Nr]));
+        _mm512_storeu_si512(dst + 3, _mm512_aesdeclast_epi128(b3, key[Nr]));
+        _mm512_storeu_si512(dst + 4, _mm512_aesdeclast_epi128(b4, key[Nr]));
+        _mm512_storeu_si512(dst + 5, _mm512_aesdeclast_epi128(b5, key[Nr]));
+        _mm512_storeu_si512(dst + 6, _mm512_aesdeclast_epi128(b6, key[Nr]));
+        _mm512_storeu_si512(dst + 7, _mm512_aesdeclast_epi128(b7, key[Nr]));
+        src += Registers;
+        dst += Registers;
+    }
+
+    for (; blocks >= Width; blocks -= Width) {
+        __m512i b = _mm512_xor_si512(_mm512_loadu_si512(src++), key[0]);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            b = _mm512_aesdec_epi128(b, key[round]);
+        }
+        _mm512_storeu_si512(dst++, _mm512_aesdeclast_epi128(b, key[Nr]));
+    }
+
+    if (blocks > 0) {
+        AESNIBackend().decryptBlocks(rk, (const unsigned char*)src,
+            (unsigned char*)dst, blocks);
+    }
+}
+
+// Same byte-reversed counter trick as the AES-NI kernel: each 128-bit lane
+// holds one reversed counter and they all step by the lane count at once.
+template <class Core>
+AES_TARGET("vaes,avx512f,avx512bw")
+void CryptCTR32VAES512(const AESRoundKeys& rk, unsigned char counter[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    static constexpr size_t Width = 4;
+    const __m128i* k = (const __m128i*)rk.enc;
+    constexpr unsigned int Nr = Core::Nr;
+    __m512i key[Nr + 1];
+    for (unsigned int round = 0; round <= Nr; round++) {
+        key[round] = _mm512_broadcast_i32x4(_mm_load_si128(k + round));
+    }
+
+    const __m512i swap = _mm512_broadcast_i32x4(_mm_set_epi8(0, 1, 2, 3, 4,
+        5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    const __m512i step = _mm512_set_epi32(0, 0, 0, 4, 0, 0, 0, 4,
+        0, 0, 0, 4, 0, 0, 0, 4);
+    const __m128i first = _mm_shuffle_epi8(
+        _mm_loadu_si128((const __m128i*)counter), _mm512_castsi512_si128(swap));
+    __m512i ctr = _mm512_add_epi32(_mm512_broadcast_i32x4(first),
+        _mm512_set_epi32(0, 0, 0, 3, 0, 0, 0, 2, 0, 0, 0, 1, 0, 0, 0, 0));
+
+    const __m512i* src = (const __m512i*)in;
+    __m512i* dst = (__m512i*)out;
+    for (; blocks >= Registers * Width; blocks -= Registers * Width) {
+        __m512i b0 = _mm512_xor_si512(_mm512_shuffle_epi8(ctr, swap), key[0]);
+        ctr = _mm512_add_epi32(ctr, step);
+        __m512i b1 = _mm512_xor_si512(_mm512_shuffle_epi8(ctr, swap), key[0]);
+        ctr = _mm512_add_epi32(ctr, step);
+        __m512i b2 = _mm512_xor_si512(_mm512_shuffle_epi8(ctr, swap), key[0]);
+        ctr = _mm512_add_epi32(ctr, step);
+        __m512i b3 = _mm512_xor_si512(_mm512_shuffle_epi8(ctr, swap), key[0]);
+        ctr = _mm512_add_epi32(ctr, step);
+        __m512i b4 = _mm512_xor_si512(_mm512_shuffle_epi8(ctr, swap), key[0]);
+        ctr = _mm512_add_epi32(ctr, step);
+        __m512i b5 = _mm512_xor_si512(_mm512_shuffle_epi8(ctr, swap), key[0]);
+        ctr = _mm512_add_epi32(ctr, step);
+        __m512i b6 = _mm512_xor_si512(_mm512_shuffle_epi8(ctr, swap), key[0]);
+        ctr = _mm512_add_epi32(ctr, step);
+        __m512i b7 = _mm512_xor_si512(_mm512_shuffle_epi8(ctr, swap), key[0]);
+        ctr = _mm512_add_epi32(ctr, step);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            EncRound512(b0, b1, b2, b3, key[round]);
+            EncRound512(b4, b5, b6, b7, key[round]);
+        }
+        _mm512_storeu_si512(dst + 0, _mm512_xor_si512(_mm512_loadu_si512(src + 0),
+            _mm512_aesenclast_epi128(b0, key[Nr])));
+        _mm512_storeu_si512(dst + 1, _mm512_xor_si512(_mm512_loadu_si512(src + 1),
+            _mm512_aesenclast_epi128(b1, key[Nr])));
+        _mm512_storeu_si512(dst + 2, _mm512_xor_si512(_mm512_loadu_si512(src + 2),
+            _mm512_aesenclast_epi128(b2, key[Nr])));
+        _mm512_storeu_si512(dst + 3, _mm512_xor_si512(_mm512_loadu_si512(src + 3),
+            _mm512_aesenclast_epi128(b3, key[Nr])));
+        _mm512_storeu_si512(dst + 4, _mm512_xor_si512(_mm512_loadu_si512(src + 4),
+            _mm512_aesenclast_epi128(b4, key[Nr])));
+        _mm512_storeu_si512(dst + 5, _mm512_xor_si512(_mm512_loadu_si512(src + 5),
+            _mm512_aesenclast_epi128(b5, key[Nr])));
+        _mm512_storeu_si512(dst + 6, _mm512_xor_si512(_mm512_loadu_si512(src + 6),
+            _mm512_aesenclast_epi128(b6, key[Nr])));
+        _mm512_storeu_si512(dst + 7, _mm512_xor_si512(_mm512_loadu_si512(src + 7),
+            _mm512_aesenclast_epi128(b7, key[Nr])));
+        src += Registers;
+        dst += Registers;
+    }
+
+    // Lane 0 holds the next counter; AES-NI finishes the remainder
+    _mm_storeu_si128((__m128i*)counter, _mm_shuffle_epi8(
+        _mm512_castsi512_si128(ctr), _mm512_castsi512_si128(swap)));
+    if (blocks > 0) {
+        AESNIBackend().cryptCTR32(rk, counter, (const unsigned char*)src,
+            (unsigned char*)dst, blocks);
+    }
+}
+
+// Gathers one block from each of four lanes into a ZMM register
+AES_TARGET("vaes,avx512f,avx512bw")
+inline __m512i Gather512(const unsigned char* const* in) {
+    __m512i x = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i*)in[0]));
+    x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i*)in[1]), 1);
+    x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i*)in[2]), 2);
+    return _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i*)in[3]), 3);
+}
+
+AES_TARGET("vaes,avx512f,avx512bw")
+inline void Scatter512(unsigned char* const* out, __m512i x) {
+    _mm_storeu_si128((__m128i*)out[0], _mm512_castsi512_si128(x));
+    _mm_storeu_si128((__m128i*)out[1], _mm512_extracti32x4_epi32(x, 1));
+    _mm_storeu_si128((__m128i*)out[2], _mm512_extracti32x4_epi32(x, 2));
+    _mm_storeu_si128((__m128i*)out[3], _mm512_extracti32x4_epi32(x, 3));
+}
+
+// Sixteen CBC chains as four ZMM registers of four lanes. The inputs of a
+// register's lanes come from different messages and are gathered with
+// inserts; its round keys are one load from the lane-interleaved table.
+template <class Core>
+AES_TARGET("vaes,avx512f,avx512bw")
+void EncryptCBCLanesVAES512(CBCLanes& lanes, size_t steps) {
+    constexpr unsigned int Nr = Core::Nr;
+    const unsigned char* in[MaxCBCLanes];
+    unsigned char* out[MaxCBCLanes];
+    size_t stride[MaxCBCLanes];
+    for (size_t l = 0; l < MaxCBCLanes; l++) {
+        in[l] = lanes.in[l];
+        out[l] = lanes.out[l];
+        stride[l] = lanes.stride[l];
+    }
+    const __m512i* chain = (const __m512i*)lanes.chain;
+    __m512i c0 = _mm512_load_si512(chain + 0);
+    __m512i c1 = _mm512_load_si512(chain + 1);
+    __m512i c2 = _mm512_load_si512(chain + 2);
+    __m512i c3 = _mm512_load_si512(chain + 3);
+
+    for (size_t step = 0; step < steps; step++) {
+        const __m512i* key = (const __m512i*)lanes.keys[0];
+        c0 = _mm512_ternarylogic_epi64(c0, key[0], Gather512(in + 0), 0x96);
+        c1 = _mm512_ternarylogic_epi64(c1, key[1], Gather512(in + 4), 0x96);
+        c2 = _mm512_ternarylogic_epi64(c2, key[2], Gather512(in + 8), 0x96);
+        c3 = _mm512_ternarylogic_epi64(c3, key[3], Gather512(in + 12), 0x96);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            key = (const __m512i*)lanes.keys[round];
+            c0 = _mm512_aesenc_epi128(c0, key[0]);
+            c1 = _mm512_aesenc_epi128(c1, key[1]);
+            c2 = _mm512_aesenc_epi128(c2, key[2]);
+            c3 = _mm512_aesenc_epi128(c3, key[3]);
+        }
+        key = (const __m512i*)lanes.keys[Nr];
+        c0 = _mm512_aesenclast_epi128(c0, key[0]);
+        c1 = _mm512_aesenclast_epi128(c1, key[1]);
+        c2 = _mm512_aesenclast_epi128(c2, key[2]);
+        c3 = _mm512_aesenclast_epi128(c3, key[3]);
+        Scatter512(out + 0, c0);
+        Scatter512(out + 4, c1);
+        Scatter512(out + 8, c2);
+        Scatter512(out + 12, c3);
+        for (size_t l = 0; l < MaxCBCLanes; l++) {
+            in[l] += stride[l];
+            out[l] += stride[l];
+        }
+    }
+
+    __m512i* chainOut = (__m512i*)lanes.chain;
+    _mm512_store_si512(chainOut + 0, c0);
+    _mm512_store_si512(chainOut + 1, c1);
+    _mm512_store_si512(chainOut + 2, c2);
+    _mm512_store_si512(chainOut + 3, c3);
+    for (size_t l = 0; l < MaxCBCLanes; l++) {
+        lanes.in[l] = in[l];
+        lanes.out[l] = out[l];
+    }
+}
+
+AES_TARGET("vaes,avx2")
+inline void EncRound256(__m256i& a, __m256i& b, __m256i& c, __m256i& d,
+    __m256i key) {
+    a = _mm256_aesenc_epi128(a, key);
+    b = _mm256_aesenc_epi128(b, key);
+    c = _mm256_aesenc_epi128(c, key);
+    d = _mm256_aesenc_epi128(d, key);
+}
+
+AES_TARGET("vaes,avx2")
+inline void DecRound256(__m256i& a, __m256i& b, __m256i& c, __m256i& d,
+    __m256i key) {
+    a = _mm256_aesdec_epi128(a, key);
+    b = _mm256_aesdec_epi128(b, key);
+    c = _mm256_aesdec_epi128(c, key);
+    d = _mm256_aesdec_epi128(d, key);
+}
+
+template <class Core>
+AES_TARGET("vaes,avx2")
+void EncryptBlocksVAES256(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    static constexpr size_t Width = 2;
+    const __m128i* k = (const __m128i*)rk.enc;
+    constexpr unsigned int Nr = Core::Nr;
+
+    const __m256i* src = (const __m256i*)in;
+    __m256i* dst = (__m256i*)out;
+    for (; blocks >= Registers * Width; blocks -= Registers * Width) {
+        __m256i key = _mm256_broadcastsi128_si256(_mm_load_si128(k));
+        __m256i b0 = _mm256_xor_si256(_mm256_loadu_si256(src + 0), key);
+        __m256i b1 = _mm256_xor_si256(_mm256_loadu_si256(src + 1), key);
+        __m256i b2 = _mm256_xor_si256(_mm256_loadu_si256(src + 2), key);
+        __m256i b3 = _mm256_xor_si256(_mm256_loadu_si256(src + 3), key);
+        __m256i b4 = _mm256_xor_si256(_mm256_loadu_si256(src + 4), key);
+        __m256i b5 = _mm256_xor_si256(_mm256_loadu_si256(src + 5), key);
+        __m256i b6 = _mm256_xor_si256(_mm256_loadu_si256(src + 6), key);
+        __m256i b7 = _mm256_xor_si256(_mm256_loadu_si256(src + 7), key);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            key = _mm256_broadcastsi128_si256(_mm_load_si128(k + round));
+            EncRound256(b0, b1, b2, b3, key);
+            EncRound256(b4, b5, b6, b7, key);
+        }
+        key = _mm256_broadcastsi128_si256(_mm_load_si128(k + Nr));
+        _mm256_storeu_si256(dst + 0, _mm256_aesenclast_epi128(b0, key));
+        _mm256_storeu_si256(dst + 1, _mm256_aesenclast_epi128(b1, key));
+        _mm256_storeu_si256(dst + 2, _mm256_aesenclast_epi128(b2, key));
+        _mm256_storeu_si256(dst + 3, _mm256_aesenclast_epi128(b3, key));
+        _mm256_storeu_si256(dst + 4, _mm256_aesenclast_epi128(b4, key));
+        _mm256_storeu_si256(dst + 5, _mm256_aesenclast_epi128(b5, key));
+        _mm256_storeu_si256(dst + 6, _mm256_aesenclast_epi128(b6, key));
+        _mm256_storeu_si256(dst + 7, _mm256_aesenclast_epi128(b7, key));
+        src += Registers;
+        dst += Registers;
+    }
+
+    if (blocks > 0) {
+        AESNIBackend().encryptBlocks(rk, (const unsigned char*)src,
+            (unsigned char*)dst, blocks);
+    }
+}
+
+template <class Core>
+AES_TARGET("vaes,avx2")
+void DecryptBlocksVAES256(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    static constexpr size_t Width = 2;
+    const __m128i* k = (const __m128i*)rk.dec;
+    constexpr unsigned int Nr = Core::Nr;
+
+    const __m256i* src = (const __m256i*)in;
+    __m256i* dst = (__m256i*)out;
+    for (; blocks >= Registers * Width; blocks -= Registers * Width) {
+        __m256i key = _mm256_broadcastsi128_si256(_mm_load_si128(k));
+        __m256i b0 = _mm256_xor_si256(_mm256_loadu_si256(src + 0), key);
+        __m256i b1 = _mm256_xor_si256(_mm256_loadu_si256(src + 1), key);
+        __m256i b2 = _mm256_xor_si256(_mm256_loadu_si256(src + 2), key);
+        __m256i b3 = _mm256_xor_si256(_mm256_loadu_si256(src + 3), key);
+        __m256i b4 = _mm256_xor_si256(_mm256_loadu_si256(src + 4), key);
+        __m256i b5 = _mm256_xor_si256(_mm256_loadu_si256(src + 5), key);
+        __m256i b6 = _mm256_xor_si256(_mm256_loadu_si256(src + 6), key);
+        __m256i b7 = _mm256_xor_si256(_mm256_loadu_si256(src + 7), key);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            key = _mm256_broadcastsi128_si256(_mm_load_si128(k + round));
+            DecRound256(b0, b1, b2, b3, key);
+            DecRound256(b4, b5, b6, b7, key);
+        }
+        key = _mm256_broadcastsi128_si256(_mm_load_si128(k + Nr));
+        _mm256_storeu_si256(dst + 0, _mm256_aesdeclast_epi128(b0, key));
+        _mm256_storeu_si256(dst + 1, _mm256_aesdeclast_epi128(b1, key));
+        _mm256_storeu_si256(dst + 2, _mm256_aesdeclast_epi128(b2, key));
+        _mm256_storeu_si256(dst + 3, _mm256_aesdeclast_epi128(b3, key));
+        _mm256_storeu_si256(dst + 4, _mm256_aesdeclast_epi128(b4, key));
+        _mm256_storeu_si256(dst + 5, _mm256_aesdeclast_epi128(b5, key));
+        _mm256_storeu_si256(dst + 6, _mm256_aesdeclast_epi128(b6, key));
+        _mm256_storeu_si256(dst + 7, _mm256_aesdeclast_epi128(b7, key));
+        src += Registers;
+        dst += Registers;
+    }
+
+    if (blocks > 0) {
+        AESNIBackend().decryptBlocks(rk, (const unsigned char*)src,
+            (unsigned char*)dst, blocks);
+    }
+}
+
+template <class Core>
+AES_TARGET("vaes,avx2")
+void CryptCTR32VAES256(const AESRoundKeys& rk, unsigned char counter[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    static constexpr size_t Width = 2;
+    const __m128i* k = (const __m128i*)rk.enc;
+    constexpr unsigned int Nr = Core::Nr;
+
+    const __m256i swap = _mm256_broadcastsi128_si256(_mm_set_epi8(0, 1, 2, 3,
+        4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    const __m256i step = _mm256_set_epi32(0, 0, 0, 2, 0, 0, 0, 2);
+    const __m128i first = _mm_shuffle_epi8(
+        _mm_loadu_si128((const __m128i*)counter), _mm256_castsi256_si128(swap));
+    __m256i ctr = _mm256_add_epi32(_mm256_broadcastsi128_si256(first),
+        _mm256_set_epi32(0, 0, 0, 1, 0, 0, 0, 0));
+
+    const __m256i* src = (const __m256i*)in;
+    __m256i* dst = (__m256i*)out;
+    for (; blocks >= Registers * Width; blocks -= Registers * Width) {
+        __m256i key = _mm256_broadcastsi128_si256(_mm_load_si128(k));
+        __m256i b0 = _mm256_xor_si256(_mm256_shuffle_epi8(ctr, swap), key);
+        ctr = _mm256_add_epi32(ctr, step);
+        __m256i b1 = _mm256_xor_si256(_mm256_shuffle_epi8(ctr, swap), key);
+        ctr = _mm256_add_epi32(ctr, step);
+        __m256i b2 = _mm256_xor_si256(_mm256_shuffle_epi8(ctr, swap), key);
+        ctr = _mm256_add_epi32(ctr, step);
+        __m256i b3 = _mm256_xor_si256(_mm256_shuffle_epi8(ctr, swap), key);
+        ctr = _mm256_add_epi32(ctr, step);
+        __m256i b4 = _mm256_xor_si256(_mm256_shuffle_epi8(ctr, swap), key);
+        ctr = _mm256_add_epi32(ctr, step);
+        __m256i b5 = _mm256_xor_si256(_mm256_shuffle_epi8(ctr, swap), key);
+        ctr = _mm256_add_epi32(ctr, step);
+        __m256i b6 = _mm256_xor_si256(_mm256_shuffle_epi8(ctr, swap), key);
+        ctr = _mm256_add_epi32(ctr, step);
+        __m256i b7 = _mm256_xor_si256(_mm256_shuffle_epi8(ctr, swap), key);
+        ctr = _mm256_add_epi32(ctr, step);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            key = _mm256_broadcastsi128_si256(_mm_load_si128(k + round));
+            EncRound256(b0, b1, b2, b3, key);
+            EncRound256(b4, b5, b6, b7, key);
+        }
+        key = _mm256_broadcastsi128_si256(_mm_load_si128(k + Nr));
+        _mm256_storeu_si256(dst + 0, _mm256_xor_si256(_mm256_loadu_si256(src + 0),
+            _mm256_aesenclast_epi128(b0, key)));
+        _mm256_storeu_si256(dst + 1, _mm256_xor_si256(_mm256_loadu_si256(src + 1),
+            _mm256_aesenclast_epi128(b1, key)));
+        _mm256_storeu_si256(dst + 2, _mm256_xor_si256(_mm256_loadu_si256(src + 2),
+            _mm256_aesenclast_epi128(b2, key)));
+        _mm256_storeu_si256(dst + 3, _mm256_xor_si256(_mm256_loadu_si256(src + 3),
+            _mm256_aesenclast_epi128(b3, key)));
+        _mm256_storeu_si256(dst + 4, _mm256_xor_si256(_mm256_loadu_si256(src + 4),
+            _mm256_aesenclast_epi128(b4, key)));
+        _mm256_storeu_si256(dst + 5, _mm256_xor_si256(_mm256_loadu_si256(src + 5),
+            _mm256_aesenclast_epi128(b5, key)));
+        _mm256_storeu_si256(dst + 6, _mm256_xor_si256(_mm256_loadu_si256(src + 6),
+            _mm256_aesenclast_epi128(b6, key)));
+        _mm256_storeu_si256(dst + 7, _mm256_xor_si256(_mm256_loadu_si256(src + 7),
+            _mm256_aesenclast_epi128(b7, key)));
+        src += Registers;
+        dst += Registers;
+    }
+
+    _mm_storeu_si128((__m128i*)counter, _mm_shuffle_epi8(
+        _mm256_castsi256_si128(ctr), _mm256_castsi256_si128(swap)));
+    if (blocks > 0) {
+        AESNIBackend().cryptCTR32(rk, counter, (const unsigned char*)src,
+            (unsigned char*)dst, blocks);
+    }
+}
+
+AES_TARGET("vaes,avx2")
+inline __m256i Gather256(const unsigned char* const* in) {
+    return _mm256_loadu2_m128i((const __m128i*)in[1], (const __m128i*)in[0]);
+}
+
+AES_TARGET("vaes,avx2")
+inline void Scatter256(unsigned char* const* out, __m256i x) {
+    _mm256_storeu2_m128i((__m128i*)out[1], (__m128i*)out[0], x);
+}
+
+// Sixteen CBC chains as eight YMM registers of two lanes
+template <class Core>
+AES_TARGET("vaes,avx2")
+void EncryptCBCLanesVAES256(CBCLanes& lanes, size_t steps) {
+    constexpr unsigned int Nr = Core::Nr;
+    const unsigned char* in[MaxCBCLanes];
+    unsigned char* out[MaxCBCLanes];
+    size_t stride[MaxCBCLanes];
+    for (size_t l = 0; l < MaxCBCLanes; l++) {
+        in[l] = lanes.in[l];
+        out[l] = lanes.out[l];
+        stride[l] = lanes.stride[l];
+    }
+    const __m256i* chain = (const __m256i*)lanes.chain;
+    __m256i c0 = _mm256_load_si256(chain + 0);
+    __m256i c1 = _mm256_load_si256(chain + 1);
+    __m256i c2 = _mm256_load_si256(chain + 2);
+    __m256i c3 = _mm256_load_si256(chain + 3);
+    __m256i c4 = _mm256_load_si256(chain + 4);
+    __m256i c5 = _mm256_load_si256(chain + 5);
+    __m256i c6 = _mm256_load_si256(chain + 6);
+    __m256i c7 = _mm256_load_si256(chain + 7);
+
+    for (size_t step = 0; step < steps; step++) {
+        const __m256i* key = (const __m256i*)lanes.keys[0];
+        c0 = _mm256_xor_si256(_mm256_xor_si256(c0, key[0]), Gather256(in + 0));
+        c1 = _mm256_xor_si256(_mm256_xor_si256(c1, key[1]), Gather256(in + 2));
+        c2 = _mm256_xor_si256(_mm256_xor_si256(c2, key[2]), Gather256(in + 4));
+        c3 = _mm256_xor_si256(_mm256_xor_si256(c3, key[3]), Gather256(in + 6));
+        c4 = _mm256_xor_si256(_mm256_xor_si256(c4, key[4]), Gather256(in + 8));
+        c5 = _mm256_xor_si256(_mm256_xor_si256(c5, key[5]), Gather256(in + 10));
+        c6 = _mm256_xor_si256(_mm256_xor_si256(c6, key[6]), Gather256(in + 12));
+        c7 = _mm256_xor_si256(_mm256_xor_si256(c7, key[7]), Gather256(in + 14));
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            key = (const __m256i*)lanes.keys[round];
+            c0 = _mm256_aesenc_epi128(c0, key[0]);
+            c1 = _mm256_aesenc_epi128(c1, key[1]);
+            c2 = _mm256_aesenc_epi128(c2, key[2]);
+            c3 = _mm256_aesenc_epi128(c3, key[3]);
+            c4 = _mm256_aesenc_epi128(c4, key[4]);
+            c5 = _mm256_aesenc_epi128(c5, key[5]);
+            c6 = _mm256_aesenc_epi128(c6, key[6]);
+            c7 = _mm256_aesenc_epi128(c7, key[7]);
+        }
+        key = (const __m256i*)lanes.keys[Nr];
+        c0 = _mm256_aesenclast_epi128(c0, key[0]);
+        c1 = _mm256_aesenclast_epi128(c1, key[1]);
+        c2 = _mm256_aesenclast_epi128(c2, key[2]);
+        c3 = _mm256_aesenclast_epi128(c3, key[3]);
+        c4 = _mm256_aesenclast_epi128(c4, key[4]);
+        c5 = _mm256_aesenclast_epi128(c5, key[5]);
+        c6 = _mm256_aesenclast_epi128(c6, key[6]);
+        c7 = _mm256_aesenclast_epi128(c7, key[7]);
+        Scatter256(out + 0, c0);
+        Scatter256(out + 2, c1);
+        Scatter256(out + 4, c2);
+        Scatter256(out + 6, c3);
+        Scatter256(out + 8, c4);
+        Scatter256(out + 10, c5);
+        Scatter256(out + 12, c6);
+        Scatter256(out + 14, c7);
+        for (size_t l = 0; l < MaxCBCLanes; l++) {
+            in[l] += stride[l];
+            out[l] += stride[l];
+        }
+    }
+
+    __m256i* chainOut = (__m256i*)lanes.chain;
+    _mm256_store_si256(chainOut + 0, c0);
+    _mm256_store_si256(chainOut + 1, c1);
+    _mm256_store_si256(chainOut + 2, c2);
+    _mm256_store_si256(chainOut + 3, c3);
+    _mm256_store_si256(chainOut + 4, c4);
+    _mm256_store_si256(chainOut + 5, c5);
+    _mm256_store_si256(chainOut + 6, c6);
+    _mm256_store_si256(chainOut + 7, c7);
+    for (size_t l = 0; l < MaxCBCLanes; l++) {
+        lanes.in[l] = in[l];
+        lanes.out[l] = out[l];
+    }
+}
+
+// Backend entry points: pick the specialization for the key once per call
+
+void EncryptBlocksVAES512(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    WithCore(rk.Nr, [&](auto core) {
+        EncryptBlocksVAES512<decltype(core)>(rk, in, out, blocks);
+    });
+}
+
+void DecryptBlocksVAES512(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    WithCore(rk.Nr, [&](auto core) {
+        DecryptBlocksVAES512<decltype(core)>(rk, in, out, blocks);
+    });
+}
+
+void CryptCTR32VAES512(const AESRoundKeys& rk, unsigned char counter[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    WithCore(rk.Nr, [&](auto core) {
+        CryptCTR32VAES512<decltype(core)>(rk, counter, in, out, blocks);
+    });
+}
+
+void EncryptCBCLanesVAES512(CBCLanes& lanes, size_t steps) {
+    WithCore(lanes.Nr, [&](auto core) {
+        EncryptCBCLanesVAES512<decltype(core)>(lanes, steps);
+    });
+}
+
+void EncryptBlocksVAES256(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    WithCore(rk.Nr, [&](auto core) {
+        EncryptBlocksVAES256<decltype(core)>(rk, in, out, blocks);
+    });
+}
+
+void DecryptBlocksVAES256(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    WithCore(rk.Nr, [&](auto core) {
+        DecryptBlocksVAES256<decltype(core)>(rk, in, out, blocks);
+    });
+}
+
+void CryptCTR32VAES256(const AESRoundKeys& rk, unsigned char counter[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    WithCore(rk.Nr, [&](auto core) {
+        CryptCTR32VAES256<decltype(core)>(rk, counter, in, out, blocks);
+    });
+}
+
+void EncryptCBCLanesVAES256(CBCLanes& lanes, size_t steps) {
+    WithCore(lanes.Nr, [&](auto core) {
+        EncryptCBCLanesVAES256<decltype(core)>(lanes, steps);
+    });
+}
+
+}  // namespace
+
+const Backend& VAES512Backend() {
+    static const Backend backend = {
+        "vaes512",
+        AESNIBackend().expandKey,
+        EncryptBlocksVAES512,
+        DecryptBlocksVAES512,
+        AESNIBackend().encryptCBC,
+        AESNIBackend().encryptCFB,
+        CryptCTR32VAES512,
+        MaxCBCLanes,
+        EncryptCBCLanesVAES512,
+        AESNIBackend().encryptBlocksMultiKey,
+        AESNIBackend().decryptBlocksMultiKey,
+    };
+    return backend;
+}
+
+const Backend& VAES256Backend() {
+    static const Backend backend = {
+        "vaes256",
+        AESNIBackend().expandKey,
+        EncryptBlocksVAES256,
+        DecryptBlocksVAES256,
+        AESNIBackend().encryptCBC,
+        AESNIBackend().encryptCFB,
+        CryptCTR32VAES256,
+        MaxCBCLanes,
+        EncryptCBCLanesVAES256,
+        AESNIBackend().encryptBlocksMultiKey,
+        AESNIBackend().decryptBlocksMultiKey,
+    };
+    return backend;
+}
+
+}  // namespace AESEngine
+
+#endif  // AES_X86
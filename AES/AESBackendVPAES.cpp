@@ -0,0 +1,409 @@
+#include "pch.h"
+#include "AESEngine.h"
+
+#ifdef AES_X86
+
+#include <cstring>
+#include <tmmintrin.h>
+
+namespace AESEngine {
+
+namespace {
+
+/// Vector-permute AES in the style of Hamburg's vpaes. The S-box is
+/// evaluated one whole block at a time in a tower-field representation
+/// GF((2^4)^2): a byte is split into two GF(16) nibbles, and every GF(16)
+/// operation becomes a 16-entry PSHUFB lookup held in a register. Nothing
+/// reads memory at a secret-dependent address, and a single block runs at
+/// full speed, which is what the serial CBC/CFB chains need.
+///
+/// GF(16) is GF(2)[x]/(x^4 + x + 1); the tower adds y with
+/// y^2 = y + Lambda. Changing into and out of the tower basis is linear, so
+/// it is two nibble lookups, with the S-box affine map folded into the exit
+/// lookup and the inverse affine map folded into the entry lookup.
+struct Tables {
+    alignas(16) unsigned char inLo[16], inHi[16];        // AES -> tower
+    alignas(16) unsigned char outLo[16], outHi[16];      // tower -> S(x)
+    alignas(16) unsigned char invInLo[16], invInHi[16];  // InvAffine, tower
+    alignas(16) unsigned char invOutLo[16], invOutHi[16];  // tower -> AES
+    alignas(16) unsigned char log[16], exp[16];
+    alignas(16) unsigned char inv[16];
+    alignas(16) unsigned char square[16], lambdaSquare[16];
+};
+
+unsigned char Gf16Mul(unsigned char a, unsigned char b) {
+    unsigned char r = 0;
+    for (int i = 0; i < 4; i++) {
+        if (b & (1 << i)) {
+            r ^= a;
+        }
+        a = (unsigned char)(((a << 1) ^ ((a & 8) ? 0x13 : 0)) & 0x0f);
+    }
+    return r;
+}
+
+unsigned char TowerMul(unsigned char a, unsigned char b, unsigned char lambda) {
+    const unsigned char ah = a >> 4, al = a & 15, bh = b >> 4, bl = b & 15;
+    const unsigned char hh = Gf16Mul(ah, bh);
+    const unsigned char h = hh ^ Gf16Mul(ah, bl) ^ Gf16Mul(al, bh);
+    const unsigned char l = Gf16Mul(al, bl) ^ Gf16Mul(lambda, hh);
+    return (unsigned char)((h << 4) | l);
+}
+
+unsigned char RotL(unsigned char x, int n) {
+    return (unsigned char)((x << n) | (x >> (8 - n)));
+}
+
+// The tables only depend on public constants, so building them with plain
+// lookups leaks nothing.
+Tables BuildTables() {
+    Tables t = {};
+
+    unsigned char lambda = 1;
+    for (; lambda < 16; lambda++) {
+        bool irreducible = true;
+        for (unsigned char a = 0; a < 16; a++) {
+            if ((Gf16Mul(a, a) ^ a) == lambda) {
+                irreducible = false;
+            }
+        }
+        if (irreducible) {
+            break;
+        }
+    }
+
+    // Any root of the AES polynomial z^8 + z^4 + z^3 + z + 1 in the tower
+    // field gives the isomorphism z -> beta.
+    unsigned char beta = 2;
+    for (; beta != 0; beta++) {
+        unsigned char p[9];
+        p[0] = 1;
+        for (int i = 1; i <= 8; i++) {
+            p[i] = TowerMul(p[i - 1], beta, lambda);
+        }
+        if ((p[8] ^ p[4] ^ p[3] ^ p[1] ^ p[0]) == 0) {
+            break;
+        }
+    }
+
+    unsigned char basis[8];
+    basis[0] = 1;
+    for (int i = 1; i < 8; i++) {
+        basis[i] = TowerMul(basis[i - 1], beta, lambda);
+    }
+
+    unsigned char toTower[256], fromTower[256];
+    for (unsigned int x = 0; x < 256; x++) {
+        unsigned char y = 0;
+        for (int i = 0; i < 8; i++) {
+            if (x & (1 << i)) {
+                y ^= basis[i];
+            }
+        }
+        toTower[x] = y;
+        fromTower[y] = (unsigned char)x;
+    }
+
+    for (unsigned int n = 0; n < 16; n++) {
+        const unsigned char lo = (unsigned char)n, hi = (unsigned char)(n << 4);
+        t.inLo[n] = toTower[lo];
+        t.inHi[n] = toTower[hi];
+
+        // S(x) = A(x^-1) ^ 0x63 with A(x) = x ^ rotl 1..4; constant on lo
+        unsigned char a = fromTower[lo];
+        t.outLo[n] = (unsigned char)(a ^ RotL(a, 1) ^ RotL(a, 2) ^ RotL(a, 3) ^
+            RotL(a, 4) ^ 0x63);
+        a = fromTower[hi];
+        t.outHi[n] = (unsigned char)(a ^ RotL(a, 1) ^ RotL(a, 2) ^ RotL(a, 3) ^
+            RotL(a, 4));
+
+        // InvS(y) = (rotl(y,1) ^ rotl(y,3) ^ rotl(y,6) ^ 0x05)^-1
+        t.invInLo[n] = toTower[(unsigned char)(RotL(lo, 1) ^ RotL(lo, 3) ^
+            RotL(lo, 6) ^ 0x05)];
+        t.invInHi[n] = toTower[(unsigned char)(RotL(hi, 1) ^ RotL(hi, 3) ^
+            RotL(hi, 6))];
+        t.invOutLo[n] = fromTower[lo];
+        t.invOutHi[n] = fromTower[hi];
+
+        t.square[n] = Gf16Mul(lo, lo);
+        t.lambdaSquare[n] = Gf16Mul(lambda, t.square[n]);
+        for (unsigned char b = 1; b < 16; b++) {
+            if (Gf16Mul(lo, b) == 1) {
+                t.inv[n] = b;
+            }
+        }
+    }
+
+    // x is a generator of GF(16)*. log(0) is large enough that any sum
+    // involving it saturates with the top bit set, which PSHUFB maps to 0.
+    unsigned char e = 1;
+    for (unsigned char i = 0; i < 15; i++) {
+        t.exp[i] = e;
+        t.log[e] = i;
+        e = Gf16Mul(e, 2);
+    }
+    t.log[0] = 0xf0;
+    return t;
+}
+
+const Tables& GetTables() {
+    static const Tables tables = BuildTables();
+    return tables;
+}
+
+/// Table registers and shuffle masks for one call.
+struct Context {
+    __m128i inLo, inHi, outLo, outHi;
+    __m128i invInLo, invInHi, invOutLo, invOutHi;
+    __m128i log, exp, inv, square, lambdaSquare;
+    __m128i nibble, fifteen, poly;
+    __m128i shiftRows, invShiftRows, rot1, rot2;
+};
+
+AES_TARGET("ssse3")
+Context MakeContext() {
+    const Tables& t = GetTables();
+    Context c;
+    c.inLo = _mm_load_si128((const __m128i*)t.inLo);
+    c.inHi = _mm_load_si128((const __m128i*)t.inHi);
+    c.outLo = _mm_load_si128((const __m128i*)t.outLo);
+    c.outHi = _mm_load_si128((const __m128i*)t.outHi);
+    c.invInLo = _mm_load_si128((const __m128i*)t.invInLo);
+    c.invInHi = _mm_load_si128((const __m128i*)t.invInHi);
+    c.invOutLo = _mm_load_si128((const __m128i*)t.invOutLo);
+    c.invOutHi = _mm_load_si128((const __m128i*)t.invOutHi);
+    c.log = _mm_load_si128((const __m128i*)t.log);
+    c.exp = _mm_load_si128((const __m128i*)t.exp);
+    c.inv = _mm_load_si128((const __m128i*)t.inv);
+    c.square = _mm_load_si128((const __m128i*)t.square);
+    c.lambdaSquare = _mm_load_si128((const __m128i*)t.lambdaSquare);
+    c.nibble = _mm_set1_epi8(0x0f);
+    c.fifteen = _mm_set1_epi8(15);
+    c.poly = _mm_set1_epi8(0x1b);
+
+    // Byte k of the state is column k / 4, row k % 4
+    c.shiftRows = _mm_setr_epi8(0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1,
+        6, 11);
+    c.invShiftRows = _mm_setr_epi8(0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12,
+        9, 6, 3);
+    c.rot1 = _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15,
+        12);
+    c.rot2 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12,
+        13);
+    return c;
+}
+
+// GF(16) product from logs: exp[(la + lb) mod 15]. For sums of real logs
+// min(s, s - 15) is the reduction; a sum involving log(0) keeps its top bit
+// either way, so the lookup yields 0.
+AES_TARGET("ssse3")
+inline __m128i MulLogs(const Context& c, __m128i la, __m128i lb) {
+    const __m128i s = _mm_adds_epu8(la, lb);
+    return _mm_shuffle_epi8(c.exp,
+        _mm_min_epu8(s, _mm_sub_epi8(s, c.fifteen)));
+}
+
+// Inverts every byte of a tower-basis vector:
+// (ah y + al)^-1 = (ah d^-1) y + (ah + al) d^-1,
+// d = Lambda ah^2 + ah al + al^2
+AES_TARGET("ssse3")
+inline void TowerInvert(const Context& c, __m128i t, __m128i& nh, __m128i& nl) {
+    const __m128i ah = _mm_and_si128(_mm_srli_epi16(t, 4), c.nibble);
+    const __m128i al = _mm_and_si128(t, c.nibble);
+    const __m128i logAh = _mm_shuffle_epi8(c.log, ah);
+    const __m128i d = _mm_xor_si128(
+        _mm_xor_si128(_mm_shuffle_epi8(c.lambdaSquare, ah),
+            _mm_shuffle_epi8(c.square, al)),
+        MulLogs(c, logAh, _mm_shuffle_epi8(c.log, al)));
+    const __m128i logDinv = _mm_shuffle_epi8(c.log, _mm_shuffle_epi8(c.inv, d));
+    nh = MulLogs(c, logAh, logDinv);
+    nl = MulLogs(c, _mm_shuffle_epi8(c.log, _mm_xor_si128(ah, al)), logDinv);
+}
+
+AES_TARGET("ssse3")
+inline __m128i SubBytes(const Context& c, __m128i x) {
+    const __m128i t = _mm_xor_si128(
+        _mm_shuffle_epi8(c.inLo, _mm_and_si128(x, c.nibble)),
+        _mm_shuffle_epi8(c.inHi, _mm_and_si128(_mm_srli_epi16(x, 4), c.nibble)));
+    __m128i nh, nl;
+    TowerInvert(c, t, nh, nl);
+    return _mm_xor_si128(_mm_shuffle_epi8(c.outLo, nl),
+        _mm_shuffle_epi8(c.outHi, nh));
+}
+
+AES_TARGET("ssse3")
+inline __m128i InvSubBytes(const Context& c, __m128i x) {
+    const __m128i t = _mm_xor_si128(
+        _mm_shuffle_epi8(c.invInLo, _mm_and_si128(x, c.nibble)),
+        _mm_shuffle_epi8(c.invInHi,
+            _mm_and_si128(_mm_srli_epi16(x, 4), c.nibble)));
+    __m128i nh, nl;
+    TowerInvert(c, t, nh, nl);
+    return _mm_xor_si128(_mm_shuffle_epi8(c.invOutLo, nl),
+        _mm_shuffle_epi8(c.invOutHi, nh));
+}
+
+AES_TARGET("ssse3")
+inline __m128i Xtime(const Context& c, __m128i x) {
+    const __m128i carry = _mm_cmpgt_epi8(_mm_setzero_si128(), x);
+    return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(carry, c.poly));
+}
+
+// out = 2a0 ^ 3a1 ^ a2 ^ a3 = xtime(a0 ^ a1) ^ a1 ^ (a2 ^ a3)
+AES_TARGET("ssse3")
+inline __m128i MixColumns(const Context& c, __m128i x) {
+    const __m128i r1 = _mm_shuffle_epi8(x, c.rot1);
+    const __m128i t = _mm_xor_si128(x, r1);
+    return _mm_xor_si128(_mm_xor_si128(Xtime(c, t), r1),
+        _mm_shuffle_epi8(t, c.rot2));
+}
+
+// InvMixColumns = MixColumns after adding 4 * (a_r ^ a_{r+2}) to each row
+AES_TARGET("ssse3")
+inline __m128i InvMixColumns(const Context& c, __m128i x) {
+    const __m128i t = _mm_xor_si128(x, _mm_shuffle_epi8(x, c.rot2));
+    return MixColumns(c, _mm_xor_si128(x, Xtime(c, Xtime(c, t))));
+}
+
+AES_TARGET("ssse3")
+inline __m128i Encrypt1(const Context& c, const __m128i* k, unsigned int Nr,
+    __m128i b) {
+    b = _mm_xor_si128(b, k[0]);
+    for (unsigned int round = 1; round < Nr; round++) {
+        b = SubBytes(c, b);
+        b = _mm_shuffle_epi8(b, c.shiftRows);
+        b = _mm_xor_si128(MixColumns(c, b), k[round]);
+    }
+    b = _mm_shuffle_epi8(SubBytes(c, b), c.shiftRows);
+    return _mm_xor_si128(b, k[Nr]);
+}
+
+// Equivalent inverse cipher over the decryption schedule
+AES_TARGET("ssse3")
+inline __m128i Decrypt1(const Context& c, const __m128i* k, unsigned int Nr,
+    __m128i b) {
+    b = _mm_xor_si128(b, k[0]);
+    for (unsigned int round = 1; round < Nr; round++) {
+        b = InvSubBytes(c, b);
+        b = _mm_shuffle_epi8(b, c.invShiftRows);
+        b = _mm_xor_si128(InvMixColumns(c, b), k[round]);
+    }
+    b = _mm_shuffle_epi8(InvSubBytes(c, b), c.invShiftRows);
+    return _mm_xor_si128(b, k[Nr]);
+}
+
+AES_TARGET("ssse3")
+void ExpandKeyVPAES(const unsigned char key[], unsigned int Nk,
+    AESRoundKeys& rk) {
+    const Context c = MakeContext();
+    const unsigned int Nr = Nk + 6;
+    const unsigned int words = 4 * (Nr + 1);
+    uint32_t w[4 * (MaxRounds + 1)];
+    uint32_t rcon = 1;
+
+    rk.Nr = Nr;
+    memcpy(w, key, 4 * Nk);
+    for (unsigned int i = Nk; i < words; i++) {
+        uint32_t temp = w[i - 1];
+        if (i % Nk == 0) {
+            temp = (temp >> 8) | (temp << 24);
+        }
+        if (i % Nk == 0 || (Nk > 6 && i % Nk == 4)) {
+            temp = (uint32_t)_mm_cvtsi128_si32(
+                SubBytes(c, _mm_cvtsi32_si128((int)temp)));
+        }
+        if (i % Nk == 0) {
+            temp ^= rcon;
+            rcon = (rcon << 1) ^ ((rcon >> 7) * 0x11b);
+        }
+        w[i] = w[i - Nk] ^ temp;
+    }
+    memcpy(rk.enc, w, 4 * words);
+
+    const __m128i* enc = (const __m128i*)rk.enc;
+    __m128i* dec = (__m128i*)rk.dec;
+    dec[0] = enc[Nr];
+    for (unsigned int round = 1; round < Nr; round++) {
+        dec[round] = InvMixColumns(c, enc[Nr - round]);
+    }
+    dec[Nr] = enc[0];
+}
+
+AES_TARGET("ssse3")
+void EncryptBlocksVPAES(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    const Context c = MakeContext();
+    const __m128i* k = (const __m128i*)rk.enc;
+    for (size_t i = 0; i < blocks; i++) {
+        const __m128i b = _mm_loadu_si128((const __m128i*)(in + i * BlockBytes));
+        _mm_storeu_si128((__m128i*)(out + i * BlockBytes),
+            Encrypt1(c, k, rk.Nr, b));
+    }
+}
+
+AES_TARGET("ssse3")
+void DecryptBlocksVPAES(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    const Context c = MakeContext();
+    const __m128i* k = (const __m128i*)rk.dec;
+    for (size_t i = 0; i < blocks; i++) {
+        const __m128i b = _mm_loadu_si128((const __m128i*)(in + i * BlockBytes));
+        _mm_storeu_si128((__m128i*)(out + i * BlockBytes),
+            Decrypt1(c, k, rk.Nr, b));
+    }
+}
+
+AES_TARGET("ssse3")
+void EncryptCBCVPAES(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    const Context c = MakeContext();
+    const __m128i* k = (const __m128i*)rk.enc;
+    __m128i chain = _mm_loadu_si128((const __m128i*)iv);
+    for (size_t i = 0; i < blocks; i++) {
+        chain = _mm_xor_si128(chain, _mm_loadu_si128((const __m128i*)in));
+        chain = Encrypt1(c, k, rk.Nr, chain);
+        _mm_storeu_si128((__m128i*)out, chain);
+        in += BlockBytes;
+        out += BlockBytes;
+    }
+    _mm_storeu_si128((__m128i*)iv, chain);
+}
+
+AES_TARGET("ssse3")
+void EncryptCFBVPAES(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    const Context c = MakeContext();
+    const __m128i* k = (const __m128i*)rk.enc;
+    __m128i chain = _mm_loadu_si128((const __m128i*)iv);
+    for (size_t i = 0; i < blocks; i++) {
+        chain = Encrypt1(c, k, rk.Nr, chain);
+        chain = _mm_xor_si128(chain, _mm_loadu_si128((const __m128i*)in));
+        _mm_storeu_si128((__m128i*)out, chain);
+        in += BlockBytes;
+        out += BlockBytes;
+    }
+    _mm_storeu_si128((__m128i*)iv, chain);
+}
+
+}  // namespace
+
+const Backend& VPAESBackend() {
+    static const Backend backend = {
+        "vpaes",
+        ExpandKeyVPAES,
+        EncryptBlocksVPAES,
+        DecryptBlocksVPAES,
+        EncryptCBCVPAES,
+        EncryptCFBVPAES,
+        nullptr,
+        0,
+        nullptr,
+        nullptr,
+        nullptr,
+    };
+    return backend;
+}
+
+}  // namespace AESEngine
+
+#endif  // AES_X86
@@ -0,0 +1,606 @@
+#include "pch.h"
+#include "AESContainer.h"
+#include "AESParallel.h"
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+
+static constexpr unsigned char HeaderMagic[4] = { 'A', 'E', 'S', 'C' };
+static constexpr unsigned char FooterMagic[4] = { 'A', 'E', 'S', 'I' };
+static constexpr unsigned char FormatVersion = 1;
+static constexpr unsigned char AlgorithmGCM = 1;
+
+static constexpr size_t TagBytes = 16;
+static constexpr size_t LengthBytes = 4;       // plaintext length before each chunk
+static constexpr size_t IndexEntryBytes = 12;
+static constexpr size_t FooterBytes = 44;
+static constexpr size_t FooterSealedBytes = 24;  // count, length, index offset
+static constexpr size_t AADBytes = AESContainerHeader::Bytes + 8 + 4;
+
+// Chunks sealed or opened per parallel batch: enough work to spread over
+// the pool, little enough to keep a stream's memory flat
+static constexpr size_t BatchBytes = 8 << 20;
+
+// The number the index is sealed under; no chunk can have it
+static constexpr unsigned long long IndexChunk = ~0ull;
+
+void StoreLE32(unsigned char* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+void StoreLE64(unsigned char* p, unsigned long long v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+uint32_t LoadLE32(const unsigned char* p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+unsigned long long LoadLE64(const unsigned char* p) {
+    unsigned long long v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+size_t SlotBytes(const AESContainerHeader& header) {
+    return LengthBytes + header.chunkBytes + TagBytes;
+}
+
+size_t BatchChunks(const AESContainerHeader& header) {
+    const size_t chunks = BatchBytes / header.chunkBytes;
+    return chunks > 0 ? chunks : 1;
+}
+
+unsigned long long ChunkOffset(const AESContainerHeader& header,
+    unsigned long long index) {
+    return AESContainerHeader::Bytes + index * SlotBytes(header);
+}
+
+void EncodeHeader(const AESContainerHeader& header,
+    unsigned char out[AESContainerHeader::Bytes]) {
+    memset(out, 0, AESContainerHeader::Bytes);
+    memcpy(out, HeaderMagic, sizeof(HeaderMagic));
+    out[4] = FormatVersion;
+    out[5] = AlgorithmGCM;
+    out[6] = (unsigned char)AESKey::KeyBytesFor(header.keyLength);
+    StoreLE32(out + 8, header.chunkBytes);
+    memcpy(out + 12, header.keyId, AESContainerHeader::KeyIdBytes);
+    memcpy(out + 28, header.nonce, AESContainerHeader::NonceBytes);
+}
+
+AESContainerHeader DecodeHeader(const unsigned char in[AESContainerHeader::Bytes]) {
+    if (memcmp(in, HeaderMagic, sizeof(HeaderMagic)) != 0) {
+        throw std::runtime_error("Not an AES container");
+    }
+    if (in[4] != FormatVersion || in[5] != AlgorithmGCM) {
+        throw std::runtime_error("Unsupported container version");
+    }
+    AESContainerHeader header;
+    header.keyLength = AESKey::KeyLengthForBytes(in[6]);
+    header.chunkBytes = LoadLE32(in + 8);
+    if (header.chunkBytes < AESContainerHeader::MinChunkBytes ||
+        header.chunkBytes > AESContainerHeader::MaxChunkBytes) {
+        throw std::runtime_error("Container chunk size is invalid");
+    }
+    memcpy(header.keyId, in + 12, AESContainerHeader::KeyIdBytes);
+    memcpy(header.nonce, in + 28, AESContainerHeader::NonceBytes);
+    return header;
+}
+
+void CheckKey(const AESContainerHeader& header, const AESKey& key) {
+    if (key.GetKeyLength() != header.keyLength) {
+        throw std::invalid_argument("Key does not match the container");
+    }
+}
+
+// The header nonce with the chunk number XORed into its last 8 bytes
+void ChunkNonce(const AESContainerHeader& header, unsigned long long index,
+    unsigned char nonce[AESContainerHeader::NonceBytes]) {
+    memcpy(nonce, header.nonce, AESContainerHeader::NonceBytes);
+    for (int i = 0; i < 8; i++) {
+        nonce[AESContainerHeader::NonceBytes - 1 - i] ^=
+            (unsigned char)(index >> (8 * i));
+    }
+}
+
+void ChunkAAD(const unsigned char headerBytes[], unsigned long long index,
+    size_t len, unsigned char aad[AADBytes]) {
+    memcpy(aad, headerBytes, AESContainerHeader::Bytes);
+    StoreLE64(aad + AESContainerHeader::Bytes, index);
+    StoreLE32(aad + AESContainerHeader::Bytes + 8, (uint32_t)len);
+}
+
+// Writes chunk `index` holding `len` bytes of `in` as length, ciphertext
+// and tag
+void SealChunk(const AESKey& key, const AESContainerHeader& header,
+    const unsigned char headerBytes[], unsigned long long index,
+    const unsigned char* in, size_t len, unsigned char* slot) {
+    unsigned char nonce[AESContainerHeader::NonceBytes];
+    unsigned char aad[AADBytes];
+    ChunkNonce(header, index, nonce);
+    ChunkAAD(headerBytes, index, len, aad);
+    StoreLE32(slot, (uint32_t)len);
+    key.EncryptGCM(in, slot + LengthBytes, len, nonce, sizeof(nonce), aad,
+        sizeof(aad), slot + LengthBytes + len, TagBytes);
+}
+
+// The reverse of SealChunk for a chunk the index says holds `len` bytes
+void OpenChunk(const AESKey& key, const AESContainerHeader& header,
+    const unsigned char headerBytes[], unsigned long long index,
+    const unsigned char* slot, size_t len, unsigned char* out) {
+    if (LoadLE32(slot) != len) {
+        throw std::runtime_error("Container chunk " + std::to_string(index) +
+            " has the wrong length");
+    }
+    unsigned char nonce[AESContainerHeader::NonceBytes];
+    unsigned char aad[AADBytes];
+    ChunkNonce(header, index, nonce);
+    ChunkAAD(headerBytes, index, len, aad);
+    if (!key.DecryptGCM(slot + LengthBytes, out, len, nonce, sizeof(nonce),
+        aad, sizeof(aad), slot + LengthBytes + len, TagBytes)) {
+        throw std::runtime_error("Container chunk " + std::to_string(index) +
+            " failed authentication");
+    }
+}
+
+// Seals (or, with `check`, verifies) the index: an empty chunk numbered
+// IndexChunk over the header, the index entries and the start of the footer
+bool IndexTag(const AESKey& key, const AESContainerHeader& header,
+    const unsigned char headerBytes[], const std::vector<unsigned char>& index,
+    const unsigned char footer[], unsigned char tag[TagBytes], bool check) {
+    std::vector<unsigned char> aad(headerBytes,
+        headerBytes + AESContainerHeader::Bytes);
+    aad.insert(aad.end(), index.begin(), index.end());
+    aad.insert(aad.end(), footer, footer + FooterSealedBytes);
+
+    unsigned char nonce[AESContainerHeader::NonceBytes];
+    ChunkNonce(header, IndexChunk, nonce);
+    unsigned char none[1] = {};
+    if (check) {
+        return key.DecryptGCM(none, none, 0, nonce, sizeof(nonce), aad.data(),
+            aad.size(), tag, TagBytes);
+    }
+    key.EncryptGCM(none, none, 0, nonce, sizeof(nonce), aad.data(),
+        aad.size(), tag, TagBytes);
+    return true;
+}
+
+void AddIndexEntry(std::vector<unsigned char>& index,
+    unsigned long long offset, size_t len) {
+    unsigned char entry[IndexEntryBytes];
+    StoreLE64(entry, offset);
+    StoreLE32(entry + 8, (uint32_t)len);
+    index.insert(index.end(), entry, entry + IndexEntryBytes);
+}
+
+void EncodeFooter(unsigned long long chunks, unsigned long long length,
+    unsigned long long indexOffset, unsigned char footer[FooterBytes]) {
+    StoreLE64(footer, chunks);
+    StoreLE64(footer + 8, length);
+    StoreLE64(footer + 16, indexOffset);
+    memcpy(footer + FooterSealedBytes + TagBytes, FooterMagic,
+        sizeof(FooterMagic));
+}
+
+void ReadFull(AESContainerSource& source, unsigned char* data, size_t len) {
+    if (source.Read(data, len) != len) {
+        throw std::runtime_error("Container is truncated");
+    }
+}
+
+}  // namespace
+
+struct AESContainerWriter::State {
+    AESContainerSink& sink;
+    AESKey key;
+    AESContainerHeader header;
+    unsigned char headerBytes[AESContainerHeader::Bytes];
+    std::vector<unsigned char> pending;  // plaintext not sealed yet
+    std::vector<unsigned char> sealed;
+    std::vector<unsigned char> index;
+    unsigned long long offset;           // bytes handed to the sink
+    unsigned long long chunks;
+    unsigned long long length;
+    bool finished;
+
+    State(AESContainerSink& sink, const AESKey& key)
+        : sink(sink), key(key), header(), headerBytes(), offset(0), chunks(0),
+          length(0), finished(false) {
+    }
+};
+
+AESContainerWriter::AESContainerWriter(AESContainerSink& sink,
+    const AESKey& key, const unsigned char keyId[], unsigned int chunkBytes)
+    : state(nullptr) {
+    if (chunkBytes < AESContainerHeader::MinChunkBytes ||
+        chunkBytes > AESContainerHeader::MaxChunkBytes) {
+        throw std::invalid_argument("Container chunk size must be 16 bytes to 256 MiB");
+    }
+    std::unique_ptr<State> s(new State(sink, key));
+    s->header.keyLength = key.GetKeyLength();
+    s->header.chunkBytes = chunkBytes;
+    if (keyId != nullptr) {
+        memcpy(s->header.keyId, keyId, AESContainerHeader::KeyIdBytes);
+    }
+    std::random_device random;
+    for (size_t i = 0; i < AESContainerHeader::NonceBytes; i += 4) {
+        StoreLE32(s->header.nonce + i, random());
+    }
+    EncodeHeader(s->header, s->headerBytes);
+    s->pending.reserve(BatchChunks(s->header) * chunkBytes);
+
+    sink.Write(s->headerBytes, AESContainerHeader::Bytes);
+    s->offset = AESContainerHeader::Bytes;
+    state = s.release();
+}
+
+AESContainerWriter::~AESContainerWriter() {
+    delete state;
+}
+
+const AESContainerHeader& AESContainerWriter::Header() const {
+    return state->header;
+}
+
+// Seals the whole chunks in `pending`, plus the short final chunk when
+// `final` is set, across the pool and appends them to the sink in order
+void AESContainerWriter::SealPending(bool final) {
+    State& s = *state;
+    const size_t chunkBytes = s.header.chunkBytes;
+    const size_t slotBytes = SlotBytes(s.header);
+    const size_t full = s.pending.size() / chunkBytes;
+    const size_t rest = s.pending.size() - full * chunkBytes;
+    const size_t count = full + (final ? 1 : 0);
+
+    s.sealed.resize(full * slotBytes +
+        (final ? LengthBytes + rest + TagBytes : 0));
+    AESEngine::ParallelFor(count, chunkBytes, [&](size_t first, size_t n) {
+        for (size_t i = first; i < first + n; i++) {
+            const size_t len = i < full ? chunkBytes : rest;
+            SealChunk(s.key, s.header, s.headerBytes, s.chunks + i,
+                s.pending.data() + i * chunkBytes, len,
+                s.sealed.data() + i * slotBytes);
+        }
+    });
+    for (size_t i = 0; i < count; i++) {
+        AddIndexEntry(s.index, s.offset + i * slotBytes,
+            i < full ? chunkBytes : rest);
+    }
+
+    s.sink.Write(s.sealed.data(), s.sealed.size());
+    s.offset += s.sealed.size();
+    s.chunks += count;
+    s.length += s.pending.size();
+    s.pending.clear();
+}
+
+void AESContainerWriter::Write(const unsigned char data[], size_t len) {
+    State& s = *state;
+    if (s.finished) {
+        throw std::runtime_error("Container is already finished");
+    }
+    // Full chunks are never the final one, so a full batch can be sealed
+    // as soon as it is complete
+    const size_t capacity = BatchChunks(s.header) * s.header.chunkBytes;
+    while (len > 0) {
+        const size_t take = len < capacity - s.pending.size()
+            ? len : capacity - s.pending.size();
+        s.pending.insert(s.pending.end(), data, data + take);
+        data += take;
+        len -= take;
+        if (s.pending.size() == capacity) {
+            SealPending(false);
+        }
+    }
+}
+
+void AESContainerWriter::Finish() {
+    State& s = *state;
+    if (s.finished) {
+        return;
+    }
+    SealPending(true);
+
+    unsigned char footer[FooterBytes];
+    EncodeFooter(s.chunks, s.length, s.offset, footer);
+    IndexTag(s.key, s.header, s.headerBytes, s.index, footer,
+        footer + FooterSealedBytes, false);
+    s.sink.Write(s.index.data(), s.index.size());
+    s.sink.Write(footer, FooterBytes);
+    s.finished = true;
+}
+
+struct AESContainerReader::State {
+    const AESContainerRandomSource& source;
+    AESKey key;
+    AESContainerHeader header;
+    unsigned char headerBytes[AESContainerHeader::Bytes];
+    unsigned long long chunks;
+    unsigned long long length;
+    size_t lastBytes;  // length of the final chunk, the only short one
+
+    State(const AESContainerRandomSource& source, const AESKey& key)
+        : source(source), key(key), header(), headerBytes(), chunks(0),
+          length(0), lastBytes(0) {
+    }
+
+    size_t ChunkBytes(unsigned long long index) const {
+        return index + 1 == chunks ? lastBytes : header.chunkBytes;
+    }
+};
+
+AESContainerHeader AESContainerReader::ReadHeader(
+    const AESContainerRandomSource& source) {
+    unsigned char bytes[AESContainerHeader::Bytes];
+    source.ReadAt(0, bytes, sizeof(bytes));
+    return DecodeHeader(bytes);
+}
+
+AESContainerReader::AESContainerReader(const AESContainerRandomSource& source,
+    const AESKey& key)
+    : state(nullptr) {
+    std::unique_ptr<State> s(new State(source, key));
+    const unsigned long long size = source.Size();
+    if (size < AESContainerHeader::Bytes + FooterBytes) {
+        throw std::runtime_error("Container is truncated");
+    }
+    source.ReadAt(0, s->headerBytes, AESContainerHeader::Bytes);
+    s->header = DecodeHeader(s->headerBytes);
+    CheckKey(s->header, key);
+
+    unsigned char footer[FooterBytes];
+    source.ReadAt(size - FooterBytes, footer, FooterBytes);
+    if (memcmp(footer + FooterSealedBytes + TagBytes, FooterMagic,
+        sizeof(FooterMagic)) != 0) {
+        throw std::runtime_error("Container is truncated or has no index");
+    }
+    const unsigned long long chunks = LoadLE64(footer);
+    const unsigned long long length = LoadLE64(footer + 8);
+    const unsigned long long indexOffset = LoadLE64(footer + 16);
+    const unsigned long long slotBytes = SlotBytes(s->header);
+    if (chunks == 0 || chunks > size / slotBytes + 1 ||
+        indexOffset + chunks * IndexEntryBytes + FooterBytes != size) {
+        throw std::runtime_error("Container index is malformed");
+    }
+
+    std::vector<unsigned char> index((size_t)(chunks * IndexEntryBytes));
+    source.ReadAt(indexOffset, index.data(), index.size());
+    if (!IndexTag(key, s->header, s->headerBytes, index, footer,
+        footer + FooterSealedBytes, true)) {
+        throw std::runtime_error("Container index failed authentication");
+    }
+
+    // The layout is fixed by the chunk size; an index that disagrees was
+    // not written by AESContainerWriter
+    s->chunks = chunks;
+    s->lastBytes = LoadLE32(index.data() + index.size() - IndexEntryBytes + 8);
+    s->length = length;
+    for (unsigned long long i = 0; i < chunks; i++) {
+        const unsigned char* entry = index.data() + i * IndexEntryBytes;
+        if (LoadLE64(entry) != ChunkOffset(s->header, i) ||
+            LoadLE32(entry + 8) != s->ChunkBytes(i)) {
+            throw std::runtime_error("Container index is malformed");
+        }
+    }
+    if (s->lastBytes >= s->header.chunkBytes ||
+        (chunks - 1) * s->header.chunkBytes + s->lastBytes != length ||
+        ChunkOffset(s->header, chunks - 1) + LengthBytes + s->lastBytes +
+            TagBytes != indexOffset) {
+        throw std::runtime_error("Container index is malformed");
+    }
+    state = s.release();
+}
+
+AESContainerReader::~AESContainerReader() {
+    delete state;
+}
+
+const AESContainerHeader& AESContainerReader::Header() const {
+    return state->header;
+}
+
+unsigned long long AESContainerReader::Length() const {
+    return state->length;
+}
+
+unsigned long long AESContainerReader::ChunkCount() const {
+    return state->chunks;
+}
+
+size_t AESContainerReader::ReadChunk(unsigned long long index,
+    unsigned char out[]) const {
+    const State& s = *state;
+    if (index >= s.chunks) {
+        throw std::out_of_range("Container has no chunk " +
+            std::to_string(index));
+    }
+    const size_t len = s.ChunkBytes(index);
+    std::vector<unsigned char> slot(LengthBytes + len + TagBytes);
+    s.source.ReadAt(ChunkOffset(s.header, index), slot.data(), slot.size());
+    OpenChunk(s.key, s.header, s.headerBytes, index, slot.data(), len, out);
+    return len;
+}
+
+void AESContainerReader::Read(unsigned long long offset, unsigned char out[],
+    size_t len) const {
+    const State& s = *state;
+    if (offset > s.length || len > s.length - offset) {
+        throw std::out_of_range("Range is outside the container");
+    }
+    if (len == 0) {
+        return;
+    }
+    const unsigned long long chunkBytes = s.header.chunkBytes;
+    const unsigned long long firstChunk = offset / chunkBytes;
+    const size_t count = (size_t)((offset + len - 1) / chunkBytes - firstChunk + 1);
+
+    AESEngine::ParallelFor(count, s.header.chunkBytes,
+        [&](size_t first, size_t n) {
+            std::vector<unsigned char> slot(SlotBytes(s.header));
+            std::vector<unsigned char> plain;
+            for (size_t i = first; i < first + n; i++) {
+                const unsigned long long chunk = firstChunk + i;
+                const unsigned long long start = chunk * chunkBytes;
+                const size_t bytes = s.ChunkBytes(chunk);
+                s.source.ReadAt(ChunkOffset(s.header, chunk), slot.data(),
+                    LengthBytes + bytes + TagBytes);
+
+                // Chunks wholly inside the range decrypt straight into `out`
+                const unsigned long long from = offset > start ? offset : start;
+                const unsigned long long to = offset + len < start + bytes
+                    ? offset + len : start + bytes;
+                if (from == start && to == start + bytes) {
+                    OpenChunk(s.key, s.header, s.headerBytes, chunk,
+                        slot.data(), bytes, out + (start - offset));
+                    continue;
+                }
+                plain.resize(bytes);
+                OpenChunk(s.key, s.header, s.headerBytes, chunk, slot.data(),
+                    bytes, plain.data());
+                memcpy(out + (from - offset), plain.data() + (from - start),
+                    (size_t)(to - from));
+            }
+        });
+}
+
+struct AESContainerStreamReader::State {
+    AESContainerSource& source;
+    AESKey key;
+    AESContainerHeader header;
+    unsigned char headerBytes[AESContainerHeader::Bytes];
+    std::vector<unsigned char> slots;   // sealed chunks of the current batch
+    std::vector<unsigned char> plain;   // and their plaintext
+    size_t plainPos;
+    std::vector<unsigned char> index;   // the index the chunks read imply
+    unsigned long long offset;          // bytes consumed from the source
+    unsigned long long chunks;
+    unsigned long long length;
+    bool sawFinal;
+    bool done;
+
+    State(AESContainerSource& source, const AESKey& key)
+        : source(source), key(key), header(), headerBytes(), plainPos(0),
+          offset(0), chunks(0), length(0), sawFinal(false), done(false) {
+    }
+};
+
+AESContainerStreamReader::AESContainerStreamReader(AESContainerSource& source,
+    const AESKey& key)
+    : state(nullptr) {
+    std::unique_ptr<State> s(new State(source, key));
+    ReadFull(source, s->headerBytes, AESContainerHeader::Bytes);
+    s->header = DecodeHeader(s->headerBytes);
+    CheckKey(s->header, key);
+    s->offset = AESContainerHeader::Bytes;
+    state = s.release();
+}
+
+AESContainerStreamReader::~AESContainerStreamReader() {
+    delete state;
+}
+
+const AESContainerHeader& AESContainerStreamReader::Header() const {
+    return state->header;
+}
+
+// Reads and opens the next batch of chunks, or once the final chunk has
+// been seen, checks the index and footer against what was read
+void AESContainerStreamReader::Fill() {
+    State& s = *state;
+    s.plain.clear();
+    s.plainPos = 0;
+
+    if (s.sawFinal) {
+        std::vector<unsigned char> index(s.index.size());
+        unsigned char footer[FooterBytes];
+        ReadFull(s.source, index.data(), index.size());
+        ReadFull(s.source, footer, FooterBytes);
+        unsigned char expected[FooterBytes];
+        EncodeFooter(s.chunks, s.length, s.offset, expected);
+        if (index != s.index ||
+            memcmp(footer, expected, FooterSealedBytes) != 0 ||
+            memcmp(footer + FooterSealedBytes + TagBytes,
+                expected + FooterSealedBytes + TagBytes,
+                sizeof(FooterMagic)) != 0) {
+            throw std::runtime_error("Container index is malformed");
+        }
+        if (!IndexTag(s.key, s.header, s.headerBytes, index, footer,
+            footer + FooterSealedBytes, true)) {
+            throw std::runtime_error("Container index failed authentication");
+        }
+        unsigned char extra;
+        if (s.source.Read(&extra, 1) != 0) {
+            throw std::runtime_error("Unexpected data after the container");
+        }
+        s.done = true;
+        return;
+    }
+
+    // Read slots up to a batch or the final chunk, whichever comes first
+    const size_t chunkBytes = s.header.chunkBytes;
+    const size_t slotBytes = SlotBytes(s.header);
+    const size_t batch = BatchChunks(s.header);
+    s.slots.resize(batch * slotBytes);
+    size_t count = 0;
+    size_t lastBytes = chunkBytes;
+    while (count < batch && !s.sawFinal) {
+        unsigned char* slot = s.slots.data() + count * slotBytes;
+        ReadFull(s.source, slot, LengthBytes);
+        const size_t len = LoadLE32(slot);
+        if (len > chunkBytes) {
+            throw std::runtime_error("Container chunk " +
+                std::to_string(s.chunks + count) + " has the wrong length");
+        }
+        ReadFull(s.source, slot + LengthBytes, len + TagBytes);
+        AddIndexEntry(s.index, s.offset, len);
+        s.offset += LengthBytes + len + TagBytes;
+        s.sawFinal = len < chunkBytes;
+        lastBytes = len;
+        count++;
+    }
+
+    const size_t total = (count - 1) * chunkBytes + lastBytes;
+    s.plain.resize(total);
+    AESEngine::ParallelFor(count, chunkBytes, [&](size_t first, size_t n) {
+        for (size_t i = first; i < first + n; i++) {
+            const size_t len = i + 1 == count ? lastBytes : chunkBytes;
+            OpenChunk(s.key, s.header, s.headerBytes, s.chunks + i,
+                s.slots.data() + i * slotBytes, len,
+                s.plain.data() + i * chunkBytes);
+        }
+    });
+    s.chunks += count;
+    s.length += total;
+}
+
+size_t AESContainerStreamReader::Read(unsigned char out[], size_t len) {
+    State& s = *state;
+    size_t written = 0;
+    while (written < len) {
+        if (s.plainPos == s.plain.size()) {
+            if (s.done) {
+                break;
+            }
+            Fill();
+            continue;
+        }
+        const size_t take = len - written < s.plain.size() - s.plainPos
+            ? len - written : s.plain.size() - s.plainPos;
+        memcpy(out + written, s.plain.data() + s.plainPos, take);
+        s.plainPos += take;
+        written += take;
+    }
+    return written;
+}
@@ -0,0 +1,239 @@
+// AESContainer.h : Chunked, authenticated file format for large objects.
+#pragma once
+#ifndef _AES_CONTAINER_H_
+#define _AES_CONTAINER_H_
+
+#include "AESKey.h"
+#include <fstream>
+#include <mutex>
+
+/// Container layout, all integers little-endian:
+///
+///   header  48 bytes: "AESC", version (1), algorithm (1 = AES-GCM), key
+///           size in bytes, 0, chunk size (u32), key id (16 bytes),
+///           nonce (12 bytes), 8 zero bytes
+///   chunk   plaintext length (u32), ciphertext, 16-byte GCM tag
+///   ...
+///   index   per chunk: file offset (u64), plaintext length (u32)
+///   footer  44 bytes: chunk count (u64), plaintext length (u64), index
+///           offset (u64), index tag (16 bytes), "AESI"
+///
+/// Chunk i is sealed on its own under the header nonce with i XORed into
+/// its last 8 bytes (big-endian), and with the header, i and the chunk's
+/// length as additional data, so chunks cannot be moved, swapped between
+/// files or resized. Every chunk but the last holds exactly the chunk size
+/// and the last holds less, possibly nothing: a file cut at a chunk
+/// boundary is missing its final chunk. The index and footer are sealed
+/// the same way as an empty chunk numbered 2^64 - 1.
+struct AESContainerHeader {
+    static constexpr size_t Bytes = 48;
+    static constexpr size_t KeyIdBytes = 16;
+    static constexpr size_t NonceBytes = 12;
+    static constexpr unsigned int MinChunkBytes = 16;
+    static constexpr unsigned int MaxChunkBytes = 1u << 28;
+    static constexpr unsigned int DefaultChunkBytes = 64 * 1024;
+
+    AESKeyLength keyLength;
+    unsigned int chunkBytes;
+    unsigned char keyId[KeyIdBytes];
+    unsigned char nonce[NonceBytes];
+};
+
+/// Where AESContainerWriter puts a container. Bytes are only ever appended,
+/// so a pipe or socket works as well as a file. Write throws on failure.
+class AES_API AESContainerSink {
+public:
+    virtual ~AESContainerSink() = default;
+    virtual void Write(const unsigned char data[], size_t len) = 0;
+};
+
+/// Sequential input of AESContainerStreamReader. Read returns the number of
+/// bytes read, fewer than `len` only at the end of the input.
+class AES_API AESContainerSource {
+public:
+    virtual ~AESContainerSource() = default;
+    virtual size_t Read(unsigned char data[], size_t len) = 0;
+};
+
+/// Random-access input of AESContainerReader. ReadAt must be callable from
+/// several threads at once and throws if the bytes are not all there.
+class AES_API AESContainerRandomSource {
+public:
+    virtual ~AESContainerRandomSource() = default;
+    virtual unsigned long long Size() const = 0;
+    virtual void ReadAt(unsigned long long offset, unsigned char data[],
+        size_t len) const = 0;
+};
+
+/// A file opened for writing as a container sink.
+class AESFileSink : public AESContainerSink {
+private:
+    std::ofstream file;
+
+public:
+    explicit AESFileSink(const char* path)
+        : file(path, std::ios::binary | std::ios::trunc) {
+        if (!file) {
+            throw std::runtime_error("Cannot create " + std::string(path));
+        }
+    }
+
+    void Write(const unsigned char data[], size_t len) override {
+        if (!file.write((const char*)data, (std::streamsize)len)) {
+            throw std::runtime_error("Container write failed");
+        }
+    }
+
+    void Close() {
+        file.close();
+        if (file.fail()) {
+            throw std::runtime_error("Container write failed");
+        }
+    }
+};
+
+/// A file opened for reading, either front to back or at random offsets.
+/// Random reads from several threads take turns on the one file handle.
+class AESFileSource : public AESContainerSource,
+                      public AESContainerRandomSource {
+private:
+    mutable std::ifstream file;
+    mutable std::mutex mutex;
+    unsigned long long size;
+
+public:
+    explicit AESFileSource(const char* path)
+        : file(path, std::ios::binary | std::ios::ate), size(0) {
+        if (!file) {
+            throw std::runtime_error("Cannot open " + std::string(path));
+        }
+        size = (unsigned long long)file.tellg();
+        file.seekg(0);
+    }
+
+    size_t Read(unsigned char data[], size_t len) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        file.read((char*)data, (std::streamsize)len);
+        const size_t got = (size_t)file.gcount();
+        if (got < len) {
+            file.clear();
+        }
+        return got;
+    }
+
+    unsigned long long Size() const override {
+        return size;
+    }
+
+    void ReadAt(unsigned long long offset, unsigned char data[],
+        size_t len) const override {
+        std::lock_guard<std::mutex> lock(mutex);
+        file.clear();
+        file.seekg((std::streamoff)offset);
+        if (!file.read((char*)data, (std::streamsize)len)) {
+            file.clear();
+            throw std::runtime_error("Container is truncated");
+        }
+    }
+};
+
+/// Writes a container from data handed over in pieces of any size. Chunks
+/// are sealed a batch at a time across the thread pool and appended to the
+/// sink in order, so memory stays at about one batch (8 MiB or a single
+/// chunk, whichever is larger) however large the object.
+class AES_API AESContainerWriter {
+private:
+    struct State;
+    State* state;  // behind a pointer so no library types cross the DLL
+
+    void SealPending(bool final);
+
+public:
+    // `keyId` (16 bytes, or null for zeros) is stored in the clear so a
+    // reader can tell which key to open the container with. The nonce is
+    // drawn at random, so one key can seal any number of containers.
+    AESContainerWriter(AESContainerSink& sink, const AESKey& key,
+        const unsigned char keyId[] = nullptr,
+        unsigned int chunkBytes = AESContainerHeader::DefaultChunkBytes);
+
+    ~AESContainerWriter();
+
+    AESContainerWriter(const AESContainerWriter&) = delete;
+    AESContainerWriter& operator=(const AESContainerWriter&) = delete;
+
+    const AESContainerHeader& Header() const;
+
+    void Write(const unsigned char data[], size_t len);
+
+    // Seals the last chunk and writes the index and footer. A container
+    // that is never finished does not open.
+    void Finish();
+};
+
+/// Random access to a container: any chunk or byte range, from any number
+/// of threads at once. The index is read and authenticated on open, so a
+/// truncated file is rejected before any data is returned; each chunk is
+/// authenticated as it is read, and std::runtime_error is thrown for one
+/// that has been altered.
+class AES_API AESContainerReader {
+private:
+    struct State;
+    State* state;
+
+public:
+    AESContainerReader(const AESContainerRandomSource& source,
+        const AESKey& key);
+
+    ~AESContainerReader();
+
+    AESContainerReader(const AESContainerReader&) = delete;
+    AESContainerReader& operator=(const AESContainerReader&) = delete;
+
+    // The header alone, to pick the key by its id before opening
+    static AESContainerHeader ReadHeader(
+        const AESContainerRandomSource& source);
+
+    const AESContainerHeader& Header() const;
+
+    unsigned long long Length() const;
+
+    unsigned long long ChunkCount() const;
+
+    // Decrypts chunk `index` into `out`, which must hold the chunk size;
+    // returns its length.
+    size_t ReadChunk(unsigned long long index, unsigned char out[]) const;
+
+    // Decrypts plaintext bytes [offset, offset + len). Only the chunks the
+    // range overlaps are read, and they are decrypted in parallel.
+    void Read(unsigned long long offset, unsigned char out[],
+        size_t len) const;
+};
+
+/// Reads a container front to back without seeking, e.g. off a socket.
+/// Chunks are read a batch at a time and decrypted in parallel. Nothing is
+/// returned from a chunk that fails authentication, and the end of the
+/// input is only reported once the final chunk, index and footer have been
+/// checked, so a truncated stream surfaces as std::runtime_error.
+class AES_API AESContainerStreamReader {
+private:
+    struct State;
+    State* state;
+
+    void Fill();
+
+public:
+    AESContainerStreamReader(AESContainerSource& source, const AESKey& key);
+
+    ~AESContainerStreamReader();
+
+    AESContainerStreamReader(const AESContainerStreamReader&) = delete;
+    AESContainerStreamReader& operator=(const AESContainerStreamReader&) =
+        delete;
+
+    const AESContainerHeader& Header() const;
+
+    // Up to `len` plaintext bytes; 0 once the whole container is read.
+    size_t Read(unsigned char out[], size_t len);
+};
+
+#endif  // _AES_CONTAINER_H_
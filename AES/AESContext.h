@@ -0,0 +1,62 @@
+// AESContext.h : State behind the opaque cipher handles of the DLL exports.
+#pragma once
+#ifndef _AES_CONTEXT_H_
+#define _AES_CONTEXT_H_
+
+#include "AESContainer.h"
+#include "AESKey.h"
+#include "AESStream.h"
+#include "AESXTSKey.h"
+
+/// What CreateCipherContext hands out. Callers only ever see a pointer to
+/// it. The exports keep every live handle in a registry (dllmain.cpp) and
+/// look pointers up there instead of reading through them, so a stale or
+/// twice-destroyed handle is rejected. A handle must still not be destroyed
+/// while another thread is inside a call that uses it.
+struct CipherContext {
+    CipherMode mode;
+    AESCounterLayout counterLayout;  // CTR only
+    AESKey key;
+
+    CipherContext(const unsigned char keyBytes[], AESKeyLength keyLength,
+        CipherMode mode,
+        const AESCounterLayout& counterLayout = AESCounterLayout())
+        : mode(mode), counterLayout(counterLayout),
+          key(keyBytes, keyLength) {
+    }
+};
+
+/// What CreateCipherStream hands out: one message being encrypted or
+/// decrypted piece by piece, with the key and mode of the context it came
+/// from.
+struct CipherStream {
+    AESStream stream;
+
+    CipherStream(const CipherContext& context, bool encrypt,
+        const unsigned char iv[])
+        : stream(context.mode, encrypt, context.counterLayout) {
+        stream.Init(context.key, iv);
+    }
+};
+
+/// What CreateXTSContext hands out: an XTS key pair and its data unit size.
+struct XTSContext {
+    AESXTSKey key;
+
+    XTSContext(const unsigned char keyBytes[], size_t keyLen,
+        size_t dataUnitBytes)
+        : key(keyBytes, keyLen, dataUnitBytes) {
+    }
+};
+
+/// What OpenContainer hands out: a container file and a reader over it.
+struct ContainerContext {
+    AESFileSource file;
+    AESContainerReader reader;
+
+    ContainerContext(const char* path, const AESKey& key)
+        : file(path), reader(file, key) {
+    }
+};
+
+#endif  // _AES_CONTEXT_H_
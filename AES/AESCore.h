@@ -0,0 +1,62 @@
+// AESCore.h : Compile-time shape of the cipher for each key length.
+#pragma once
+#ifndef _AES_CORE_H_
+#define _AES_CORE_H_
+
+#include "AES.h"
+#include "AESEngine.h"
+
+// Asks for a loop with a constant trip count to be unrolled completely.
+// MSVC has no such pragma but unrolls short constant loops on its own.
+#if defined(__clang__)
+#define AES_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+#define AES_UNROLL _Pragma("GCC unroll 16")
+#else
+#define AES_UNROLL
+#endif
+
+namespace AESEngine {
+
+/// Parameters of AES for one key length (FIPS-197 figure 4). The kernels
+/// are templated on this, so round loops have a constant trip count that
+/// unrolls, schedules fit fixed-size arrays and nothing in the hot loop
+/// branches on the key length.
+template <AESKeyLength KeyLength>
+struct AesCore {
+    static constexpr AESKeyLength keyLength = KeyLength;
+    static constexpr unsigned int Nk =
+        KeyLength == AESKeyLength::AES_128 ? 4 :
+        KeyLength == AESKeyLength::AES_192 ? 6 : 8;
+    static constexpr unsigned int Nr = Nk + 6;
+    static constexpr unsigned int KeyBytes = 4 * Nk;
+    static constexpr unsigned int ScheduleWords = 4 * (Nr + 1);
+    static constexpr unsigned int ScheduleBytes = BlockBytes * (Nr + 1);
+
+    static_assert(Nr <= MaxRounds, "Schedule does not fit AESRoundKeys");
+};
+
+using AesCore128 = AesCore<AESKeyLength::AES_128>;
+using AesCore192 = AesCore<AESKeyLength::AES_192>;
+using AesCore256 = AesCore<AESKeyLength::AES_256>;
+
+// Calls fn(AesCore<...>()) for the key length with `Nr` rounds; this is the
+// one branch on key length a backend call makes before its kernel runs.
+template <class Fn>
+inline void WithCore(unsigned int Nr, Fn&& fn) {
+    switch (Nr) {
+    case AesCore128::Nr:
+        fn(AesCore128());
+        break;
+    case AesCore192::Nr:
+        fn(AesCore192());
+        break;
+    default:
+        fn(AesCore256());
+        break;
+    }
+}
+
+}  // namespace AESEngine
+
+#endif  // _AES_CORE_H_
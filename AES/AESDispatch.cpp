@@ -0,0 +1,185 @@
+#include "pch.h"
+#include "AESEngine.h"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#ifdef AES_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace AESEngine {
+
+namespace {
+
+#ifdef AES_X86
+void Cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4]) {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, (int)leaf, (int)subleaf);
+    for (int i = 0; i < 4; i++) {
+        regs[i] = (unsigned int)r[i];
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state the OS saves on context switch (XCR0). Only valid when
+// CPUID reports OSXSAVE.
+unsigned long long Xgetbv() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int lo, hi;
+    __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+#endif
+
+CpuFeatures DetectCpu() {
+    CpuFeatures cpu = {};
+#ifdef AES_X86
+    unsigned int regs[4];
+    Cpuid(0, 0, regs);
+    const unsigned int maxLeaf = regs[0];
+    bool avx = false;
+    unsigned long long xcr0 = 0;
+    if (maxLeaf >= 1) {
+        Cpuid(1, 0, regs);
+        cpu.sse2 = (regs[3] & (1u << 26)) != 0;
+        cpu.ssse3 = cpu.sse2 && (regs[2] & (1u << 9)) != 0;
+        cpu.aesni = cpu.sse2 && (regs[2] & (1u << 25)) != 0;
+        cpu.pclmul = cpu.ssse3 && (regs[2] & (1u << 1)) != 0;
+        if ((regs[2] & (1u << 27)) != 0) {
+            xcr0 = Xgetbv();
+        }
+        avx = (regs[2] & (1u << 28)) != 0;
+    }
+    if (maxLeaf >= 7 && cpu.aesni && avx) {
+        Cpuid(7, 0, regs);
+        const bool vaes = (regs[2] & (1u << 9)) != 0;
+        const bool avx2 = (regs[1] & (1u << 5)) != 0;
+        const bool avx512f = (regs[1] & (1u << 16)) != 0;
+        const bool avx512bw = (regs[1] & (1u << 30)) != 0;
+        // XMM|YMM for AVX2, plus opmask|ZMM_Hi256|Hi16_ZMM for AVX-512
+        const bool ymmState = (xcr0 & 0x06) == 0x06;
+        const bool zmmState = (xcr0 & 0xE6) == 0xE6;
+        cpu.vaes256 = vaes && avx2 && ymmState;
+        cpu.vaes512 = vaes && avx512f && avx512bw && zmmState;
+    }
+#endif
+    return cpu;
+}
+
+std::string BackendOverride() {
+    std::string name;
+#ifdef _MSC_VER
+    char* value = nullptr;
+    size_t len = 0;
+    if (_dupenv_s(&value, &len, "AES_BACKEND") == 0 && value != nullptr) {
+        name = value;
+        free(value);
+    }
+#else
+    const char* value = getenv("AES_BACKEND");
+    if (value != nullptr) {
+        name = value;
+    }
+#endif
+    return name;
+}
+
+Dispatch SelectBackends() {
+    Dispatch d = {};
+    d.cpu = DetectCpu();
+#ifdef AES_COMPACT_TABLES
+    d.bulk = &CompactBackend();
+    d.serial = &CompactBackend();
+#else
+    d.bulk = &PortableBackend();
+    d.serial = &PortableBackend();
+#endif
+
+#ifdef AES_X86
+    if (d.cpu.aesni) {
+        d.bulk = &AESNIBackend();
+        d.serial = &AESNIBackend();
+        if (d.cpu.vaes512) {
+            d.bulk = &VAES512Backend();
+        }
+        else if (d.cpu.vaes256) {
+            d.bulk = &VAES256Backend();
+        }
+    }
+    else if (d.cpu.sse2) {
+        d.bulk = &BitsliceBackend();
+        if (d.cpu.ssse3) {
+            d.serial = &VPAESBackend();
+        }
+    }
+#endif
+
+    // A forced backend the CPU cannot run is ignored
+    const std::string forced = BackendOverride();
+    if (forced == "portable") {
+        d.bulk = &PortableBackend();
+        d.serial = &PortableBackend();
+    }
+    else if (forced == "compact") {
+        d.bulk = &CompactBackend();
+        d.serial = &CompactBackend();
+    }
+#ifdef AES_X86
+    else if (forced == "aesni" && d.cpu.aesni) {
+        d.bulk = &AESNIBackend();
+        d.serial = &AESNIBackend();
+    }
+    else if (forced == "vaes512" && d.cpu.vaes512) {
+        d.bulk = &VAES512Backend();
+        d.serial = &AESNIBackend();
+    }
+    else if (forced == "vaes256" && d.cpu.vaes256) {
+        d.bulk = &VAES256Backend();
+        d.serial = &AESNIBackend();
+    }
+    else if (forced == "bitslice" && d.cpu.sse2) {
+        d.bulk = &BitsliceBackend();
+        d.serial = &BitsliceBackend();
+    }
+    else if (forced == "vpaes" && d.cpu.ssse3) {
+        d.bulk = &VPAESBackend();
+        d.serial = &VPAESBackend();
+    }
+#endif
+
+    return d;
+}
+
+}  // namespace
+
+const Dispatch& GetDispatch() {
+    static const Dispatch dispatch = SelectBackends();
+    return dispatch;
+}
+
+void ExpandKey(const unsigned char key[], unsigned int Nk, AESRoundKeys& rk) {
+    GetDispatch().serial->expandKey(key, Nk, rk);
+}
+
+void EncryptBlock(const AESRoundKeys& rk, const unsigned char in[],
+    unsigned char out[]) {
+    GetDispatch().serial->encryptBlocks(rk, in, out, 1);
+}
+
+void DecryptBlock(const AESRoundKeys& rk, const unsigned char in[],
+    unsigned char out[]) {
+    GetDispatch().serial->decryptBlocks(rk, in, out, 1);
+}
+
+}  // namespace AESEngine
@@ -0,0 +1,337 @@
+#include "pch.h"
+#include "AESEngine.h"
+#include "AESCore.h"
+#include "AESTables.h"
+
+namespace AESEngine {
+
+namespace {
+
+// Where the kernels find the T-table column for a byte entering on row
+// `row` (a constant after inlining). The full set is one 1 KiB table per
+// row; the compact set keeps row 0's only and rotates it into place, a
+// quarter of the L1 footprint for one rotate per lookup.
+struct FullLookup {
+    static uint32_t Te(unsigned int row, unsigned int x) {
+        return tables.Te[row][x];
+    }
+
+    static uint32_t Td(unsigned int row, unsigned int x) {
+        return tables.Td[row][x];
+    }
+};
+
+struct CompactLookup {
+    static uint32_t RotateRows(uint32_t w, unsigned int row) {
+        return row == 0 ? w : (w << (8 * row)) | (w >> (32 - 8 * row));
+    }
+
+    static uint32_t Te(unsigned int row, unsigned int x) {
+        return RotateRows(tables.Te[0][x], row);
+    }
+
+    static uint32_t Td(unsigned int row, unsigned int x) {
+        return RotateRows(tables.Td[0][x], row);
+    }
+};
+
+inline uint32_t LoadWord(const unsigned char* p) {
+    return Column(p[0], p[1], p[2], p[3]);
+}
+
+inline void StoreWord(unsigned char* p, uint32_t w) {
+    p[0] = (unsigned char)w;
+    p[1] = (unsigned char)(w >> 8);
+    p[2] = (unsigned char)(w >> 16);
+    p[3] = (unsigned char)(w >> 24);
+}
+
+inline uint32_t SubWord(uint32_t w) {
+    return Column(tables.Sbox[w & 0xff], tables.Sbox[(w >> 8) & 0xff],
+        tables.Sbox[(w >> 16) & 0xff], tables.Sbox[w >> 24]);
+}
+
+// InvMixColumns of a key word: Td[.][Sbox[x]] cancels the InvSubBytes step
+template <class Lookup>
+inline uint32_t InvMixWord(uint32_t w) {
+    return Lookup::Td(0, tables.Sbox[w & 0xff]) ^
+        Lookup::Td(1, tables.Sbox[(w >> 8) & 0xff]) ^
+        Lookup::Td(2, tables.Sbox[(w >> 16) & 0xff]) ^
+        Lookup::Td(3, tables.Sbox[w >> 24]);
+}
+
+template <class Core, class Lookup>
+void ExpandKeyPortable(const unsigned char key[], AESRoundKeys& rk) {
+    constexpr unsigned int Nk = Core::Nk;
+    constexpr unsigned int Nr = Core::Nr;
+    constexpr unsigned int words = Core::ScheduleWords;
+    uint32_t w[words];
+
+    rk.Nr = Nr;
+    for (unsigned int i = 0; i < Nk; i++) {
+        w[i] = LoadWord(key + 4 * i);
+    }
+
+    for (unsigned int i = Nk; i < words; i++) {
+        uint32_t temp = w[i - 1];
+        if (i % Nk == 0) {
+            // RotWord is a right rotation of the little-endian word
+            temp = SubWord((temp >> 8) | (temp << 24)) ^
+                tables.Rcon[i / Nk - 1];
+        }
+        else if (Nk > 6 && i % Nk == 4) {
+            temp = SubWord(temp);
+        }
+        w[i] = w[i - Nk] ^ temp;
+    }
+
+    for (unsigned int i = 0; i < words; i++) {
+        StoreWord(rk.enc + 4 * i, w[i]);
+    }
+
+    for (unsigned int round = 0; round <= Nr; round++) {
+        const uint32_t* src = w + 4 * (Nr - round);
+        unsigned char* dst = rk.dec + BlockBytes * round;
+        for (unsigned int j = 0; j < 4; j++) {
+            uint32_t word = src[j];
+            if (round != 0 && round != Nr) {
+                word = InvMixWord<Lookup>(word);
+            }
+            StoreWord(dst + 4 * j, word);
+        }
+    }
+}
+
+template <class Core, class Lookup>
+inline void EncryptBlockPortable(const AESRoundKeys& rk,
+    const unsigned char in[], unsigned char out[]) {
+    const unsigned char* k = rk.enc;
+    uint32_t s0 = LoadWord(in) ^ LoadWord(k);
+    uint32_t s1 = LoadWord(in + 4) ^ LoadWord(k + 4);
+    uint32_t s2 = LoadWord(in + 8) ^ LoadWord(k + 8);
+    uint32_t s3 = LoadWord(in + 12) ^ LoadWord(k + 12);
+    uint32_t t0, t1, t2, t3;
+
+    // SubBytes, ShiftRows and MixColumns: four lookups per column
+    AES_UNROLL
+    for (unsigned int round = 1; round < Core::Nr; round++) {
+        k += BlockBytes;
+        t0 = Lookup::Te(0, s0 & 0xff) ^ Lookup::Te(1, (s1 >> 8) & 0xff) ^
+            Lookup::Te(2, (s2 >> 16) & 0xff) ^ Lookup::Te(3, s3 >> 24) ^
+            LoadWord(k);
+        t1 = Lookup::Te(0, s1 & 0xff) ^ Lookup::Te(1, (s2 >> 8) & 0xff) ^
+            Lookup::Te(2, (s3 >> 16) & 0xff) ^ Lookup::Te(3, s0 >> 24) ^
+            LoadWord(k + 4);
+        t2 = Lookup::Te(0, s2 & 0xff) ^ Lookup::Te(1, (s3 >> 8) & 0xff) ^
+            Lookup::Te(2, (s0 >> 16) & 0xff) ^ Lookup::Te(3, s1 >> 24) ^
+            LoadWord(k + 8);
+        t3 = Lookup::Te(0, s3 & 0xff) ^ Lookup::Te(1, (s0 >> 8) & 0xff) ^
+            Lookup::Te(2, (s1 >> 16) & 0xff) ^ Lookup::Te(3, s2 >> 24) ^
+            LoadWord(k + 12);
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    // Final round has no MixColumns
+    const unsigned char* sbox = tables.Sbox;
+    k += BlockBytes;
+    t0 = Column(sbox[s0 & 0xff], sbox[(s1 >> 8) & 0xff],
+        sbox[(s2 >> 16) & 0xff], sbox[s3 >> 24]);
+    t1 = Column(sbox[s1 & 0xff], sbox[(s2 >> 8) & 0xff],
+        sbox[(s3 >> 16) & 0xff], sbox[s0 >> 24]);
+    t2 = Column(sbox[s2 & 0xff], sbox[(s3 >> 8) & 0xff],
+        sbox[(s0 >> 16) & 0xff], sbox[s1 >> 24]);
+    t3 = Column(sbox[s3 & 0xff], sbox[(s0 >> 8) & 0xff],
+        sbox[(s1 >> 16) & 0xff], sbox[s2 >> 24]);
+
+    StoreWord(out, t0 ^ LoadWord(k));
+    StoreWord(out + 4, t1 ^ LoadWord(k + 4));
+    StoreWord(out + 8, t2 ^ LoadWord(k + 8));
+    StoreWord(out + 12, t3 ^ LoadWord(k + 12));
+}
+
+template <class Core, class Lookup>
+inline void DecryptBlockPortable(const AESRoundKeys& rk,
+    const unsigned char in[], unsigned char out[]) {
+    const unsigned char* k = rk.dec;
+    uint32_t s0 = LoadWord(in) ^ LoadWord(k);
+    uint32_t s1 = LoadWord(in + 4) ^ LoadWord(k + 4);
+    uint32_t s2 = LoadWord(in + 8) ^ LoadWord(k + 8);
+    uint32_t s3 = LoadWord(in + 12) ^ LoadWord(k + 12);
+    uint32_t t0, t1, t2, t3;
+
+    // InvSubBytes, InvShiftRows and InvMixColumns: four lookups per column
+    AES_UNROLL
+    for (unsigned int round = 1; round < Core::Nr; round++) {
+        k += BlockBytes;
+        t0 = Lookup::Td(0, s0 & 0xff) ^ Lookup::Td(1, (s3 >> 8) & 0xff) ^
+            Lookup::Td(2, (s2 >> 16) & 0xff) ^ Lookup::Td(3, s1 >> 24) ^
+            LoadWord(k);
+        t1 = Lookup::Td(0, s1 & 0xff) ^ Lookup::Td(1, (s0 >> 8) & 0xff) ^
+            Lookup::Td(2, (s3 >> 16) & 0xff) ^ Lookup::Td(3, s2 >> 24) ^
+            LoadWord(k + 4);
+        t2 = Lookup::Td(0, s2 & 0xff) ^ Lookup::Td(1, (s1 >> 8) & 0xff) ^
+            Lookup::Td(2, (s0 >> 16) & 0xff) ^ Lookup::Td(3, s3 >> 24) ^
+            LoadWord(k + 8);
+        t3 = Lookup::Td(0, s3 & 0xff) ^ Lookup::Td(1, (s2 >> 8) & 0xff) ^
+            Lookup::Td(2, (s1 >> 16) & 0xff) ^ Lookup::Td(3, s0 >> 24) ^
+            LoadWord(k + 12);
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    // Final round has no InvMixColumns
+    const unsigned char* invSbox = tables.InvSbox;
+    k += BlockBytes;
+    t0 = Column(invSbox[s0 & 0xff], invSbox[(s3 >> 8) & 0xff],
+        invSbox[(s2 >> 16) & 0xff], invSbox[s1 >> 24]);
+    t1 = Column(invSbox[s1 & 0xff], invSbox[(s0 >> 8) & 0xff],
+        invSbox[(s3 >> 16) & 0xff], invSbox[s2 >> 24]);
+    t2 = Column(invSbox[s2 & 0xff], invSbox[(s1 >> 8) & 0xff],
+        invSbox[(s0 >> 16) & 0xff], invSbox[s3 >> 24]);
+    t3 = Column(invSbox[s3 & 0xff], invSbox[(s2 >> 8) & 0xff],
+        invSbox[(s1 >> 16) & 0xff], invSbox[s0 >> 24]);
+
+    StoreWord(out, t0 ^ LoadWord(k));
+    StoreWord(out + 4, t1 ^ LoadWord(k + 4));
+    StoreWord(out + 8, t2 ^ LoadWord(k + 8));
+    StoreWord(out + 12, t3 ^ LoadWord(k + 12));
+}
+
+template <class Core, class Lookup>
+void EncryptBlocksPortable(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    for (size_t i = 0; i < blocks; i++) {
+        EncryptBlockPortable<Core, Lookup>(rk, in + i * BlockBytes,
+            out + i * BlockBytes);
+    }
+}
+
+template <class Core, class Lookup>
+void DecryptBlocksPortable(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    for (size_t i = 0; i < blocks; i++) {
+        DecryptBlockPortable<Core, Lookup>(rk, in + i * BlockBytes,
+            out + i * BlockBytes);
+    }
+}
+
+template <class Core, class Lookup>
+void EncryptCBCPortable(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    for (size_t i = 0; i < blocks; i++) {
+        for (unsigned int j = 0; j < BlockBytes; j++) {
+            iv[j] ^= in[j];
+        }
+        EncryptBlockPortable<Core, Lookup>(rk, iv, iv);
+        memcpy(out, iv, BlockBytes);
+        in += BlockBytes;
+        out += BlockBytes;
+    }
+}
+
+template <class Core, class Lookup>
+void EncryptCFBPortable(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    for (size_t i = 0; i < blocks; i++) {
+        EncryptBlockPortable<Core, Lookup>(rk, iv, iv);
+        for (unsigned int j = 0; j < BlockBytes; j++) {
+            iv[j] ^= in[j];
+        }
+        memcpy(out, iv, BlockBytes);
+        in += BlockBytes;
+        out += BlockBytes;
+    }
+}
+
+// Backend entry points: pick the specialization for the key once per call
+template <class Lookup>
+struct PortableEntry {
+    static void ExpandKey(const unsigned char key[], unsigned int Nk,
+        AESRoundKeys& rk) {
+        WithCore(Nk + 6, [&](auto core) {
+            ExpandKeyPortable<decltype(core), Lookup>(key, rk);
+        });
+    }
+
+    static void EncryptBlocks(const AESRoundKeys& rk, const unsigned char* in,
+        unsigned char* out, size_t blocks) {
+        WithCore(rk.Nr, [&](auto core) {
+            EncryptBlocksPortable<decltype(core), Lookup>(rk, in, out, blocks);
+        });
+    }
+
+    static void DecryptBlocks(const AESRoundKeys& rk, const unsigned char* in,
+        unsigned char* out, size_t blocks) {
+        WithCore(rk.Nr, [&](auto core) {
+            DecryptBlocksPortable<decltype(core), Lookup>(rk, in, out, blocks);
+        });
+    }
+
+    static void EncryptCBC(const AESRoundKeys& rk, unsigned char iv[],
+        const unsigned char* in, unsigned char* out, size_t blocks) {
+        WithCore(rk.Nr, [&](auto core) {
+            EncryptCBCPortable<decltype(core), Lookup>(rk, iv, in, out, blocks);
+        });
+    }
+
+    static void EncryptCFB(const AESRoundKeys& rk, unsigned char iv[],
+        const unsigned char* in, unsigned char* out, size_t blocks) {
+        WithCore(rk.Nr, [&](auto core) {
+            EncryptCFBPortable<decltype(core), Lookup>(rk, iv, in, out, blocks);
+        });
+    }
+};
+
+}  // namespace
+
+const Backend& PortableBackend() {
+    static const Backend backend = {
+        "portable",
+        PortableEntry<FullLookup>::ExpandKey,
+        PortableEntry<FullLookup>::EncryptBlocks,
+        PortableEntry<FullLookup>::DecryptBlocks,
+        PortableEntry<FullLookup>::EncryptCBC,
+        PortableEntry<FullLookup>::EncryptCFB,
+        nullptr,
+        0,
+        nullptr,
+        nullptr,
+        nullptr,
+    };
+    return backend;
+}
+
+const Backend& CompactBackend() {
+    static const Backend backend = {
+        "compact",
+        PortableEntry<CompactLookup>::ExpandKey,
+        PortableEntry<CompactLookup>::EncryptBlocks,
+        PortableEntry<CompactLookup>::DecryptBlocks,
+        PortableEntry<CompactLookup>::EncryptCBC,
+        PortableEntry<CompactLookup>::EncryptCFB,
+        nullptr,
+        0,
+        nullptr,
+        nullptr,
+        nullptr,
+    };
+    return backend;
+}
+
+void SecureZero(void* data, size_t len) {
+#if defined(_WIN32)
+    SecureZeroMemory(data, len);
+#else
+    volatile unsigned char* p = (volatile unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        p[i] = 0;
+    }
+#endif
+}
+
+}  // namespace AESEngine
@@ -0,0 +1,163 @@
+// AESEngine.h : Internal AES block engine shared by every mode.
+#pragma once
+#ifndef _AES_ENGINE_H_
+#define _AES_ENGINE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define AES_X86 1
+#endif
+
+// MSVC exposes every intrinsic unconditionally; GCC and Clang need the
+// instruction set enabled on each function that uses it.
+#if defined(__GNUC__) || defined(__clang__)
+#define AES_TARGET(isa) __attribute__((target(isa)))
+#else
+#define AES_TARGET(isa)
+#endif
+
+namespace AESEngine {
+
+static constexpr unsigned int BlockBytes = 16;
+static constexpr unsigned int MaxRounds = 14;
+
+/// Expanded key schedule. `enc` holds the FIPS-197 round keys in byte order,
+/// `dec` holds the round keys of the equivalent inverse cipher (FIPS-197
+/// section 5.3.5): reversed, with InvMixColumns applied to rounds 1..Nr-1.
+/// Every backend produces and consumes this same layout.
+struct AESRoundKeys {
+    alignas(16) unsigned char enc[BlockBytes * (MaxRounds + 1)];
+    alignas(16) unsigned char dec[BlockBytes * (MaxRounds + 1)];
+    unsigned int Nr;
+};
+
+/// Widest interleave any multi-buffer kernel uses.
+static constexpr unsigned int MaxCBCLanes = 16;
+
+/// State of the multi-buffer CBC kernels: up to MaxCBCLanes independent
+/// chains that share Nr, each advanced one block per step. Round keys are
+/// stored round-major, so adjacent lanes' keys for one round are contiguous
+/// and a wide register loads several of them at once. Idle lanes read a zero
+/// block and write to `sink` with a zero `stride`.
+struct CBCLanes {
+    alignas(64) unsigned char keys[MaxRounds + 1][MaxCBCLanes][BlockBytes];
+    alignas(64) unsigned char chain[MaxCBCLanes][BlockBytes];
+    alignas(16) unsigned char sink[BlockBytes];
+    const unsigned char* in[MaxCBCLanes];
+    unsigned char* out[MaxCBCLanes];
+    size_t stride[MaxCBCLanes];
+    unsigned int Nr;
+};
+
+/// One implementation of the block cipher. The *Blocks functions process
+/// independent blocks and are what the parallelizable modes batch through;
+/// the CBC/CFB functions run a serial chain and leave the last feedback
+/// block in `iv`. `cryptCTR32` is an optional fused CTR kernel that keeps
+/// the counters in registers; backends without one leave it null and CTR
+/// falls back to encryptBlocks. `encryptCBCLanes` runs the first `cbcLanes`
+/// lanes of a CBCLanes for `steps` blocks, advancing `in`, `out` and `chain`;
+/// backends without one (cbcLanes == 0) run each CBC message serially.
+/// The *MultiKey functions process independent blocks that each have their
+/// own key: block i is read from in[i] and written to out[i] under keys[i],
+/// and every key has the same Nr. They are optional as well; without them a
+/// multi-key batch costs one encryptBlocks call per block.
+struct Backend {
+    const char* name;
+
+    void (*expandKey)(const unsigned char key[], unsigned int Nk,
+        AESRoundKeys& rk);
+
+    void (*encryptBlocks)(const AESRoundKeys& rk, const unsigned char* in,
+        unsigned char* out, size_t blocks);
+
+    void (*decryptBlocks)(const AESRoundKeys& rk, const unsigned char* in,
+        unsigned char* out, size_t blocks);
+
+    void (*encryptCBC)(const AESRoundKeys& rk, unsigned char iv[],
+        const unsigned char* in, unsigned char* out, size_t blocks);
+
+    void (*encryptCFB)(const AESRoundKeys& rk, unsigned char iv[],
+        const unsigned char* in, unsigned char* out, size_t blocks);
+
+    // out = in ^ keystream for `blocks` counter blocks. Only the last four
+    // bytes of `counter` step, as a big-endian 32-bit counter, and the
+    // caller guarantees they do not wrap; `counter` is left at the next value.
+    void (*cryptCTR32)(const AESRoundKeys& rk, unsigned char counter[],
+        const unsigned char* in, unsigned char* out, size_t blocks);
+
+    unsigned int cbcLanes;
+
+    void (*encryptCBCLanes)(CBCLanes& lanes, size_t steps);
+
+    void (*encryptBlocksMultiKey)(const AESRoundKeys* const keys[],
+        const unsigned char* const in[], unsigned char* const out[],
+        size_t blocks);
+
+    void (*decryptBlocksMultiKey)(const AESRoundKeys* const keys[],
+        const unsigned char* const in[], unsigned char* const out[],
+        size_t blocks);
+};
+
+struct CpuFeatures {
+    bool sse2;
+    bool ssse3;
+    bool aesni;
+    bool pclmul;    // carry-less multiply, used by GHASH
+    bool vaes256;   // VAES + AVX2 with YMM state enabled by the OS
+    bool vaes512;   // VAES + AVX-512F/BW with ZMM state enabled by the OS
+};
+
+/// Backends selected for this process: `bulk` serves modes that can batch
+/// independent blocks, `serial` serves the one-block-at-a-time chains.
+struct Dispatch {
+    CpuFeatures cpu;
+    const Backend* bulk;
+    const Backend* serial;
+};
+
+// Probes CPUID on first use and honours the AES_BACKEND environment variable
+// ("portable", "compact", "aesni", "vaes256", "vaes512", "bitslice",
+// "vpaes") to force a backend for testing.
+const Dispatch& GetDispatch();
+
+// Portable T-table backend, always available.
+const Backend& PortableBackend();
+
+// The same kernels on one rotated T-table per direction instead of four:
+// 2 KiB of tables rather than 8 KiB, for cores whose L1 is shared with other
+// hot code. Building with AES_COMPACT_TABLES makes it the portable fallback.
+const Backend& CompactBackend();
+
+#ifdef AES_X86
+const Backend& AESNIBackend();
+
+// Wide VAES kernels for the bulk modes, 32 (ZMM) or 16 (YMM) blocks per
+// iteration; key expansion and the serial chains are AES-NI's.
+const Backend& VAES512Backend();
+const Backend& VAES256Backend();
+
+// Constant-time SSE2 kernel that bitslices eight blocks per pass.
+const Backend& BitsliceBackend();
+
+// Constant-time SSSE3 vector-permute kernel, one block at a time.
+const Backend& VPAESBackend();
+#endif
+
+// Expands a key of Nk 32-bit words (4, 6 or 8) into both schedules.
+void ExpandKey(const unsigned char key[], unsigned int Nk, AESRoundKeys& rk);
+
+void EncryptBlock(const AESRoundKeys& rk, const unsigned char in[],
+    unsigned char out[]);
+
+void DecryptBlock(const AESRoundKeys& rk, const unsigned char in[],
+    unsigned char out[]);
+
+// Zeroes key material or plaintext in a way the compiler may not drop as a
+// dead store.
+void SecureZero(void* data, size_t len);
+
+}  // namespace AESEngine
+
+#endif  // _AES_ENGINE_H_
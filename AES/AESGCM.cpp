@@ -0,0 +1,490 @@
+#include "pch.h"
+#include "AESGCM.h"
+#include "AESModes.h"
+#include "AESCore.h"
+#include <cstring>
+
+#ifdef AES_X86
+#include <immintrin.h>
+#endif
+
+namespace AESEngine {
+
+namespace {
+
+// Blocks per generic-path pass: CTR output is hashed while still in L1
+static constexpr size_t GCMChunkBlocks = 256;
+
+/// Hash subkey material. `powers` holds H^1..H^8 byte-reversed for the
+/// PCLMULQDQ path; `hh`/`hl` are the 4-bit Shoup table of H otherwise.
+struct GHashKey {
+    bool clmul;
+    alignas(16) unsigned char powers[8][BlockBytes];
+    uint64_t hh[16];
+    uint64_t hl[16];
+};
+
+inline uint64_t LoadBE64(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+inline void StoreBE64(unsigned char* p, uint64_t v) {
+    for (int i = 7; i >= 0; i--) {
+        p[i] = (unsigned char)v;
+        v >>= 8;
+    }
+}
+
+// inc32 of SP 800-38D: steps the last four bytes, big-endian, mod 2^32
+inline void Increment32(unsigned char block[BlockBytes]) {
+    for (int i = BlockBytes - 1; i >= (int)BlockBytes - 4; i--) {
+        if (++block[i] != 0) {
+            break;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Portable GHASH: 4-bit tables (Shoup), 16 x 128-bit multiples of H per key.
+
+/// Reduction of the four bits shifted out of the low end per nibble step
+static const uint64_t Last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0,
+};
+
+void InitTable(GHashKey& key, const unsigned char h[BlockBytes]) {
+    uint64_t vh = LoadBE64(h);
+    uint64_t vl = LoadBE64(h + 8);
+    key.hh[0] = 0;
+    key.hl[0] = 0;
+    key.hh[8] = vh;
+    key.hl[8] = vl;
+
+    // In GCM's reflected bit order, halving the index multiplies by x
+    for (int i = 4; i > 0; i >>= 1) {
+        const uint64_t reduce = (vl & 1) * 0xe100000000000000ull;
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ reduce;
+        key.hh[i] = vh;
+        key.hl[i] = vl;
+    }
+    for (int i = 2; i <= 8; i *= 2) {
+        for (int j = 1; j < i; j++) {
+            key.hh[i + j] = key.hh[i] ^ key.hh[j];
+            key.hl[i + j] = key.hl[i] ^ key.hl[j];
+        }
+    }
+}
+
+// x = x * H
+void MulTable(const GHashKey& key, unsigned char x[BlockBytes]) {
+    unsigned int nibble = x[15] & 0xf;
+    uint64_t zh = key.hh[nibble];
+    uint64_t zl = key.hl[nibble];
+
+    for (int i = 15; i >= 0; i--) {
+        if (i != 15) {
+            const unsigned int rem = (unsigned int)(zl & 0xf);
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ (Last4[rem] << 48);
+            nibble = x[i] & 0xf;
+            zh ^= key.hh[nibble];
+            zl ^= key.hl[nibble];
+        }
+        const unsigned int rem = (unsigned int)(zl & 0xf);
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ (Last4[rem] << 48);
+        nibble = x[i] >> 4;
+        zh ^= key.hh[nibble];
+        zl ^= key.hl[nibble];
+    }
+    StoreBE64(x, zh);
+    StoreBE64(x + 8, zl);
+}
+
+void GHashTable(const GHashKey& key, unsigned char y[BlockBytes],
+    const unsigned char* data, size_t len) {
+    for (; len >= BlockBytes; len -= BlockBytes, data += BlockBytes) {
+        for (unsigned int i = 0; i < BlockBytes; i++) {
+            y[i] ^= data[i];
+        }
+        MulTable(key, y);
+    }
+    if (len > 0) {
+        for (size_t i = 0; i < len; i++) {
+            y[i] ^= data[i];
+        }
+        MulTable(key, y);
+    }
+}
+
+#ifdef AES_X86
+
+// ---------------------------------------------------------------------------
+// PCLMULQDQ GHASH. Field elements are byte-reversed on load so the 128-bit
+// lanes read as polynomials; products are summed unreduced and reduced once
+// per group of up to eight blocks (Gueron & Kounavis, Intel CLMUL paper).
+
+AES_TARGET("ssse3")
+inline __m128i ByteSwap(__m128i x) {
+    return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+        10, 11, 12, 13, 14, 15));
+}
+
+// lo/mid/hi += a * b, unreduced
+AES_TARGET("pclmul,sse2")
+inline void MulAcc(__m128i a, __m128i b, __m128i& lo, __m128i& mid,
+    __m128i& hi) {
+    lo = _mm_xor_si128(lo, _mm_clmulepi64_si128(a, b, 0x00));
+    hi = _mm_xor_si128(hi, _mm_clmulepi64_si128(a, b, 0x11));
+    mid = _mm_xor_si128(mid, _mm_clmulepi64_si128(a, b, 0x01));
+    mid = _mm_xor_si128(mid, _mm_clmulepi64_si128(a, b, 0x10));
+}
+
+// Folds a 256-bit product into GF(2^128): shift left one bit for the
+// reflected representation, then reduce by x^128 + x^7 + x^2 + x + 1.
+AES_TARGET("pclmul,sse2")
+inline __m128i Reduce(__m128i lo, __m128i mid, __m128i hi) {
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+    __m128i carryLo = _mm_srli_epi32(lo, 31);
+    __m128i carryHi = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    const __m128i across = _mm_srli_si128(carryLo, 12);
+    carryHi = _mm_slli_si128(carryHi, 4);
+    carryLo = _mm_slli_si128(carryLo, 4);
+    lo = _mm_or_si128(lo, carryLo);
+    hi = _mm_or_si128(_mm_or_si128(hi, carryHi), across);
+
+    __m128i t = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31),
+        _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+    const __m128i spill = _mm_srli_si128(t, 4);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(t, 12));
+    t = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1),
+        _mm_srli_epi32(lo, 2)), _mm_xor_si128(_mm_srli_epi32(lo, 7), spill));
+    return _mm_xor_si128(hi, _mm_xor_si128(lo, t));
+}
+
+AES_TARGET("pclmul,sse2")
+inline __m128i Mul(__m128i a, __m128i b) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i mid = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    MulAcc(a, b, lo, mid, hi);
+    return Reduce(lo, mid, hi);
+}
+
+AES_TARGET("pclmul,ssse3")
+void InitCLMUL(GHashKey& key, const unsigned char h[BlockBytes]) {
+    __m128i* powers = (__m128i*)key.powers;
+    const __m128i h1 = ByteSwap(_mm_loadu_si128((const __m128i*)h));
+    powers[0] = h1;
+    for (int i = 1; i < 8; i++) {
+        powers[i] = Mul(powers[i - 1], h1);
+    }
+}
+
+// Eight blocks: y' = (y ^ x0)H^8 ^ x1 H^7 ^ ... ^ x7 H, one reduction
+AES_TARGET("pclmul,ssse3")
+inline __m128i Hash8(const __m128i* powers, __m128i y, const __m128i x[8]) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i mid = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    MulAcc(_mm_xor_si128(x[0], y), powers[7], lo, mid, hi);
+    for (int i = 1; i < 8; i++) {
+        MulAcc(x[i], powers[7 - i], lo, mid, hi);
+    }
+    return Reduce(lo, mid, hi);
+}
+
+AES_TARGET("pclmul,ssse3")
+void GHashCLMUL(const GHashKey& key, unsigned char y[BlockBytes],
+    const unsigned char* data, size_t len) {
+    const __m128i* powers = (const __m128i*)key.powers;
+    const __m128i* src = (const __m128i*)data;
+    __m128i acc = ByteSwap(_mm_loadu_si128((const __m128i*)y));
+
+    for (; len >= 8 * BlockBytes; len -= 8 * BlockBytes, src += 8) {
+        __m128i x[8];
+        for (int i = 0; i < 8; i++) {
+            x[i] = ByteSwap(_mm_loadu_si128(src + i));
+        }
+        acc = Hash8(powers, acc, x);
+    }
+    for (; len >= BlockBytes; len -= BlockBytes, src++) {
+        acc = Mul(_mm_xor_si128(acc, ByteSwap(_mm_loadu_si128(src))),
+            powers[0]);
+    }
+    if (len > 0) {
+        unsigned char last[BlockBytes] = {};
+        memcpy(last, src, len);
+        acc = Mul(_mm_xor_si128(acc,
+            ByteSwap(_mm_loadu_si128((const __m128i*)last))), powers[0]);
+    }
+    _mm_storeu_si128((__m128i*)y, ByteSwap(acc));
+}
+
+// One pass over whole blocks doing CTR with AES-NI and GHASH with PCLMULQDQ.
+// The eight multiplications of a group are spread over the AES rounds of
+// the next group, so both units stay busy and every block is loaded once.
+// Decryption hashes its input group during that group's own rounds;
+// encryption hashes each group's output during the following group's.
+template <class Core>
+AES_TARGET("aes,pclmul,ssse3")
+void CryptStitched(const AESRoundKeys& rk, const GHashKey& hashKey,
+    unsigned char y[BlockBytes], unsigned char counter[BlockBytes],
+    const unsigned char* in, unsigned char* out, size_t blocks, bool decrypt) {
+    const __m128i* k = (const __m128i*)rk.enc;
+    constexpr unsigned int Nr = Core::Nr;
+    const __m128i* powers = (const __m128i*)hashKey.powers;
+    const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+    const __m128i* src = (const __m128i*)in;
+    __m128i* dst = (__m128i*)out;
+
+    __m128i acc = ByteSwap(_mm_loadu_si128((const __m128i*)y));
+    __m128i ctr = ByteSwap(_mm_loadu_si128((const __m128i*)counter));
+    __m128i x[8];
+    bool pending = false;
+
+    for (; blocks >= 8; blocks -= 8) {
+        if (decrypt) {
+            for (int i = 0; i < 8; i++) {
+                x[i] = ByteSwap(_mm_loadu_si128(src + i));
+            }
+            x[0] = _mm_xor_si128(x[0], acc);
+            pending = true;
+        }
+
+        __m128i b0 = _mm_xor_si128(ByteSwap(ctr), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        __m128i b1 = _mm_xor_si128(ByteSwap(ctr), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        __m128i b2 = _mm_xor_si128(ByteSwap(ctr), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        __m128i b3 = _mm_xor_si128(ByteSwap(ctr), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        __m128i b4 = _mm_xor_si128(ByteSwap(ctr), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        __m128i b5 = _mm_xor_si128(ByteSwap(ctr), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        __m128i b6 = _mm_xor_si128(ByteSwap(ctr), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        __m128i b7 = _mm_xor_si128(ByteSwap(ctr), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+
+        __m128i lo = _mm_setzero_si128();
+        __m128i mid = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            const __m128i key = k[round];
+            b0 = _mm_aesenc_si128(b0, key);
+            b1 = _mm_aesenc_si128(b1, key);
+            b2 = _mm_aesenc_si128(b2, key);
+            b3 = _mm_aesenc_si128(b3, key);
+            b4 = _mm_aesenc_si128(b4, key);
+            b5 = _mm_aesenc_si128(b5, key);
+            b6 = _mm_aesenc_si128(b6, key);
+            b7 = _mm_aesenc_si128(b7, key);
+            if (pending && round <= 8) {
+                MulAcc(x[round - 1], powers[8 - round], lo, mid, hi);
+            }
+        }
+        if (pending) {
+            acc = Reduce(lo, mid, hi);
+        }
+
+        const __m128i key = k[Nr];
+        b0 = _mm_xor_si128(_mm_loadu_si128(src + 0), _mm_aesenclast_si128(b0, key));
+        b1 = _mm_xor_si128(_mm_loadu_si128(src + 1), _mm_aesenclast_si128(b1, key));
+        b2 = _mm_xor_si128(_mm_loadu_si128(src + 2), _mm_aesenclast_si128(b2, key));
+        b3 = _mm_xor_si128(_mm_loadu_si128(src + 3), _mm_aesenclast_si128(b3, key));
+        b4 = _mm_xor_si128(_mm_loadu_si128(src + 4), _mm_aesenclast_si128(b4, key));
+        b5 = _mm_xor_si128(_mm_loadu_si128(src + 5), _mm_aesenclast_si128(b5, key));
+        b6 = _mm_xor_si128(_mm_loadu_si128(src + 6), _mm_aesenclast_si128(b6, key));
+        b7 = _mm_xor_si128(_mm_loadu_si128(src + 7), _mm_aesenclast_si128(b7, key));
+        _mm_storeu_si128(dst + 0, b0);
+        _mm_storeu_si128(dst + 1, b1);
+        _mm_storeu_si128(dst + 2, b2);
+        _mm_storeu_si128(dst + 3, b3);
+        _mm_storeu_si128(dst + 4, b4);
+        _mm_storeu_si128(dst + 5, b5);
+        _mm_storeu_si128(dst + 6, b6);
+        _mm_storeu_si128(dst + 7, b7);
+
+        if (!decrypt) {
+            x[0] = _mm_xor_si128(ByteSwap(b0), acc);
+            x[1] = ByteSwap(b1);
+            x[2] = ByteSwap(b2);
+            x[3] = ByteSwap(b3);
+            x[4] = ByteSwap(b4);
+            x[5] = ByteSwap(b5);
+            x[6] = ByteSwap(b6);
+            x[7] = ByteSwap(b7);
+            pending = true;
+        }
+        src += 8;
+        dst += 8;
+    }
+
+    // Encryption still owes the hash of its last full group
+    if (!decrypt && pending) {
+        acc = Hash8(powers, _mm_setzero_si128(), x);
+    }
+
+    for (; blocks > 0; blocks--) {
+        __m128i b = _mm_xor_si128(ByteSwap(ctr), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        AES_UNROLL
+        for (unsigned int round = 1; round < Nr; round++) {
+            b = _mm_aesenc_si128(b, k[round]);
+        }
+        const __m128i data = _mm_loadu_si128(src++);
+        b = _mm_xor_si128(data, _mm_aesenclast_si128(b, k[Nr]));
+        _mm_storeu_si128(dst++, b);
+        acc = Mul(_mm_xor_si128(acc, ByteSwap(decrypt ? data : b)), powers[0]);
+    }
+
+    _mm_storeu_si128((__m128i*)y, ByteSwap(acc));
+    _mm_storeu_si128((__m128i*)counter, ByteSwap(ctr));
+}
+
+#endif  // AES_X86
+
+// The stitched kernel is tied to AES-NI, so it only runs when dispatch
+// picked an AES-NI based backend; a forced software backend keeps tables.
+bool UseCLMUL() {
+#ifdef AES_X86
+    const Dispatch& d = GetDispatch();
+    return d.cpu.pclmul && d.serial == &AESNIBackend();
+#else
+    return false;
+#endif
+}
+
+void InitHashKey(GHashKey& key, const AESRoundKeys& rk) {
+    unsigned char h[BlockBytes] = {};
+    EncryptBlock(rk, h, h);
+    key.clmul = UseCLMUL();
+#ifdef AES_X86
+    if (key.clmul) {
+        InitCLMUL(key, h);
+        return;
+    }
+#endif
+    InitTable(key, h);
+}
+
+// y = GHASH(y, data), zero-padding a partial final block
+void GHash(const GHashKey& key, unsigned char y[BlockBytes],
+    const unsigned char* data, size_t len) {
+#ifdef AES_X86
+    if (key.clmul) {
+        GHashCLMUL(key, y, data, len);
+        return;
+    }
+#endif
+    GHashTable(key, y, data, len);
+}
+
+// Appends the 64-bit bit lengths of two inputs as one block
+void GHashLengths(const GHashKey& key, unsigned char y[BlockBytes],
+    uint64_t firstLen, uint64_t secondLen) {
+    unsigned char block[BlockBytes];
+    StoreBE64(block, firstLen * 8);
+    StoreBE64(block + 8, secondLen * 8);
+    GHash(key, y, block, BlockBytes);
+}
+
+void CryptGCM(const AESRoundKeys& rk, const unsigned char* iv, size_t ivLen,
+    const unsigned char* aad, size_t aadLen, const unsigned char* in,
+    unsigned char* out, size_t len, unsigned char tag[GCMTagBytes],
+    bool decrypt) {
+    GHashKey key;
+    InitHashKey(key, rk);
+
+    // Pre-counter block J0
+    unsigned char j0[BlockBytes] = {};
+    if (ivLen == 12) {
+        memcpy(j0, iv, 12);
+        j0[15] = 1;
+    }
+    else {
+        GHash(key, j0, iv, ivLen);
+        GHashLengths(key, j0, 0, ivLen);
+    }
+
+    unsigned char y[BlockBytes] = {};
+    GHash(key, y, aad, aadLen);
+
+    unsigned char counter[BlockBytes];
+    memcpy(counter, j0, BlockBytes);
+    Increment32(counter);
+
+    size_t blocks = len / BlockBytes;
+#ifdef AES_X86
+    if (key.clmul) {
+        WithCore(rk.Nr, [&](auto core) {
+            CryptStitched<decltype(core)>(rk, key, y, counter, in, out,
+                blocks, decrypt);
+        });
+        in += blocks * BlockBytes;
+        out += blocks * BlockBytes;
+        blocks = 0;
+    }
+#endif
+    // Without CLMUL: CTR a chunk, then hash it while it is still in cache
+    while (blocks > 0) {
+        const size_t n = blocks < GCMChunkBlocks ? blocks : GCMChunkBlocks;
+        if (decrypt) {
+            GHash(key, y, in, n * BlockBytes);
+        }
+        CryptCTR(rk, counter, 4, true, in, out, n * BlockBytes);
+        if (!decrypt) {
+            GHash(key, y, out, n * BlockBytes);
+        }
+        in += n * BlockBytes;
+        out += n * BlockBytes;
+        blocks -= n;
+    }
+
+    const size_t tail = len % BlockBytes;
+    if (tail > 0) {
+        if (decrypt) {
+            GHash(key, y, in, tail);
+        }
+        CryptCTR(rk, counter, 4, true, in, out, tail);
+        if (!decrypt) {
+            GHash(key, y, out, tail);
+        }
+    }
+
+    GHashLengths(key, y, aadLen, len);
+    EncryptBlock(rk, j0, tag);
+    for (unsigned int i = 0; i < GCMTagBytes; i++) {
+        tag[i] ^= y[i];
+    }
+}
+
+}  // namespace
+
+void EncryptGCM(const AESRoundKeys& rk, const unsigned char* iv, size_t ivLen,
+    const unsigned char* aad, size_t aadLen, const unsigned char* in,
+    unsigned char* out, size_t len, unsigned char tag[GCMTagBytes]) {
+    CryptGCM(rk, iv, ivLen, aad, aadLen, in, out, len, tag, false);
+}
+
+void DecryptGCM(const AESRoundKeys& rk, const unsigned char* iv, size_t ivLen,
+    const unsigned char* aad, size_t aadLen, const unsigned char* in,
+    unsigned char* out, size_t len, unsigned char tag[GCMTagBytes]) {
+    CryptGCM(rk, iv, ivLen, aad, aadLen, in, out, len, tag, true);
+}
+
+}  // namespace AESEngine
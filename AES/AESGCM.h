@@ -0,0 +1,29 @@
+// AESGCM.h : Galois/Counter Mode (NIST SP 800-38D) over the block engine.
+#pragma once
+#ifndef _AES_GCM_H_
+#define _AES_GCM_H_
+
+#include "AESEngine.h"
+
+namespace AESEngine {
+
+static constexpr unsigned int GCMTagBytes = 16;
+
+// GCM encryption of `len` bytes (any length) authenticated together with
+// `aadLen` bytes of additional data. A 12-byte IV takes the fast path;
+// other lengths are hashed into the pre-counter block. Writes the full
+// 16-byte tag; callers truncate it if they use a shorter one. `out` may
+// alias `in`.
+void EncryptGCM(const AESRoundKeys& rk, const unsigned char* iv, size_t ivLen,
+    const unsigned char* aad, size_t aadLen, const unsigned char* in,
+    unsigned char* out, size_t len, unsigned char tag[GCMTagBytes]);
+
+// GCM decryption. Writes the plaintext and the tag the ciphertext should
+// carry; comparing it against the received tag is left to the caller.
+void DecryptGCM(const AESRoundKeys& rk, const unsigned char* iv, size_t ivLen,
+    const unsigned char* aad, size_t aadLen, const unsigned char* in,
+    unsigned char* out, size_t len, unsigned char tag[GCMTagBytes]);
+
+}  // namespace AESEngine
+
+#endif  // _AES_GCM_H_
@@ -0,0 +1,640 @@
+#include "pch.h"
+#include "AESKey.h"
+#include "AESGCM.h"
+#include "AESModes.h"
+#include "AESCore.h"
+
+namespace {
+
+unsigned int WordsForKeyLength(AESKeyLength keyLength) {
+    switch (keyLength) {
+    case AESKeyLength::AES_128:
+        return AESEngine::AesCore128::Nk;
+    case AESKeyLength::AES_192:
+        return AESEngine::AesCore192::Nk;
+    case AESKeyLength::AES_256:
+        return AESEngine::AesCore256::Nk;
+    default:
+        throw std::invalid_argument("Invalid AES key length");
+    }
+}
+
+void CheckIV(const std::vector<unsigned char>& iv) {
+    if (iv.size() != AESEngine::BlockBytes) {
+        throw std::invalid_argument("IV must be " +
+            std::to_string(AESEngine::BlockBytes) + " bytes");
+    }
+}
+
+void CheckCounterLayout(const AESCounterLayout& layout) {
+    if (layout.counterBytes < 1 || layout.counterBytes > AESEngine::BlockBytes) {
+        throw std::invalid_argument("CTR counter must be 1 to " +
+            std::to_string(AESEngine::BlockBytes) + " bytes");
+    }
+}
+
+void CheckRecordMode(CipherMode mode, AESRecordPadding padding,
+    const unsigned char ivs[], size_t count) {
+    if (mode < CipherMode::ECB || mode > CipherMode::CTR) {
+        throw std::invalid_argument("Records can be ECB, CBC, CFB or CTR");
+    }
+    if (padding != AESRecordPadding::PKCS7 &&
+        padding != AESRecordPadding::Block) {
+        throw std::invalid_argument("Invalid record padding");
+    }
+    if (mode != CipherMode::ECB && ivs == nullptr && count > 0) {
+        throw std::invalid_argument("IVs are required for this mode");
+    }
+}
+
+size_t RecordLength(CipherMode mode, AESRecordPadding padding, size_t len) {
+    const size_t tail = len % AESEngine::BlockBytes;
+    if (mode == CipherMode::CTR) {
+        return len;
+    }
+    if (padding == AESRecordPadding::PKCS7) {
+        return len - tail + AESEngine::BlockBytes;
+    }
+    return tail == 0 ? len : len - tail + AESEngine::BlockBytes;
+}
+
+// Whether any record of the arena shares bytes with out[0, outLen)
+bool RecordsOverlap(const unsigned char arena[], const size_t offsets[],
+    const size_t lengths[], size_t count, const unsigned char out[],
+    size_t outLen) {
+    const uintptr_t outStart = (uintptr_t)out;
+    const uintptr_t outEnd = outStart + outLen;
+    for (size_t i = 0; i < count; i++) {
+        const uintptr_t start = (uintptr_t)(arena + offsets[i]);
+        if (lengths[i] > 0 && start < outEnd &&
+            outStart < start + lengths[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Bytes DecryptPackedCBC decrypts per step
+static constexpr size_t RecordStretchBytes = 4096;
+
+// CBC decryption in place of `count` records packed back to back in
+// `data`, record i at offsets[i]. Each stretch's ciphertext is saved before
+// it is decrypted, since every block but a record's first chains on the
+// ciphertext block before it, which is overwritten by then.
+void DecryptPackedCBC(const AESEngine::AESRoundKeys& rk, unsigned char data[],
+    const size_t offsets[], size_t count, const unsigned char ivs[]) {
+    const size_t total = offsets[count];
+    unsigned char saved[RecordStretchBytes];
+    unsigned char carry[AESEngine::BlockBytes];
+    size_t record = 0;
+    for (size_t start = 0; start < total; start += RecordStretchBytes) {
+        const size_t n = total - start < RecordStretchBytes
+            ? total - start : RecordStretchBytes;
+        memcpy(saved, data + start, n);
+        AESEngine::DecryptECB(rk, data + start, data + start, n);
+        for (size_t b = 0; b < n; b += AESEngine::BlockBytes) {
+            const size_t at = start + b;
+            while (offsets[record + 1] <= at) {
+                record++;
+            }
+            const unsigned char* previous = at == offsets[record]
+                ? ivs + record * AESEngine::BlockBytes
+                : b > 0 ? saved + b - AESEngine::BlockBytes : carry;
+            for (unsigned int k = 0; k < AESEngine::BlockBytes; k++) {
+                data[at + k] ^= previous[k];
+            }
+        }
+        memcpy(carry, saved + n - AESEngine::BlockBytes,
+            AESEngine::BlockBytes);
+    }
+}
+
+// SP 800-38D caps the plaintext at 2^39 - 256 bits
+static constexpr unsigned long long GCMMaxBytes = (1ull << 36) - 32;
+
+void CheckGCM(size_t len, size_t ivLen, size_t tagLen) {
+    if (ivLen == 0) {
+        throw std::invalid_argument("GCM IV must not be empty");
+    }
+    if (tagLen > AESEngine::GCMTagBytes ||
+        (tagLen < 12 && tagLen != 8 && tagLen != 4)) {
+        throw std::invalid_argument("GCM tag must be 4, 8 or 12 to 16 bytes");
+    }
+    if ((unsigned long long)len > GCMMaxBytes) {
+        throw std::length_error("GCM input is too long");
+    }
+}
+
+}  // namespace
+
+AESKey::AESKey(const unsigned char key[], AESKeyLength keyLength)
+    : keyLength(keyLength) {
+    AESEngine::ExpandKey(key, WordsForKeyLength(keyLength), roundKeys);
+}
+
+AESKeyLength AESKey::KeyLengthForBytes(size_t len) {
+    switch (len) {
+    case 16:
+        return AESKeyLength::AES_128;
+    case 24:
+        return AESKeyLength::AES_192;
+    case 32:
+        return AESKeyLength::AES_256;
+    default:
+        throw std::invalid_argument("AES key must be 16, 24 or 32 bytes");
+    }
+}
+
+size_t AESKey::KeyBytesFor(AESKeyLength keyLength) {
+    switch (keyLength) {
+    case AESKeyLength::AES_128:
+        return 16;
+    case AESKeyLength::AES_192:
+        return 24;
+    case AESKeyLength::AES_256:
+        return 32;
+    default:
+        throw std::invalid_argument("Invalid AES key length");
+    }
+}
+
+// The first Nk words of the encryption schedule are the key itself
+bool AESKey::Matches(const unsigned char key[],
+    AESKeyLength keyLength) const {
+    if (keyLength != this->keyLength) {
+        return false;
+    }
+    const size_t keyBytes = 4 * WordsForKeyLength(keyLength);
+    unsigned char diff = 0;
+    for (size_t i = 0; i < keyBytes; i++) {
+        diff |= (unsigned char)(roundKeys.enc[i] ^ key[i]);
+    }
+    return diff == 0;
+}
+
+AESKey::AESKey(const std::vector<unsigned char>& key)
+    : AESKey(key.data(), KeyLengthForBytes(key.size())) {
+}
+
+AESKey::~AESKey() {
+    AESEngine::SecureZero(&roundKeys, sizeof(roundKeys));
+}
+
+void AESKey::CheckLength(size_t len) const {
+    if (len % blockBytesLen != 0) {
+        throw std::length_error("Plaintext length must be divisible by " +
+            std::to_string(blockBytesLen));
+    }
+}
+
+void AESKey::EncryptECB(const unsigned char in[], unsigned char out[],
+    size_t len) const {
+    CheckLength(len);
+    AESEngine::EncryptECB(roundKeys, in, out, len);
+}
+
+void AESKey::DecryptECB(const unsigned char in[], unsigned char out[],
+    size_t len) const {
+    CheckLength(len);
+    AESEngine::DecryptECB(roundKeys, in, out, len);
+}
+
+void AESKey::EncryptCBC(const unsigned char in[], unsigned char out[],
+    size_t len, const unsigned char iv[]) const {
+    CheckLength(len);
+    unsigned char block[blockBytesLen];
+    memcpy(block, iv, blockBytesLen);
+    AESEngine::EncryptCBC(roundKeys, block, in, out, len);
+}
+
+void AESKey::DecryptCBC(const unsigned char in[], unsigned char out[],
+    size_t len, const unsigned char iv[]) const {
+    CheckLength(len);
+    unsigned char block[blockBytesLen];
+    memcpy(block, iv, blockBytesLen);
+    AESEngine::DecryptCBC(roundKeys, block, in, out, len);
+}
+
+void AESKey::EncryptCBCMulti(const AESCBCMessage messages[], size_t count) {
+    std::vector<AESEngine::CBCMessage> engine(count);
+    std::vector<unsigned char> ivs(count * blockBytesLen);
+    for (size_t i = 0; i < count; i++) {
+        const AESCBCMessage& m = messages[i];
+        if (m.key == nullptr || m.iv == nullptr) {
+            throw std::invalid_argument("CBC message needs a key and an IV");
+        }
+        m.key->CheckLength(m.len);
+        memcpy(ivs.data() + i * blockBytesLen, m.iv, blockBytesLen);
+        engine[i] = { &m.key->roundKeys, ivs.data() + i * blockBytesLen, m.in,
+            m.out, m.len };
+    }
+    AESEngine::EncryptCBCMulti(engine.data(), count);
+}
+
+void AESKey::CryptECBMulti(const AESKeyedMessage messages[], size_t count,
+    bool decrypt) {
+    std::vector<AESEngine::KeyedMessage> engine(count);
+    for (size_t i = 0; i < count; i++) {
+        const AESKeyedMessage& m = messages[i];
+        if (m.key == nullptr) {
+            throw std::invalid_argument("ECB message needs a key");
+        }
+        m.key->CheckLength(m.len);
+        engine[i] = { &m.key->roundKeys, nullptr, m.in, m.out, m.len };
+    }
+    if (decrypt) {
+        AESEngine::DecryptECBMulti(engine.data(), count);
+    }
+    else {
+        AESEngine::EncryptECBMulti(engine.data(), count);
+    }
+}
+
+void AESKey::EncryptECBMulti(const AESKeyedMessage messages[], size_t count) {
+    CryptECBMulti(messages, count, false);
+}
+
+void AESKey::DecryptECBMulti(const AESKeyedMessage messages[], size_t count) {
+    CryptECBMulti(messages, count, true);
+}
+
+void AESKey::EncryptCTRMulti(const AESKeyedMessage messages[], size_t count,
+    const AESCounterLayout& layout) {
+    CheckCounterLayout(layout);
+    std::vector<AESEngine::KeyedMessage> engine(count);
+    std::vector<unsigned char> counters(count * blockBytesLen);
+    for (size_t i = 0; i < count; i++) {
+        const AESKeyedMessage& m = messages[i];
+        if (m.key == nullptr || m.iv == nullptr) {
+            throw std::invalid_argument("CTR message needs a key and an IV");
+        }
+        memcpy(counters.data() + i * blockBytesLen, m.iv, blockBytesLen);
+        engine[i] = { &m.key->roundKeys, counters.data() + i * blockBytesLen,
+            m.in, m.out, m.len };
+    }
+    AESEngine::CryptCTRMulti(engine.data(), count, layout.counterBytes,
+        layout.bigEndian);
+}
+
+void AESKey::DecryptCTRMulti(const AESKeyedMessage messages[], size_t count,
+    const AESCounterLayout& layout) {
+    EncryptCTRMulti(messages, count, layout);
+}
+
+size_t AESKey::RecordsEncryptedLength(CipherMode mode,
+    AESRecordPadding padding, const size_t lengths[], size_t count) {
+    CheckRecordMode(mode, padding, nullptr, 0);
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += RecordLength(mode, padding, lengths[i]);
+    }
+    return total;
+}
+
+void AESKey::EncryptRecords(CipherMode mode, AESRecordPadding padding,
+    const unsigned char arena[], const size_t offsets[],
+    const size_t lengths[], size_t count, const unsigned char ivs[],
+    unsigned char out[], size_t outCapacity, size_t outOffsets[],
+    const AESCounterLayout& layout) const {
+    CheckRecordMode(mode, padding, ivs, count);
+    if (mode == CipherMode::CTR) {
+        CheckCounterLayout(layout);
+    }
+    if (RecordsEncryptedLength(mode, padding, lengths, count) > outCapacity) {
+        throw std::length_error("Output buffer is too small");
+    }
+
+    // Gather the padded records back to back, then encrypt them in place
+    size_t pos = 0;
+    for (size_t i = 0; i < count; i++) {
+        const size_t len = lengths[i];
+        const size_t padded = RecordLength(mode, padding, len);
+        memcpy(out + pos, arena + offsets[i], len);
+        memset(out + pos + len, (int)(padded - len), padded - len);
+        outOffsets[i] = pos;
+        pos += padded;
+    }
+    outOffsets[count] = pos;
+
+    unsigned char block[blockBytesLen];
+    switch (mode) {
+    case CipherMode::ECB:
+        // Records are independent blocks, so one call covers them all
+        AESEngine::EncryptECB(roundKeys, out, out, pos);
+        break;
+    case CipherMode::CBC: {
+        std::vector<AESEngine::CBCMessage> messages(count);
+        std::vector<unsigned char> chains(ivs, ivs + count * blockBytesLen);
+        for (size_t i = 0; i < count; i++) {
+            unsigned char* record = out + outOffsets[i];
+            messages[i] = { &roundKeys, chains.data() + i * blockBytesLen,
+                record, record, outOffsets[i + 1] - outOffsets[i] };
+        }
+        AESEngine::EncryptCBCMulti(messages.data(), count);
+        break;
+    }
+    case CipherMode::CFB:
+        for (size_t i = 0; i < count; i++) {
+            memcpy(block, ivs + i * blockBytesLen, blockBytesLen);
+            AESEngine::EncryptCFB(roundKeys, block, out + outOffsets[i],
+                out + outOffsets[i], outOffsets[i + 1] - outOffsets[i]);
+        }
+        break;
+    default:
+        for (size_t i = 0; i < count; i++) {
+            memcpy(block, ivs + i * blockBytesLen, blockBytesLen);
+            AESEngine::CryptCTR(roundKeys, block, layout.counterBytes,
+                layout.bigEndian, out + outOffsets[i], out + outOffsets[i],
+                lengths[i]);
+        }
+        break;
+    }
+}
+
+void AESKey::DecryptRecords(CipherMode mode, AESRecordPadding padding,
+    const unsigned char arena[], const size_t offsets[],
+    const size_t lengths[], size_t count, const unsigned char ivs[],
+    unsigned char out[], size_t outCapacity, size_t outOffsets[],
+    const AESCounterLayout& layout) const {
+    CheckRecordMode(mode, padding, ivs, count);
+    if (mode == CipherMode::CTR) {
+        CheckCounterLayout(layout);
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (mode != CipherMode::CTR) {
+            CheckLength(lengths[i]);
+        }
+        total += lengths[i];
+    }
+    if (total > outCapacity) {
+        throw std::length_error("Output buffer is too small");
+    }
+
+    size_t pos = 0;
+    for (size_t i = 0; i < count; i++) {
+        outOffsets[i] = pos;
+        pos += lengths[i];
+    }
+    outOffsets[count] = pos;
+
+    // In place, every record must already sit where it is written, or
+    // writing one record could overwrite another before it is read
+    const bool inPlace = out == arena;
+    if (inPlace) {
+        for (size_t i = 0; i < count; i++) {
+            if (offsets[i] != outOffsets[i]) {
+                throw std::invalid_argument(
+                    "Records decrypted in place must be packed back to back");
+            }
+        }
+    }
+    else if (RecordsOverlap(arena, offsets, lengths, count, out, total)) {
+        throw std::invalid_argument("Output overlaps the arena");
+    }
+
+    unsigned char block[blockBytesLen];
+    switch (mode) {
+    case CipherMode::ECB:
+    case CipherMode::CBC:
+        if (mode == CipherMode::CBC && inPlace) {
+            DecryptPackedCBC(roundKeys, out, outOffsets, count, ivs);
+            break;
+        }
+        if (!inPlace) {
+            for (size_t i = 0; i < count; i++) {
+                memcpy(out + outOffsets[i], arena + offsets[i], lengths[i]);
+            }
+        }
+        AESEngine::DecryptECB(roundKeys, out, out, total);
+        if (mode == CipherMode::CBC) {
+            // Each block still needs the ciphertext block before it (or the
+            // IV), which the untouched arena still holds
+            for (size_t i = 0; i < count; i++) {
+                unsigned char* record = out + outOffsets[i];
+                const unsigned char* previous = ivs + i * blockBytesLen;
+                for (size_t b = 0; b < lengths[i]; b += blockBytesLen) {
+                    for (unsigned int k = 0; k < blockBytesLen; k++) {
+                        record[b + k] ^= previous[k];
+                    }
+                    previous = arena + offsets[i] + b;
+                }
+            }
+        }
+        break;
+    case CipherMode::CFB:
+        for (size_t i = 0; i < count; i++) {
+            memcpy(block, ivs + i * blockBytesLen, blockBytesLen);
+            AESEngine::DecryptCFB(roundKeys, block, arena + offsets[i],
+                out + outOffsets[i], lengths[i]);
+        }
+        break;
+    default:
+        for (size_t i = 0; i < count; i++) {
+            memcpy(block, ivs + i * blockBytesLen, blockBytesLen);
+            AESEngine::CryptCTR(roundKeys, block, layout.counterBytes,
+                layout.bigEndian, arena + offsets[i], out + outOffsets[i],
+                lengths[i]);
+        }
+        break;
+    }
+
+    if (mode == CipherMode::CTR || padding != AESRecordPadding::PKCS7) {
+        return;
+    }
+
+    // Strip the padding, closing the gaps it leaves
+    size_t start = 0;
+    size_t write = 0;
+    for (size_t i = 0; i < count; i++) {
+        const unsigned char* record = out + start;
+        const size_t len = lengths[i];
+        const unsigned char pad = len > 0 ? record[len - 1] : 0;
+        bool valid = pad >= 1 && pad <= blockBytesLen;
+        for (size_t k = 1; valid && k < pad; k++) {
+            valid = record[len - 1 - k] == pad;
+        }
+        if (!valid) {
+            memset(out, 0, total);
+            throw std::runtime_error("Invalid record padding");
+        }
+        memmove(out + write, record, len - pad);
+        outOffsets[i] = write;
+        write += len - pad;
+        start += len;
+    }
+    outOffsets[count] = write;
+}
+
+void AESKey::EncryptCFB(const unsigned char in[], unsigned char out[],
+    size_t len, const unsigned char iv[]) const {
+    CheckLength(len);
+    unsigned char block[blockBytesLen];
+    memcpy(block, iv, blockBytesLen);
+    AESEngine::EncryptCFB(roundKeys, block, in, out, len);
+}
+
+void AESKey::DecryptCFB(const unsigned char in[], unsigned char out[],
+    size_t len, const unsigned char iv[]) const {
+    CheckLength(len);
+    unsigned char block[blockBytesLen];
+    memcpy(block, iv, blockBytesLen);
+    AESEngine::DecryptCFB(roundKeys, block, in, out, len);
+}
+
+void AESKey::EncryptCTR(const unsigned char in[], unsigned char out[],
+    size_t len, const unsigned char iv[],
+    const AESCounterLayout& layout) const {
+    CheckCounterLayout(layout);
+    unsigned char counter[blockBytesLen];
+    memcpy(counter, iv, blockBytesLen);
+    AESEngine::CryptCTR(roundKeys, counter, layout.counterBytes,
+        layout.bigEndian, in, out, len);
+}
+
+void AESKey::DecryptCTR(const unsigned char in[], unsigned char out[],
+    size_t len, const unsigned char iv[],
+    const AESCounterLayout& layout) const {
+    EncryptCTR(in, out, len, iv, layout);
+}
+
+void AESKey::EncryptCTRRange(const unsigned char in[], unsigned char out[],
+    size_t len, const unsigned char iv[], unsigned long long offset,
+    const AESCounterLayout& layout) const {
+    CheckCounterLayout(layout);
+    AESEngine::CryptCTRAt(roundKeys, iv, layout.counterBytes,
+        layout.bigEndian, offset, in, out, len);
+}
+
+void AESKey::DecryptCTRRange(const unsigned char in[], unsigned char out[],
+    size_t len, const unsigned char iv[], unsigned long long offset,
+    const AESCounterLayout& layout) const {
+    EncryptCTRRange(in, out, len, iv, offset, layout);
+}
+
+void AESKey::EncryptGCM(const unsigned char in[], unsigned char out[],
+    size_t len, const unsigned char iv[], size_t ivLen,
+    const unsigned char aad[], size_t aadLen, unsigned char tag[],
+    size_t tagLen) const {
+    CheckGCM(len, ivLen, tagLen);
+    unsigned char fullTag[AESEngine::GCMTagBytes];
+    AESEngine::EncryptGCM(roundKeys, iv, ivLen, aad, aadLen, in, out, len,
+        fullTag);
+    memcpy(tag, fullTag, tagLen);
+}
+
+bool AESKey::DecryptGCM(const unsigned char in[], unsigned char out[],
+    size_t len, const unsigned char iv[], size_t ivLen,
+    const unsigned char aad[], size_t aadLen, const unsigned char tag[],
+    size_t tagLen) const {
+    CheckGCM(len, ivLen, tagLen);
+    unsigned char expected[AESEngine::GCMTagBytes];
+    AESEngine::DecryptGCM(roundKeys, iv, ivLen, aad, aadLen, in, out, len,
+        expected);
+
+    // Compare every byte so the timing does not reveal where they differ
+    unsigned char diff = 0;
+    for (size_t i = 0; i < tagLen; i++) {
+        diff |= (unsigned char)(expected[i] ^ tag[i]);
+    }
+    if (diff != 0) {
+        if (len > 0) {
+            memset(out, 0, len);
+        }
+        return false;
+    }
+    return true;
+}
+
+std::vector<unsigned char> AESKey::EncryptECB(
+    const std::vector<unsigned char>& in) const {
+    std::vector<unsigned char> out(in.size());
+    EncryptECB(in.data(), out.data(), in.size());
+    return out;
+}
+
+std::vector<unsigned char> AESKey::DecryptECB(
+    const std::vector<unsigned char>& in) const {
+    std::vector<unsigned char> out(in.size());
+    DecryptECB(in.data(), out.data(), in.size());
+    return out;
+}
+
+std::vector<unsigned char> AESKey::EncryptCBC(
+    const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& iv) const {
+    CheckIV(iv);
+    std::vector<unsigned char> out(in.size());
+    EncryptCBC(in.data(), out.data(), in.size(), iv.data());
+    return out;
+}
+
+std::vector<unsigned char> AESKey::DecryptCBC(
+    const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& iv) const {
+    CheckIV(iv);
+    std::vector<unsigned char> out(in.size());
+    DecryptCBC(in.data(), out.data(), in.size(), iv.data());
+    return out;
+}
+
+std::vector<unsigned char> AESKey::EncryptCFB(
+    const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& iv) const {
+    CheckIV(iv);
+    std::vector<unsigned char> out(in.size());
+    EncryptCFB(in.data(), out.data(), in.size(), iv.data());
+    return out;
+}
+
+std::vector<unsigned char> AESKey::DecryptCFB(
+    const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& iv) const {
+    CheckIV(iv);
+    std::vector<unsigned char> out(in.size());
+    DecryptCFB(in.data(), out.data(), in.size(), iv.data());
+    return out;
+}
+
+std::vector<unsigned char> AESKey::EncryptCTR(
+    const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& iv,
+    const AESCounterLayout& layout) const {
+    CheckIV(iv);
+    std::vector<unsigned char> out(in.size());
+    EncryptCTR(in.data(), out.data(), in.size(), iv.data(), layout);
+    return out;
+}
+
+std::vector<unsigned char> AESKey::DecryptCTR(
+    const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& iv,
+    const AESCounterLayout& layout) const {
+    return EncryptCTR(in, iv, layout);
+}
+
+std::vector<unsigned char> AESKey::EncryptGCM(
+    const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& iv,
+    const std::vector<unsigned char>& aad) const {
+    std::vector<unsigned char> out(in.size() + AESEngine::GCMTagBytes);
+    EncryptGCM(in.data(), out.data(), in.size(), iv.data(), iv.size(),
+        aad.data(), aad.size(), out.data() + in.size());
+    return out;
+}
+
+std::vector<unsigned char> AESKey::DecryptGCM(
+    const std::vector<unsigned char>& in,
+    const std::vector<unsigned char>& iv,
+    const std::vector<unsigned char>& aad) const {
+    if (in.size() < AESEngine::GCMTagBytes) {
+        throw std::length_error("GCM input is shorter than its tag");
+    }
+    const size_t len = in.size() - AESEngine::GCMTagBytes;
+    std::vector<unsigned char> out(len);
+    if (!DecryptGCM(in.data(), out.data(), len, iv.data(), iv.size(),
+        aad.data(), aad.size(), in.data() + len)) {
+        throw std::runtime_error("GCM authentication failed");
+    }
+    return out;
+}
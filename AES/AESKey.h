@@ -0,0 +1,245 @@
+// AESKey.h : Expanded AES key that is set up once and reused across calls.
+#pragma once
+#ifndef _AES_KEY_H_
+#define _AES_KEY_H_
+
+#include "AES.h"
+#include "AESEngine.h"
+
+class AESKey;
+class AESReencryptor;
+class AESStream;
+class AESXTSKey;
+
+/// Mode a cipher handle is bound to. The values are part of the C ABI.
+enum class CipherMode : int { ECB = 0, CBC = 1, CFB = 2, CTR = 3, GCM = 4 };
+
+/// How AESKey::EncryptRecords fills out a record's last block. The values
+/// are part of the C ABI.
+enum class AESRecordPadding : int {
+    // 1 to 16 bytes of value n, always added, so DecryptRecords recovers
+    // every record's exact length
+    PKCS7 = 0,
+    // A partial last block is filled like ContextEncrypt fills it; whole
+    // blocks get nothing and decryption leaves the padding in place
+    Block = 1,
+};
+
+/// One message for AESKey::EncryptCBCMulti. `len` must be a multiple of 16;
+/// `iv` is 16 bytes and is not modified.
+struct AESCBCMessage {
+    const AESKey* key;
+    const unsigned char* iv;
+    const unsigned char* in;
+    unsigned char* out;
+    size_t len;
+};
+
+/// One message for the multi-key ECB and CTR calls, each under its own key.
+/// ECB lengths must be a multiple of 16 and ECB ignores `iv`; CTR takes any
+/// length and reads the 16-byte `iv` as the initial counter block without
+/// modifying it.
+struct AESKeyedMessage {
+    const AESKey* key;
+    const unsigned char* iv;
+    const unsigned char* in;
+    unsigned char* out;
+    size_t len;
+};
+
+/// Holds the encryption and decryption round keys for one AES key. The
+/// schedule is expanded in the constructor and never modified afterwards, so
+/// a single AESKey can be shared read-only by any number of threads.
+///
+/// Lengths are in bytes and, except for CTR and GCM, must be a multiple of
+/// 16. `out` may alias `in`.
+/// The chained modes take the IV by value and do not update it.
+class AES_API AESKey {
+private:
+    static constexpr unsigned int blockBytesLen = AESEngine::BlockBytes;
+
+    AESEngine::AESRoundKeys roundKeys;
+    AESKeyLength keyLength;
+
+    void CheckLength(size_t len) const;
+
+    static void CryptECBMulti(const AESKeyedMessage messages[], size_t count,
+        bool decrypt);
+
+    friend class AESReencryptor;
+    friend class AESStream;
+    friend class AESXTSKey;
+
+public:
+    // `key` must hold 16, 24 or 32 bytes to match `keyLength`.
+    AESKey(const unsigned char key[], AESKeyLength keyLength);
+
+    // The key length is taken from the vector size (16, 24 or 32 bytes).
+    explicit AESKey(const std::vector<unsigned char>& key);
+
+    AESKey(const AESKey& other) = default;
+    AESKey& operator=(const AESKey& other) = default;
+
+    ~AESKey();
+
+    AESKeyLength GetKeyLength() const { return keyLength; }
+
+    // Maps a key size in bytes (16, 24 or 32) to its AESKeyLength; throws
+    // std::invalid_argument for any other size.
+    static AESKeyLength KeyLengthForBytes(size_t len);
+
+    // The key size in bytes for `keyLength`, the inverse of
+    // KeyLengthForBytes; throws std::invalid_argument for an invalid length.
+    static size_t KeyBytesFor(AESKeyLength keyLength);
+
+    // Whether this schedule was expanded from `key`. Every byte is compared
+    // whatever the outcome, so the time taken does not depend on the key.
+    bool Matches(const unsigned char key[], AESKeyLength keyLength) const;
+
+    void EncryptECB(const unsigned char in[], unsigned char out[],
+        size_t len) const;
+
+    void DecryptECB(const unsigned char in[], unsigned char out[],
+        size_t len) const;
+
+    void EncryptCBC(const unsigned char in[], unsigned char out[], size_t len,
+        const unsigned char iv[]) const;
+
+    void DecryptCBC(const unsigned char in[], unsigned char out[], size_t len,
+        const unsigned char iv[]) const;
+
+    // CBC-encrypts many independent messages at once. A single CBC chain
+    // cannot be parallelized, so the chains of different messages are
+    // interleaved through the AES pipeline instead; with many messages
+    // this approaches ECB throughput. Keys and lengths may all differ.
+    static void EncryptCBCMulti(const AESCBCMessage messages[], size_t count);
+
+    // ECB over many messages that each have their own key (rows of a table
+    // under per-row keys, say). Blocks of different keys go through the
+    // cipher together, each lane reading its own round keys, so many keys
+    // with a few blocks each approach single-key ECB throughput. Key lengths
+    // may be mixed.
+    static void EncryptECBMulti(const AESKeyedMessage messages[],
+        size_t count);
+
+    static void DecryptECBMulti(const AESKeyedMessage messages[],
+        size_t count);
+
+    // CTR over many messages that each have their own key and counter block,
+    // batched like EncryptECBMulti; every counter follows `layout`.
+    static void EncryptCTRMulti(const AESKeyedMessage messages[],
+        size_t count, const AESCounterLayout& layout = AESCounterLayout());
+
+    static void DecryptCTRMulti(const AESKeyedMessage messages[],
+        size_t count, const AESCounterLayout& layout = AESCounterLayout());
+
+    // Encrypts `count` small records (database values, say) in one call.
+    // Record i is `lengths[i]` bytes at `offsets[i]` of `arena`; with CBC,
+    // CFB and CTR its IV is the 16 bytes at `ivs + 16 * i`. The padded
+    // results are laid out back to back in `out`, record i at
+    // `outOffsets[i]`, and `outOffsets[count]` is the total, which
+    // RecordsEncryptedLength gives up front. ECB runs as one call over the
+    // whole output and CBC interleaves the records like EncryptCBCMulti.
+    // CTR records are never padded; GCM is not available. `out` must not
+    // overlap `arena`.
+    void EncryptRecords(CipherMode mode, AESRecordPadding padding,
+        const unsigned char arena[], const size_t offsets[],
+        const size_t lengths[], size_t count, const unsigned char ivs[],
+        unsigned char out[], size_t outCapacity, size_t outOffsets[],
+        const AESCounterLayout& layout = AESCounterLayout()) const;
+
+    // The reverse of EncryptRecords. `outCapacity` must hold the sum of
+    // `lengths`; with PKCS7 padding the records come out shorter, and
+    // std::runtime_error is thrown if any record's padding is malformed.
+    // `out` may be `arena` when the records are packed back to back from
+    // its start, as EncryptRecords writes them; any other overlap throws
+    // std::invalid_argument.
+    void DecryptRecords(CipherMode mode, AESRecordPadding padding,
+        const unsigned char arena[], const size_t offsets[],
+        const size_t lengths[], size_t count, const unsigned char ivs[],
+        unsigned char out[], size_t outCapacity, size_t outOffsets[],
+        const AESCounterLayout& layout = AESCounterLayout()) const;
+
+    static size_t RecordsEncryptedLength(CipherMode mode,
+        AESRecordPadding padding, const size_t lengths[], size_t count);
+
+    void EncryptCFB(const unsigned char in[], unsigned char out[], size_t len,
+        const unsigned char iv[]) const;
+
+    void DecryptCFB(const unsigned char in[], unsigned char out[], size_t len,
+        const unsigned char iv[]) const;
+
+    // CTR accepts any `len`; encrypting and decrypting are the same
+    // operation. `iv` is the initial counter block, read through `layout`.
+    void EncryptCTR(const unsigned char in[], unsigned char out[], size_t len,
+        const unsigned char iv[],
+        const AESCounterLayout& layout = AESCounterLayout()) const;
+
+    void DecryptCTR(const unsigned char in[], unsigned char out[], size_t len,
+        const unsigned char iv[],
+        const AESCounterLayout& layout = AESCounterLayout()) const;
+
+    // Random access into a CTR stream that started at `iv`: `in` holds
+    // bytes [offset, offset + len) of it, and the counter is jumped straight
+    // to `offset`, so the cost does not grow with `offset`. Encrypting a
+    // range rewrites it in place in a larger ciphertext.
+    void EncryptCTRRange(const unsigned char in[], unsigned char out[],
+        size_t len, const unsigned char iv[], unsigned long long offset,
+        const AESCounterLayout& layout = AESCounterLayout()) const;
+
+    void DecryptCTRRange(const unsigned char in[], unsigned char out[],
+        size_t len, const unsigned char iv[], unsigned long long offset,
+        const AESCounterLayout& layout = AESCounterLayout()) const;
+
+    // GCM (NIST SP 800-38D) encrypts any `len` and authenticates it together
+    // with `aadLen` bytes of `aad`. `iv` may be any non-empty length; 12 bytes
+    // is the fast path. The tag is `tagLen` bytes: 16, 15, 14, 13, 12, 8 or 4.
+    void EncryptGCM(const unsigned char in[], unsigned char out[], size_t len,
+        const unsigned char iv[], size_t ivLen, const unsigned char aad[],
+        size_t aadLen, unsigned char tag[], size_t tagLen = 16) const;
+
+    // Returns false when `tag` does not match; `out` is then zeroed so
+    // unauthenticated plaintext is never handed back.
+    bool DecryptGCM(const unsigned char in[], unsigned char out[], size_t len,
+        const unsigned char iv[], size_t ivLen, const unsigned char aad[],
+        size_t aadLen, const unsigned char tag[], size_t tagLen = 16) const;
+
+    std::vector<unsigned char> EncryptECB(
+        const std::vector<unsigned char>& in) const;
+
+    std::vector<unsigned char> DecryptECB(
+        const std::vector<unsigned char>& in) const;
+
+    std::vector<unsigned char> EncryptCBC(const std::vector<unsigned char>& in,
+        const std::vector<unsigned char>& iv) const;
+
+    std::vector<unsigned char> DecryptCBC(const std::vector<unsigned char>& in,
+        const std::vector<unsigned char>& iv) const;
+
+    std::vector<unsigned char> EncryptCFB(const std::vector<unsigned char>& in,
+        const std::vector<unsigned char>& iv) const;
+
+    std::vector<unsigned char> DecryptCFB(const std::vector<unsigned char>& in,
+        const std::vector<unsigned char>& iv) const;
+
+    std::vector<unsigned char> EncryptCTR(const std::vector<unsigned char>& in,
+        const std::vector<unsigned char>& iv,
+        const AESCounterLayout& layout = AESCounterLayout()) const;
+
+    std::vector<unsigned char> DecryptCTR(const std::vector<unsigned char>& in,
+        const std::vector<unsigned char>& iv,
+        const AESCounterLayout& layout = AESCounterLayout()) const;
+
+    // Returns the ciphertext followed by the 16-byte tag.
+    std::vector<unsigned char> EncryptGCM(const std::vector<unsigned char>& in,
+        const std::vector<unsigned char>& iv,
+        const std::vector<unsigned char>& aad = {}) const;
+
+    // `in` is ciphertext followed by the 16-byte tag; throws
+    // std::runtime_error when authentication fails.
+    std::vector<unsigned char> DecryptGCM(const std::vector<unsigned char>& in,
+        const std::vector<unsigned char>& iv,
+        const std::vector<unsigned char>& aad = {}) const;
+};
+
+#endif  // _AES_KEY_H_
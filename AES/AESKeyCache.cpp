@@ -0,0 +1,186 @@
+#include "pch.h"
+#include "AESKeyCache.h"
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+
+namespace {
+
+// Enough shards that threads serving different tenants rarely meet on a
+// lock; a power of two, picked by the top bits of the fingerprint
+static constexpr size_t Shards = 16;
+static_assert(Shards == 16, "CachedKey picks the shard by four bits");
+
+struct Entry {
+    uint64_t fingerprint;
+    std::shared_ptr<const AESKey> key;
+};
+
+// One independently locked LRU list, most recently used first. Each shard
+// gets its own cache lines so the locks do not false-share.
+struct alignas(64) Shard {
+    std::mutex mutex;
+    std::list<Entry> lru;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    unsigned long long hits = 0;
+    unsigned long long misses = 0;
+    unsigned long long evictions = 0;
+};
+
+struct Cache {
+    Shard shards[Shards];
+    std::atomic<size_t> capacity{ AESKeyCacheOptions().capacity };
+    std::atomic<size_t> entries{ 0 };  // across all shards
+    uint64_t seed;
+
+    Cache() {
+        std::random_device rd;
+        seed = ((uint64_t)rd() << 32) ^ rd();
+    }
+};
+
+Cache& GetCache() {
+    static Cache cache;
+    return cache;
+}
+
+// Seeded multiply-xorshift hash of the key. The seed keeps fingerprints
+// from being predicted across processes; a match is still confirmed
+// against the schedule, so this only has to spread keys well.
+uint64_t Fingerprint(const Cache& cache, const unsigned char key[],
+    size_t len) {
+    uint64_t h = cache.seed ^ (len * 0x9e3779b97f4a7c15ull);
+    for (size_t i = 0; i < len; i += 8) {
+        uint64_t word;
+        memcpy(&word, key + i, 8);
+        h = (h ^ word) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    h *= 0xc4ceb9fe1a85ec53ull;
+    return h ^ (h >> 29);
+}
+
+// Evicts `shard`'s least recently used keys while the whole cache is over
+// capacity, keeping at least `keep` of them. The caller holds shard.mutex.
+// Returns whether the cache is still over capacity.
+bool Trim(Cache& cache, Shard& shard, size_t keep) {
+    while (cache.entries > cache.capacity && shard.lru.size() > keep) {
+        shard.index.erase(shard.lru.back().fingerprint);
+        shard.lru.pop_back();
+        shard.evictions++;
+        cache.entries--;
+    }
+    return cache.entries > cache.capacity;
+}
+
+// Brings the cache back to capacity, one key from each shard in turn so
+// that no shard is emptied for the others; `first` is tried first.
+void TrimAll(Cache& cache, size_t first) {
+    bool evicted = true;
+    while (cache.entries > cache.capacity && evicted) {
+        evicted = false;
+        for (size_t i = 0; i < Shards; i++) {
+            Shard& shard = cache.shards[(first + i) % Shards];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (cache.entries > cache.capacity && !shard.lru.empty()) {
+                shard.index.erase(shard.lru.back().fingerprint);
+                shard.lru.pop_back();
+                shard.evictions++;
+                cache.entries--;
+                evicted = true;
+            }
+        }
+    }
+}
+
+}  // namespace
+
+void SetKeyCacheOptions(const AESKeyCacheOptions& options) {
+    Cache& cache = GetCache();
+    cache.capacity = options.capacity;
+    TrimAll(cache, 0);
+}
+
+AESKeyCacheOptions GetKeyCacheOptions() {
+    AESKeyCacheOptions options;
+    options.capacity = GetCache().capacity;
+    return options;
+}
+
+AESKeyCacheStats GetKeyCacheStats() {
+    Cache& cache = GetCache();
+    AESKeyCacheStats stats = {};
+    stats.capacity = cache.capacity;
+    for (Shard& shard : cache.shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.evictions += shard.evictions;
+        stats.entries += shard.lru.size();
+    }
+    return stats;
+}
+
+void ClearKeyCache() {
+    Cache& cache = GetCache();
+    for (Shard& shard : cache.shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        cache.entries -= shard.lru.size();
+        shard.index.clear();
+        shard.lru.clear();
+    }
+}
+
+std::shared_ptr<const AESKey> CachedKey(const unsigned char key[],
+    AESKeyLength keyLength) {
+    Cache& cache = GetCache();
+    const size_t len = AESKey::KeyBytesFor(keyLength);
+    if (cache.capacity == 0) {
+        return std::make_shared<const AESKey>(key, keyLength);
+    }
+
+    const uint64_t fingerprint = Fingerprint(cache, key, len);
+    // The top bits pick the shard; the map buckets by the low ones
+    const size_t shardIndex = (size_t)(fingerprint >> 60);
+    Shard& shard = cache.shards[shardIndex];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.index.find(fingerprint);
+        if (found != shard.index.end() &&
+            found->second->key->Matches(key, keyLength)) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+            shard.hits++;
+            return found->second->key;
+        }
+        shard.misses++;
+    }
+
+    // Expand outside the lock; if another thread cached the key meanwhile,
+    // or a colliding key holds the slot, the newer schedule replaces it
+    std::shared_ptr<const AESKey> expanded =
+        std::make_shared<const AESKey>(key, keyLength);
+    bool over = false;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.index.find(fingerprint);
+        if (found != shard.index.end()) {
+            found->second->key = expanded;
+            shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+        }
+        else {
+            shard.lru.push_front({ fingerprint, expanded });
+            shard.index[fingerprint] = shard.lru.begin();
+            cache.entries++;
+            // This shard's own oldest keys go first, but never the new one
+            over = Trim(cache, shard, 1);
+        }
+    }
+
+    // Only the new key is left here; take the oldest from the other shards
+    if (over) {
+        TrimAll(cache, shardIndex + 1);
+    }
+    return expanded;
+}
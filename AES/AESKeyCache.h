@@ -0,0 +1,48 @@
+// AESKeyCache.h : Process-wide cache of expanded key schedules.
+#pragma once
+#ifndef _AES_KEY_CACHE_H_
+#define _AES_KEY_CACHE_H_
+
+#include "AESKey.h"
+#include <memory>
+
+/// Size of the schedule cache behind the one-shot calls (the AES methods and
+/// the Encrypt/Decrypt style exports), which take raw key bytes on every
+/// call. `capacity` bounds the number of keys across all shards; 0 turns
+/// caching off and drops every cached schedule.
+struct AESKeyCacheOptions {
+    size_t capacity = 4096;  // about 2 MiB of schedules
+};
+
+struct AESKeyCacheStats {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    size_t entries;
+    size_t capacity;
+};
+
+// Shrinking the capacity evicts keys right away, the least recently used
+// of each shard first.
+AES_API void SetKeyCacheOptions(const AESKeyCacheOptions& options);
+
+AES_API AESKeyCacheOptions GetKeyCacheOptions();
+
+AES_API AESKeyCacheStats GetKeyCacheStats();
+
+// Drops and wipes every cached schedule; the counters keep running.
+AES_API void ClearKeyCache();
+
+// The expanded schedule for `key`, from the cache when it holds it and
+// expanded (and cached) otherwise. Keys are spread over independently
+// locked shards by a hash seeded per process, and a hit is confirmed
+// against the cached schedule itself, so a hash collision can only cost a
+// miss. Recency is tracked per shard: a full cache evicts the least
+// recently used key of the shard taking the new one, or of the other
+// shards when that shard holds nothing else, so the order is only
+// approximately LRU across the whole cache. The returned
+// schedule stays valid while it is held, even if it is evicted meanwhile.
+AES_API std::shared_ptr<const AESKey> CachedKey(const unsigned char key[],
+    AESKeyLength keyLength);
+
+#endif  // _AES_KEY_CACHE_H_
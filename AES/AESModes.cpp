@@ -0,0 +1,702 @@
+#include "pch.h"
+#include "AESModes.h"
+#include "AESParallel.h"
+#include <cstring>
+#include <vector>
+
+namespace AESEngine {
+
+namespace {
+
+// Blocks handed to a backend per call by the parallel decryption modes;
+// sized to keep the scratch buffer in L1.
+static constexpr size_t ChunkBlocks = 32;
+
+inline void XorBlock(const unsigned char* a, const unsigned char* b,
+    unsigned char* c) {
+    for (unsigned int i = 0; i < BlockBytes; i++) {
+        c[i] = a[i] ^ b[i];
+    }
+}
+
+// Adds `n` to the counter field of a CTR counter block, wrapping within the
+// field so the nonce bytes are never touched.
+void AddCounter(unsigned char counter[], unsigned int counterBytes,
+    bool bigEndian, unsigned long long n) {
+    unsigned int carry = 0;
+    for (unsigned int i = 0; i < counterBytes && (n != 0 || carry != 0); i++) {
+        unsigned char& byte = bigEndian ? counter[BlockBytes - 1 - i]
+                                        : counter[BlockBytes - counterBytes + i];
+        const unsigned int sum = byte + (unsigned int)(n & 0xFF) + carry;
+        byte = (unsigned char)sum;
+        carry = sum >> 8;
+        n >>= 8;
+    }
+}
+
+// c = a ^ b over n bytes, a machine word at a time
+inline void XorBytes(const unsigned char* a, const unsigned char* b,
+    unsigned char* c, size_t n) {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        x ^= y;
+        memcpy(c + i, &x, sizeof(x));
+    }
+    for (; i < n; i++) {
+        c[i] = a[i] ^ b[i];
+    }
+}
+
+// Full CTR blocks on one thread: counters are laid out ChunkBlocks at a time
+// and encrypted in one backend call, so the wide kernels see a full batch.
+// Within a run where only the lowest counter byte changes, each block is the
+// saved counter with that one byte patched; stepping a single counter block
+// in place would stall every copy on store forwarding.
+void CryptCTRBlocks(const Backend& backend, const AESRoundKeys& rk,
+    unsigned char counter[], unsigned int counterBytes, bool bigEndian,
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    if (backend.cryptCTR32 != nullptr && bigEndian && counterBytes >= 4) {
+        // The fused kernel only steps the low 32 bits; split at each wrap
+        // and carry into the rest of the field here.
+        while (blocks > 0) {
+            const uint32_t low32 = (uint32_t)counter[12] << 24 |
+                (uint32_t)counter[13] << 16 | (uint32_t)counter[14] << 8 |
+                counter[15];
+            const unsigned long long room = 0x100000000ull - low32;
+            const size_t n = blocks < room ? blocks : (size_t)room;
+            unsigned char next[BlockBytes];
+            memcpy(next, counter, BlockBytes);
+            AddCounter(next, counterBytes, bigEndian, n);
+            backend.cryptCTR32(rk, counter, in, out, n);
+            memcpy(counter, next, BlockBytes);
+            in += n * BlockBytes;
+            out += n * BlockBytes;
+            blocks -= n;
+        }
+        return;
+    }
+
+    const unsigned int low = bigEndian ? BlockBytes - 1
+                                       : BlockBytes - counterBytes;
+    unsigned char buffer[ChunkBlocks * BlockBytes];
+    const size_t used =
+        (blocks < ChunkBlocks ? blocks : ChunkBlocks) * BlockBytes;
+    while (blocks > 0) {
+        const size_t n = blocks < ChunkBlocks ? blocks : ChunkBlocks;
+        size_t i = 0;
+        while (i < n) {
+            const unsigned int start = counter[low];
+            size_t run = 256 - start;
+            if (run > n - i) {
+                run = n - i;
+            }
+            for (size_t j = 0; j < run; j++) {
+                memcpy(buffer + (i + j) * BlockBytes, counter, BlockBytes);
+                buffer[(i + j) * BlockBytes + low] = (unsigned char)(start + j);
+            }
+            AddCounter(counter, counterBytes, bigEndian, run);
+            i += run;
+        }
+        backend.encryptBlocks(rk, buffer, buffer, n);
+        XorBytes(in, buffer, out, n * BlockBytes);
+        in += n * BlockBytes;
+        out += n * BlockBytes;
+        blocks -= n;
+    }
+    // The keystream would give the plaintext away with the ciphertext
+    SecureZero(buffer, used);
+}
+
+// Decrypts a run of chained-mode blocks on one thread, leaving the last
+// ciphertext block in `iv`
+typedef void (*ChainedDecrypt)(const Backend& backend, const AESRoundKeys& rk,
+    unsigned char iv[], const unsigned char* in, unsigned char* out,
+    size_t blocks);
+
+void DecryptCBCBlocks(const Backend& backend, const AESRoundKeys& rk,
+    unsigned char iv[], const unsigned char* in, unsigned char* out,
+    size_t blocks) {
+    unsigned char buffer[ChunkBlocks * BlockBytes];
+    const size_t used =
+        (blocks < ChunkBlocks ? blocks : ChunkBlocks) * BlockBytes;
+
+    // P[i] = D(C[i]) ^ C[i-1]. Each chunk is decrypted into scratch first so
+    // the ciphertext it chains on survives when out aliases in.
+    while (blocks > 0) {
+        const size_t n = blocks < ChunkBlocks ? blocks : ChunkBlocks;
+        backend.decryptBlocks(rk, in, buffer, n);
+        XorBlock(buffer, iv, buffer);
+        for (size_t i = 1; i < n; i++) {
+            XorBlock(buffer + i * BlockBytes, in + (i - 1) * BlockBytes,
+                buffer + i * BlockBytes);
+        }
+        memcpy(iv, in + (n - 1) * BlockBytes, BlockBytes);
+        memcpy(out, buffer, n * BlockBytes);
+        in += n * BlockBytes;
+        out += n * BlockBytes;
+        blocks -= n;
+    }
+    SecureZero(buffer, used);
+}
+
+void DecryptCFBBlocks(const Backend& backend, const AESRoundKeys& rk,
+    unsigned char iv[], const unsigned char* in, unsigned char* out,
+    size_t blocks) {
+    unsigned char buffer[ChunkBlocks * BlockBytes];
+    const size_t used =
+        (blocks < ChunkBlocks ? blocks : ChunkBlocks) * BlockBytes;
+
+    // P[i] = E(C[i-1]) ^ C[i]: the keystream inputs are all known up front
+    while (blocks > 0) {
+        const size_t n = blocks < ChunkBlocks ? blocks : ChunkBlocks;
+        memcpy(buffer, iv, BlockBytes);
+        memcpy(buffer + BlockBytes, in, (n - 1) * BlockBytes);
+        memcpy(iv, in + (n - 1) * BlockBytes, BlockBytes);
+        backend.encryptBlocks(rk, buffer, buffer, n);
+        for (size_t i = 0; i < n; i++) {
+            XorBlock(buffer + i * BlockBytes, in + i * BlockBytes,
+                out + i * BlockBytes);
+        }
+        in += n * BlockBytes;
+        out += n * BlockBytes;
+        blocks -= n;
+    }
+    SecureZero(buffer, used);
+}
+
+// CBC and CFB decryption only look back one ciphertext block, so the input
+// splits into segments that each start from the block before them. The
+// segment seeds are copied out before any thread runs: with out == in a
+// neighbouring thread would otherwise overwrite them.
+void DecryptChained(ChainedDecrypt decrypt, const AESRoundKeys& rk,
+    unsigned char iv[], const unsigned char* in, unsigned char* out,
+    size_t blocks) {
+    const Backend& backend = *GetDispatch().bulk;
+    const size_t chunkBlocks = ParallelChunkBytes() / BlockBytes;
+    const size_t segmentBlocks = chunkBlocks > 0 ? chunkBlocks : 1;
+    const size_t segments = (blocks + segmentBlocks - 1) / segmentBlocks;
+    if (segments < 2) {
+        decrypt(backend, rk, iv, in, out, blocks);
+        return;
+    }
+
+    std::vector<unsigned char> seeds(segments * BlockBytes);
+    memcpy(seeds.data(), iv, BlockBytes);
+    for (size_t s = 1; s < segments; s++) {
+        memcpy(seeds.data() + s * BlockBytes,
+            in + (s * segmentBlocks - 1) * BlockBytes, BlockBytes);
+    }
+    memcpy(iv, in + (blocks - 1) * BlockBytes, BlockBytes);
+
+    ParallelFor(segments, segmentBlocks * BlockBytes, [&](size_t first, size_t n) {
+        const size_t start = first * segmentBlocks;
+        const size_t end = (first + n) * segmentBlocks;
+        unsigned char local[BlockBytes];
+        memcpy(local, seeds.data() + first * BlockBytes, BlockBytes);
+        decrypt(backend, rk, local, in + start * BlockBytes,
+            out + start * BlockBytes,
+            (end < blocks ? end : blocks) - start);
+    });
+}
+
+// Multi-key kernels share one Nr across a call, so the multi-key modes keep
+// a queue of pending blocks per key size and flush each when it fills.
+static constexpr size_t KeySizes = 3;
+
+inline size_t KeySizeIndex(const AESRoundKeys& rk) {
+    return (rk.Nr - 10) / 2;
+}
+
+struct KeyedQueue {
+    const AESRoundKeys* keys[ChunkBlocks];
+    const unsigned char* in[ChunkBlocks];
+    unsigned char* out[ChunkBlocks];
+    size_t count;
+};
+
+// CTR keystream blocks waiting on a KeyedQueue: block i is generated in
+// place from its counter, then XORed over bytes[i] bytes of src[i] into
+// dst[i]
+struct CTRQueue : KeyedQueue {
+    unsigned char blocks[ChunkBlocks][BlockBytes];
+    const unsigned char* src[ChunkBlocks];
+    unsigned char* dst[ChunkBlocks];
+    size_t bytes[ChunkBlocks];
+};
+
+void RunKeyed(const Backend& backend, bool decrypt, const KeyedQueue& queue) {
+    const auto kernel = decrypt ? backend.decryptBlocksMultiKey
+                                : backend.encryptBlocksMultiKey;
+    if (kernel != nullptr) {
+        kernel(queue.keys, queue.in, queue.out, queue.count);
+        return;
+    }
+    const auto single = decrypt ? backend.decryptBlocks : backend.encryptBlocks;
+    for (size_t i = 0; i < queue.count; i++) {
+        single(*queue.keys[i], queue.in[i], queue.out[i], 1);
+    }
+}
+
+void RunCTR(const Backend& backend, CTRQueue& queue) {
+    RunKeyed(backend, false, queue);
+    for (size_t i = 0; i < queue.count; i++) {
+        XorBytes(queue.src[i], queue.blocks[i], queue.dst[i], queue.bytes[i]);
+    }
+    queue.count = 0;
+}
+
+// Splits the messages of a multi-key call across threads, weighting each by
+// the average message length
+void ForEachMessage(const KeyedMessage messages[], size_t count,
+    const std::function<void(size_t first, size_t n)>& fn) {
+    if (count == 0) {
+        return;
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += messages[i].len;
+    }
+    ParallelFor(count, total / count, fn);
+}
+
+void CryptECBMulti(const KeyedMessage messages[], size_t count,
+    bool decrypt) {
+    const Backend& backend = *GetDispatch().bulk;
+    ForEachMessage(messages, count, [&](size_t first, size_t n) {
+        KeyedQueue queues[KeySizes];
+        for (KeyedQueue& queue : queues) {
+            queue.count = 0;
+        }
+        for (size_t i = first; i < first + n; i++) {
+            const KeyedMessage& m = messages[i];
+            const size_t blocks = m.len / BlockBytes;
+            if (blocks >= ChunkBlocks) {
+                (decrypt ? backend.decryptBlocks : backend.encryptBlocks)(
+                    *m.rk, m.in, m.out, blocks);
+                continue;
+            }
+            // Locals, since stores into the queue could alias the message
+            const AESRoundKeys* rk = m.rk;
+            const unsigned char* in = m.in;
+            unsigned char* out = m.out;
+            KeyedQueue& queue = queues[KeySizeIndex(*rk)];
+            size_t slot = queue.count;
+            for (size_t j = 0; j < blocks; j++) {
+                queue.keys[slot] = rk;
+                queue.in[slot] = in + j * BlockBytes;
+                queue.out[slot] = out + j * BlockBytes;
+                if (++slot == ChunkBlocks) {
+                    queue.count = slot;
+                    RunKeyed(backend, decrypt, queue);
+                    slot = 0;
+                }
+            }
+            queue.count = slot;
+        }
+        for (KeyedQueue& queue : queues) {
+            if (queue.count > 0) {
+                RunKeyed(backend, decrypt, queue);
+            }
+        }
+    });
+}
+
+// Blocks a re-encryption decrypts and encrypts again per step: 4 KiB of
+// plaintext, which never leaves L1.
+static constexpr size_t RekeyBlocks = 256;
+
+void DecryptSide(const Backend& backend, const RekeySide& side,
+    unsigned char iv[], const unsigned char* in, unsigned char* out,
+    size_t blocks) {
+    switch (side.mode) {
+    case Mode::ECB:
+        backend.decryptBlocks(*side.rk, in, out, blocks);
+        break;
+    case Mode::CBC:
+        DecryptCBCBlocks(backend, *side.rk, iv, in, out, blocks);
+        break;
+    case Mode::CFB:
+        DecryptCFBBlocks(backend, *side.rk, iv, in, out, blocks);
+        break;
+    default:
+        CryptCTRBlocks(backend, *side.rk, iv, side.counterBytes,
+            side.bigEndian, in, out, blocks);
+        break;
+    }
+}
+
+void EncryptSide(const Backend& backend, const Backend& serial,
+    const RekeySide& side, unsigned char iv[], const unsigned char* in,
+    unsigned char* out, size_t blocks) {
+    switch (side.mode) {
+    case Mode::ECB:
+        backend.encryptBlocks(*side.rk, in, out, blocks);
+        break;
+    case Mode::CBC:
+        serial.encryptCBC(*side.rk, iv, in, out, blocks);
+        break;
+    case Mode::CFB:
+        serial.encryptCFB(*side.rk, iv, in, out, blocks);
+        break;
+    default:
+        CryptCTRBlocks(backend, *side.rk, iv, side.counterBytes,
+            side.bigEndian, in, out, blocks);
+        break;
+    }
+}
+
+// Re-encrypts a stretch of whole blocks on one thread, `fromIV` and `toIV`
+// being the chain or counter state at its start. Each step reads its input
+// before writing output over it, and the CBC/CFB decryption keeps its own
+// copy of the block it chains on, so `out` may alias `in`.
+void ReencryptBlocks(const Backend& backend, const Backend& serial,
+    const RekeySide& from, unsigned char fromIV[], const RekeySide& to,
+    unsigned char toIV[], const unsigned char* in, unsigned char* out,
+    size_t blocks) {
+    unsigned char plain[RekeyBlocks * BlockBytes];
+    while (blocks > 0) {
+        const size_t n = blocks < RekeyBlocks ? blocks : RekeyBlocks;
+        DecryptSide(backend, from, fromIV, in, plain, n);
+        EncryptSide(backend, serial, to, toIV, plain, out, n);
+        in += n * BlockBytes;
+        out += n * BlockBytes;
+        blocks -= n;
+    }
+    SecureZero(plain, sizeof(plain));
+}
+
+}  // namespace
+
+void EncryptECB(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t len) {
+    const Backend& backend = *GetDispatch().bulk;
+    ParallelFor(len / BlockBytes, BlockBytes, [&](size_t first, size_t n) {
+        backend.encryptBlocks(rk, in + first * BlockBytes,
+            out + first * BlockBytes, n);
+    });
+}
+
+void DecryptECB(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t len) {
+    const Backend& backend = *GetDispatch().bulk;
+    ParallelFor(len / BlockBytes, BlockBytes, [&](size_t first, size_t n) {
+        backend.decryptBlocks(rk, in + first * BlockBytes,
+            out + first * BlockBytes, n);
+    });
+}
+
+void EncryptECBMulti(const KeyedMessage messages[], size_t count) {
+    CryptECBMulti(messages, count, false);
+}
+
+void DecryptECBMulti(const KeyedMessage messages[], size_t count) {
+    CryptECBMulti(messages, count, true);
+}
+
+void EncryptCBC(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t len) {
+    GetDispatch().serial->encryptCBC(rk, iv, in, out, len / BlockBytes);
+}
+
+void DecryptCBC(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t len) {
+    DecryptChained(DecryptCBCBlocks, rk, iv, in, out, len / BlockBytes);
+}
+
+void EncryptCBCMulti(const CBCMessage messages[], size_t count) {
+    const Backend& backend = *GetDispatch().bulk;
+    const Backend& serial = *GetDispatch().serial;
+    if (backend.cbcLanes == 0) {
+        for (size_t i = 0; i < count; i++) {
+            const CBCMessage& m = messages[i];
+            serial.encryptCBC(*m.rk, m.iv, m.in, m.out, m.len / BlockBytes);
+        }
+        return;
+    }
+
+    static const unsigned char zero[BlockBytes] = {};
+    const unsigned int width = backend.cbcLanes;
+    CBCLanes lanes = {};
+    const CBCMessage* owner[MaxCBCLanes];
+    size_t left[MaxCBCLanes];
+
+    // Lanes share one round count, so each key size gets its own pass
+    for (unsigned int Nr = 10; Nr <= MaxRounds; Nr += 2) {
+        lanes.Nr = Nr;
+        for (unsigned int l = 0; l < width; l++) {
+            owner[l] = nullptr;
+            left[l] = 0;
+            lanes.in[l] = zero;
+            lanes.out[l] = lanes.sink;
+            lanes.stride[l] = 0;
+        }
+
+        size_t next = 0;
+        for (;;) {
+            // Hand every idle lane the next message of this key size
+            unsigned int active = 0;
+            for (unsigned int l = 0; l < width; l++) {
+                while (owner[l] == nullptr && next < count) {
+                    const CBCMessage& m = messages[next++];
+                    if (m.rk->Nr != Nr || m.len < BlockBytes) {
+                        continue;
+                    }
+                    for (unsigned int round = 0; round <= Nr; round++) {
+                        memcpy(lanes.keys[round][l],
+                            m.rk->enc + round * BlockBytes, BlockBytes);
+                    }
+                    memcpy(lanes.chain[l], m.iv, BlockBytes);
+                    lanes.in[l] = m.in;
+                    lanes.out[l] = m.out;
+                    lanes.stride[l] = BlockBytes;
+                    owner[l] = &m;
+                    left[l] = m.len / BlockBytes;
+                }
+                active += owner[l] != nullptr ? 1 : 0;
+            }
+            if (active == 0) {
+                break;
+            }
+
+            // A lone chain gains nothing from the other lanes; finish it
+            // on the serial kernel.
+            if (active == 1 && next == count) {
+                for (unsigned int l = 0; l < width; l++) {
+                    if (owner[l] != nullptr) {
+                        memcpy(owner[l]->iv, lanes.chain[l], BlockBytes);
+                        serial.encryptCBC(*owner[l]->rk, owner[l]->iv,
+                            lanes.in[l], lanes.out[l], left[l]);
+                        owner[l] = nullptr;
+                    }
+                }
+                break;
+            }
+
+            // Run until the shortest chain ends, then retire it
+            size_t steps = SIZE_MAX;
+            for (unsigned int l = 0; l < width; l++) {
+                if (owner[l] != nullptr && left[l] < steps) {
+                    steps = left[l];
+                }
+            }
+            backend.encryptCBCLanes(lanes, steps);
+            for (unsigned int l = 0; l < width; l++) {
+                if (owner[l] == nullptr) {
+                    continue;
+                }
+                left[l] -= steps;
+                if (left[l] == 0) {
+                    memcpy(owner[l]->iv, lanes.chain[l], BlockBytes);
+                    owner[l] = nullptr;
+                    lanes.in[l] = zero;
+                    lanes.out[l] = lanes.sink;
+                    lanes.stride[l] = 0;
+                }
+            }
+        }
+    }
+}
+
+void EncryptCFB(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t len) {
+    GetDispatch().serial->encryptCFB(rk, iv, in, out, len / BlockBytes);
+}
+
+void DecryptCFB(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t len) {
+    DecryptChained(DecryptCFBBlocks, rk, iv, in, out, len / BlockBytes);
+}
+
+void CryptCTR(const AESRoundKeys& rk, unsigned char counter[],
+    unsigned int counterBytes, bool bigEndian, const unsigned char* in,
+    unsigned char* out, size_t len) {
+    const Backend& backend = *GetDispatch().bulk;
+    const size_t blocks = len / BlockBytes;
+
+    // Every block's counter is known up front, so each thread seeks its own
+    // copy of the counter to the start of its range.
+    ParallelFor(blocks, BlockBytes,
+        [&](size_t first, size_t n) {
+            unsigned char local[BlockBytes];
+            memcpy(local, counter, BlockBytes);
+            AddCounter(local, counterBytes, bigEndian, first);
+            CryptCTRBlocks(backend, rk, local, counterBytes, bigEndian,
+                in + first * BlockBytes, out + first * BlockBytes, n);
+        });
+    AddCounter(counter, counterBytes, bigEndian, blocks);
+
+    const size_t tail = len % BlockBytes;
+    if (tail > 0) {
+        unsigned char keystream[BlockBytes];
+        backend.encryptBlocks(rk, counter, keystream, 1);
+        AddCounter(counter, counterBytes, bigEndian, 1);
+        XorBytes(in + blocks * BlockBytes, keystream, out + blocks * BlockBytes,
+            tail);
+        SecureZero(keystream, sizeof(keystream));
+    }
+}
+
+void CryptCTRAt(const AESRoundKeys& rk, const unsigned char counter[],
+    unsigned int counterBytes, bool bigEndian, unsigned long long offset,
+    const unsigned char* in, unsigned char* out, size_t len) {
+    unsigned char local[BlockBytes];
+    memcpy(local, counter, BlockBytes);
+    AddCounter(local, counterBytes, bigEndian, offset / BlockBytes);
+
+    // An unaligned start uses the rest of its block's keystream first
+    const size_t skip = (size_t)(offset % BlockBytes);
+    if (skip > 0 && len > 0) {
+        unsigned char keystream[BlockBytes];
+        GetDispatch().bulk->encryptBlocks(rk, local, keystream, 1);
+        AddCounter(local, counterBytes, bigEndian, 1);
+        const size_t head = len < BlockBytes - skip ? len : BlockBytes - skip;
+        XorBytes(in, keystream + skip, out, head);
+        SecureZero(keystream, sizeof(keystream));
+        in += head;
+        out += head;
+        len -= head;
+    }
+    CryptCTR(rk, local, counterBytes, bigEndian, in, out, len);
+}
+
+void CryptCTRMulti(const KeyedMessage messages[], size_t count,
+    unsigned int counterBytes, bool bigEndian) {
+    const Backend& backend = *GetDispatch().bulk;
+    ForEachMessage(messages, count, [&](size_t first, size_t n) {
+        CTRQueue queues[KeySizes];
+        for (CTRQueue& queue : queues) {
+            queue.count = 0;
+            for (size_t i = 0; i < ChunkBlocks; i++) {
+                queue.in[i] = queue.blocks[i];
+                queue.out[i] = queue.blocks[i];
+            }
+        }
+        for (size_t i = first; i < first + n; i++) {
+            const KeyedMessage& m = messages[i];
+            const unsigned char* in = m.in;
+            unsigned char* out = m.out;
+            size_t len = m.len;
+
+            // A long message fills batches by itself; only its partial last
+            // block joins the queue
+            const size_t blocks = len / BlockBytes;
+            if (blocks >= ChunkBlocks) {
+                CryptCTRBlocks(backend, *m.rk, m.counter, counterBytes,
+                    bigEndian, in, out, blocks);
+                in += blocks * BlockBytes;
+                out += blocks * BlockBytes;
+                len -= blocks * BlockBytes;
+            }
+
+            CTRQueue& queue = queues[KeySizeIndex(*m.rk)];
+            while (len > 0) {
+                const size_t slot = queue.count;
+                const size_t bytes = len < BlockBytes ? len : BlockBytes;
+                memcpy(queue.blocks[slot], m.counter, BlockBytes);
+                AddCounter(m.counter, counterBytes, bigEndian, 1);
+                queue.keys[slot] = m.rk;
+                queue.src[slot] = in;
+                queue.dst[slot] = out;
+                queue.bytes[slot] = bytes;
+                in += bytes;
+                out += bytes;
+                len -= bytes;
+                if (++queue.count == ChunkBlocks) {
+                    RunCTR(backend, queue);
+                }
+            }
+        }
+        for (CTRQueue& queue : queues) {
+            if (queue.count > 0) {
+                RunCTR(backend, queue);
+            }
+            SecureZero(queue.blocks, sizeof(queue.blocks));
+        }
+    });
+}
+
+void Reencrypt(const RekeySide& from, const RekeySide& to,
+    const unsigned char* in, unsigned char* out, size_t len) {
+    const Backend& backend = *GetDispatch().bulk;
+    const Backend& serial = *GetDispatch().serial;
+    const size_t blocks = len / BlockBytes;
+
+    if (to.mode == Mode::CBC || to.mode == Mode::CFB) {
+        // The new chain is serial, so the whole pass runs on this thread
+        ReencryptBlocks(backend, serial, from, from.iv, to, to.iv, in, out,
+            blocks);
+    }
+    else if (blocks > 0) {
+        // Every segment's starting state is known up front: the old side
+        // chains on the ciphertext block before it or seeks its counter, the
+        // new side seeks its counter. The old side's seeds are copied out
+        // before any thread runs, since with out == in a neighbouring thread
+        // would overwrite them.
+        const size_t chunkBlocks = ParallelChunkBytes() / BlockBytes;
+        const size_t segmentBlocks = chunkBlocks > 0 ? chunkBlocks : 1;
+        const size_t segments = (blocks + segmentBlocks - 1) / segmentBlocks;
+        const bool fromChained = from.mode == Mode::CBC ||
+            from.mode == Mode::CFB;
+        std::vector<unsigned char> seeds(segments * BlockBytes);
+        memcpy(seeds.data(), from.iv, BlockBytes);
+        for (size_t s = 1; s < segments; s++) {
+            unsigned char* seed = seeds.data() + s * BlockBytes;
+            if (fromChained) {
+                memcpy(seed, in + (s * segmentBlocks - 1) * BlockBytes,
+                    BlockBytes);
+            }
+            else if (from.mode == Mode::CTR) {
+                memcpy(seed, from.iv, BlockBytes);
+                AddCounter(seed, from.counterBytes, from.bigEndian,
+                    s * segmentBlocks);
+            }
+        }
+        if (fromChained) {
+            memcpy(from.iv, in + (blocks - 1) * BlockBytes, BlockBytes);
+        }
+        else if (from.mode == Mode::CTR) {
+            AddCounter(from.iv, from.counterBytes, from.bigEndian, blocks);
+        }
+        unsigned char toStart[BlockBytes];
+        memcpy(toStart, to.iv, BlockBytes);
+        if (to.mode == Mode::CTR) {
+            AddCounter(to.iv, to.counterBytes, to.bigEndian, blocks);
+        }
+
+        ParallelFor(segments, segmentBlocks * BlockBytes,
+            [&](size_t first, size_t n) {
+                const size_t start = first * segmentBlocks;
+                const size_t end = (first + n) * segmentBlocks;
+                unsigned char fromLocal[BlockBytes];
+                unsigned char toLocal[BlockBytes];
+                memcpy(fromLocal, seeds.data() + first * BlockBytes,
+                    BlockBytes);
+                memcpy(toLocal, toStart, BlockBytes);
+                if (to.mode == Mode::CTR) {
+                    AddCounter(toLocal, to.counterBytes, to.bigEndian, start);
+                }
+                ReencryptBlocks(backend, serial, from, fromLocal, to, toLocal,
+                    in + start * BlockBytes, out + start * BlockBytes,
+                    (end < blocks ? end : blocks) - start);
+            });
+    }
+
+    // Only CTR to CTR has a partial last block: both keystreams at once
+    const size_t tail = len % BlockBytes;
+    if (tail > 0) {
+        unsigned char keystream[2][BlockBytes];
+        backend.encryptBlocks(*from.rk, from.iv, keystream[0], 1);
+        backend.encryptBlocks(*to.rk, to.iv, keystream[1], 1);
+        AddCounter(from.iv, from.counterBytes, from.bigEndian, 1);
+        AddCounter(to.iv, to.counterBytes, to.bigEndian, 1);
+        XorBlock(keystream[0], keystream[1], keystream[0]);
+        XorBytes(in + blocks * BlockBytes, keystream[0],
+            out + blocks * BlockBytes, tail);
+        SecureZero(keystream[0], sizeof(keystream));
+    }
+}
+
+}  // namespace AESEngine
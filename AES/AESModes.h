@@ -0,0 +1,116 @@
+// AESModes.h : Block cipher modes of operation over the dispatched backends.
+#pragma once
+#ifndef _AES_MODES_H_
+#define _AES_MODES_H_
+
+#include "AESEngine.h"
+
+namespace AESEngine {
+
+// All lengths are in bytes and must be a multiple of BlockBytes. `out` may
+// alias `in`. For the chained modes `iv` is read as the initialization
+// vector and left holding the feedback block that continues the chain.
+// CBC and CFB decryption have no serial dependency and split large inputs
+// across threads.
+
+void EncryptECB(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t len);
+
+void DecryptECB(const AESRoundKeys& rk, const unsigned char* in,
+    unsigned char* out, size_t len);
+
+void EncryptCBC(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t len);
+
+void DecryptCBC(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t len);
+
+/// One message of a multi-buffer CBC encryption.
+struct CBCMessage {
+    const AESRoundKeys* rk;
+    unsigned char* iv;
+    const unsigned char* in;
+    unsigned char* out;
+    size_t len;
+};
+
+// CBC-encrypts independent messages, each with its own key and IV, by
+// interleaving their chains through the backend's multi-lane kernel so the
+// AES pipeline stays full although every chain is serial. Lengths may differ;
+// each `iv` is left as EncryptCBC leaves it.
+void EncryptCBCMulti(const CBCMessage messages[], size_t count);
+
+/// One message of a multi-key ECB or CTR call. `counter` is the CTR counter
+/// block, left at the first unused value as CryptCTR leaves it; ECB
+/// ignores it.
+struct KeyedMessage {
+    const AESRoundKeys* rk;
+    unsigned char* counter;
+    const unsigned char* in;
+    unsigned char* out;
+    size_t len;
+};
+
+// ECB over messages that each have their own key. Blocks of different
+// messages are queued together and handed to the backend's multi-key
+// kernel, which loads every lane's round keys itself, so many keys with a
+// few blocks each run close to single-key ECB rather than paying a call per
+// key. Keys of any size may be mixed; long messages run on their own.
+void EncryptECBMulti(const KeyedMessage messages[], size_t count);
+
+void DecryptECBMulti(const KeyedMessage messages[], size_t count);
+
+// CTR over messages that each have their own key and counter block, batched
+// like EncryptECBMulti. `len` may be any byte count.
+void CryptCTRMulti(const KeyedMessage messages[], size_t count,
+    unsigned int counterBytes, bool bigEndian);
+
+void EncryptCFB(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t len);
+
+void DecryptCFB(const AESRoundKeys& rk, unsigned char iv[],
+    const unsigned char* in, unsigned char* out, size_t len);
+
+// CTR keystream over the counter block `counter`: its last `counterBytes`
+// bytes (1..16) are a big- or little-endian counter that wraps within that
+// field, the leading bytes are a fixed nonce. `len` may be any byte count;
+// encryption and decryption are the same operation. `counter` is left at the
+// first unused counter value. Large inputs are split across threads.
+void CryptCTR(const AESRoundKeys& rk, unsigned char counter[],
+    unsigned int counterBytes, bool bigEndian, const unsigned char* in,
+    unsigned char* out, size_t len);
+
+// Bytes [offset, offset + len) of the CTR stream that starts at `counter`,
+// found by seeking rather than by running the keystream up to `offset`: the
+// counter jumps offset / 16 blocks ahead and the first offset % 16 bytes of
+// that block's keystream are skipped. `counter` is not modified.
+void CryptCTRAt(const AESRoundKeys& rk, const unsigned char counter[],
+    unsigned int counterBytes, bool bigEndian, unsigned long long offset,
+    const unsigned char* in, unsigned char* out, size_t len);
+
+/// Modes a re-encryption can read and write; the values match CipherMode.
+enum class Mode : int { ECB = 0, CBC = 1, CFB = 2, CTR = 3 };
+
+/// One side of a re-encryption. `iv` is the feedback block (CBC, CFB) or
+/// counter block (CTR) and is left where the chain continues, as the
+/// single-mode calls leave it; ECB ignores it.
+struct RekeySide {
+    const AESRoundKeys* rk;
+    Mode mode;
+    unsigned char* iv;
+    unsigned int counterBytes;
+    bool bigEndian;
+};
+
+// Turns ciphertext under `from` into ciphertext under `to` in one pass over
+// memory: each stretch is decrypted into a scratch buffer on the stack and
+// encrypted again from there while it is still in L1, and the scratch is
+// wiped afterwards. Stretches are split across threads unless `to` is CBC
+// or CFB. `len` must be a multiple of BlockBytes unless both sides are CTR.
+// `out` may alias `in`.
+void Reencrypt(const RekeySide& from, const RekeySide& to,
+    const unsigned char* in, unsigned char* out, size_t len);
+
+}  // namespace AESEngine
+
+#endif  // _AES_MODES_H_
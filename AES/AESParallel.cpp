@@ -0,0 +1,318 @@
+#include "pch.h"
+#include "AESParallel.h"
+#include "AES.h"
+#include "AESEngine.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32) && defined(__linux__)
+#include <pthread.h>
+#endif
+
+namespace AESEngine {
+
+namespace {
+
+/// One ParallelFor call. Lives on the caller's stack; `pending` counts the
+/// chunks not yet finished and is only changed under `mutex`, so the caller
+/// cannot return while a worker still holds the job.
+struct Job {
+    const std::function<void(size_t first, size_t n)>* fn;
+    size_t pending;
+    std::exception_ptr error;  // the first chunk that threw
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+struct Task {
+    Job* job;
+    size_t first;
+    size_t n;
+};
+
+/// A worker's share of the queued chunks. The owner takes from the front,
+/// where its contiguous range starts; idle threads steal from the back so
+/// they take the chunks the owner would reach last.
+struct WorkQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+};
+
+void PinToCore(std::thread& thread, unsigned int core) {
+#if defined(_WIN32)
+    const unsigned int bits = sizeof(DWORD_PTR) * 8;
+    SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << (core % bits));
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % CPU_SETSIZE, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+    (void)thread;
+    (void)core;
+#endif
+}
+
+class ThreadPool {
+public:
+    ThreadPool(unsigned int workers, bool pin) : queues(workers) {
+        static const unsigned int cores = std::thread::hardware_concurrency();
+        for (unsigned int i = 0; i < workers; i++) {
+            queues[i].reset(new WorkQueue());
+        }
+        threads.reserve(workers);
+        for (unsigned int i = 0; i < workers; i++) {
+            threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+            if (pin && cores > 0) {
+                // Core 0 is left to the calling thread
+                PinToCore(threads.back(), (i + 1) % cores);
+            }
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Run(size_t count, size_t chunk,
+        const std::function<void(size_t first, size_t n)>& fn) {
+        // A pool with no workers has nothing to deal to
+        if (queues.empty()) {
+            fn(0, count);
+            return;
+        }
+
+        Job job;
+        job.fn = &fn;
+        job.pending = (count + chunk - 1) / chunk;
+
+        // Deal the chunks out as one contiguous run per worker, so a thread
+        // that is never robbed walks memory sequentially.
+        const size_t workers = queues.size();
+        const size_t chunks = job.pending;
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            queued += chunks;
+        }
+        size_t next = 0;
+        for (size_t w = 0; w < workers; w++) {
+            const size_t share = chunks / workers + (w < chunks % workers ? 1 : 0);
+            std::lock_guard<std::mutex> lock(queues[w]->mutex);
+            for (size_t c = 0; c < share; c++, next++) {
+                const size_t first = next * chunk;
+                const size_t n = count - first < chunk ? count - first : chunk;
+                queues[w]->tasks.push_back(Task{ &job, first, n });
+            }
+        }
+        wake.notify_all();
+
+        // The caller steals too instead of sleeping through the call
+        while (RunOne(0)) {
+        }
+        std::unique_lock<std::mutex> lock(job.mutex);
+        job.done.wait(lock, [&job] { return job.pending == 0; });
+        if (job.error) {
+            std::rethrow_exception(job.error);
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    size_t queued = 0;
+    bool stopping = false;
+
+    bool Pop(size_t index, bool front, Task& task) {
+        WorkQueue& queue = *queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            return false;
+        }
+        if (front) {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        else {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        }
+        return true;
+    }
+
+    // Runs one chunk from queue `home`, or stolen from another queue;
+    // false when every queue is empty.
+    bool RunOne(size_t home) {
+        Task task;
+        bool found = Pop(home, true, task);
+        for (size_t i = 1; !found && i < queues.size(); i++) {
+            found = Pop((home + i) % queues.size(), false, task);
+        }
+        if (!found) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            queued--;
+        }
+
+        // A chunk that throws must still be counted off, or the caller
+        // would wait forever; the caller rethrows it
+        std::exception_ptr error;
+        try {
+            (*task.job->fn)(task.first, task.n);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+
+        Job& job = *task.job;
+        std::lock_guard<std::mutex> lock(job.mutex);
+        if (error && !job.error) {
+            job.error = error;
+        }
+        if (--job.pending == 0) {
+            job.done.notify_all();
+        }
+        return true;
+    }
+
+    void WorkerLoop(size_t index) {
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(wakeMutex);
+                wake.wait(lock, [this] { return stopping || queued > 0; });
+                if (stopping) {
+                    return;
+                }
+            }
+            while (RunOne(index)) {
+            }
+        }
+    }
+};
+
+unsigned int LogicalCores() {
+    // hardware_concurrency can cost a system call; the core count is fixed
+    static const unsigned int cores = std::thread::hardware_concurrency();
+    return cores > 0 ? cores : 1;
+}
+
+std::mutex configMutex;
+AESThreadingOptions config;
+
+// Read on every call, so kept outside the lock
+std::atomic<size_t> inlineBelow(AESThreadingOptions().minParallelBytes);
+std::atomic<size_t> chunkBytes(AESThreadingOptions().chunkBytes);
+std::atomic<unsigned int> threadCount(0);
+
+// The current pool. Callers hold a reference for the length of a call, so
+// a pool replaced by SetThreadingOptions finishes its work before it goes.
+// Deliberately never freed at exit: joining threads while the DLL unloads
+// can deadlock on the loader lock.
+std::shared_ptr<ThreadPool>& CurrentPool() {
+    static std::shared_ptr<ThreadPool>* pool = new std::shared_ptr<ThreadPool>();
+    return *pool;
+}
+
+unsigned int ConfiguredThreads() {
+    const unsigned int threads = threadCount.load(std::memory_order_relaxed);
+    return threads > 0 ? threads : LogicalCores();
+}
+
+// Null when the settings now ask for a single thread; ParallelFor's check
+// is made outside the lock and SetThreadingOptions may have run since
+std::shared_ptr<ThreadPool> AcquirePool() {
+    std::lock_guard<std::mutex> lock(configMutex);
+    if (ConfiguredThreads() <= 1) {
+        return nullptr;
+    }
+    std::shared_ptr<ThreadPool>& pool = CurrentPool();
+    if (!pool) {
+        pool = std::make_shared<ThreadPool>(ConfiguredThreads() - 1,
+            config.pinThreads);
+    }
+    return pool;
+}
+
+}  // namespace
+
+void ParallelFor(size_t count, size_t itemBytes,
+    const std::function<void(size_t first, size_t n)>& fn) {
+    if (count == 0) {
+        return;
+    }
+    if (itemBytes == 0) {
+        itemBytes = 1;
+    }
+
+    // Small calls never see the pool
+    const size_t threshold = inlineBelow.load(std::memory_order_relaxed);
+    if (count <= threshold / itemBytes || ConfiguredThreads() <= 1) {
+        fn(0, count);
+        return;
+    }
+
+    const size_t chunkItems = ParallelChunkBytes() / itemBytes;
+    const size_t chunk = chunkItems > 0 ? chunkItems : 1;
+    if (count <= chunk) {
+        fn(0, count);
+        return;
+    }
+    const std::shared_ptr<ThreadPool> pool = AcquirePool();
+    if (!pool) {
+        fn(0, count);
+        return;
+    }
+    pool->Run(count, chunk, fn);
+}
+
+size_t ParallelChunkBytes() {
+    return chunkBytes.load(std::memory_order_relaxed);
+}
+
+}  // namespace AESEngine
+
+void SetThreadingOptions(const AESThreadingOptions& options) {
+    if (options.chunkBytes < AESEngine::BlockBytes) {
+        throw std::invalid_argument("Chunk size must be at least one block");
+    }
+
+    std::shared_ptr<AESEngine::ThreadPool> retired;
+    {
+        std::lock_guard<std::mutex> lock(AESEngine::configMutex);
+        const bool rebuild = options.threads != AESEngine::config.threads ||
+            options.pinThreads != AESEngine::config.pinThreads;
+        AESEngine::config = options;
+        AESEngine::inlineBelow = options.minParallelBytes;
+        AESEngine::chunkBytes = options.chunkBytes;
+        AESEngine::threadCount = options.threads;
+        if (rebuild) {
+            // The next parallel call starts a pool with the new settings
+            retired.swap(AESEngine::CurrentPool());
+        }
+    }
+}
+
+AESThreadingOptions GetThreadingOptions() {
+    std::lock_guard<std::mutex> lock(AESEngine::configMutex);
+    return AESEngine::config;
+}
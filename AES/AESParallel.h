@@ -0,0 +1,27 @@
+// AESParallel.h : Splits independent block ranges across a shared thread pool.
+#pragma once
+#ifndef _AES_PARALLEL_H_
+#define _AES_PARALLEL_H_
+
+#include <cstddef>
+#include <functional>
+
+namespace AESEngine {
+
+// Calls fn(first, n) over [0, count), where each item is `itemBytes` bytes,
+// in chunks of about the configured chunk size (AESThreadingOptions). The
+// chunks are queued on a persistent work-stealing pool and the calling
+// thread works alongside it; returns once every chunk is done. Calls below
+// the configured threshold, or with a single thread configured, run fn once
+// inline without touching the pool. If fn throws, the remaining chunks
+// still run and the first exception is rethrown to the caller.
+void ParallelFor(size_t count, size_t itemBytes,
+    const std::function<void(size_t first, size_t n)>& fn);
+
+// The chunk size ParallelFor cuts work into, in bytes. Modes whose chunks
+// need per-chunk setup (CBC/CFB decryption seeds) size items by it.
+size_t ParallelChunkBytes();
+
+}  // namespace AESEngine
+
+#endif  // _AES_PARALLEL_H_
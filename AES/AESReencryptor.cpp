@@ -0,0 +1,137 @@
+#include "pch.h"
+#include "AESReencryptor.h"
+#include "AESContainer.h"
+#include "AESModes.h"
+#include <cstdio>
+#include <future>
+
+namespace {
+
+// Bytes read from the file at a time by ReencryptFile; large enough that
+// each piece is spread across the thread pool
+static constexpr size_t FilePieceBytes = 8 << 20;
+
+}  // namespace
+
+AESReencryptor::AESReencryptor(const AESCipherSpec& from,
+    const AESCipherSpec& to)
+    : from(), to(), ended(false) {
+    InitSide(this->from, from);
+    InitSide(this->to, to);
+}
+
+AESReencryptor::~AESReencryptor() {
+    Wipe();
+}
+
+void AESReencryptor::InitSide(Side& side, const AESCipherSpec& spec) {
+    if (spec.mode == CipherMode::GCM) {
+        throw std::invalid_argument("GCM cannot be re-encrypted in place");
+    }
+    if (spec.mode < CipherMode::ECB || spec.mode > CipherMode::CTR) {
+        throw std::invalid_argument("Invalid cipher mode");
+    }
+    if (spec.key == nullptr) {
+        throw std::invalid_argument("Key is required");
+    }
+    if (spec.mode != CipherMode::ECB && spec.iv == nullptr) {
+        throw std::invalid_argument("IV is required for this mode");
+    }
+    if (spec.counterLayout.counterBytes < 1 ||
+        spec.counterLayout.counterBytes > blockBytesLen) {
+        throw std::invalid_argument("CTR counter must be 1 to " +
+            std::to_string(blockBytesLen) + " bytes");
+    }
+
+    side.mode = spec.mode;
+    side.counterLayout = spec.counterLayout;
+    side.roundKeys = spec.key->roundKeys;
+    if (spec.iv != nullptr) {
+        memcpy(side.chain, spec.iv, blockBytesLen);
+    }
+}
+
+void AESReencryptor::Wipe() {
+    AESEngine::SecureZero(&from.roundKeys, sizeof(from.roundKeys));
+    AESEngine::SecureZero(from.chain, sizeof(from.chain));
+    AESEngine::SecureZero(&to.roundKeys, sizeof(to.roundKeys));
+    AESEngine::SecureZero(to.chain, sizeof(to.chain));
+}
+
+void AESReencryptor::Update(const unsigned char in[], unsigned char out[],
+    size_t len) {
+    if (ended) {
+        throw std::length_error("Only the last piece may end mid-block");
+    }
+    if (len % blockBytesLen != 0) {
+        if (from.mode != CipherMode::CTR || to.mode != CipherMode::CTR) {
+            throw std::length_error("Ciphertext length must be divisible by " +
+                std::to_string(blockBytesLen));
+        }
+        ended = true;
+    }
+
+    const AESEngine::RekeySide oldSide = { &from.roundKeys,
+        (AESEngine::Mode)from.mode, from.chain,
+        from.counterLayout.counterBytes, from.counterLayout.bigEndian };
+    const AESEngine::RekeySide newSide = { &to.roundKeys,
+        (AESEngine::Mode)to.mode, to.chain,
+        to.counterLayout.counterBytes, to.counterLayout.bigEndian };
+    AESEngine::Reencrypt(oldSide, newSide, in, out, len);
+}
+
+std::vector<unsigned char> AESReencryptor::Update(
+    const std::vector<unsigned char>& in) {
+    std::vector<unsigned char> out(in.size());
+    Update(in.data(), out.data(), in.size());
+    return out;
+}
+
+void AESReencryptor::Reencrypt(const AESCipherSpec& from,
+    const AESCipherSpec& to, const unsigned char in[], unsigned char out[],
+    size_t len) {
+    AESReencryptor(from, to).Update(in, out, len);
+}
+
+std::vector<unsigned char> AESReencryptor::Reencrypt(const AESCipherSpec& from,
+    const AESCipherSpec& to, const std::vector<unsigned char>& in) {
+    return AESReencryptor(from, to).Update(in);
+}
+
+void AESReencryptor::ReencryptFile(const AESCipherSpec& from,
+    const AESCipherSpec& to, const char* inPath, const char* outPath) {
+    if (inPath == nullptr || outPath == nullptr) {
+        throw std::invalid_argument("Input and output paths are required");
+    }
+
+    AESReencryptor rekey(from, to);
+    AESFileSource in(inPath);
+    std::exception_ptr failure;
+    {
+        AESFileSink out(outPath);
+        try {
+            // Reads one piece ahead, in place of the one just written
+            std::vector<unsigned char> current(FilePieceBytes);
+            std::vector<unsigned char> next(FilePieceBytes);
+            size_t got = in.Read(current.data(), current.size());
+            while (got > 0) {
+                std::future<size_t> ahead = std::async(std::launch::async,
+                    [&] { return in.Read(next.data(), next.size()); });
+                rekey.Update(current.data(), current.data(), got);
+                out.Write(current.data(), got);
+                got = ahead.get();
+                current.swap(next);
+            }
+            out.Close();
+        }
+        catch (...) {
+            failure = std::current_exception();
+        }
+    }
+
+    // A half-rotated object is not left behind to be mistaken for a whole one
+    if (failure) {
+        std::remove(outPath);
+        std::rethrow_exception(failure);
+    }
+}
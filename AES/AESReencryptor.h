@@ -0,0 +1,77 @@
+// AESReencryptor.h : One-pass re-encryption from one key and mode to another.
+#pragma once
+#ifndef _AES_REENCRYPTOR_H_
+#define _AES_REENCRYPTOR_H_
+
+#include "AESKey.h"
+
+/// One side of a re-encryption: ciphertext under `key` in `mode` (ECB, CBC,
+/// CFB or CTR) from the 16-byte `iv`, which CTR reads as its initial counter
+/// block through `counterLayout`. ECB ignores `iv`.
+struct AESCipherSpec {
+    const AESKey* key;
+    CipherMode mode;
+    const unsigned char* iv;
+    AESCounterLayout counterLayout;
+};
+
+/// Moves ciphertext from one key, mode and IV to another in a single pass,
+/// for key rotation. Each stretch of blocks is decrypted into a 4 KiB buffer
+/// on the stack and encrypted again while it is still in L1, so plaintext
+/// never reaches a heap buffer and the data crosses memory once in and once
+/// out. Stretches run across the thread pool unless the new mode is CBC or
+/// CFB, whose chain is serial.
+///
+/// Ciphertext keeps its length, so any padding carries over unchanged.
+/// Pieces must be whole blocks, except that when both sides are CTR the
+/// last piece may end mid-block. Both schedules are copied, so the keys may
+/// be released once the reencryptor is built.
+class AES_API AESReencryptor {
+private:
+    static constexpr unsigned int blockBytesLen = AESEngine::BlockBytes;
+
+    struct Side {
+        CipherMode mode;
+        AESCounterLayout counterLayout;
+        AESEngine::AESRoundKeys roundKeys;
+        unsigned char chain[blockBytesLen];   // feedback block or counter
+    };
+
+    Side from;
+    Side to;
+    bool ended;  // a CTR piece ended mid-block
+
+    static void InitSide(Side& side, const AESCipherSpec& spec);
+    void Wipe();
+
+public:
+    AESReencryptor(const AESCipherSpec& from, const AESCipherSpec& to);
+
+    AESReencryptor(const AESReencryptor& other) = default;
+    AESReencryptor& operator=(const AESReencryptor& other) = default;
+
+    ~AESReencryptor();
+
+    // Re-encrypts the next `len` bytes of the object into `out`, which may
+    // be `in`. Throws std::length_error for a piece that is not whole
+    // blocks when that is not allowed.
+    void Update(const unsigned char in[], unsigned char out[], size_t len);
+
+    std::vector<unsigned char> Update(const std::vector<unsigned char>& in);
+
+    // Re-encrypts a whole object held in memory.
+    static void Reencrypt(const AESCipherSpec& from, const AESCipherSpec& to,
+        const unsigned char in[], unsigned char out[], size_t len);
+
+    static std::vector<unsigned char> Reencrypt(const AESCipherSpec& from,
+        const AESCipherSpec& to, const std::vector<unsigned char>& in);
+
+    // Re-encrypts the file at `inPath` into `outPath`. The next piece is
+    // read while the current one is re-encrypted and written, so a large
+    // archive is bound by the disks rather than by the cipher. `outPath` is
+    // removed if anything fails.
+    static void ReencryptFile(const AESCipherSpec& from,
+        const AESCipherSpec& to, const char* inPath, const char* outPath);
+};
+
+#endif  // _AES_REENCRYPTOR_H_
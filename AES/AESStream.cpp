@@ -0,0 +1,252 @@
+#include "pch.h"
+#include "AESStream.h"
+#include "AESModes.h"
+
+namespace {
+
+// Bytes staged at a time by the in-place path of the block modes
+static constexpr size_t ScratchBytes = 4096;
+
+}  // namespace
+
+AESStream::AESStream(CipherMode mode, bool encrypt,
+    const AESCounterLayout& counterLayout)
+    : mode(mode), encrypt(encrypt), counterLayout(counterLayout),
+      started(false), roundKeys(), chain(), buffer(), buffered(0) {
+    if (mode == CipherMode::GCM) {
+        throw std::invalid_argument("GCM cannot be streamed");
+    }
+    if (mode < CipherMode::ECB || mode > CipherMode::CTR) {
+        throw std::invalid_argument("Invalid cipher mode");
+    }
+    if (counterLayout.counterBytes < 1 ||
+        counterLayout.counterBytes > blockBytesLen) {
+        throw std::invalid_argument("CTR counter must be 1 to " +
+            std::to_string(blockBytesLen) + " bytes");
+    }
+}
+
+AESStream::~AESStream() {
+    Wipe();
+}
+
+void AESStream::Wipe() {
+    AESEngine::SecureZero(&roundKeys, sizeof(roundKeys));
+    AESEngine::SecureZero(chain, blockBytesLen);
+    AESEngine::SecureZero(buffer, blockBytesLen);
+    buffered = 0;
+    started = false;
+}
+
+void AESStream::Init(const AESKey& key, const unsigned char iv[]) {
+    if (mode != CipherMode::ECB && iv == nullptr) {
+        throw std::invalid_argument("IV is required for this mode");
+    }
+    Wipe();
+    roundKeys = key.roundKeys;
+    if (iv != nullptr) {
+        memcpy(chain, iv, blockBytesLen);
+    }
+    started = true;
+}
+
+void AESStream::Init(const unsigned char key[], AESKeyLength keyLength,
+    const unsigned char iv[]) {
+    Init(AESKey(key, keyLength), iv);
+}
+
+size_t AESStream::UpdateLength(size_t inLen) const {
+    if (mode == CipherMode::CTR) {
+        return inLen;
+    }
+    const size_t total = buffered + inLen;
+    return total - total % blockBytesLen;
+}
+
+size_t AESStream::FinalLength() const {
+    const bool padded = mode != CipherMode::CTR && encrypt && buffered > 0;
+    return padded ? blockBytesLen : 0;
+}
+
+// Whole blocks of the block modes; CBC and CFB leave `chain` ready for the
+// next call
+void AESStream::RunBlocks(const unsigned char* in, unsigned char* out,
+    size_t len) {
+    switch (mode) {
+    case CipherMode::ECB:
+        if (encrypt) {
+            AESEngine::EncryptECB(roundKeys, in, out, len);
+        }
+        else {
+            AESEngine::DecryptECB(roundKeys, in, out, len);
+        }
+        break;
+    case CipherMode::CBC:
+        if (encrypt) {
+            AESEngine::EncryptCBC(roundKeys, chain, in, out, len);
+        }
+        else {
+            AESEngine::DecryptCBC(roundKeys, chain, in, out, len);
+        }
+        break;
+    case CipherMode::CFB:
+        if (encrypt) {
+            AESEngine::EncryptCFB(roundKeys, chain, in, out, len);
+        }
+        else {
+            AESEngine::DecryptCFB(roundKeys, chain, in, out, len);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+size_t AESStream::Update(const unsigned char in[], size_t inLen,
+    unsigned char out[]) {
+    if (!started) {
+        throw std::runtime_error("Stream is not initialized");
+    }
+
+    // An empty piece may come with null pointers; there is nothing to copy
+    if (inLen == 0) {
+        return 0;
+    }
+
+    if (mode == CipherMode::CTR) {
+        // Finish the keystream block a previous call left half used
+        size_t done = 0;
+        for (; buffered > 0 && done < inLen; buffered--, done++) {
+            out[done] = in[done] ^ buffer[blockBytesLen - buffered];
+        }
+
+        const size_t rest = inLen - done;
+        const size_t whole = rest - rest % blockBytesLen;
+        AESEngine::CryptCTR(roundKeys, chain, counterLayout.counterBytes,
+            counterLayout.bigEndian, in + done, out + done, whole);
+        done += whole;
+
+        if (done < inLen) {
+            memset(buffer, 0, blockBytesLen);
+            AESEngine::CryptCTR(roundKeys, chain, counterLayout.counterBytes,
+                counterLayout.bigEndian, buffer, buffer, blockBytesLen);
+            const size_t tail = inLen - done;
+            for (size_t i = 0; i < tail; i++) {
+                out[done + i] = in[done + i] ^ buffer[i];
+            }
+            buffered = blockBytesLen - tail;
+        }
+        return inLen;
+    }
+
+    if (buffered > 0 && out == in) {
+        return UpdateInPlace(out, inLen);
+    }
+
+    size_t written = 0;
+    if (buffered > 0) {
+        const size_t take = inLen < blockBytesLen - buffered
+            ? inLen : blockBytesLen - buffered;
+        memcpy(buffer + buffered, in, take);
+        buffered += take;
+        in += take;
+        inLen -= take;
+        if (buffered < blockBytesLen) {
+            return 0;
+        }
+        RunBlocks(buffer, out, blockBytesLen);
+        written = blockBytesLen;
+        buffered = 0;
+    }
+
+    const size_t whole = inLen - inLen % blockBytesLen;
+    RunBlocks(in, out + written, whole);
+    written += whole;
+
+    buffered = inLen - whole;
+    memcpy(buffer, in + whole, buffered);
+    return written;
+}
+
+// With `buffered` bytes held back, output block j covers data[16j, 16j + 16)
+// while input block j is data[16j - buffered, 16j + 16 - buffered): every
+// block written overwrites the first `buffered` bytes of the next input
+// block. Those are saved in `carry` before each chunk is written back.
+size_t AESStream::UpdateInPlace(unsigned char data[], size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+
+    const size_t held = buffered;
+    const size_t total = held + len;
+    const size_t blocks = total / blockBytesLen;
+
+    unsigned char scratch[ScratchBytes];
+    unsigned char carry[blockBytesLen];
+    memcpy(carry, buffer, held);
+    size_t carried = held;
+
+    for (size_t block = 0; block < blocks; ) {
+        const size_t maxBlocks = ScratchBytes / blockBytesLen;
+        const size_t n = blocks - block < maxBlocks ? blocks - block : maxBlocks;
+        const size_t start = block * blockBytesLen;
+        const size_t end = start + n * blockBytesLen;
+
+        memcpy(scratch, carry, held);
+        memcpy(scratch + held, data + start, end - start - held);
+        carried = total - end < held ? total - end : held;
+        memcpy(carry, data + end - held, carried);
+
+        RunBlocks(scratch, scratch, end - start);
+        memcpy(data + start, scratch, end - start);
+        block += n;
+    }
+
+    // The unprocessed tail is what is left of the carry plus the input after
+    // the last written block
+    const size_t done = blocks * blockBytesLen;
+    buffered = total - done;
+    memcpy(buffer, carry, carried);
+    memcpy(buffer + carried, data + done - held + carried, buffered - carried);
+    // The scratch held the output, plaintext when decrypting
+    const size_t maxBlocks = ScratchBytes / blockBytesLen;
+    AESEngine::SecureZero(scratch,
+        (blocks < maxBlocks ? blocks : maxBlocks) * blockBytesLen);
+    AESEngine::SecureZero(carry, held);
+    return done;
+}
+
+size_t AESStream::Final(unsigned char out[]) {
+    if (!started) {
+        throw std::runtime_error("Stream is not initialized");
+    }
+
+    size_t written = 0;
+    if (mode != CipherMode::CTR && buffered > 0) {
+        if (!encrypt) {
+            Wipe();
+            throw std::length_error("Ciphertext length must be divisible by " +
+                std::to_string(blockBytesLen));
+        }
+        // Same padding as EncryptPadded, so the result matches ContextEncrypt
+        memset(buffer + buffered, (int)(blockBytesLen - buffered),
+            blockBytesLen - buffered);
+        RunBlocks(buffer, out, blockBytesLen);
+        written = blockBytesLen;
+    }
+    Wipe();
+    return written;
+}
+
+std::vector<unsigned char> AESStream::Update(
+    const std::vector<unsigned char>& in) {
+    std::vector<unsigned char> out(UpdateLength(in.size()));
+    out.resize(Update(in.data(), in.size(), out.data()));
+    return out;
+}
+
+std::vector<unsigned char> AESStream::Final() {
+    std::vector<unsigned char> out(blockBytesLen);
+    out.resize(Final(out.data()));
+    return out;
+}
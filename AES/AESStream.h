@@ -0,0 +1,85 @@
+// AESStream.h : Incremental encryption of messages that arrive in pieces.
+#pragma once
+#ifndef _AES_STREAM_H_
+#define _AES_STREAM_H_
+
+#include "AESKey.h"
+
+/// Encrypts or decrypts one message handed over in pieces of any size, in
+/// constant memory: Init, Update as the data arrives, then Final. Between
+/// calls it carries the feedback block (CBC, CFB), the counter (CTR) and up
+/// to 15 bytes of a block that is not complete yet.
+///
+/// The output is the same as one ContextEncrypt/ContextDecrypt call over the
+/// whole message. ECB, CBC and CFB encryption pad a partial last block in
+/// Final the way EncryptPadded does; decryption leaves any padding in place;
+/// CTR is never padded. GCM is not available as a stream.
+class AES_API AESStream {
+private:
+    static constexpr unsigned int blockBytesLen = AESEngine::BlockBytes;
+
+    CipherMode mode;
+    bool encrypt;
+    AESCounterLayout counterLayout;
+    bool started;
+
+    AESEngine::AESRoundKeys roundKeys;
+    unsigned char chain[blockBytesLen];   // IV, feedback block or counter
+    // ECB/CBC/CFB: the first `buffered` bytes are input of the next block.
+    // CTR: the last `buffered` bytes are unused keystream.
+    unsigned char buffer[blockBytesLen];
+    size_t buffered;
+
+    void RunBlocks(const unsigned char* in, unsigned char* out, size_t len);
+    size_t UpdateInPlace(unsigned char data[], size_t len);
+    void Wipe();
+
+public:
+    // Init must be called before the first Update. `counterLayout` is used
+    // by CTR only.
+    AESStream(CipherMode mode, bool encrypt,
+        const AESCounterLayout& counterLayout = AESCounterLayout());
+
+    AESStream(const AESStream& other) = default;
+    AESStream& operator=(const AESStream& other) = default;
+
+    ~AESStream();
+
+    CipherMode GetMode() const { return mode; }
+
+    bool IsEncrypting() const { return encrypt; }
+
+    // Starts a message, dropping anything left of an unfinished one. `iv` is
+    // 16 bytes for CBC, CFB and CTR and ignored for ECB.
+    void Init(const AESKey& key, const unsigned char iv[] = nullptr);
+
+    void Init(const unsigned char key[], AESKeyLength keyLength,
+        const unsigned char iv[] = nullptr);
+
+    // Bytes the next Update(in, inLen, out) will write: whole blocks for ECB,
+    // CBC and CFB (never more than inLen + 15), exactly inLen for CTR.
+    size_t UpdateLength(size_t inLen) const;
+
+    // Bytes Final will write: 16 when encrypting with a partial block held
+    // back, otherwise 0.
+    size_t FinalLength() const;
+
+    // Processes `inLen` bytes and returns how many were written to `out`.
+    // `out` may be `in`, as long as that buffer has room for
+    // UpdateLength(inLen) bytes: with a partial block buffered, a block
+    // mode writes up to 15 bytes more than it reads. Otherwise the two must
+    // not overlap.
+    size_t Update(const unsigned char in[], size_t inLen, unsigned char out[]);
+
+    // Ends the message and returns how many bytes were written to `out`:
+    // the padded last block (at most 16) when encrypting. Decryption throws
+    // std::length_error when the ciphertext did not end on a block boundary.
+    // Init starts the next message.
+    size_t Final(unsigned char out[]);
+
+    std::vector<unsigned char> Update(const std::vector<unsigned char>& in);
+
+    std::vector<unsigned char> Final();
+};
+
+#endif  // _AES_STREAM_H_
@@ -0,0 +1,109 @@
+// AESTables.h : Lookup tables of the portable cipher, built at compile time.
+#pragma once
+#ifndef _AES_TABLES_H_
+#define _AES_TABLES_H_
+
+#include "AESEngine.h"
+
+namespace AESEngine {
+
+/// Round tables. A state column is held as a little-endian 32-bit word, so
+/// row 0 lives in the low byte. Te[k][x] is the MixColumns column produced by
+/// SubBytes(x) entering on row k; Td[k][x] is the InvMixColumns column
+/// produced by InvSubBytes(x) entering on row k. Rcon[i] is x^i in GF(2^8).
+/// Every table starts on its own cache line.
+struct Tables {
+    alignas(64) uint32_t Te[4][256];
+    alignas(64) uint32_t Td[4][256];
+    alignas(64) unsigned char Sbox[256];
+    alignas(64) unsigned char InvSbox[256];
+    alignas(64) uint32_t Rcon[10];
+};
+
+constexpr uint32_t RotL8(uint32_t w) {
+    return (w << 8) | (w >> 24);
+}
+
+constexpr uint32_t Column(unsigned char r0, unsigned char r1,
+    unsigned char r2, unsigned char r3) {
+    return (uint32_t)r0 | ((uint32_t)r1 << 8) | ((uint32_t)r2 << 16) |
+        ((uint32_t)r3 << 24);
+}
+
+// Multiplication by x in GF(2^8) modulo x^8 + x^4 + x^3 + x + 1
+constexpr unsigned char XTime(unsigned char b) {
+    return (unsigned char)((b << 1) ^ ((b >> 7) * 0x1b));
+}
+
+constexpr unsigned char GFMul(unsigned char a, unsigned char b) {
+    unsigned char product = 0;
+    for (; b != 0; b >>= 1) {
+        if (b & 1) {
+            product ^= a;
+        }
+        a = XTime(a);
+    }
+    return product;
+}
+
+constexpr unsigned char RotateByte(unsigned char b, unsigned int bits) {
+    return (unsigned char)((b << bits) | (b >> (8 - bits)));
+}
+
+constexpr Tables BuildTables() {
+    Tables t = {};
+
+    // 3 generates GF(2^8)*: walking p through 3^i and q through 3^-i keeps
+    // q the inverse of p, and the S-box is the affine map of that inverse
+    unsigned char p = 1;
+    unsigned char q = 1;
+    do {
+        p = (unsigned char)(p ^ XTime(p));
+        q ^= (unsigned char)(q << 1);
+        q ^= (unsigned char)(q << 2);
+        q ^= (unsigned char)(q << 4);
+        if (q & 0x80) {
+            q ^= 0x09;
+        }
+        t.Sbox[p] = (unsigned char)(q ^ RotateByte(q, 1) ^ RotateByte(q, 2) ^
+            RotateByte(q, 3) ^ RotateByte(q, 4) ^ 0x63);
+    } while (p != 1);
+    t.Sbox[0] = 0x63;
+
+    for (unsigned int x = 0; x < 256; x++) {
+        t.InvSbox[t.Sbox[x]] = (unsigned char)x;
+    }
+
+    for (unsigned int x = 0; x < 256; x++) {
+        const unsigned char s = t.Sbox[x];
+        const unsigned char is = t.InvSbox[x];
+
+        // First columns of the MDS and inverse MDS matrices
+        t.Te[0][x] = Column(GFMul(s, 2), s, s, GFMul(s, 3));
+        t.Td[0][x] = Column(GFMul(is, 14), GFMul(is, 9), GFMul(is, 13),
+            GFMul(is, 11));
+
+        for (unsigned int k = 1; k < 4; k++) {
+            t.Te[k][x] = RotL8(t.Te[k - 1][x]);
+            t.Td[k][x] = RotL8(t.Td[k - 1][x]);
+        }
+    }
+
+    unsigned char rcon = 1;
+    for (unsigned int i = 0; i < 10; i++) {
+        t.Rcon[i] = rcon;
+        rcon = XTime(rcon);
+    }
+    return t;
+}
+
+// One copy for the whole library, evaluated by the compiler
+inline constexpr Tables tables = BuildTables();
+
+static_assert(tables.Sbox[0x00] == 0x63 && tables.Sbox[0x53] == 0xed &&
+    tables.InvSbox[0x63] == 0x00 && tables.Te[0][0x00] == 0xa56363c6 &&
+    tables.Rcon[9] == 0x36, "AES tables are wrong");
+
+}  // namespace AESEngine
+
+#endif  // _AES_TABLES_H_
@@ -0,0 +1,355 @@
+#include "pch.h"
+#include "AESXTS.h"
+#include "AESParallel.h"
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#ifdef AES_X86
+#include <emmintrin.h>
+#endif
+
+namespace AESEngine {
+
+namespace {
+
+// Blocks whose tweaks are generated and encrypted together; the tweaks and
+// the working copy stay in L1 and the backend sees a run long enough for
+// its widest kernel.
+static constexpr size_t XTSChunkBlocks = 32;
+
+inline uint64_t LoadLE64(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+inline void StoreLE64(unsigned char* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (unsigned char)v;
+        v >>= 8;
+    }
+}
+
+// Writes `n` successive tweaks T, T*a, T*a^2, ... to `out` and leaves
+// `tweak` at T*a^n. Multiplying by a in GF(2^128) is a 1-bit shift of the
+// little-endian value with the carry folded back in as 0x87.
+void TweakChain(unsigned char tweak[BlockBytes], unsigned char* out,
+    size_t n) {
+    uint64_t lo = LoadLE64(tweak);
+    uint64_t hi = LoadLE64(tweak + 8);
+    for (size_t i = 0; i < n; i++) {
+        StoreLE64(out + i * BlockBytes, lo);
+        StoreLE64(out + i * BlockBytes + 8, hi);
+        const uint64_t carry = hi >> 63;
+        hi = (hi << 1) | (lo >> 63);
+        lo = (lo << 1) ^ (0x87 & (0 - carry));
+    }
+    StoreLE64(tweak, lo);
+    StoreLE64(tweak + 8, hi);
+}
+
+#ifdef AES_X86
+// The same chain in one XMM register: each 32-bit lane shifts left by one
+// and takes the bit shifted out of the lane below it, the top lane's bit
+// wrapping round to the bottom as 0x87.
+AES_TARGET("sse2")
+void TweakChainSSE2(unsigned char tweak[BlockBytes], unsigned char* out,
+    size_t n) {
+    const __m128i poly = _mm_set_epi32(1, 1, 1, 0x87);
+    __m128i t = _mm_loadu_si128((const __m128i*)tweak);
+    for (size_t i = 0; i < n; i++) {
+        _mm_storeu_si128((__m128i*)(out + i * BlockBytes), t);
+        const __m128i carry = _mm_shuffle_epi32(_mm_srai_epi32(t, 31), 0x93);
+        t = _mm_xor_si128(_mm_slli_epi32(t, 1), _mm_and_si128(carry, poly));
+    }
+    _mm_storeu_si128((__m128i*)tweak, t);
+}
+#endif
+
+inline void XorBytes(const unsigned char* a, const unsigned char* b,
+    unsigned char* c, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        c[i] = a[i] ^ b[i];
+    }
+}
+
+struct XTSKeys {
+    const Backend* backend;
+    const AESRoundKeys* dataKeys;
+    const AESRoundKeys* tweakKeys;
+    void (*tweakChain)(unsigned char tweak[BlockBytes], unsigned char* out,
+        size_t n);
+    bool encrypt;
+};
+
+XTSKeys MakeKeys(const AESRoundKeys& dataKeys, const AESRoundKeys& tweakKeys,
+    bool encrypt) {
+    const Dispatch& dispatch = GetDispatch();
+    XTSKeys keys = { dispatch.bulk, &dataKeys, &tweakKeys, TweakChain,
+        encrypt };
+#ifdef AES_X86
+    if (dispatch.cpu.sse2) {
+        keys.tweakChain = TweakChainSSE2;
+    }
+#endif
+    return keys;
+}
+
+// One block under tweak `t`: out = E(in ^ t) ^ t, or D for decryption
+void CryptBlock(const XTSKeys& keys, const unsigned char* in,
+    unsigned char* out, const unsigned char* t) {
+    unsigned char block[BlockBytes];
+    XorBytes(in, t, block, BlockBytes);
+    if (keys.encrypt) {
+        keys.backend->encryptBlocks(*keys.dataKeys, block, block, 1);
+    }
+    else {
+        keys.backend->decryptBlocks(*keys.dataKeys, block, block, 1);
+    }
+    XorBytes(block, t, out, BlockBytes);
+}
+
+// The encrypted unit number, the tweak of the unit's first block
+void UnitTweak(const XTSKeys& keys, unsigned long long sector,
+    unsigned char tweak[BlockBytes]) {
+    memset(tweak, 0, BlockBytes);
+    StoreLE64(tweak, sector);
+    keys.backend->encryptBlocks(*keys.tweakKeys, tweak, tweak, 1);
+}
+
+// Multiplies `tweak` by a^n: the tweak of block n of a unit
+void AdvanceTweak(unsigned char tweak[BlockBytes], size_t n) {
+    uint64_t lo = LoadLE64(tweak);
+    uint64_t hi = LoadLE64(tweak + 8);
+    for (size_t i = 0; i < n; i++) {
+        const uint64_t carry = hi >> 63;
+        hi = (hi << 1) | (lo >> 63);
+        lo = (lo << 1) ^ (0x87 & (0 - carry));
+    }
+    StoreLE64(tweak, lo);
+    StoreLE64(tweak + 8, hi);
+}
+
+// `blocks` whole blocks from the one whose tweak is `tweak`, which is left
+// at the tweak of the block after them
+void CryptBlocks(const XTSKeys& keys, unsigned char tweak[BlockBytes],
+    const unsigned char* in, unsigned char* out, size_t blocks) {
+    alignas(16) unsigned char tweaks[XTSChunkBlocks * BlockBytes];
+    alignas(16) unsigned char work[XTSChunkBlocks * BlockBytes];
+    for (size_t done = 0; done < blocks; ) {
+        const size_t n = blocks - done < XTSChunkBlocks ? blocks - done
+                                                        : XTSChunkBlocks;
+        const size_t bytes = n * BlockBytes;
+        keys.tweakChain(tweak, tweaks, n);
+        XorBytes(in + done * BlockBytes, tweaks, work, bytes);
+        if (keys.encrypt) {
+            keys.backend->encryptBlocks(*keys.dataKeys, work, work, n);
+        }
+        else {
+            keys.backend->decryptBlocks(*keys.dataKeys, work, work, n);
+        }
+        XorBytes(work, tweaks, out + done * BlockBytes, bytes);
+        done += n;
+    }
+}
+
+// Ciphertext stealing over the last full block of a unit and the `tail`
+// bytes after it; `tweak` is the full block's tweak. Everything read from
+// `in` is copied out before `out` is written, so the two may alias.
+void StealTail(const XTSKeys& keys, unsigned char tweak[BlockBytes],
+    const unsigned char* in, unsigned char* out, size_t tail) {
+    unsigned char tweakPair[2 * BlockBytes];
+    keys.tweakChain(tweak, tweakPair, 2);
+    const unsigned char* first = keys.encrypt ? tweakPair
+                                              : tweakPair + BlockBytes;
+    const unsigned char* second = keys.encrypt ? tweakPair + BlockBytes
+                                               : tweakPair;
+
+    unsigned char stolen[BlockBytes];
+    unsigned char merged[BlockBytes];
+    CryptBlock(keys, in, stolen, first);
+    memcpy(merged, in + BlockBytes, tail);
+    memcpy(merged + tail, stolen + tail, BlockBytes - tail);
+    memcpy(out + BlockBytes, stolen, tail);
+    CryptBlock(keys, merged, out, second);
+}
+
+void CryptUnit(const XTSKeys& keys, unsigned long long sector,
+    const unsigned char* in, unsigned char* out, size_t len) {
+    alignas(16) unsigned char tweak[BlockBytes];
+    UnitTweak(keys, sector, tweak);
+
+    // With a partial last block the final full block joins the stealing
+    const size_t tail = len % BlockBytes;
+    const size_t bulk = len / BlockBytes - (tail != 0 ? 1 : 0);
+    CryptBlocks(keys, tweak, in, out, bulk);
+    if (tail != 0) {
+        StealTail(keys, tweak, in + bulk * BlockBytes, out + bulk * BlockBytes,
+            tail);
+    }
+}
+
+// Bytes [from, to) of a `len`-byte unit into `out`. Each block only needs
+// its own tweak, so the blocks before `from` are skipped by advancing the
+// tweak; only the blocks cut by `from` and `to`, and the stealing pair when
+// `to` reaches into it, are processed whole in scratch space.
+void CryptUnitRange(const XTSKeys& keys, unsigned long long sector,
+    const unsigned char* in, size_t len, size_t from, size_t to,
+    unsigned char* out) {
+    if (from == 0 && to == len) {
+        CryptUnit(keys, sector, in, out, len);
+        return;
+    }
+
+    alignas(16) unsigned char tweak[BlockBytes];
+    UnitTweak(keys, sector, tweak);
+    const size_t tail = len % BlockBytes;
+    const size_t bulk = len / BlockBytes - (tail != 0 ? 1 : 0);
+
+    size_t block = from / BlockBytes;
+    const size_t endBlock = (to + BlockBytes - 1) / BlockBytes;
+    const size_t lastBulk = endBlock < bulk ? endBlock : bulk;
+    AdvanceTweak(tweak, block < bulk ? block : bulk);
+
+    unsigned char scratch[2 * BlockBytes];
+    while (block < lastBulk) {
+        const size_t start = block * BlockBytes;
+        if (start >= from && start + BlockBytes <= to) {
+            // Whole blocks inside the range go straight to `out`
+            const size_t stop = to / BlockBytes < lastBulk ? to / BlockBytes
+                                                           : lastBulk;
+            CryptBlocks(keys, tweak, in + start, out + (start - from),
+                stop - block);
+            block = stop;
+            continue;
+        }
+        CryptBlocks(keys, tweak, in + start, scratch, 1);
+        const size_t lo = start > from ? start : from;
+        const size_t hi = start + BlockBytes < to ? start + BlockBytes : to;
+        memcpy(out + (lo - from), scratch + (lo - start), hi - lo);
+        block++;
+    }
+
+    const size_t stealStart = bulk * BlockBytes;
+    if (tail != 0 && to > stealStart) {
+        StealTail(keys, tweak, in + stealStart, scratch, tail);
+        const size_t lo = stealStart > from ? stealStart : from;
+        memcpy(out + (lo - from), scratch + (lo - stealStart), to - lo);
+    }
+}
+
+void CheckUnits(size_t unitBytes, size_t len) {
+    if (unitBytes < BlockBytes) {
+        throw std::invalid_argument("XTS data unit must be at least 16 bytes");
+    }
+    if (len % unitBytes != 0 && len % unitBytes < BlockBytes) {
+        throw std::length_error("Last XTS data unit must be at least 16 bytes");
+    }
+}
+
+void CryptXTS(const XTSKeys& keys, size_t unitBytes,
+    unsigned long long sector, const unsigned char* in, unsigned char* out,
+    size_t len) {
+    CheckUnits(unitBytes, len);
+    const size_t units = (len + unitBytes - 1) / unitBytes;
+    ParallelFor(units, unitBytes, [&](size_t first, size_t n) {
+        for (size_t u = first; u < first + n; u++) {
+            const size_t offset = u * unitBytes;
+            const size_t bytes = len - offset < unitBytes ? len - offset
+                                                          : unitBytes;
+            CryptUnit(keys, sector + u, in + offset, out + offset, bytes);
+        }
+    });
+}
+
+void CryptXTSRuns(const XTSKeys& keys, size_t unitBytes, const XTSRun runs[],
+    size_t count) {
+    // Flatten the runs into units so short and long runs balance across
+    // threads
+    std::vector<XTSRun> units;
+    for (size_t r = 0; r < count; r++) {
+        CheckUnits(unitBytes, runs[r].len);
+        for (size_t offset = 0; offset < runs[r].len; offset += unitBytes) {
+            const size_t bytes = runs[r].len - offset < unitBytes
+                ? runs[r].len - offset : unitBytes;
+            units.push_back({ runs[r].sector + offset / unitBytes,
+                runs[r].in + offset, runs[r].out + offset, bytes });
+        }
+    }
+    ParallelFor(units.size(), unitBytes, [&](size_t first, size_t n) {
+        for (size_t u = first; u < first + n; u++) {
+            CryptUnit(keys, units[u].sector, units[u].in, units[u].out,
+                units[u].len);
+        }
+    });
+}
+
+// Units overlapping [offset, offset + len) of an `objectLen`-byte object
+// whose first unit is `sector`; the inner units are whole and run in
+// parallel, the two at the ends are cut
+void CryptXTSRange(const XTSKeys& keys, size_t unitBytes,
+    unsigned long long sector, const unsigned char* object, size_t objectLen,
+    size_t offset, unsigned char* out, size_t len) {
+    CheckUnits(unitBytes, objectLen);
+    if (offset > objectLen || len > objectLen - offset) {
+        throw std::out_of_range("XTS range is outside the object");
+    }
+    if (len == 0) {
+        return;
+    }
+    const size_t firstUnit = offset / unitBytes;
+    const size_t units = (offset + len - 1) / unitBytes - firstUnit + 1;
+    ParallelFor(units, unitBytes, [&](size_t first, size_t n) {
+        for (size_t u = firstUnit + first; u < firstUnit + first + n; u++) {
+            const size_t start = u * unitBytes;
+            const size_t bytes = objectLen - start < unitBytes
+                ? objectLen - start : unitBytes;
+            const size_t from = offset > start ? offset - start : 0;
+            const size_t to = offset + len - start < bytes
+                ? offset + len - start : bytes;
+            CryptUnitRange(keys, sector + u, object + start, bytes, from, to,
+                out + (start + from - offset));
+        }
+    });
+}
+
+}  // namespace
+
+void EncryptXTS(const AESRoundKeys& dataKeys, const AESRoundKeys& tweakKeys,
+    size_t unitBytes, unsigned long long sector, const unsigned char* in,
+    unsigned char* out, size_t len) {
+    CryptXTS(MakeKeys(dataKeys, tweakKeys, true), unitBytes, sector, in, out,
+        len);
+}
+
+void DecryptXTS(const AESRoundKeys& dataKeys, const AESRoundKeys& tweakKeys,
+    size_t unitBytes, unsigned long long sector, const unsigned char* in,
+    unsigned char* out, size_t len) {
+    CryptXTS(MakeKeys(dataKeys, tweakKeys, false), unitBytes, sector, in, out,
+        len);
+}
+
+void EncryptXTSRuns(const AESRoundKeys& dataKeys,
+    const AESRoundKeys& tweakKeys, size_t unitBytes, const XTSRun runs[],
+    size_t count) {
+    CryptXTSRuns(MakeKeys(dataKeys, tweakKeys, true), unitBytes, runs, count);
+}
+
+void DecryptXTSRuns(const AESRoundKeys& dataKeys,
+    const AESRoundKeys& tweakKeys, size_t unitBytes, const XTSRun runs[],
+    size_t count) {
+    CryptXTSRuns(MakeKeys(dataKeys, tweakKeys, false), unitBytes, runs, count);
+}
+
+void DecryptXTSRange(const AESRoundKeys& dataKeys,
+    const AESRoundKeys& tweakKeys, size_t unitBytes, unsigned long long sector,
+    const unsigned char* object, size_t objectLen, size_t offset,
+    unsigned char* out, size_t len) {
+    CryptXTSRange(MakeKeys(dataKeys, tweakKeys, false), unitBytes, sector,
+        object, objectLen, offset, out, len);
+}
+
+}  // namespace AESEngine
@@ -0,0 +1,55 @@
+// AESXTS.h : XTS-AES (IEEE 1619) for sector-addressed storage.
+#pragma once
+#ifndef _AES_XTS_H_
+#define _AES_XTS_H_
+
+#include "AESEngine.h"
+
+namespace AESEngine {
+
+/// Consecutive data units of one XTS call, the first numbered `sector`.
+struct XTSRun {
+    unsigned long long sector;
+    const unsigned char* in;
+    unsigned char* out;
+    size_t len;
+};
+
+// XTS over `len` bytes of consecutive data units of `unitBytes` bytes, the
+// first numbered `sector`. Each unit starts from the tweak key's encryption
+// of its number (128-bit little-endian). The last unit may be short but
+// must hold at least one block; one that is not whole blocks is finished
+// with ciphertext stealing. Units are independent and run in parallel.
+// `out` may alias `in`.
+void EncryptXTS(const AESRoundKeys& dataKeys, const AESRoundKeys& tweakKeys,
+    size_t unitBytes, unsigned long long sector, const unsigned char* in,
+    unsigned char* out, size_t len);
+
+void DecryptXTS(const AESRoundKeys& dataKeys, const AESRoundKeys& tweakKeys,
+    size_t unitBytes, unsigned long long sector, const unsigned char* in,
+    unsigned char* out, size_t len);
+
+// The same over several runs at once, e.g. the scattered sectors of one I/O
+// request; the units of all runs share the thread pool.
+void EncryptXTSRuns(const AESRoundKeys& dataKeys,
+    const AESRoundKeys& tweakKeys, size_t unitBytes, const XTSRun runs[],
+    size_t count);
+
+void DecryptXTSRuns(const AESRoundKeys& dataKeys,
+    const AESRoundKeys& tweakKeys, size_t unitBytes, const XTSRun runs[],
+    size_t count);
+
+// Decrypts bytes [offset, offset + len) of an XTS-encrypted object of
+// `objectLen` bytes whose first unit is numbered `sector`, reading only the
+// units the range overlaps. Blocks are seeked to by their tweak, so the
+// cost follows `len`, not `offset`; a range that reaches into a stolen tail
+// also reads the full block before it. `out` receives exactly `len` bytes
+// and must not overlap `object`.
+void DecryptXTSRange(const AESRoundKeys& dataKeys,
+    const AESRoundKeys& tweakKeys, size_t unitBytes, unsigned long long sector,
+    const unsigned char* object, size_t objectLen, size_t offset,
+    unsigned char* out, size_t len);
+
+}  // namespace AESEngine
+
+#endif  // _AES_XTS_H_
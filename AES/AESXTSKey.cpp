@@ -0,0 +1,101 @@
+#include "pch.h"
+#include "AESXTSKey.h"
+#include "AESXTS.h"
+
+namespace {
+
+AESKeyLength HalfKeyLength(size_t keyLen) {
+    if (keyLen != 32 && keyLen != 48 && keyLen != 64) {
+        throw std::invalid_argument("XTS key must be 32, 48 or 64 bytes");
+    }
+    return AESKey::KeyLengthForBytes(keyLen / 2);
+}
+
+std::vector<AESEngine::XTSRun> ToRuns(const AESXTSSector sectors[],
+    size_t count) {
+    std::vector<AESEngine::XTSRun> runs(count);
+    for (size_t i = 0; i < count; i++) {
+        runs[i] = { sectors[i].sector, sectors[i].in, sectors[i].out,
+            sectors[i].len };
+    }
+    return runs;
+}
+
+}  // namespace
+
+AESXTSKey::AESXTSKey(const unsigned char key[], size_t keyLen,
+    size_t dataUnitBytes)
+    : dataKey(key, HalfKeyLength(keyLen)),
+      tweakKey(key + keyLen / 2, HalfKeyLength(keyLen)),
+      dataUnitBytes(dataUnitBytes) {
+    // IEEE 1619 needs independent keys; equal halves weaken the first block
+    if (memcmp(key, key + keyLen / 2, keyLen / 2) == 0) {
+        throw std::invalid_argument("XTS data and tweak keys must differ");
+    }
+    if (dataUnitBytes < AESEngine::BlockBytes) {
+        throw std::invalid_argument("XTS data unit must be at least 16 bytes");
+    }
+}
+
+AESXTSKey::AESXTSKey(const std::vector<unsigned char>& key,
+    size_t dataUnitBytes)
+    : AESXTSKey(key.data(), key.size(), dataUnitBytes) {
+}
+
+void AESXTSKey::EncryptSectors(const unsigned char in[], unsigned char out[],
+    size_t len, unsigned long long startSector) const {
+    AESEngine::EncryptXTS(dataKey.roundKeys, tweakKey.roundKeys,
+        dataUnitBytes, startSector, in, out, len);
+}
+
+void AESXTSKey::DecryptSectors(const unsigned char in[], unsigned char out[],
+    size_t len, unsigned long long startSector) const {
+    AESEngine::DecryptXTS(dataKey.roundKeys, tweakKey.roundKeys,
+        dataUnitBytes, startSector, in, out, len);
+}
+
+void AESXTSKey::EncryptBatch(const AESXTSSector sectors[],
+    size_t count) const {
+    const std::vector<AESEngine::XTSRun> runs = ToRuns(sectors, count);
+    AESEngine::EncryptXTSRuns(dataKey.roundKeys, tweakKey.roundKeys,
+        dataUnitBytes, runs.data(), count);
+}
+
+void AESXTSKey::DecryptBatch(const AESXTSSector sectors[],
+    size_t count) const {
+    const std::vector<AESEngine::XTSRun> runs = ToRuns(sectors, count);
+    AESEngine::DecryptXTSRuns(dataKey.roundKeys, tweakKey.roundKeys,
+        dataUnitBytes, runs.data(), count);
+}
+
+void AESXTSKey::DecryptRange(const unsigned char object[], size_t objectLen,
+    unsigned long long startSector, size_t offset, unsigned char out[],
+    size_t len) const {
+    AESEngine::DecryptXTSRange(dataKey.roundKeys, tweakKey.roundKeys,
+        dataUnitBytes, startSector, object, objectLen, offset, out, len);
+}
+
+std::vector<unsigned char> AESXTSKey::EncryptSectors(
+    const std::vector<unsigned char>& in,
+    unsigned long long startSector) const {
+    std::vector<unsigned char> out(in.size());
+    EncryptSectors(in.data(), out.data(), in.size(), startSector);
+    return out;
+}
+
+std::vector<unsigned char> AESXTSKey::DecryptSectors(
+    const std::vector<unsigned char>& in,
+    unsigned long long startSector) const {
+    std::vector<unsigned char> out(in.size());
+    DecryptSectors(in.data(), out.data(), in.size(), startSector);
+    return out;
+}
+
+std::vector<unsigned char> AESXTSKey::DecryptRange(
+    const std::vector<unsigned char>& object, unsigned long long startSector,
+    size_t offset, size_t len) const {
+    std::vector<unsigned char> out(len);
+    DecryptRange(object.data(), object.size(), startSector, offset,
+        out.data(), len);
+    return out;
+}
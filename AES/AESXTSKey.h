@@ -0,0 +1,78 @@
+// AESXTSKey.h : XTS-AES key pair for sector-level storage encryption.
+#pragma once
+#ifndef _AES_XTS_KEY_H_
+#define _AES_XTS_KEY_H_
+
+#include "AESKey.h"
+
+/// One entry of an AESXTSKey batch: `len` bytes of consecutive data units,
+/// the first numbered `sector`. `out` may be `in`.
+struct AESXTSSector {
+    unsigned long long sector;
+    const unsigned char* in;
+    unsigned char* out;
+    size_t len;
+};
+
+/// XTS-AES (IEEE 1619): a data key and a tweak key, both expanded once.
+/// Data is cut into data units of `dataUnitBytes` (a disk sector, usually
+/// 512 or 4096 bytes), and each unit is encrypted under the tweak of its
+/// unit number, so any unit can be read or rewritten on its own. Units are
+/// spread over the thread pool.
+///
+/// Lengths need not be multiples of 16: the last unit of a call may be
+/// shorter than `dataUnitBytes`, but not shorter than 16 bytes, and is
+/// finished with ciphertext stealing. `out` may alias `in`. The schedules
+/// are never modified after construction, so one AESXTSKey can be shared
+/// read-only by any number of threads.
+class AES_API AESXTSKey {
+private:
+    AESKey dataKey;
+    AESKey tweakKey;
+    size_t dataUnitBytes;
+
+public:
+    // `key` is 32, 48 or 64 bytes: the data key followed by a tweak key of
+    // the same size (XTS-AES-128, -192, -256). The two halves must differ.
+    AESXTSKey(const unsigned char key[], size_t keyLen,
+        size_t dataUnitBytes = 512);
+
+    explicit AESXTSKey(const std::vector<unsigned char>& key,
+        size_t dataUnitBytes = 512);
+
+    size_t GetDataUnitBytes() const { return dataUnitBytes; }
+
+    // Encrypts `len` bytes of consecutive units starting at `startSector`.
+    void EncryptSectors(const unsigned char in[], unsigned char out[],
+        size_t len, unsigned long long startSector) const;
+
+    void DecryptSectors(const unsigned char in[], unsigned char out[],
+        size_t len, unsigned long long startSector) const;
+
+    // Handles the scattered sectors of one I/O request in a single call.
+    void EncryptBatch(const AESXTSSector sectors[], size_t count) const;
+
+    void DecryptBatch(const AESXTSSector sectors[], size_t count) const;
+
+    // Decrypts bytes [offset, offset + len) of an encrypted object of
+    // `objectLen` bytes (a mapped file, say) whose first unit is
+    // `startSector`. Only the units the range overlaps are read and only
+    // the blocks it touches are decrypted. `out` receives `len` bytes.
+    void DecryptRange(const unsigned char object[], size_t objectLen,
+        unsigned long long startSector, size_t offset, unsigned char out[],
+        size_t len) const;
+
+    std::vector<unsigned char> EncryptSectors(
+        const std::vector<unsigned char>& in,
+        unsigned long long startSector) const;
+
+    std::vector<unsigned char> DecryptSectors(
+        const std::vector<unsigned char>& in,
+        unsigned long long startSector) const;
+
+    std::vector<unsigned char> DecryptRange(
+        const std::vector<unsigned char>& object,
+        unsigned long long startSector, size_t offset, size_t len) const;
+};
+
+#endif  // _AES_XTS_KEY_H_
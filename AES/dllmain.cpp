@@ -1,9 +1,236 @@
 // dllmain.cpp : Defines the entry point for the DLL application.
 #include "pch.h"
 #include "AES.h"
+#include "AESEngine.h"
+#include "AESContext.h"
+#include "AESGCM.h"
+#include "AESKey.h"
+#include "AESKeyCache.h"
+#include "AESReencryptor.h"
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_set>
 
 #define EXPORTED_METHOD extern "C" __declspec(dllexport)
 
+namespace {
+
+// Every handle handed out and not yet released, one set per handle type.
+// Pointers are looked up here rather than read through, so a stale,
+// foreign or twice-destroyed handle is rejected without touching its memory.
+std::shared_mutex handleMutex;
+
+template <typename T>
+std::unordered_set<const T*>& LiveHandles() {
+    static std::unordered_set<const T*> handles;
+    return handles;
+}
+
+template <typename T>
+T* RegisterHandle(std::unique_ptr<T> handle) {
+    std::unique_lock<std::shared_mutex> lock(handleMutex);
+    LiveHandles<T>().insert(handle.get());
+    return handle.release();
+}
+
+// `handle` if it is live; throws std::invalid_argument with `error` if not
+template <typename T>
+T* CheckHandle(T* handle, const char* error) {
+    std::shared_lock<std::shared_mutex> lock(handleMutex);
+    if (LiveHandles<T>().count(handle) == 0) {
+        throw std::invalid_argument(error);
+    }
+    return handle;
+}
+
+// Deletes `handle` if it is live and ignores it otherwise
+template <typename T>
+void ReleaseHandle(T* handle) {
+    {
+        std::unique_lock<std::shared_mutex> lock(handleMutex);
+        if (LiveHandles<T>().erase(handle) == 0) {
+            return;
+        }
+    }
+    delete handle;
+}
+
+CipherContext* CheckContext(CipherContext* context) {
+    return CheckHandle(context, "Invalid cipher context");
+}
+
+XTSContext* CheckXTS(XTSContext* context) {
+    return CheckHandle(context, "Invalid XTS context");
+}
+
+// Builds the batch for XTSEncryptBatch/XTSDecryptBatch: entry i is
+// lengths[i] bytes at offsets[i], written to the same offset of `out`
+std::vector<AESXTSSector> XTSBatch(const unsigned long long* sectors,
+    const unsigned char* arena, const size_t* offsets, const size_t* lengths,
+    size_t count, unsigned char* out) {
+    std::vector<AESXTSSector> batch(count);
+    for (size_t i = 0; i < count; i++) {
+        batch[i] = { sectors[i], arena + offsets[i], out + offsets[i], lengths[i] };
+    }
+    return batch;
+}
+
+// Builds the batch for MultiKeyEncrypt/MultiKeyDecrypt: row i is lengths[i]
+// bytes at offsets[i] under contexts[i], with its counter block at
+// ivs + 16 * i for CTR, written to the same offset of `out`. The contexts
+// must all be ECB, or all CTR with one counter layout; `shape` is set to
+// the first of them.
+std::vector<AESKeyedMessage> MultiKeyBatch(CipherContext* const* contexts,
+    const unsigned char* arena, const size_t* offsets, const size_t* lengths,
+    size_t count, const unsigned char* ivs, unsigned char* out,
+    const CipherContext*& shape) {
+    std::vector<AESKeyedMessage> batch(count);
+    shape = nullptr;
+    for (size_t i = 0; i < count; i++) {
+        const CipherContext& ctx = *CheckContext(contexts[i]);
+        if (shape == nullptr) {
+            if (ctx.mode != CipherMode::ECB && ctx.mode != CipherMode::CTR) {
+                throw std::invalid_argument("Multi-key calls are ECB or CTR");
+            }
+            if (ctx.mode == CipherMode::CTR && ivs == nullptr) {
+                throw std::invalid_argument("IVs are required for CTR");
+            }
+            shape = &ctx;
+        }
+        else if (ctx.mode != shape->mode ||
+            ctx.counterLayout.counterBytes != shape->counterLayout.counterBytes ||
+            ctx.counterLayout.bigEndian != shape->counterLayout.bigEndian) {
+            throw std::invalid_argument("Contexts of a multi-key call differ");
+        }
+        batch[i] = { &ctx.key, ivs != nullptr ? ivs + i * 16 : nullptr,
+            arena + offsets[i], out + offsets[i], lengths[i] };
+    }
+    return batch;
+}
+
+// One side of ContextReencrypt/ReencryptFile: the context's key, mode and
+// counter layout with the object's IV
+AESCipherSpec CipherSpec(CipherContext* context, const unsigned char* iv) {
+    const CipherContext& ctx = *CheckContext(context);
+    return { &ctx.key, ctx.mode, iv, ctx.counterLayout };
+}
+
+ContainerContext* CheckContainer(ContainerContext* context) {
+    return CheckHandle(context, "Invalid container");
+}
+
+// Bytes read from a file at a time by the file-to-file exports
+static constexpr size_t FileBufferBytes = 1 << 20;
+
+CipherStream* CheckStream(CipherStream* stream) {
+    return CheckHandle(stream, "Invalid cipher stream");
+}
+
+// Runs `mode` over `len` bytes; `in` and `out` may be the same buffer
+void RunMode(const AESKey& key, CipherMode mode, bool encrypt,
+    const unsigned char* iv, const unsigned char* in, unsigned char* out,
+    size_t len, const AESCounterLayout& layout = AESCounterLayout()) {
+    if (mode != CipherMode::ECB && iv == nullptr) {
+        throw std::invalid_argument("IV is required for this mode");
+    }
+    switch (mode) {
+    case CipherMode::ECB:
+        if (encrypt) {
+            key.EncryptECB(in, out, len);
+        }
+        else {
+            key.DecryptECB(in, out, len);
+        }
+        break;
+    case CipherMode::CBC:
+        if (encrypt) {
+            key.EncryptCBC(in, out, len, iv);
+        }
+        else {
+            key.DecryptCBC(in, out, len, iv);
+        }
+        break;
+    case CipherMode::CFB:
+        if (encrypt) {
+            key.EncryptCFB(in, out, len, iv);
+        }
+        else {
+            key.DecryptCFB(in, out, len, iv);
+        }
+        break;
+    case CipherMode::CTR:
+        key.EncryptCTR(in, out, len, iv, layout);
+        break;
+    case CipherMode::GCM:
+        // GCM carries a tag and has its own exports
+        throw std::invalid_argument("GCM needs ContextGCMEncrypt/ContextGCMDecrypt");
+    }
+}
+
+// Length after padding to the block size, as AES::padToBlockSize pads
+size_t PaddedLength(size_t len) {
+    return len + (16 - len % 16) % 16;
+}
+
+// Encrypted size of `len` bytes: CTR is a stream mode and is never padded
+size_t EncryptedLength(CipherMode mode, size_t len) {
+    return mode == CipherMode::CTR ? len : PaddedLength(len);
+}
+
+// Encrypts `len` bytes into EncryptedLength(mode, len) bytes of `out`. Whole blocks
+// go straight from `in` to `out`; only a partial last block is padded, on
+// the stack. `out` may be `in` when it has room for the padding.
+void EncryptPadded(const AESKey& key, CipherMode mode,
+    const unsigned char* iv, const unsigned char* in, unsigned char* out,
+    size_t len, const AESCounterLayout& layout = AESCounterLayout()) {
+    if (mode == CipherMode::CTR) {
+        RunMode(key, mode, true, iv, in, out, len, layout);
+        return;
+    }
+
+    const size_t fullLen = len - len % 16;
+    RunMode(key, mode, true, iv, in, out, fullLen);
+
+    if (fullLen < len) {
+        const size_t tail = len - fullLen;
+        unsigned char last[16];
+        std::memcpy(last, in + fullLen, tail);
+        std::memset(last + tail, (int)(16 - tail), 16 - tail);
+
+        // CBC and CFB both chain on the previous ciphertext block
+        const unsigned char* chain = fullLen > 0 ? out + fullLen - 16 : iv;
+        RunMode(key, mode, true, chain, last, out + fullLen, 16);
+    }
+}
+
+// Ciphertext followed by its tag into `out`, which must hold len + 16 bytes
+void SealGCM(const AESKey& key, const unsigned char* iv, size_t ivLen,
+    const unsigned char* aad, size_t aadLen, const unsigned char* in,
+    unsigned char* out, size_t len) {
+    if (iv == nullptr || (aad == nullptr && aadLen > 0)) {
+        throw std::invalid_argument("GCM IV and AAD are required");
+    }
+    key.EncryptGCM(in, out, len, iv, ivLen, aad, aadLen, out + len);
+}
+
+// Verifies and decrypts ciphertext followed by its tag; `out` gets len - 16
+// bytes and is zeroed when the tag does not match
+bool OpenGCM(const AESKey& key, const unsigned char* iv, size_t ivLen,
+    const unsigned char* aad, size_t aadLen, const unsigned char* in,
+    unsigned char* out, size_t len) {
+    if (iv == nullptr || (aad == nullptr && aadLen > 0)) {
+        throw std::invalid_argument("GCM IV and AAD are required");
+    }
+    if (len < AESEngine::GCMTagBytes) {
+        return false;
+    }
+    const size_t dataLen = len - AESEngine::GCMTagBytes;
+    return key.DecryptGCM(in, out, dataLen, iv, ivLen, aad, aadLen, in + dataLen);
+}
+
+}  // namespace
+
 // Function to generate a random key for AES encryption
 EXPORTED_METHOD unsigned char* GenerateKey(size_t* keyLen) {  // keyLen is a pointer to the key length
     try {
@@ -35,23 +262,17 @@ EXPORTED_METHOD unsigned char* GenerateKey(size_t* keyLen) {  // keyLen is a poi
 // plainLen is the length of the plain text
 EXPORTED_METHOD unsigned char* Encrypt(const unsigned char* keyBytes, size_t keyLen, const unsigned char* plainBytes, size_t plainLen, size_t* encryptedLen) {
     try {
-        AES aes(AESKeyLength::AES_128);
-
-        std::vector<unsigned char> keyVector(keyBytes, keyBytes + keyLen);
-        std::vector<unsigned char> plainTextVector(plainBytes, plainBytes + plainLen);
-
-        std::vector<unsigned char> paddingBytes = aes.padToBlockSize(plainTextVector, 16);
-        std::vector<std::vector<unsigned char>> blocks = aes.divideIntoBlocks(paddingBytes, 16);
-
-        std::vector<unsigned char> encryptedBytes;
-        for (const auto& block : blocks) {
-            auto encryptedBlock = aes.EncryptECB(block, keyVector);
-            encryptedBytes.insert(encryptedBytes.end(), encryptedBlock.begin(), encryptedBlock.end());
+        if (keyLen < 16) {
+            throw std::invalid_argument("AES-128 key must be 16 bytes");
         }
 
-        *encryptedLen = encryptedBytes.size();
-        unsigned char* encryptedArray = new unsigned char[encryptedBytes.size()];
-        std::memcpy(encryptedArray, encryptedBytes.data(), encryptedBytes.size());
+        // Expanded on first use, then served from the schedule cache
+        std::shared_ptr<const AESKey> context = CachedKey(keyBytes, AESKeyLength::AES_128);
+
+        const size_t paddedLen = PaddedLength(plainLen);
+        unsigned char* encryptedArray = new unsigned char[paddedLen];
+        EncryptPadded(*context, CipherMode::ECB, nullptr, plainBytes, encryptedArray, plainLen);
+        *encryptedLen = paddedLen;
 
         return encryptedArray;
     }
@@ -64,24 +285,99 @@ EXPORTED_METHOD unsigned char* Encrypt(const unsigned char* keyBytes, size_t key
 // Function to decrypt cipher text using AES decryption
 EXPORTED_METHOD unsigned char* Decrypt(const unsigned char* keyBytes, size_t keyLen, const unsigned char* encryptedBytes, size_t encryptedLen, size_t* decryptedLen) {
     try {
-        AES aes(AESKeyLength::AES_128);
+        if (keyLen < 16) {
+            throw std::invalid_argument("AES-128 key must be 16 bytes");
+        }
 
-        std::vector<unsigned char> keyVector(keyBytes, keyBytes + keyLen);
-        std::vector<unsigned char> encryptedBytesVector(encryptedBytes, encryptedBytes + encryptedLen);
+        // Expanded on first use, then served from the schedule cache
+        std::shared_ptr<const AESKey> context = CachedKey(keyBytes, AESKeyLength::AES_128);
 
-        std::vector<std::vector<unsigned char>> blocks = aes.divideIntoBlocks(encryptedBytesVector, 16);
+        std::unique_ptr<unsigned char[]> decryptedArray(new unsigned char[encryptedLen]);
+        context->DecryptECB(encryptedBytes, decryptedArray.get(), encryptedLen);
+        *decryptedLen = encryptedLen;
 
-        std::vector<unsigned char> decryptedBytes;
-        for (const auto& block : blocks) {
-            auto decryptedBlock = aes.DecryptECB(block, keyVector);
-            decryptedBytes.insert(decryptedBytes.end(), decryptedBlock.begin(), decryptedBlock.end());
+        return decryptedArray.release();
+    }
+    catch (const std::exception&) {
+        *decryptedLen = 0;
+        return nullptr;
+    }
+}
+
+// Function to create a reusable cipher context
+// keyBytes is the key, keyLen is 16, 24 or 32 bytes (AES-128/192/256)
+// mode is 0 for ECB, 1 for CBC, 2 for CFB, 3 for CTR (full 128-bit big-endian counter), 4 for GCM
+// The key is expanded once here; release the handle with DestroyCipherContext
+EXPORTED_METHOD CipherContext* CreateCipherContext(const unsigned char* keyBytes, size_t keyLen, int mode) {
+    try {
+        if (keyBytes == nullptr) {
+            throw std::invalid_argument("Key is required");
+        }
+        if (mode < (int)CipherMode::ECB || mode > (int)CipherMode::GCM) {
+            throw std::invalid_argument("Invalid cipher mode");
+        }
+
+        return RegisterHandle(std::make_unique<CipherContext>(keyBytes, AESKey::KeyLengthForBytes(keyLen), (CipherMode)mode));
+    }
+    catch (const std::exception&) {
+        return nullptr;
+    }
+}
+
+// Function to create a CTR cipher context with a custom counter layout
+// The last counterBytes (1..16) bytes of the iv passed to each call are the
+// counter, big-endian when counterBigEndian is nonzero; the rest is the nonce
+// CTR output is never padded and has the same length as its input
+EXPORTED_METHOD CipherContext* CreateCTRContext(const unsigned char* keyBytes, size_t keyLen, unsigned int counterBytes, int counterBigEndian) {
+    try {
+        if (keyBytes == nullptr) {
+            throw std::invalid_argument("Key is required");
         }
+        if (counterBytes < 1 || counterBytes > 16) {
+            throw std::invalid_argument("Invalid CTR counter size");
+        }
+
+        AESCounterLayout layout;
+        layout.counterBytes = counterBytes;
+        layout.bigEndian = counterBigEndian != 0;
+        return RegisterHandle(std::make_unique<CipherContext>(keyBytes, AESKey::KeyLengthForBytes(keyLen), CipherMode::CTR, layout));
+    }
+    catch (const std::exception&) {
+        return nullptr;
+    }
+}
+
+// Function to encrypt with a cipher context
+// iv is 16 bytes for CBC/CFB/CTR and ignored for ECB
+// The plain text is padded to the block size the same way Encrypt does, except in CTR
+EXPORTED_METHOD unsigned char* ContextEncrypt(CipherContext* context, const unsigned char* iv, const unsigned char* plainBytes, size_t plainLen, size_t* encryptedLen) {
+    try {
+        const CipherContext& ctx = *CheckContext(context);
 
-        *decryptedLen = decryptedBytes.size();
-        unsigned char* decryptedArray = new unsigned char[decryptedBytes.size()];
-        std::memcpy(decryptedArray, decryptedBytes.data(), decryptedBytes.size());
+        const size_t paddedLen = EncryptedLength(ctx.mode, plainLen);
+        std::unique_ptr<unsigned char[]> encryptedArray(new unsigned char[paddedLen]);
+        EncryptPadded(ctx.key, ctx.mode, iv, plainBytes, encryptedArray.get(), plainLen, ctx.counterLayout);
+        *encryptedLen = paddedLen;
 
-        return decryptedArray;
+        return encryptedArray.release();
+    }
+    catch (const std::exception&) {
+        *encryptedLen = 0;
+        return nullptr;
+    }
+}
+
+// Function to decrypt with a cipher context
+// encryptedLen must be a multiple of 16; padding is left in place like Decrypt
+EXPORTED_METHOD unsigned char* ContextDecrypt(CipherContext* context, const unsigned char* iv, const unsigned char* encryptedBytes, size_t encryptedLen, size_t* decryptedLen) {
+    try {
+        const CipherContext& ctx = *CheckContext(context);
+
+        std::unique_ptr<unsigned char[]> decryptedArray(new unsigned char[encryptedLen]);
+        RunMode(ctx.key, ctx.mode, false, iv, encryptedBytes, decryptedArray.get(), encryptedLen, ctx.counterLayout);
+        *decryptedLen = encryptedLen;
+
+        return decryptedArray.release();
     }
     catch (const std::exception&) {
         *decryptedLen = 0;
@@ -89,6 +385,701 @@ EXPORTED_METHOD unsigned char* Decrypt(const unsigned char* keyBytes, size_t key
     }
 }
 
+// Function to release a cipher context and wipe its key schedule
+// A pointer that is not a live handle, such as one already destroyed, is ignored
+EXPORTED_METHOD void DestroyCipherContext(CipherContext* context) {
+    ReleaseHandle(context);
+}
+
+// Function to query the output size of EncryptInto/ContextEncryptInto
+// Decryption output is always the same size as its input
+// CTR contexts never pad, so for them this is an upper bound
+EXPORTED_METHOD size_t GetEncryptedLength(size_t plainLen) {
+    return PaddedLength(plainLen);
+}
+
+// Function to encrypt into a caller-provided buffer without allocating
+// keyLen is 16, 24 or 32 bytes (AES-128/192/256), the mode is ECB
+// outCapacity must be at least GetEncryptedLength(plainLen); outBytes may be plainBytes
+// Returns TRUE and sets *written on success
+EXPORTED_METHOD BOOL EncryptInto(const unsigned char* keyBytes, size_t keyLen, const unsigned char* plainBytes, size_t plainLen, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        if (keyBytes == nullptr || outCapacity < PaddedLength(plainLen)) {
+            return FALSE;
+        }
+
+        std::shared_ptr<const AESKey> context = CachedKey(keyBytes, AESKey::KeyLengthForBytes(keyLen));
+        EncryptPadded(*context, CipherMode::ECB, nullptr, plainBytes, outBytes, plainLen);
+        *written = PaddedLength(plainLen);
+
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to decrypt into a caller-provided buffer without allocating
+// encryptedLen must be a multiple of 16 and outCapacity at least encryptedLen
+EXPORTED_METHOD BOOL DecryptInto(const unsigned char* keyBytes, size_t keyLen, const unsigned char* encryptedBytes, size_t encryptedLen, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        if (keyBytes == nullptr || outCapacity < encryptedLen) {
+            return FALSE;
+        }
+
+        std::shared_ptr<const AESKey> context = CachedKey(keyBytes, AESKey::KeyLengthForBytes(keyLen));
+        RunMode(*context, CipherMode::ECB, false, nullptr, encryptedBytes, outBytes, encryptedLen);
+        *written = encryptedLen;
+
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to encrypt with a cipher context into a caller-provided buffer
+// Same padding as ContextEncrypt; nothing is allocated
+EXPORTED_METHOD BOOL ContextEncryptInto(CipherContext* context, const unsigned char* iv, const unsigned char* plainBytes, size_t plainLen, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        const CipherContext& ctx = *CheckContext(context);
+        if (outCapacity < EncryptedLength(ctx.mode, plainLen)) {
+            return FALSE;
+        }
+
+        EncryptPadded(ctx.key, ctx.mode, iv, plainBytes, outBytes, plainLen, ctx.counterLayout);
+        *written = EncryptedLength(ctx.mode, plainLen);
+
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to decrypt with a cipher context into a caller-provided buffer
+EXPORTED_METHOD BOOL ContextDecryptInto(CipherContext* context, const unsigned char* iv, const unsigned char* encryptedBytes, size_t encryptedLen, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        const CipherContext& ctx = *CheckContext(context);
+        if (outCapacity < encryptedLen) {
+            return FALSE;
+        }
+
+        RunMode(ctx.key, ctx.mode, false, iv, encryptedBytes, outBytes, encryptedLen, ctx.counterLayout);
+        *written = encryptedLen;
+
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to decrypt bytes [offset, offset + len) of a CTR-encrypted object without the bytes before them
+// The context must be in CTR mode; encryptedBytes holds just the range and iv is the object's initial counter block
+// The counter is jumped straight to offset, so a read costs the same anywhere in the object
+EXPORTED_METHOD BOOL ContextDecryptRange(CipherContext* context, const unsigned char* iv, unsigned long long offset, const unsigned char* encryptedBytes, size_t len, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        const CipherContext& ctx = *CheckContext(context);
+        if (ctx.mode != CipherMode::CTR || iv == nullptr || outCapacity < len) {
+            return FALSE;
+        }
+
+        ctx.key.DecryptCTRRange(encryptedBytes, outBytes, len, iv, offset, ctx.counterLayout);
+        *written = len;
+
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to encrypt and authenticate with AES-GCM into a caller-provided buffer
+// keyLen is 16, 24 or 32 bytes; iv is ivLen bytes, 12 recommended, never reused with a key
+// aad is authenticated but not encrypted and may be null when aadLen is 0
+// outBytes receives the cipher text followed by a 16-byte tag: outCapacity >= plainLen + 16
+EXPORTED_METHOD BOOL GCMEncrypt(const unsigned char* keyBytes, size_t keyLen, const unsigned char* iv, size_t ivLen, const unsigned char* aad, size_t aadLen, const unsigned char* plainBytes, size_t plainLen, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        if (keyBytes == nullptr || outCapacity < plainLen + AESEngine::GCMTagBytes) {
+            return FALSE;
+        }
+
+        std::shared_ptr<const AESKey> context = CachedKey(keyBytes, AESKey::KeyLengthForBytes(keyLen));
+        SealGCM(*context, iv, ivLen, aad, aadLen, plainBytes, outBytes, plainLen);
+        *written = plainLen + AESEngine::GCMTagBytes;
+
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to verify and decrypt AES-GCM output of GCMEncrypt
+// encryptedBytes is the cipher text followed by its 16-byte tag
+// Returns FALSE if the tag does not match; nothing decrypted is left in outBytes then
+EXPORTED_METHOD BOOL GCMDecrypt(const unsigned char* keyBytes, size_t keyLen, const unsigned char* iv, size_t ivLen, const unsigned char* aad, size_t aadLen, const unsigned char* encryptedBytes, size_t encryptedLen, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        if (keyBytes == nullptr || encryptedLen < AESEngine::GCMTagBytes ||
+            outCapacity < encryptedLen - AESEngine::GCMTagBytes) {
+            return FALSE;
+        }
+
+        std::shared_ptr<const AESKey> context = CachedKey(keyBytes, AESKey::KeyLengthForBytes(keyLen));
+        if (!OpenGCM(*context, iv, ivLen, aad, aadLen, encryptedBytes, outBytes, encryptedLen)) {
+            return FALSE;
+        }
+        *written = encryptedLen - AESEngine::GCMTagBytes;
+
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to encrypt with a GCM cipher context (mode 4), same layout as GCMEncrypt
+EXPORTED_METHOD BOOL ContextGCMEncrypt(CipherContext* context, const unsigned char* iv, size_t ivLen, const unsigned char* aad, size_t aadLen, const unsigned char* plainBytes, size_t plainLen, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        const CipherContext& ctx = *CheckContext(context);
+        if (ctx.mode != CipherMode::GCM || outCapacity < plainLen + AESEngine::GCMTagBytes) {
+            return FALSE;
+        }
+
+        SealGCM(ctx.key, iv, ivLen, aad, aadLen, plainBytes, outBytes, plainLen);
+        *written = plainLen + AESEngine::GCMTagBytes;
+
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to verify and decrypt with a GCM cipher context, same layout as GCMDecrypt
+EXPORTED_METHOD BOOL ContextGCMDecrypt(CipherContext* context, const unsigned char* iv, size_t ivLen, const unsigned char* aad, size_t aadLen, const unsigned char* encryptedBytes, size_t encryptedLen, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        const CipherContext& ctx = *CheckContext(context);
+        if (ctx.mode != CipherMode::GCM || encryptedLen < AESEngine::GCMTagBytes ||
+            outCapacity < encryptedLen - AESEngine::GCMTagBytes) {
+            return FALSE;
+        }
+
+        if (!OpenGCM(ctx.key, iv, ivLen, aad, aadLen, encryptedBytes, outBytes, encryptedLen)) {
+            return FALSE;
+        }
+        *written = encryptedLen - AESEngine::GCMTagBytes;
+
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to query the output size of ContextEncryptRecords, 0 for an invalid mode or padding
+// mode is as for CreateCipherContext (GCM not allowed), padding as for ContextEncryptRecords
+EXPORTED_METHOD size_t GetRecordsEncryptedLength(int mode, int padding, const size_t* lengths, size_t count) {
+    try {
+        return AESKey::RecordsEncryptedLength((CipherMode)mode, (AESRecordPadding)padding, lengths, count);
+    }
+    catch (const std::exception&) {
+        return 0;
+    }
+}
+
+// Function to encrypt many small records (e.g. database values) with a cipher context in one call
+// Record i is lengths[i] bytes at offsets[i] of arena; ivs holds 16 bytes per record for CBC/CFB/CTR and may be null for ECB
+// padding is 0 for PKCS#7 (DecryptRecords recovers exact lengths) or 1 to pad only a partial last block, as ContextEncrypt does
+// The records are written back to back: record i at outOffsets[i], and outOffsets[count] is the total, so outOffsets has count + 1 entries
+// outCapacity must be at least GetRecordsEncryptedLength; outBytes must not overlap arena
+EXPORTED_METHOD BOOL ContextEncryptRecords(CipherContext* context, int padding, const unsigned char* arena, const size_t* offsets, const size_t* lengths, size_t count, const unsigned char* ivs, unsigned char* outBytes, size_t outCapacity, size_t* outOffsets) {
+    try {
+        const CipherContext& ctx = *CheckContext(context);
+        ctx.key.EncryptRecords(ctx.mode, (AESRecordPadding)padding, arena, offsets, lengths, count, ivs, outBytes, outCapacity, outOffsets, ctx.counterLayout);
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to decrypt a batch written by ContextEncryptRecords, same layout and padding
+// outCapacity must be at least the sum of lengths; with PKCS#7 the padding is removed and outOffsets give the exact lengths
+// outBytes may be arena when the records are packed back to back from its start, as ContextEncryptRecords writes them, and must not overlap it otherwise
+// Fails if a record is not whole blocks (except CTR) or its padding is malformed
+EXPORTED_METHOD BOOL ContextDecryptRecords(CipherContext* context, int padding, const unsigned char* arena, const size_t* offsets, const size_t* lengths, size_t count, const unsigned char* ivs, unsigned char* outBytes, size_t outCapacity, size_t* outOffsets) {
+    try {
+        const CipherContext& ctx = *CheckContext(context);
+        ctx.key.DecryptRecords(ctx.mode, (AESRecordPadding)padding, arena, offsets, lengths, count, ivs, outBytes, outCapacity, outOffsets, ctx.counterLayout);
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to encrypt many rows that each have their own key in one call
+// contexts[i] is the cipher context of row i: all ECB, or all CTR with the same counter layout
+// Row i is lengths[i] bytes at offsets[i] of arena (a multiple of 16 for ECB); ivs holds 16 bytes per row for CTR and may be null for ECB
+// Blocks of different rows are encrypted together, so many keys with a few blocks each run nearly as fast as one key
+// Each result goes to the same offset of outBytes, which may be arena
+EXPORTED_METHOD BOOL MultiKeyEncrypt(CipherContext* const* contexts, const unsigned char* arena, const size_t* offsets, const size_t* lengths, size_t count, const unsigned char* ivs, unsigned char* outBytes) {
+    try {
+        const CipherContext* shape = nullptr;
+        const std::vector<AESKeyedMessage> batch = MultiKeyBatch(contexts, arena, offsets, lengths, count, ivs, outBytes, shape);
+        if (shape == nullptr) {
+            return TRUE;
+        }
+        if (shape->mode == CipherMode::CTR) {
+            AESKey::EncryptCTRMulti(batch.data(), batch.size(), shape->counterLayout);
+        }
+        else {
+            AESKey::EncryptECBMulti(batch.data(), batch.size());
+        }
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to decrypt rows written by MultiKeyEncrypt, same layout
+EXPORTED_METHOD BOOL MultiKeyDecrypt(CipherContext* const* contexts, const unsigned char* arena, const size_t* offsets, const size_t* lengths, size_t count, const unsigned char* ivs, unsigned char* outBytes) {
+    try {
+        const CipherContext* shape = nullptr;
+        const std::vector<AESKeyedMessage> batch = MultiKeyBatch(contexts, arena, offsets, lengths, count, ivs, outBytes, shape);
+        if (shape == nullptr) {
+            return TRUE;
+        }
+        if (shape->mode == CipherMode::CTR) {
+            AESKey::DecryptCTRMulti(batch.data(), batch.size(), shape->counterLayout);
+        }
+        else {
+            AESKey::DecryptECBMulti(batch.data(), batch.size());
+        }
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to move an object's cipher text from one key, mode and IV to another in one pass (key rotation)
+// fromContext/toContext are ECB, CBC, CFB or CTR cipher contexts; the IVs are 16 bytes and ignored for ECB
+// The plaintext only ever exists a few KiB at a time on the stack, and the pass runs in parallel unless the new mode is CBC or CFB
+// The length is unchanged, so padding carries over: encryptedLen must be a multiple of 16 unless both contexts are CTR
+// outCapacity must be at least encryptedLen; outBytes may be encryptedBytes
+EXPORTED_METHOD BOOL ContextReencrypt(CipherContext* fromContext, const unsigned char* fromIv, CipherContext* toContext, const unsigned char* toIv, const unsigned char* encryptedBytes, size_t encryptedLen, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        const AESCipherSpec from = CipherSpec(fromContext, fromIv);
+        const AESCipherSpec to = CipherSpec(toContext, toIv);
+        if (outCapacity < encryptedLen) {
+            return FALSE;
+        }
+
+        AESReencryptor::Reencrypt(from, to, encryptedBytes, outBytes, encryptedLen);
+        *written = encryptedLen;
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to re-encrypt a whole file into another, same rules as ContextReencrypt
+// The next piece is read while the current one is re-encrypted and written, so a large archive is bound by I/O
+// Returns FALSE, and removes outPath, if the file cannot be read or written or its length does not fit the modes
+EXPORTED_METHOD BOOL ReencryptFile(CipherContext* fromContext, const unsigned char* fromIv, CipherContext* toContext, const unsigned char* toIv, const char* inPath, const char* outPath) {
+    try {
+        if (inPath == nullptr || outPath == nullptr) {
+            return FALSE;
+        }
+
+        AESReencryptor::ReencryptFile(CipherSpec(fromContext, fromIv), CipherSpec(toContext, toIv), inPath, outPath);
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to start a streamed encryption (encrypt nonzero) or decryption with a cipher context
+// iv is 16 bytes for CBC/CFB/CTR and ignored for ECB; GCM contexts cannot be streamed
+// Feed the message through StreamUpdate in pieces of any size, then call StreamFinal
+// The stream copies the key, so the context may be destroyed while it is in use
+EXPORTED_METHOD CipherStream* CreateCipherStream(CipherContext* context, int encrypt, const unsigned char* iv) {
+    try {
+        const CipherContext& ctx = *CheckContext(context);
+        return RegisterHandle(std::make_unique<CipherStream>(ctx, encrypt != 0, iv));
+    }
+    catch (const std::exception&) {
+        return nullptr;
+    }
+}
+
+// Function to process the next piece of a streamed message
+// ECB/CBC/CFB write whole blocks only and hold back up to 15 bytes for the next call; CTR writes inLen bytes
+// outCapacity of inLen + 16 is always enough; outBytes may be inputBytes
+EXPORTED_METHOD BOOL StreamUpdate(CipherStream* stream, const unsigned char* inputBytes, size_t inLen, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        AESStream& s = CheckStream(stream)->stream;
+        if (outCapacity < s.UpdateLength(inLen)) {
+            return FALSE;
+        }
+
+        *written = s.Update(inputBytes, inLen, outBytes);
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to finish a streamed message; outCapacity of 16 is always enough
+// Encryption writes the padded last block, as ContextEncrypt pads it
+// Decryption fails if the cipher text did not end on a block boundary
+// The stream can not be updated again; release it with DestroyCipherStream
+EXPORTED_METHOD BOOL StreamFinal(CipherStream* stream, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        AESStream& s = CheckStream(stream)->stream;
+        if (outCapacity < s.FinalLength()) {
+            return FALSE;
+        }
+
+        *written = s.Final(outBytes);
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to release a cipher stream and wipe its key schedule and buffered data
+EXPORTED_METHOD void DestroyCipherStream(CipherStream* stream) {
+    ReleaseHandle(stream);
+}
+
+// Function to create an XTS-AES (IEEE 1619) context for sector-level storage encryption
+// keyBytes is 32, 48 or 64 bytes: the data key followed by the tweak key, and the two halves must differ
+// dataUnitBytes is the sector size each tweak covers, at least 16 (usually 512 or 4096)
+// Release the handle with DestroyXTSContext
+EXPORTED_METHOD XTSContext* CreateXTSContext(const unsigned char* keyBytes, size_t keyLen, size_t dataUnitBytes) {
+    try {
+        if (keyBytes == nullptr) {
+            throw std::invalid_argument("Key is required");
+        }
+
+        return RegisterHandle(std::make_unique<XTSContext>(keyBytes, keyLen, dataUnitBytes));
+    }
+    catch (const std::exception&) {
+        return nullptr;
+    }
+}
+
+// Function to encrypt consecutive sectors, the first numbered startSector
+// Output has the same length as the input; the last sector may be short but needs at least 16 bytes
+// outCapacity must be at least len; outBytes may be inputBytes
+EXPORTED_METHOD BOOL XTSEncryptSectors(XTSContext* context, unsigned long long startSector, const unsigned char* inputBytes, size_t len, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        const XTSContext& ctx = *CheckXTS(context);
+        if (outCapacity < len) {
+            return FALSE;
+        }
+
+        ctx.key.EncryptSectors(inputBytes, outBytes, len, startSector);
+        *written = len;
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to decrypt consecutive sectors, same layout as XTSEncryptSectors
+EXPORTED_METHOD BOOL XTSDecryptSectors(XTSContext* context, unsigned long long startSector, const unsigned char* inputBytes, size_t len, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        const XTSContext& ctx = *CheckXTS(context);
+        if (outCapacity < len) {
+            return FALSE;
+        }
+
+        ctx.key.DecryptSectors(inputBytes, outBytes, len, startSector);
+        *written = len;
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to encrypt the scattered sectors of one I/O request in one call
+// Entry i is lengths[i] bytes at offsets[i] of arena, consecutive sectors starting at sectors[i]
+// Each result goes to the same offset of outBytes, which may be arena
+EXPORTED_METHOD BOOL XTSEncryptBatch(XTSContext* context, const unsigned long long* sectors, const unsigned char* arena, const size_t* offsets, const size_t* lengths, size_t count, unsigned char* outBytes) {
+    try {
+        const XTSContext& ctx = *CheckXTS(context);
+        const std::vector<AESXTSSector> batch = XTSBatch(sectors, arena, offsets, lengths, count, outBytes);
+        ctx.key.EncryptBatch(batch.data(), batch.size());
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to decrypt a batch, same layout as XTSEncryptBatch
+EXPORTED_METHOD BOOL XTSDecryptBatch(XTSContext* context, const unsigned long long* sectors, const unsigned char* arena, const size_t* offsets, const size_t* lengths, size_t count, unsigned char* outBytes) {
+    try {
+        const XTSContext& ctx = *CheckXTS(context);
+        const std::vector<AESXTSSector> batch = XTSBatch(sectors, arena, offsets, lengths, count, outBytes);
+        ctx.key.DecryptBatch(batch.data(), batch.size());
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to decrypt bytes [offset, offset + len) of an XTS-encrypted object of objectLen bytes
+// objectBytes is the whole object (a mapped file, say), its first sector numbered startSector
+// Only the sectors the range overlaps are read, and only the blocks it touches are decrypted
+EXPORTED_METHOD BOOL XTSDecryptRange(XTSContext* context, unsigned long long startSector, const unsigned char* objectBytes, size_t objectLen, size_t offset, size_t len, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        const XTSContext& ctx = *CheckXTS(context);
+        if (outCapacity < len) {
+            return FALSE;
+        }
+
+        ctx.key.DecryptRange(objectBytes, objectLen, startSector, offset, outBytes, len);
+        *written = len;
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to release an XTS context and wipe its key schedules
+EXPORTED_METHOD void DestroyXTSContext(XTSContext* context) {
+    ReleaseHandle(context);
+}
+
+// Function to encrypt a file into a chunked, authenticated container (layout in AESContainer.h)
+// keyId is 16 bytes stored in the clear to tell which key opens the file, or null for zeros
+// chunkSize of 0 uses 64 KiB; chunks are sealed in parallel and any chunk can later be read alone
+// Returns FALSE, and removes outPath, if the input cannot be read or the container cannot be written
+EXPORTED_METHOD BOOL ContainerEncryptFile(const unsigned char* keyBytes, size_t keyLen, const unsigned char* keyId, unsigned int chunkSize, const char* inPath, const char* outPath) {
+    try {
+        if (keyBytes == nullptr || inPath == nullptr || outPath == nullptr) {
+            return FALSE;
+        }
+
+        const AESKey key(keyBytes, AESKey::KeyLengthForBytes(keyLen));
+        AESFileSource in(inPath);
+        bool complete = false;
+        {
+            AESFileSink out(outPath);
+            try {
+                AESContainerWriter writer(out, key, keyId, chunkSize != 0 ? chunkSize : AESContainerHeader::DefaultChunkBytes);
+                std::vector<unsigned char> buffer(FileBufferBytes);
+                for (size_t got; (got = in.Read(buffer.data(), buffer.size())) > 0; ) {
+                    writer.Write(buffer.data(), got);
+                }
+                writer.Finish();
+                out.Close();
+                complete = true;
+            }
+            catch (const std::exception&) {
+            }
+        }
+
+        // A container cut short by a failed read or write is not left behind
+        if (!complete) {
+            std::remove(outPath);
+        }
+        return complete ? TRUE : FALSE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to decrypt a whole container file front to back
+// Returns FALSE, and removes outPath, if any chunk, the index or the footer is altered or missing
+EXPORTED_METHOD BOOL ContainerDecryptFile(const unsigned char* keyBytes, size_t keyLen, const char* inPath, const char* outPath) {
+    try {
+        if (keyBytes == nullptr || inPath == nullptr || outPath == nullptr) {
+            return FALSE;
+        }
+
+        const AESKey key(keyBytes, AESKey::KeyLengthForBytes(keyLen));
+        AESFileSource in(inPath);
+        bool complete = false;
+        {
+            AESFileSink out(outPath);
+            try {
+                AESContainerStreamReader reader(in, key);
+                std::vector<unsigned char> buffer(FileBufferBytes);
+                for (size_t got; (got = reader.Read(buffer.data(), buffer.size())) > 0; ) {
+                    out.Write(buffer.data(), got);
+                }
+                out.Close();
+                complete = true;
+            }
+            catch (const std::exception&) {
+            }
+        }
+
+        // Plaintext of a container that did not check out is not left behind
+        if (!complete) {
+            std::remove(outPath);
+        }
+        return complete ? TRUE : FALSE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to open a container file for random-access reads
+// The index is authenticated here, so a truncated file fails to open; release with CloseContainer
+EXPORTED_METHOD ContainerContext* OpenContainer(const unsigned char* keyBytes, size_t keyLen, const char* path) {
+    try {
+        if (keyBytes == nullptr || path == nullptr) {
+            throw std::invalid_argument("Key and path are required");
+        }
+
+        return RegisterHandle(std::make_unique<ContainerContext>(path, AESKey(keyBytes, AESKey::KeyLengthForBytes(keyLen))));
+    }
+    catch (const std::exception&) {
+        return nullptr;
+    }
+}
+
+// Function to get the plaintext length of an open container, 0 for an invalid handle
+EXPORTED_METHOD unsigned long long ContainerLength(ContainerContext* context) {
+    try {
+        return CheckContainer(context)->reader.Length();
+    }
+    catch (const std::exception&) {
+        return 0;
+    }
+}
+
+// Function to decrypt plaintext bytes [offset, offset + len) of an open container
+// Only the chunks the range overlaps are read, in parallel; safe to call from several threads at once
+EXPORTED_METHOD BOOL ContainerRead(ContainerContext* context, unsigned long long offset, size_t len, unsigned char* outBytes, size_t outCapacity, size_t* written) {
+    try {
+        *written = 0;
+        const ContainerContext& ctx = *CheckContainer(context);
+        if (outCapacity < len) {
+            return FALSE;
+        }
+
+        ctx.reader.Read(offset, outBytes, len);
+        *written = len;
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to close a container opened with OpenContainer
+EXPORTED_METHOD void CloseContainer(ContainerContext* context) {
+    ReleaseHandle(context);
+}
+
+// Function to tune the thread pool behind large ECB/CTR/CBC/CFB/XTS calls
+// threads counts the calling thread, 0 uses one per logical core; 1 keeps every call on the caller
+// chunkBytes and minParallelBytes of 0 keep the defaults (256 KiB chunks, threads from 1 MiB up)
+// Returns FALSE if the settings are rejected
+EXPORTED_METHOD BOOL ConfigureThreading(unsigned int threads, size_t chunkBytes, size_t minParallelBytes, int pinThreads) {
+    try {
+        AESThreadingOptions options;
+        options.threads = threads;
+        if (chunkBytes != 0) {
+            options.chunkBytes = chunkBytes;
+        }
+        if (minParallelBytes != 0) {
+            options.minParallelBytes = minParallelBytes;
+        }
+        options.pinThreads = pinThreads != 0;
+        SetThreadingOptions(options);
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to size the cache of expanded keys used by the calls that take raw key bytes
+// capacity bounds the number of cached keys (4096 by default); 0 turns caching off
+// Eviction is least recently used within each of the cache's 16 shards, so only approximately LRU overall
+EXPORTED_METHOD BOOL ConfigureKeyCache(size_t capacity) {
+    try {
+        AESKeyCacheOptions options;
+        options.capacity = capacity;
+        SetKeyCacheOptions(options);
+        return TRUE;
+    }
+    catch (const std::exception&) {
+        return FALSE;
+    }
+}
+
+// Function to read the key cache counters; any pointer may be null
+EXPORTED_METHOD void QueryKeyCache(unsigned long long* hits, unsigned long long* misses, unsigned long long* evictions, size_t* entries) {
+    const AESKeyCacheStats stats = GetKeyCacheStats();
+    if (hits != nullptr) {
+        *hits = stats.hits;
+    }
+    if (misses != nullptr) {
+        *misses = stats.misses;
+    }
+    if (evictions != nullptr) {
+        *evictions = stats.evictions;
+    }
+    if (entries != nullptr) {
+        *entries = stats.entries;
+    }
+}
+
+// Function to drop and wipe every cached key, e.g. after a key is retired
+EXPORTED_METHOD void FlushKeyCache() {
+    ClearKeyCache();
+}
+
+// Function to name the block backends in use; either pointer may be null
+// bulk serves the modes that batch independent blocks, serial the CBC/CFB encryption chains
+// AES_BACKEND (portable, compact, aesni, vaes256, vaes512, bitslice, vpaes) forces one before the first call; one the CPU lacks is ignored
+EXPORTED_METHOD void GetBackendNames(const char** bulk, const char** serial) {
+    const AESEngine::Dispatch& dispatch = AESEngine::GetDispatch();
+    if (bulk != nullptr) {
+        *bulk = dispatch.bulk->name;
+    }
+    if (serial != nullptr) {
+        *serial = dispatch.serial->name;
+    }
+}
+
 // Function to free allocated memory
 EXPORTED_METHOD void FreeMemory(unsigned char* ptr) {
     if (ptr != nullptr) {
@@ -99,6 +1090,9 @@ EXPORTED_METHOD void FreeMemory(unsigned char* ptr) {
 BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved) {
     switch (ul_reason_for_call) {
     case DLL_PROCESS_ATTACH:
+        // Probe the CPU once and pick the block backends before any export runs
+        AESEngine::GetDispatch();
+        break;
     case DLL_THREAD_ATTACH:
     case DLL_THREAD_DETACH:
     case DLL_PROCESS_DETACH:
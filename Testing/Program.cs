@@ -1,5 +1,8 @@
 ﻿using System;
+using System.Diagnostics;
+using System.IO;
 using System.Runtime.InteropServices;
+using System.Security.Cryptography;
 using System.Text;
 
 namespace Testing
@@ -18,12 +21,606 @@ namespace Testing
         [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
         public static extern IntPtr Decrypt(byte[] keyBytes, UIntPtr keyLen, byte[] encryptedBytes, UIntPtr encryptedLen, out UIntPtr decryptedLen);
 
+        // Cipher contexts: expand the key once and reuse it across calls
+        // mode: 0 = ECB, 1 = CBC, 2 = CFB, 3 = CTR, 4 = GCM; keyLen: 16, 24 or 32
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern IntPtr CreateCipherContext(byte[] keyBytes, UIntPtr keyLen, int mode);
+
+        // CTR with the last counterBytes (1..16) of the IV as the counter
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern IntPtr CreateCTRContext(byte[] keyBytes, UIntPtr keyLen, uint counterBytes, int counterBigEndian);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern IntPtr ContextEncrypt(IntPtr context, byte[] iv, byte[] plainBytes, UIntPtr plainLen, out UIntPtr encryptedLen);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern IntPtr ContextDecrypt(IntPtr context, byte[] iv, byte[] encryptedBytes, UIntPtr encryptedLen, out UIntPtr decryptedLen);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void DestroyCipherContext(IntPtr context);
+
+        // Caller-buffer variants: nothing is allocated inside the DLL
+        // Size the output with GetEncryptedLength; decryption output matches its input size
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern UIntPtr GetEncryptedLength(UIntPtr plainLen);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool EncryptInto(byte[] keyBytes, UIntPtr keyLen, byte[] plainBytes, UIntPtr plainLen, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool DecryptInto(byte[] keyBytes, UIntPtr keyLen, byte[] encryptedBytes, UIntPtr encryptedLen, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool ContextEncryptInto(IntPtr context, byte[] iv, byte[] plainBytes, UIntPtr plainLen, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool ContextDecryptInto(IntPtr context, byte[] iv, byte[] encryptedBytes, UIntPtr encryptedLen, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        // CTR contexts only: decrypts bytes [offset, offset + len) of an object given just those bytes
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool ContextDecryptRange(IntPtr context, byte[] iv, ulong offset, byte[] encryptedBytes, UIntPtr len, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        // AES-GCM: output is the cipher text followed by a 16-byte tag
+        // Decryption returns false when the tag does not authenticate the data
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool GCMEncrypt(byte[] keyBytes, UIntPtr keyLen, byte[] iv, UIntPtr ivLen, byte[] aad, UIntPtr aadLen, byte[] plainBytes, UIntPtr plainLen, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool GCMDecrypt(byte[] keyBytes, UIntPtr keyLen, byte[] iv, UIntPtr ivLen, byte[] aad, UIntPtr aadLen, byte[] encryptedBytes, UIntPtr encryptedLen, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool ContextGCMEncrypt(IntPtr context, byte[] iv, UIntPtr ivLen, byte[] aad, UIntPtr aadLen, byte[] plainBytes, UIntPtr plainLen, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool ContextGCMDecrypt(IntPtr context, byte[] iv, UIntPtr ivLen, byte[] aad, UIntPtr aadLen, byte[] encryptedBytes, UIntPtr encryptedLen, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        // Record batches: many small values in one arena, encrypted in one call
+        // outOffsets needs count + 1 entries; padding 0 is PKCS#7, 1 pads like ContextEncrypt
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern UIntPtr GetRecordsEncryptedLength(int mode, int padding, UIntPtr[] lengths, UIntPtr count);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool ContextEncryptRecords(IntPtr context, int padding, byte[] arena, UIntPtr[] offsets, UIntPtr[] lengths, UIntPtr count, byte[] ivs, [Out] byte[] outBytes, UIntPtr outCapacity, [Out] UIntPtr[] outOffsets);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool ContextDecryptRecords(IntPtr context, int padding, byte[] arena, UIntPtr[] offsets, UIntPtr[] lengths, UIntPtr count, byte[] ivs, [Out] byte[] outBytes, UIntPtr outCapacity, [Out] UIntPtr[] outOffsets);
+
+        // Multi-key rows: contexts[i] (all ECB, or all CTR with one layout) encrypts lengths[i] bytes at offsets[i]
+        // ivs holds 16 bytes per row for CTR and may be null for ECB; output at the same offsets
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool MultiKeyEncrypt(IntPtr[] contexts, byte[] arena, UIntPtr[] offsets, UIntPtr[] lengths, UIntPtr count, byte[] ivs, [Out] byte[] outBytes);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool MultiKeyDecrypt(IntPtr[] contexts, byte[] arena, UIntPtr[] offsets, UIntPtr[] lengths, UIntPtr count, byte[] ivs, [Out] byte[] outBytes);
+
+        // Key rotation: cipher text under one context and IV to another in one pass, same length
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool ContextReencrypt(IntPtr fromContext, byte[] fromIv, IntPtr toContext, byte[] toIv, byte[] encryptedBytes, UIntPtr encryptedLen, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool ReencryptFile(IntPtr fromContext, byte[] fromIv, IntPtr toContext, byte[] toIv, string inPath, string outPath);
+
+        // Streaming: feed a message through StreamUpdate in pieces of any size, then StreamFinal
+        // Output matches ContextEncrypt/ContextDecrypt of the whole message; inLen + 16 bytes of room always suffice
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern IntPtr CreateCipherStream(IntPtr context, int encrypt, byte[] iv);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool StreamUpdate(IntPtr stream, byte[] inputBytes, UIntPtr inLen, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool StreamFinal(IntPtr stream, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void DestroyCipherStream(IntPtr stream);
+
+        // XTS-AES for sector storage: 32/48/64-byte key (data key then tweak key), sectors of dataUnitBytes
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern IntPtr CreateXTSContext(byte[] keyBytes, UIntPtr keyLen, UIntPtr dataUnitBytes);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool XTSEncryptSectors(IntPtr context, ulong startSector, byte[] inputBytes, UIntPtr len, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool XTSDecryptSectors(IntPtr context, ulong startSector, byte[] inputBytes, UIntPtr len, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        // Batch entry i: lengths[i] bytes at offsets[i] of arena, starting at sectors[i]; output at the same offsets
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool XTSEncryptBatch(IntPtr context, ulong[] sectors, byte[] arena, UIntPtr[] offsets, UIntPtr[] lengths, UIntPtr count, [Out] byte[] outBytes);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool XTSDecryptBatch(IntPtr context, ulong[] sectors, byte[] arena, UIntPtr[] offsets, UIntPtr[] lengths, UIntPtr count, [Out] byte[] outBytes);
+
+        // Decrypts bytes [offset, offset + len) of a whole XTS-encrypted object
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool XTSDecryptRange(IntPtr context, ulong startSector, byte[] objectBytes, UIntPtr objectLen, UIntPtr offset, UIntPtr len, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void DestroyXTSContext(IntPtr context);
+
+        // Chunked, authenticated container files; keyId is 16 bytes or null, chunkSize 0 uses 64 KiB
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool ContainerEncryptFile(byte[] keyBytes, UIntPtr keyLen, byte[] keyId, uint chunkSize, string inPath, string outPath);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool ContainerDecryptFile(byte[] keyBytes, UIntPtr keyLen, string inPath, string outPath);
+
+        // Random-access reads of a container; close the handle with CloseContainer
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern IntPtr OpenContainer(byte[] keyBytes, UIntPtr keyLen, string path);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern ulong ContainerLength(IntPtr context);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool ContainerRead(IntPtr context, ulong offset, UIntPtr len, [Out] byte[] outBytes, UIntPtr outCapacity, out UIntPtr written);
+
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void CloseContainer(IntPtr context);
+
+        // Thread pool for large calls; 0 for threads, chunkBytes or minParallelBytes keeps the default
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool ConfigureThreading(uint threads, UIntPtr chunkBytes, UIntPtr minParallelBytes, int pinThreads);
+
+        // Cache of expanded keys behind the raw-key calls; capacity 0 turns it off
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern bool ConfigureKeyCache(UIntPtr capacity);
+
+        // Key cache hit, miss and eviction counters and its current size
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void QueryKeyCache(out ulong hits, out ulong misses, out ulong evictions, out UIntPtr entries);
+
+        // Drops and wipes every cached key
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void FlushKeyCache();
+
+        // Names of the block backends this process runs; AES_BACKEND forces one
+        [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void GetBackendNames(out IntPtr bulk, out IntPtr serial);
+
         // Import the FreeMemory function
         [DllImport(_dllPath, CallingConvention = CallingConvention.Cdecl)]
         public static extern void FreeMemory(IntPtr ptr);
 
-        static void Main()
+        // Times writing, streaming back and randomly reading a container of `gib` GiB in `dir`
+        static void BenchmarkContainer(string dir, int gib)
+        {
+            byte[] key = new byte[32];
+            new Random(1).NextBytes(key);
+            string plainPath = Path.Combine(dir, "container-bench.bin");
+            string sealedPath = Path.Combine(dir, "container-bench.aesc");
+            string openedPath = Path.Combine(dir, "container-bench.out");
+            long bytes = (long)gib << 30;
+
+            byte[] block = new byte[64 << 20];
+            new Random(2).NextBytes(block);
+            using (FileStream file = File.Create(plainPath))
+            {
+                for (long done = 0; done < bytes; done += block.Length)
+                {
+                    file.Write(block, 0, block.Length);
+                }
+            }
+
+            Stopwatch watch = Stopwatch.StartNew();
+            if (!ContainerEncryptFile(key, new UIntPtr((uint)key.Length), null, 0, plainPath, sealedPath))
+            {
+                Console.WriteLine("Container encryption failed.");
+                return;
+            }
+            Console.WriteLine($"Write:  {bytes / watch.Elapsed.TotalSeconds / (1 << 20):F0} MiB/s");
+
+            watch.Restart();
+            if (!ContainerDecryptFile(key, new UIntPtr((uint)key.Length), sealedPath, openedPath))
+            {
+                Console.WriteLine("Container decryption failed.");
+                return;
+            }
+            Console.WriteLine($"Stream: {bytes / watch.Elapsed.TotalSeconds / (1 << 20):F0} MiB/s");
+
+            // Random 64 KiB reads cost the same anywhere in the file
+            IntPtr container = OpenContainer(key, new UIntPtr((uint)key.Length), sealedPath);
+            byte[] range = new byte[64 << 10];
+            Random offsets = new Random(3);
+            const int reads = 4096;
+            watch.Restart();
+            for (int i = 0; i < reads; i++)
+            {
+                ulong offset = (ulong)(offsets.NextDouble() * (bytes - range.Length));
+                ContainerRead(container, offset, new UIntPtr((uint)range.Length), range, new UIntPtr((uint)range.Length), out UIntPtr written);
+            }
+            Console.WriteLine($"Random: {watch.Elapsed.TotalMilliseconds * 1000 / reads:F1} us per 64 KiB read");
+            CloseContainer(container);
+
+            File.Delete(plainPath);
+            File.Delete(sealedPath);
+            File.Delete(openedPath);
+        }
+
+        // Values AES_BACKEND can force; selftest-all runs every one of them
+        static readonly string[] _backends = { "portable", "compact", "aesni", "vaes256", "vaes512", "bitslice", "vpaes" };
+
+        static int _failures;
+
+        static void Expect(string name, byte[] got, byte[] want)
+        {
+            if (!got.AsSpan().SequenceEqual(want))
+            {
+                _failures++;
+                Console.WriteLine($"FAIL {name}: got {Convert.ToHexString(got)}, want {Convert.ToHexString(want)}");
+            }
+        }
+
+        static void Expect(string name, bool ok)
+        {
+            if (!ok)
+            {
+                _failures++;
+                Console.WriteLine($"FAIL {name}");
+            }
+        }
+
+        // Encrypts or decrypts `input` with a context into a buffer of the same length
+        static byte[] ContextRun(IntPtr context, bool encrypt, byte[] iv, byte[] input)
+        {
+            byte[] output = new byte[input.Length];
+            UIntPtr len = new UIntPtr((uint)input.Length);
+            UIntPtr written;
+            bool ok = encrypt
+                ? ContextEncryptInto(context, iv, input, len, output, len, out written)
+                : ContextDecryptInto(context, iv, input, len, output, len, out written);
+            Expect("context call", ok && written == len);
+            return output;
+        }
+
+        static IntPtr Context(byte[] key, int mode)
+        {
+            return CreateCipherContext(key, new UIntPtr((uint)key.Length), mode);
+        }
+
+        // FIPS-197 appendix C: one block per key length, then the same block
+        // repeated over enough blocks that the wide kernels and their tails run
+        static void TestFips197()
+        {
+            byte[] plain = Convert.FromHexString("00112233445566778899aabbccddeeff");
+            string[] keys = { "000102030405060708090a0b0c0d0e0f", "000102030405060708090a0b0c0d0e0f1011121314151617", "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f" };
+            string[] cipherTexts = { "69c4e0d86a7b0430d8cdb78070b4c55a", "dda97ca4864cdfe06eaf70a0ec0d7191", "8ea2b7ca516745bfeafc49904b496089" };
+            for (int k = 0; k < keys.Length; k++)
+            {
+                string name = $"FIPS-197 C.{k + 1}";
+                byte[] cipher = Convert.FromHexString(cipherTexts[k]);
+                IntPtr context = Context(Convert.FromHexString(keys[k]), 0);
+                Expect(name + " encrypt", ContextRun(context, true, new byte[16], plain), cipher);
+                Expect(name + " decrypt", ContextRun(context, false, new byte[16], cipher), plain);
+
+                byte[] plainRun = new byte[67 * 16];
+                byte[] cipherRun = new byte[67 * 16];
+                for (int i = 0; i < 67; i++)
+                {
+                    plain.CopyTo(plainRun, i * 16);
+                    cipher.CopyTo(cipherRun, i * 16);
+                }
+                Expect(name + " encrypt x67", ContextRun(context, true, new byte[16], plainRun), cipherRun);
+                Expect(name + " decrypt x67", ContextRun(context, false, new byte[16], cipherRun), plainRun);
+                DestroyCipherContext(context);
+            }
+        }
+
+        static readonly string[] _sp80038aKeys = { "2b7e151628aed2a6abf7158809cf4f3c", "8e73b0f7da0e6452c810f32b809079e562f8ead2522c6b7b", "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4" };
+
+        // SP 800-38A appendix F: ECB, CBC, CFB128 and CTR with each key length
+        static void TestSP80038A()
+        {
+            byte[] plain = Convert.FromHexString("6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e5130c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710");
+            byte[] iv = Convert.FromHexString("000102030405060708090a0b0c0d0e0f");
+            byte[] counter = Convert.FromHexString("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff");
+            string[,] cipherTexts =
+            {
+                {
+                    "3ad77bb40d7a3660a89ecaf32466ef97f5d3d58503b9699de785895a96fdbaaf43b1cd7f598ece23881b00e3ed0306887b0c785e27e8ad3f8223207104725dd4",
+                    "7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b273bed6b8e3c1743b7116e69e222295163ff1caa1681fac09120eca307586e1a7",
+                    "3b3fd92eb72dad20333449f8e83cfb4ac8a64537a0b3a93fcde3cdad9f1ce58b26751f67a3cbb140b1808cf187a4f4dfc04b05357c5d1c0eeac4c66f9ff7f2e6",
+                    "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee",
+                },
+                {
+                    "bd334f1d6e45f25ff712a214571fa5cc974104846d0ad3ad7734ecb3ecee4eefef7afd2270e2e60adce0ba2face6444e9a4b41ba738d6c72fb16691603c18e0e",
+                    "4f021db243bc633d7178183a9fa071e8b4d9ada9ad7dedf4e5e738763f69145a571b242012fb7ae07fa9baac3df102e008b0e27988598881d920a9e64f5615cd",
+                    "cdc80d6fddf18cab34c25909c99a417467ce7f7f81173621961a2b70171d3d7a2e1e8a1dd59b88b1c8e60fed1efac4c9c05f9f9ca9834fa042ae8fba584b09ff",
+                    "1abc932417521ca24f2b0459fe7e6e0b090339ec0aa6faefd5ccc2c6f4ce8e941e36b26bd1ebc670d1bd1d665620abf74f78a7f6d29809585a97daec58c6b050",
+                },
+                {
+                    "f3eed1bdb5d2a03c064b5a7e3db181f8591ccb10d410ed26dc5ba74a31362870b6ed21b99ca6f4f9f153e7b1beafed1d23304b7a39f9f3ff067d8d8f9e24ecc7",
+                    "f58c4c04d6e5f1ba779eabfb5f7bfbd69cfc4e967edb808d679f777bc6702c7d39f23369a9d9bacfa530e26304231461b2eb05e2c39be9fcda6c19078c6a9d1b",
+                    "dc7e84bfda79164b7ecd8486985d386039ffed143b28b1c832113c6331e5407bdf10132415e54b92a13ed0a8267ae2f975a385741ab9cef82031623d55b1e471",
+                    "601ec313775789a5b7a7f504bbf3d228f443e3ca4d62b59aca84e990cacaf5c52b0930daa23de94ce87017ba2d84988ddfc9c58db67aada613c2dd08457941a6",
+                },
+            };
+            string[] modes = { "ECB", "CBC", "CFB", "CTR" };
+            for (int k = 0; k < _sp80038aKeys.Length; k++)
+            {
+                for (int mode = 0; mode < modes.Length; mode++)
+                {
+                    string name = $"SP 800-38A {modes[mode]}-AES{128 + 64 * k}";
+                    byte[] cipher = Convert.FromHexString(cipherTexts[k, mode]);
+                    byte[] start = mode == 3 ? counter : iv;
+                    IntPtr context = Context(Convert.FromHexString(_sp80038aKeys[k]), mode);
+                    Expect(name + " encrypt", ContextRun(context, true, start, plain), cipher);
+                    Expect(name + " decrypt", ContextRun(context, false, start, cipher), plain);
+                    DestroyCipherContext(context);
+                }
+            }
+        }
+
+        static void Increment(byte[] counter, int counterBytes, bool bigEndian)
         {
+            for (int i = 0; i < counterBytes; i++)
+            {
+                int at = bigEndian ? 15 - i : 16 - counterBytes + i;
+                if (++counter[at] != 0)
+                {
+                    break;
+                }
+            }
+        }
+
+        // Long messages checked against the same mode built block by block
+        // from one-block ECB calls, which FIPS-197 has already pinned down.
+        // Covers the wide CBC/CFB decryption and CTR kernels, and CTR counters
+        // that wrap within their field without touching the nonce.
+        static void TestChainedModes()
+        {
+            const int blocks = 67;
+            byte[] plain = new byte[blocks * 16];
+            for (int i = 0; i < plain.Length; i++)
+            {
+                plain[i] = (byte)(i * 13 + 5);
+            }
+
+            foreach (string keyHex in _sp80038aKeys)
+            {
+                byte[] key = Convert.FromHexString(keyHex);
+                string size = $"AES{key.Length * 8}";
+                IntPtr ecb = Context(key, 0);
+                byte[] block = new byte[16];
+                byte[] EncryptBlock(byte[] input) => ContextRun(ecb, true, new byte[16], input);
+
+                byte[] iv = Convert.FromHexString("000102030405060708090a0b0c0d0e0f");
+                byte[] cbc = new byte[plain.Length];
+                byte[] cfb = new byte[plain.Length];
+                byte[] cbcChain = (byte[])iv.Clone();
+                byte[] cfbChain = (byte[])iv.Clone();
+                for (int b = 0; b < blocks; b++)
+                {
+                    for (int i = 0; i < 16; i++)
+                    {
+                        block[i] = (byte)(plain[b * 16 + i] ^ cbcChain[i]);
+                    }
+                    cbcChain = EncryptBlock(block);
+                    cbcChain.CopyTo(cbc, b * 16);
+
+                    byte[] keystream = EncryptBlock(cfbChain);
+                    for (int i = 0; i < 16; i++)
+                    {
+                        cfb[b * 16 + i] = (byte)(plain[b * 16 + i] ^ keystream[i]);
+                    }
+                    cfbChain = cfb.AsSpan(b * 16, 16).ToArray();
+                }
+
+                IntPtr context = Context(key, 1);
+                Expect($"CBC-{size} x{blocks} encrypt", ContextRun(context, true, iv, plain), cbc);
+                Expect($"CBC-{size} x{blocks} decrypt", ContextRun(context, false, iv, cbc), plain);
+                DestroyCipherContext(context);
+                context = Context(key, 2);
+                Expect($"CFB-{size} x{blocks} encrypt", ContextRun(context, true, iv, plain), cfb);
+                Expect($"CFB-{size} x{blocks} decrypt", ContextRun(context, false, iv, cfb), plain);
+                DestroyCipherContext(context);
+
+                // Each counter starts a few blocks short of wrapping; the last
+                // message ends mid-block
+                var layouts = new (int counterBytes, bool bigEndian, string start)[]
+                {
+                    (16, true, "fffffffffffffffffffffffffffffff8"),
+                    (4, true, "0123456789abcdef01234567fffffff8"),
+                    (8, true, "0123456789abcdefffffffffffffffe0"),
+                    (2, false, "0123456789abcdef0123456789abf8ff"),
+                };
+                foreach (var layout in layouts)
+                {
+                    string name = $"CTR-{size} {layout.counterBytes}-byte {(layout.bigEndian ? "big" : "little")}-endian wrap";
+                    byte[] message = layout.counterBytes == 2 ? plain.AsSpan(0, plain.Length - 5).ToArray() : plain;
+                    byte[] start = Convert.FromHexString(layout.start);
+                    byte[] counter = (byte[])start.Clone();
+                    byte[] ctr = new byte[message.Length];
+                    for (int b = 0; b * 16 < message.Length; b++)
+                    {
+                        byte[] keystream = EncryptBlock(counter);
+                        for (int i = 0; i < 16 && b * 16 + i < message.Length; i++)
+                        {
+                            ctr[b * 16 + i] = (byte)(message[b * 16 + i] ^ keystream[i]);
+                        }
+                        Increment(counter, layout.counterBytes, layout.bigEndian);
+                    }
+
+                    context = CreateCTRContext(key, new UIntPtr((uint)key.Length), (uint)layout.counterBytes, layout.bigEndian ? 1 : 0);
+                    Expect(name + " encrypt", ContextRun(context, true, start, message), ctr);
+                    Expect(name + " decrypt", ContextRun(context, false, start, ctr), message);
+                    DestroyCipherContext(context);
+                }
+                DestroyCipherContext(ecb);
+            }
+        }
+
+        // GCM test cases 2, 3, 4, 6 (60-byte IV) and 16 (AES-256) from the
+        // GCM specification, then a 1000-byte message whose tag was computed
+        // with OpenSSL; the tag covers the cipher text, so it checks that too
+        static void TestGCM()
+        {
+            const string key128 = "feffe9928665731c6d6a8f9467308308";
+            const string key256 = "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308";
+            const string plain60 = "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39";
+            const string aad = "feedfacedeadbeeffeedfacedeadbeefabaddad2";
+            var cases = new (string name, string key, string iv, string aad, string plain, string sealedHex)[]
+            {
+                ("GCM test case 2", "00000000000000000000000000000000", "000000000000000000000000", "", "00000000000000000000000000000000",
+                    "0388dace60b6a392f328c2b971b2fe78" + "ab6e47d42cec13bdf53a67b21257bddf"),
+                ("GCM test case 3", key128, "cafebabefacedbaddecaf888", "", plain60 + "1aafd255",
+                    "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985" + "4d5c2af327cd64a62cf35abd2ba6fab4"),
+                ("GCM test case 4", key128, "cafebabefacedbaddecaf888", aad, plain60,
+                    "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091" + "5bc94fbc3221a5db94fae95ae7121a47"),
+                ("GCM test case 6", key128, "9313225df88406e555909c5aff5269aa6a7a9538534f7da1e4c303d2a318a728c3c0c95156809539fcf0e2429a6b525416aedbf5a0de6a57a637b39b", aad, plain60,
+                    "8ce24998625615b603a033aca13fb894be9112a5c3a211a8ba262a3cca7e2ca701e4a9a4fba43c90ccdcb281d48c7c6fd62875d2aca417034c34aee5" + "619cc5aefffe0bfa462af43c1699d050"),
+                ("GCM test case 16", key256, "cafebabefacedbaddecaf888", aad, plain60,
+                    "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662" + "76fc6ece0f4e1768cddf8853bb2d551b"),
+            };
+            foreach (var test in cases)
+            {
+                byte[] key = Convert.FromHexString(test.key);
+                byte[] iv = Convert.FromHexString(test.iv);
+                byte[] header = Convert.FromHexString(test.aad);
+                byte[] plain = Convert.FromHexString(test.plain);
+                byte[] sealedBytes = Convert.FromHexString(test.sealedHex);
+                Expect(test.name + " encrypt", Seal(key, iv, header, plain), sealedBytes);
+                Expect(test.name + " decrypt", Open(key, iv, header, sealedBytes) ?? Array.Empty<byte>(), plain);
+                sealedBytes[sealedBytes.Length - 1] ^= 1;
+                Expect(test.name + " rejects a bad tag", Open(key, iv, header, sealedBytes) == null);
+            }
+
+            byte[] longKey = Convert.FromHexString(key256);
+            byte[] longIv = Convert.FromHexString("cafebabefacedbaddecaf888");
+            byte[] longAad = Convert.FromHexString(aad);
+            byte[] longPlain = new byte[1000];
+            for (int i = 0; i < longPlain.Length; i++)
+            {
+                longPlain[i] = (byte)(i * 7);
+            }
+            byte[] longSealed = Seal(longKey, longIv, longAad, longPlain);
+            Expect("GCM 1000-byte tag", longSealed.AsSpan(longPlain.Length).ToArray(), Convert.FromHexString("7694024f71d09ac5cea764bab5f6df2b"));
+            Expect("GCM 1000-byte decrypt", Open(longKey, longIv, longAad, longSealed) ?? Array.Empty<byte>(), longPlain);
+        }
+
+        static byte[] Seal(byte[] key, byte[] iv, byte[] aad, byte[] plain)
+        {
+            byte[] output = new byte[plain.Length + 16];
+            bool ok = GCMEncrypt(key, new UIntPtr((uint)key.Length), iv, new UIntPtr((uint)iv.Length), aad, new UIntPtr((uint)aad.Length),
+                plain, new UIntPtr((uint)plain.Length), output, new UIntPtr((uint)output.Length), out UIntPtr written);
+            Expect("GCMEncrypt call", ok && written.ToUInt64() == (ulong)output.Length);
+            return output;
+        }
+
+        // Null when the tag does not authenticate the input
+        static byte[]? Open(byte[] key, byte[] iv, byte[] aad, byte[] sealedBytes)
+        {
+            byte[] output = new byte[sealedBytes.Length];
+            bool ok = GCMDecrypt(key, new UIntPtr((uint)key.Length), iv, new UIntPtr((uint)iv.Length), aad, new UIntPtr((uint)aad.Length),
+                sealedBytes, new UIntPtr((uint)sealedBytes.Length), output, new UIntPtr((uint)output.Length), out UIntPtr written);
+            return ok ? output.AsSpan(0, (int)written.ToUInt32()).ToArray() : null;
+        }
+
+        // IEEE 1619 XTS-AES vectors 2, 4 and 10, and 15 to 18 for ciphertext
+        // stealing. The 512-byte vectors are compared by SHA-256 of their
+        // cipher text; each data unit is the whole vector.
+        static void TestXTS()
+        {
+            byte[] pattern = new byte[512];
+            for (int i = 0; i < pattern.Length; i++)
+            {
+                pattern[i] = (byte)i;
+            }
+            const string stealingKey = "fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0bfbebdbcbbbab9b8b7b6b5b4b3b2b1b0";
+            var cases = new (string name, string key, ulong sector, byte[] plain, string cipher, bool hashed)[]
+            {
+                ("XTS vector 2", "1111111111111111111111111111111122222222222222222222222222222222", 0x3333333333,
+                    Enumerable.Repeat((byte)0x44, 32).ToArray(), "c454185e6a16936e39334038acef838bfb186fff7480adc4289382ecd6d394f0", false),
+                ("XTS vector 4", "2718281828459045235360287471352631415926535897932384626433832795", 0,
+                    pattern, "ebee4d64dd2395bb2d6a2d37a0a48ecb2bf4913cfc99d27c2214f2f4144715ea", true),
+                ("XTS vector 10", "27182818284590452353602874713526624977572470936999595749669676273141592653589793238462643383279502884197169399375105820974944592", 0xff,
+                    pattern, "e97e974fa393af794f7a4684395814cf820de60a01eaec677d87b452e316b364", true),
+                ("XTS vector 15", stealingKey, 0x123456789a, pattern.AsSpan(0, 17).ToArray(), "6c1625db4671522d3d7599601de7ca09ed", false),
+                ("XTS vector 16", stealingKey, 0x123456789a, pattern.AsSpan(0, 18).ToArray(), "d069444b7a7e0cab09e24447d24deb1fedbf", false),
+                ("XTS vector 17", stealingKey, 0x123456789a, pattern.AsSpan(0, 19).ToArray(), "e5df1351c0544ba1350b3363cd8ef4beedbf9d", false),
+                ("XTS vector 18", stealingKey, 0x123456789a, pattern.AsSpan(0, 20).ToArray(), "9d84c813f719aa2c7be3f66171c7c5c2edbf9dac", false),
+            };
+            foreach (var test in cases)
+            {
+                byte[] key = Convert.FromHexString(test.key);
+                UIntPtr len = new UIntPtr((uint)test.plain.Length);
+                IntPtr context = CreateXTSContext(key, new UIntPtr((uint)key.Length), len);
+                byte[] cipher = new byte[test.plain.Length];
+                byte[] plain = new byte[test.plain.Length];
+                Expect(test.name + " encrypt call", XTSEncryptSectors(context, test.sector, test.plain, len, cipher, len, out UIntPtr written));
+                Expect(test.name + " encrypt", test.hashed ? SHA256.HashData(cipher) : cipher, Convert.FromHexString(test.cipher));
+                Expect(test.name + " decrypt call", XTSDecryptSectors(context, test.sector, cipher, len, plain, len, out written));
+                Expect(test.name + " decrypt", plain, test.plain);
+                DestroyXTSContext(context);
+            }
+        }
+
+        // Known-answer tests on the backends this process selected; returns the number of failures
+        static int SelfTest()
+        {
+            GetBackendNames(out IntPtr bulk, out IntPtr serial);
+            Console.WriteLine($"Backends: bulk {Marshal.PtrToStringAnsi(bulk)}, serial {Marshal.PtrToStringAnsi(serial)}");
+
+            _failures = 0;
+            TestFips197();
+            TestSP80038A();
+            TestChainedModes();
+            TestGCM();
+            TestXTS();
+            Console.WriteLine(_failures == 0 ? "All known-answer tests passed." : $"{_failures} known-answer checks failed.");
+            return _failures;
+        }
+
+        // Runs SelfTest once per backend, each in a child process since the
+        // DLL reads AES_BACKEND once; a backend the CPU lacks falls back to
+        // one it has, which the child's first line shows
+        static int SelfTestAll()
+        {
+            int failed = 0;
+            foreach (string backend in _backends)
+            {
+                ProcessStartInfo start = new ProcessStartInfo(Environment.ProcessPath!) { UseShellExecute = false };
+                if (Path.GetFileNameWithoutExtension(start.FileName) == "dotnet")
+                {
+                    start.ArgumentList.Add(typeof(Program).Assembly.Location);
+                }
+                start.ArgumentList.Add("selftest");
+                start.Environment["AES_BACKEND"] = backend;
+
+                Console.WriteLine($"AES_BACKEND={backend}");
+                using (Process child = Process.Start(start)!)
+                {
+                    child.WaitForExit();
+                    if (child.ExitCode != 0)
+                    {
+                        failed++;
+                    }
+                }
+            }
+            Console.WriteLine(failed == 0 ? "All backends passed." : $"{failed} backends failed.");
+            return failed;
+        }
+
+        static void Main(string[] args)
+        {
+            // Program container-bench [dir] [GiB]
+            if (args.Length > 0 && args[0] == "container-bench")
+            {
+                BenchmarkContainer(args.Length > 1 ? args[1] : Path.GetTempPath(), args.Length > 2 ? int.Parse(args[2]) : 4);
+                return;
+            }
+
+            // Program selftest: known-answer tests on the backends AES_BACKEND or the CPU picked
+            // Program selftest-all: the same once per backend; the exit code is nonzero on any failure
+            if (args.Length > 0 && args[0] == "selftest")
+            {
+                Environment.Exit(SelfTest() == 0 ? 0 : 1);
+            }
+            if (args.Length > 0 && args[0] == "selftest-all")
+            {
+                Environment.Exit(SelfTestAll() == 0 ? 0 : 1);
+            }
+
             try
             {
                 Console.WriteLine("AES Encryption/Decryption");